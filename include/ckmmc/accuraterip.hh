@@ -0,0 +1,161 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/accuraterip.hh
+ * @brief Defines the AccurateRip checksum class.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <vector>
+#include <ckcore/types.hh>
+#include "ckmmc/hash.hh"
+#include "ckmmc/secureripper.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief AccurateRip checksum class.
+     * Calculates the AccurateRip v1 and v2 checksums of all audio tracks and
+     * the CUETools database CRC of the disc while the audio is extracted.
+     * The audio must be delivered in disc order, either directly by a
+     * SecureRipper or using update().
+     *
+     * Discs pressed with a different offset have the same audio shifted by
+     * a number of samples. The v1 checksums are linear in the sample
+     * position so they are calculated for every offset in the offset range
+     * from a few thousand samples stored at each track boundary. The v2
+     * checksums and the CUETools database CRC are calculated for offset
+     * zero and for each offset added using add_offset().
+     */
+    class AccurateRip : public SecureRipper::Sink
+    {
+    public:
+        /**
+         * Defines AccurateRip constants.
+         */
+        enum
+        {
+            ckFRAME_SAMPLES = 588,
+            ckSKIP_SAMPLES = 5 * 588,       // Skipped at the start and end of the disc.
+            ckCTDB_SKIP_SAMPLES = 10 * 588,
+            ckMAX_OFFSET_RANGE = 5 * 588 - 1
+        };
+
+        /**
+         * @brief Database match class.
+         */
+        class Match
+        {
+        public:
+            int offset_;                    // Pressing offset in samples.
+            bool v2_;
+            unsigned int confidence_;       // Number of submissions.
+
+            Match() : offset_(0),v2_(false),confidence_(0) {}
+        };
+
+    private:
+        /**
+         * @brief Track class.
+         */
+        class Track
+        {
+        public:
+            ckcore::tint64 start_;          // First sample of the track.
+            ckcore::tint64 first_;          // First sample included in the checksum.
+            ckcore::tint64 last_;           // Last sample included in the checksum.
+
+            ckcore::tuint32 sum_;           // Sum of the included samples.
+            std::vector<ckcore::tuint32> head_; // Samples around first_.
+            std::vector<ckcore::tuint32> tail_; // Samples around last_.
+            std::vector<ckcore::tuint32> v1_;   // v1 checksums for all offsets.
+
+            Track() : start_(0),first_(0),last_(0),sum_(0) {}
+        };
+
+        /**
+         * @brief Exact checksums for one offset.
+         */
+        class Variant
+        {
+        public:
+            int offset_;
+            std::vector<ckcore::tuint32> v1_;
+            std::vector<ckcore::tuint32> v2_;
+            Crc32 ctdb_;
+
+            Variant() : offset_(0) {}
+        };
+
+        /**
+         * @brief Database entry class.
+         */
+        class Entry
+        {
+        public:
+            unsigned int confidence_;
+            ckcore::tuint32 crc_;
+            ckcore::tuint32 frame450_crc_;
+        };
+
+        std::vector<ckcore::tuint32> lbas_;
+        ckcore::tuint32 leadout_;
+        ckcore::tint64 end_;                // Samples on the disc.
+        ckcore::tint64 pos_;                // Samples received.
+        int range_;
+
+        std::vector<Track> tracks_;
+        std::vector<Variant> variants_;
+        std::vector<std::vector<Entry> > entries_;
+
+        static void sum(const unsigned char *data,ckcore::tuint32 count,
+                        ckcore::tuint32 index,ckcore::tuint32 &v1,ckcore::tuint32 &v2,
+                        ckcore::tuint32 &total);
+        static void copy(const unsigned char *data,ckcore::tint64 pos,ckcore::tint64 count,
+                         ckcore::tint64 start,std::vector<ckcore::tuint32> &samples);
+
+        void reset();
+        void finish();
+        ckcore::tuint32 weighted(const Track &track,ckcore::tint64 pos) const;
+
+    public:
+        AccurateRip(const std::vector<ckcore::tuint32> &lbas,ckcore::tuint32 leadout);
+        ~AccurateRip();
+
+        void offset_range(int range);
+        void add_offset(int offset);
+
+        void update(const unsigned char *data,ckcore::tuint32 count);
+        void audio(ckcore::tuint32 lba,const unsigned char *data,ckcore::tuint32 count);
+        bool complete() const;
+
+        bool v1(unsigned int track,int offset,ckcore::tuint32 &crc) const;
+        bool v2(unsigned int track,int offset,ckcore::tuint32 &crc) const;
+        bool ctdb_crc(int offset,ckcore::tuint32 &crc) const;
+
+        ckcore::tuint32 disc_id1() const;
+        ckcore::tuint32 disc_id2() const;
+        ckcore::tuint32 cddb_id() const;
+        ckcore::tstring dbar_name() const;
+
+        bool load(const unsigned char *data,size_t len);
+        bool verify(unsigned int track,Match &match) const;
+    };
+};
@@ -0,0 +1,91 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/audioreader.hh
+ * @brief Defines the CD-DA reader class.
+ */
+
+#pragma once
+#include <vector>
+#include <ckcore/types.hh>
+#include "ckmmc/buffer.hh"
+#include "ckmmc/mmcdevice.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief CD-DA reader class.
+     * Reads audio frames using READ CD with as many frames per command as
+     * the transfer length allows. C2 error pointers and sub-channel data can
+     * be requested along with the audio, they are returned in separate
+     * buffers. Frames flagged by C2 are read again, without touching the
+     * surrounding frames, until they read without C2 errors or the retries
+     * are exhausted.
+     *
+     * Audio samples are returned as 16-bit little endian values. Devices
+     * returning samples MSB first must be configured using byte_swap().
+     */
+    class AudioReader
+    {
+    public:
+        /**
+         * Defines reader constants.
+         */
+        enum
+        {
+            ckFRAME_SIZE = 2352,
+            ckC2_SIZE = 294,
+            ckDEFAULT_C2_RETRIES = 16
+        };
+
+    private:
+        MmcDevice &device_;
+        bool c2_;
+        MmcDevice::ReadCdSubchannel sub_;
+        bool swap_;
+        unsigned int c2_retries_;
+        AlignedBuffer buffer_;
+
+        ckcore::tuint32 sub_size() const;
+        static bool has_c2_errors(const unsigned char *c2);
+        void store(const unsigned char *frame,ckcore::tuint32 index,unsigned char *audio,
+                   unsigned char *c2,unsigned char *sub) const;
+        void read_frames(ckcore::tuint32 lba,ckcore::tuint32 index,ckcore::tuint32 count,
+                         unsigned char *audio,unsigned char *c2,unsigned char *sub,
+                         std::vector<ckcore::tuint32> &flagged,
+                         std::vector<ckcore::tuint32> &bad_frames);
+
+    public:
+        AudioReader(MmcDevice &device);
+        ~AudioReader();
+
+        bool c2(bool enable);
+        bool c2() const;
+        void subchannel(MmcDevice::ReadCdSubchannel sub);
+        MmcDevice::ReadCdSubchannel subchannel() const;
+        void byte_swap(bool swap);
+        bool byte_swap() const;
+        void c2_retries(unsigned int retries);
+        unsigned int c2_retries() const;
+
+        bool read(ckcore::tuint32 lba,ckcore::tuint32 count,unsigned char *audio,
+                  unsigned char *c2,unsigned char *sub,
+                  std::vector<ckcore::tuint32> &bad_frames);
+    };
+};
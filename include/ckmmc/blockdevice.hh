@@ -0,0 +1,75 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/blockdevice.hh
+ * @brief Defines the block device class.
+ */
+
+#pragma once
+#ifdef _WINDOWS
+#include <windows.h>
+#endif
+#include <ckcore/types.hh>
+#include "ckmmc/scsidevice.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Block device class.
+     * Reads 2048 byte data sectors through the operating system block device
+     * instead of sending SCSI commands. The device is opened for unbuffered
+     * access and several read requests are kept in flight, allowing the
+     * storage stack to merge and pipeline them.
+     */
+    class BlockDevice
+    {
+    public:
+        /**
+         * Defines block device constants.
+         */
+        enum
+        {
+            ckSECTOR_SIZE = 2048,
+            ckMAX_IN_FLIGHT = 8
+        };
+
+    private:
+#ifdef _WINDOWS
+        HANDLE handle_;
+        HANDLE events_[ckMAX_IN_FLIGHT];
+#else
+        int fd_;
+#endif
+
+        // Prevent copying.
+        BlockDevice(const BlockDevice &device);
+        BlockDevice &operator=(const BlockDevice &device);
+
+    public:
+        BlockDevice();
+        ~BlockDevice();
+
+        bool open(const ScsiDevice::Address &addr);
+        void close();
+        bool is_open() const;
+
+        bool read(ckcore::tuint32 lba,ckcore::tuint32 count,
+                  unsigned char *buffer,ckcore::tuint32 chunk_len);
+    };
+};
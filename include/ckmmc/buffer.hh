@@ -0,0 +1,67 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/buffer.hh
+ * @brief Defines the aligned buffer class.
+ */
+
+#pragma once
+#include <ckcore/types.hh>
+
+namespace ckmmc
+{
+    /**
+     * @brief Aligned buffer class.
+     * Data buffer aligned to a page boundary. Page alignment satisfies the
+     * alignment requirements of all host adapters and allows the buffer to
+     * be used for unbuffered file I/O.
+     */
+    class AlignedBuffer
+    {
+    public:
+        /**
+         * Defines buffer constants.
+         */
+        enum
+        {
+            ckBUFFER_ALIGNMENT = 4096
+        };
+
+    private:
+        unsigned char *data_;
+        void *block_;
+        ckcore::tuint32 size_;
+
+        // Prevent copying.
+        AlignedBuffer(const AlignedBuffer &buffer);
+        AlignedBuffer &operator=(const AlignedBuffer &buffer);
+
+    public:
+        AlignedBuffer();
+        AlignedBuffer(ckcore::tuint32 size);
+        ~AlignedBuffer();
+
+        bool allocate(ckcore::tuint32 size);
+        void free();
+
+        unsigned char *data();
+        const unsigned char *data() const;
+        ckcore::tuint32 size() const;
+    };
+};
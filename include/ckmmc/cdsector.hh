@@ -0,0 +1,90 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/cdsector.hh
+ * @brief Defines the raw CD-ROM sector class.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <vector>
+#include <ckcore/types.hh>
+#include "ckmmc/mmc.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Raw CD-ROM sector class.
+     * Builds, verifies and repairs raw 2352 byte Mode 1 and Mode 2 sectors.
+     * The sectors are protected by a 32-bit EDC and, except for Mode 2 Form
+     * 2 sectors, by the P and Q Reed-Solomon product code (ECMA-130). Raw
+     * sectors may also be descrambled and converted to their cooked form.
+     */
+    class CdSector
+    {
+    public:
+        /**
+         * Defines sector constants.
+         */
+        enum
+        {
+            ckSECTOR_SIZE = 2352,
+            ckMODE1_DATA_SIZE = 2048,
+            ckMODE2_FORM1_DATA_SIZE = 2048,
+            ckMODE2_FORM2_DATA_SIZE = 2324,
+            ckDATA_OFFSET = 16,             // Mode 1 user data.
+            ckSUBHEADER_OFFSET = 16,        // Mode 2 sub-header.
+            ckMODE2_DATA_OFFSET = 24,       // Mode 2 user data.
+            ckCORRECT_ROUNDS = 4            // P and Q correction rounds.
+        };
+
+        /**
+         * Defines sector types.
+         */
+        enum Type
+        {
+            ckTYPE_UNKNOWN,
+            ckTYPE_MODE1,
+            ckTYPE_MODE2_FORM1,
+            ckTYPE_MODE2_FORM2
+        };
+
+    private:
+        static void header(unsigned char *sector,ckcore::tuint32 lba,unsigned char mode);
+        static void ecc_encode(unsigned char *sector);
+        static unsigned int ecc_correct(unsigned char *sector,bool &failed);
+
+    public:
+        static ckcore::tuint32 edc(const unsigned char *data,size_t len);
+        static void scramble(unsigned char *sector);
+
+        static void encode_mode1(unsigned char *sector,ckcore::tuint32 lba);
+        static void encode_mode2_form1(unsigned char *sector,ckcore::tuint32 lba);
+        static void encode_mode2_form2(unsigned char *sector,ckcore::tuint32 lba);
+
+        static Type type(const unsigned char *sector);
+        static bool check(const unsigned char *sector);
+        static bool correct(unsigned char *sector);
+
+        static bool cook(unsigned char *buffer,ckcore::tuint32 count,
+                         ckcore::tuint32 stride,ckcore::tuint32 lba,bool scrambled,
+                         ScsiModePage05::DataBlock block,
+                         std::vector<ckcore::tuint32> &invalid);
+    };
+};
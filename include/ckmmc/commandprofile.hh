@@ -0,0 +1,71 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/commandprofile.hh
+ * @brief Defines the command profile class.
+ */
+
+#pragma once
+#include <ckcore/types.hh>
+
+namespace ckmmc
+{
+    /**
+     * @brief Command profile class.
+     * Keeps track of which commands a device implements and how long they
+     * take to complete. The information is obtained from the REPORT
+     * SUPPORTED OPERATION CODES command when available and from the latency
+     * of completed commands, and is used to select per command timeouts.
+     */
+    class CommandProfile
+    {
+    public:
+        /**
+         * Defines profile constants.
+         */
+        enum
+        {
+            ckNUM_BUCKETS = 16,         // Latency buckets, bucket i counts latencies below 2^i ms.
+            ckMIN_SAMPLES = 32,         // Samples required before a timeout is learned.
+            ckMIN_TIMEOUT = 5,          // Smallest learned timeout in seconds.
+            ckMIN_MEDIA_TIMEOUT = 60,   // Smallest learned timeout of media access commands.
+            ckTIMEOUT_FACTOR = 4        // Safety factor applied to the 99th percentile.
+        };
+
+    private:
+        bool reported_;
+        unsigned char supported_[256 / 8];
+        ckcore::tuint32 timeouts_[256];     // Reported timeouts in seconds, 0 if unknown.
+        ckcore::tuint32 samples_[256][ckNUM_BUCKETS];
+        ckcore::tuint32 num_samples_[256];
+
+    public:
+        CommandProfile();
+        ~CommandProfile();
+
+        void clear();
+        bool parse(unsigned char *buffer,ckcore::tuint32 buffer_len);
+
+        bool reported() const;
+        bool supported(unsigned char opcode) const;
+
+        void record(unsigned char opcode,ckcore::tuint64 elapsed);
+        long timeout(unsigned char opcode) const;
+    };
+};
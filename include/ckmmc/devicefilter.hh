@@ -0,0 +1,69 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/devicefilter.hh
+ * @brief Defines the device filter class.
+ */
+
+#pragma once
+#include <vector>
+#include <ckcore/types.hh>
+#include "ckmmc/device.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Device filter class.
+     * Describes which devices the device manager should keep when scanning
+     * the system. The filter is evaluated in stages, the address and identity
+     * stages are evaluated before any commands are sent to the device while
+     * the feature stage is evaluated once the device capabilities are known.
+     */
+    class DeviceFilter
+    {
+    private:
+        std::vector<ckcore::tint32> buses_;
+        ckcore::tstring vendor_;
+        ckcore::tstring identifier_;
+        ckcore::tuint64 all_features_;  // All of these features must be supported.
+        ckcore::tuint64 any_features_;  // At least one of these features must be supported.
+        bool recorder_;
+
+        static bool match_prefix(const ckcore::tchar *str,
+                                 const ckcore::tstring &prefix);
+
+    public:
+        DeviceFilter();
+        ~DeviceFilter();
+
+        void bus(ckcore::tint32 bus);
+        void vendor(const ckcore::tchar *vendor);
+        void identifier(const ckcore::tchar *identifier);
+        void require(Device::Feature feature);
+        void require_any(Device::Feature feature);
+        void require_recorder();
+
+        bool has_identity() const;
+
+        bool match_address(const ScsiDevice::Address &addr) const;
+        bool match_identity(const ckcore::tchar *vendor,
+                            const ckcore::tchar *identifier) const;
+        bool match_features(Device &device) const;
+    };
+};
@@ -25,6 +25,7 @@
 #include <ckcore/types.hh>
 #include <ckcore/process.hh>
 #include "ckmmc/device.hh"
+#include "ckmmc/devicefilter.hh"
 #include "ckmmc/scsidriver.hh"
 
 namespace ckmmc
@@ -75,6 +76,7 @@ namespace ckmmc
         };
 
         ScsiDriver &driver_;
+        ScsiDevice::HealthCallback *health_callback_;
 
         // Vector containing all devices.
         std::vector<Device *> devices_;
@@ -85,7 +87,9 @@ namespace ckmmc
         DeviceManager();
         ~DeviceManager();
 
-        bool scan(ScanCallback *callback);
+        bool scan(ScanCallback *callback,const DeviceFilter *filter = NULL);
+
+        void health_callback(ScsiDevice::HealthCallback *callback);
 
         const std::vector<Device *> &devices() const;
     };
@@ -0,0 +1,95 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/directfile.hh
+ * @brief Defines the unbuffered file writer class.
+ */
+
+#pragma once
+#ifdef _WINDOWS
+#include <windows.h>
+#endif
+#include <ckcore/types.hh>
+#include "ckmmc/buffer.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Unbuffered file writer class.
+     * Writes a file bypassing the system file cache with multiple writes in
+     * flight. Chunks consisting only of zeros are not written, they are left
+     * as holes in a sparse file.
+     *
+     * Writes complete in the order they were issued. The written data must
+     * remain valid until the write has been completed.
+     */
+    class DirectFile
+    {
+    public:
+        /**
+         * Defines writer constants.
+         */
+        enum
+        {
+            ckMAX_PENDING = 8,
+            ckALIGNMENT = AlignedBuffer::ckBUFFER_ALIGNMENT
+        };
+
+    private:
+#ifdef _WINDOWS
+        HANDLE handle_;
+        OVERLAPPED overlapped_[ckMAX_PENDING];
+        HANDLE events_[ckMAX_PENDING];
+#else
+        int fd_;
+#endif
+        bool active_[ckMAX_PENDING];        // False for skipped writes.
+        ckcore::tuint32 lengths_[ckMAX_PENDING];
+        unsigned int head_;                 // Number of issued writes.
+        unsigned int tail_;                 // Number of completed writes.
+
+        bool sparse_;
+        bool failed_;
+        ckcore::tuint64 size_;
+        ckcore::tuint64 hole_bytes_;
+        AlignedBuffer tail_buffer_;         // Padded copy of an unaligned final write.
+
+        // Prevent copying.
+        DirectFile(const DirectFile &file);
+        DirectFile &operator=(const DirectFile &file);
+
+        static bool is_zero(const unsigned char *data,ckcore::tuint32 len);
+
+    public:
+        DirectFile();
+        ~DirectFile();
+
+        bool create(const ckcore::tchar *path);
+        bool close();
+        bool is_open() const;
+
+        bool write(ckcore::tuint64 offset,const unsigned char *data,ckcore::tuint32 len);
+        bool complete();
+        unsigned int pending() const;
+
+        bool sparse() const;
+        ckcore::tuint64 size() const;
+        ckcore::tuint64 hole_bytes() const;
+    };
+};
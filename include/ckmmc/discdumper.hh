@@ -0,0 +1,129 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/discdumper.hh
+ * @brief Defines the disc dumper class.
+ */
+
+#pragma once
+#include <vector>
+#include <ckcore/types.hh>
+#include "ckmmc/hash.hh"
+#include "ckmmc/mmcdevice.hh"
+#include "ckmmc/streamreader.hh"
+#include "ckmmc/sync.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Disc dumper class.
+     * Copies 2048 byte sectors to an image file. Three stages run at the
+     * same time: a stream reader reads ahead of the writer, the image is
+     * written unbuffered with overlapped writes and a separate thread hashes
+     * the same buffers while they are being written. The image never has to
+     * be read back for hashing. Chunks of zeros are left as holes in the
+     * image file.
+     */
+    class DiscDumper
+    {
+    public:
+        /**
+         * Defines hash algorithms.
+         */
+        enum
+        {
+            ckHASH_CRC32 = 0x01,
+            ckHASH_MD5 = 0x02,
+            ckHASH_SHA256 = 0x04,
+            ckHASH_ALL = 0x07
+        };
+
+    private:
+        /**
+         * @brief Hash thread class.
+         * Hashes chunks in the order they were pushed.
+         */
+        class HashThread : public Thread
+        {
+        private:
+            enum
+            {
+                ckMAX_JOBS = 8
+            };
+
+            const unsigned char *data_[ckMAX_JOBS];
+            ckcore::tuint32 len_[ckMAX_JOBS];
+            unsigned int hashes_;
+
+            volatile long head_;            // Number of pushed chunks.
+            volatile long tail_;            // Number of hashed chunks.
+            volatile long stop_;
+            Event job_event_;
+            Event done_event_;
+
+        protected:
+            void run();
+
+        public:
+            Crc32 crc32_;
+            Md5 md5_;
+            Sha256 sha256_;
+
+            HashThread(unsigned int hashes);
+            ~HashThread();
+
+            void push(const unsigned char *data,ckcore::tuint32 len);
+            void wait(long count);
+            void stop();
+        };
+
+        /**
+         * Defines dump constants.
+         */
+        enum
+        {
+            // Chunks being written and hashed while the next chunk is read.
+            // Must not exceed the number of pending direct file writes.
+            ckMAX_IN_FLIGHT = 4
+        };
+
+        MmcDevice &device_;
+        std::vector<MmcDevice::ReadError> errors_;
+        ckcore::tuint32 crc32_;
+        unsigned char md5_[16];
+        unsigned char sha256_[32];
+        ckcore::tuint64 size_;
+        ckcore::tuint64 hole_bytes_;
+
+    public:
+        DiscDumper(MmcDevice &device);
+        ~DiscDumper();
+
+        bool dump(const ckcore::tchar *path,unsigned int hashes = ckHASH_ALL);
+        bool dump(const ckcore::tchar *path,ckcore::tuint32 lba,ckcore::tuint32 count,
+                  unsigned int hashes = ckHASH_ALL);
+
+        const std::vector<MmcDevice::ReadError> &errors() const;
+        ckcore::tuint32 crc32() const;
+        const unsigned char *md5() const;
+        const unsigned char *sha256() const;
+        ckcore::tuint64 size() const;
+        ckcore::tuint64 hole_bytes() const;
+    };
+};
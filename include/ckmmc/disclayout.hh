@@ -0,0 +1,97 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/disclayout.hh
+ * @brief Defines the disc layout class.
+ */
+
+#pragma once
+#include <vector>
+#include <ckcore/types.hh>
+#include "ckmmc/mmcdevice.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Disc layout class.
+     * Detects the track pregaps, index positions, ISRC codes and media
+     * catalog number of a CD. The track and index of a frame is recorded in
+     * its Q sub-channel. Since both only increase across the disc, each
+     * boundary is located by a binary search between two frames with known
+     * positions, requiring about 20 single frame reads per boundary instead
+     * of reading every frame.
+     */
+    class DiscLayout
+    {
+    public:
+        /**
+         * Defines layout constants.
+         */
+        enum
+        {
+            ckMAX_TRACKS = 99,
+            ckQ_PROBE_FRAMES = 4,           // Frames tried to find a position.
+            ckCONTROL_DATA = 0x04           // Control bit of data tracks.
+        };
+
+        /**
+         * @brief Track class.
+         */
+        class Track
+        {
+        public:
+            unsigned char number_;
+            unsigned char control_;
+            ckcore::tuint32 pregap_;        // Address of index 0, equals start_ if no pregap.
+            ckcore::tuint32 start_;         // Address of index 1.
+            std::vector<ckcore::tuint32> indexes_;  // Addresses of index 2 and up.
+            ckcore::tstring isrc_;          // Empty if unknown.
+
+            Track() : number_(0),control_(0),pregap_(0),start_(0) {}
+        };
+
+    private:
+        MmcDevice &device_;
+        std::vector<Track> tracks_;
+        ckcore::tuint32 leadout_;
+        ckcore::tstring mcn_;
+        ckcore::tuint32 reads_;
+
+        static unsigned char bcd(unsigned char value);
+
+        bool read_toc();
+        bool read_q(ckcore::tuint32 lba,unsigned char *q,bool &mode1);
+        bool read_position(ckcore::tuint32 lba,unsigned char &track,unsigned char &index);
+        void find_pregap(size_t i);
+        void find_indexes(size_t i);
+        void read_isrc(size_t i);
+        void read_mcn();
+
+    public:
+        DiscLayout(MmcDevice &device);
+        ~DiscLayout();
+
+        bool detect();
+
+        const std::vector<Track> &tracks() const;
+        ckcore::tuint32 leadout() const;
+        const ckcore::tstring &mcn() const;
+        ckcore::tuint32 reads() const;
+    };
+};
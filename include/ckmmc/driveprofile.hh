@@ -0,0 +1,77 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/driveprofile.hh
+ * @brief Defines the drive profile store.
+ */
+
+#pragma once
+#include <map>
+#include <ckcore/types.hh>
+
+namespace ckmmc
+{
+    /**
+     * @brief Drive profile class.
+     * Contains calibration results of a drive model.
+     */
+    class DriveProfile
+    {
+    public:
+        ckcore::tuint32 max_transfer_;  // Largest working transfer in bytes, 0 if unknown.
+        ckcore::tuint32 best_transfer_; // Fastest sequential read transfer in bytes, 0 if unknown.
+        bool read_offset_known_;
+        ckcore::tint32 read_offset_;    // Audio read offset in samples.
+
+        /**
+         * Constructs an empty drive profile.
+         */
+        DriveProfile() : max_transfer_(0),best_transfer_(0),read_offset_known_(false),
+            read_offset_(0) {}
+    };
+
+    /**
+     * @brief Drive profile store class.
+     * Keeps calibration results for each drive identity (vendor, product and
+     * firmware revision) so that calibration only has to be performed once
+     * per drive model. The store can be serialized to a string which may be
+     * saved by the application between sessions.
+     */
+    class DriveProfileStore
+    {
+    private:
+        std::map<ckcore::tstring,DriveProfile> profiles_;
+
+        DriveProfileStore();
+        ~DriveProfileStore();
+
+    public:
+        static DriveProfileStore &instance();
+        static ckcore::tstring key(const ckcore::tchar *vendor,
+                                   const ckcore::tchar *identifier,
+                                   const ckcore::tchar *revision);
+
+        bool find(const ckcore::tstring &key,DriveProfile &profile) const;
+        void store(const ckcore::tstring &key,const DriveProfile &profile);
+        void clear();
+
+        ckcore::tstring save() const;
+        bool load(const ckcore::tstring &data);
+    };
+};
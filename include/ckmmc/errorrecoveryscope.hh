@@ -0,0 +1,61 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/errorrecoveryscope.hh
+ * @brief Defines the error recovery scope class.
+ */
+
+#pragma once
+#include <ckcore/types.hh>
+#include "ckmmc/mmc.hh"
+#include "ckmmc/mmcdevice.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Class for temporarily changing device error recovery.
+     * Saves the read/write error recovery parameters of a device when
+     * constructed and restores them when destructed, if they have been
+     * changed.
+     */
+    class ErrorRecoveryScope
+    {
+    private:
+        MmcDevice &device_;
+        ScsiModePage01 saved_;
+        bool valid_;
+        bool changed_;
+
+        // Prevent copying.
+        ErrorRecoveryScope(const ErrorRecoveryScope &scope);
+        ErrorRecoveryScope &operator=(const ErrorRecoveryScope &scope);
+
+    public:
+        ErrorRecoveryScope(MmcDevice &device);
+        ~ErrorRecoveryScope();
+
+        bool valid() const;
+        const ScsiModePage01 &saved() const;
+
+        bool apply(const ScsiModePage01 &page);
+        bool fail_fast();
+        bool read_retries(unsigned char count);
+        bool restore();
+    };
+};
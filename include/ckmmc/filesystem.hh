@@ -0,0 +1,216 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/filesystem.hh
+ * @brief Defines the disc file system reader class.
+ */
+
+#pragma once
+#include <vector>
+#include <ckcore/types.hh>
+#include "ckmmc/mmcdevice.hh"
+#include "ckmmc/sectorcache.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Disc file system reader class.
+     * Read-only directory reader for ISO9660 (including Joliet and Rock
+     * Ridge) and UDF file systems. Metadata is read through a sector cache
+     * while file data is read directly from the device.
+     *
+     * Multiple files are extracted in a single pass over the disc, the file
+     * extents are read in LBA order rather than in directory order.
+     */
+    class FileSystem
+    {
+    public:
+        /**
+         * Defines file system types.
+         */
+        enum Type
+        {
+            ckFS_NONE,
+            ckFS_ISO9660,
+            ckFS_JOLIET,
+            ckFS_ROCK_RIDGE,
+            ckFS_UDF
+        };
+
+        /**
+         * Defines extraction constants.
+         */
+        enum
+        {
+            ckMAX_GAP = 256,                    // Sectors read through instead of seeking.
+            ckEXTRACT_BUFFER_SIZE = 2048 * 1024,
+            ckMETADATA_CACHE_SIZE = 4096 * 1024
+        };
+
+        /**
+         * @brief File extent class.
+         */
+        class Extent
+        {
+        public:
+            ckcore::tuint32 lba_;
+            ckcore::tuint32 length_;            // Length in bytes.
+            bool recorded_;                     // If false the extent reads as zeros.
+
+            Extent(ckcore::tuint32 lba,ckcore::tuint32 length,bool recorded) :
+                lba_(lba),length_(length),recorded_(recorded) {}
+        };
+
+        /**
+         * @brief File class.
+         */
+        class File
+        {
+        public:
+            ckcore::tstring name_;
+            ckcore::tstring path_;              // Path relative to the root directory.
+            ckcore::tuint64 size_;
+            bool directory_;
+            std::vector<Extent> extents_;
+            std::vector<unsigned char> inline_; // Data embedded in the UDF file entry.
+
+            File() : size_(0),directory_(false) {}
+        };
+
+        /**
+         * @brief Extraction sink interface.
+         * Receives file data during extraction. Data is delivered in disc
+         * order, fragmented files may therefore be written out of order.
+         */
+        class Sink
+        {
+        public:
+            virtual ~Sink() {}
+
+            /**
+             * Called when data of a file has been read.
+             * @param [in] file Index of the file in the extraction list.
+             * @param [in] offset Byte offset of the data in the file.
+             * @param [in] data The file data.
+             * @param [in] len The number of bytes.
+             * @return If successful true is returned, if not false is
+             *         returned and the extraction is aborted.
+             */
+            virtual bool write(size_t file,ckcore::tuint64 offset,
+                               const unsigned char *data,ckcore::tuint32 len) = 0;
+
+            /**
+             * Called when data of a file could not be read. The data is
+             * written as zeros.
+             * @param [in] file Index of the file in the extraction list.
+             * @param [in] offset Byte offset of the unreadable data.
+             * @param [in] len The number of unreadable bytes.
+             */
+            virtual void error(size_t file,ckcore::tuint64 offset,
+                               ckcore::tuint32 len) = 0;
+        };
+
+    private:
+        /**
+         * @brief UDF partition map class.
+         */
+        class PartitionMap
+        {
+        public:
+            ckcore::tuint16 number_;            // Partition number.
+            ckcore::tuint32 start_;             // First sector of the partition.
+            bool metadata_;
+            ckcore::tuint32 metadata_lbn_;      // Metadata file location.
+            ckcore::tuint32 mirror_lbn_;        // Metadata mirror file location.
+            std::vector<Extent> extents_;       // Extents of the metadata file.
+
+            PartitionMap() : number_(0),start_(0),metadata_(false),
+                metadata_lbn_(0),mirror_lbn_(0) {}
+        };
+
+        /**
+         * @brief Extraction piece class.
+         */
+        class Piece
+        {
+        public:
+            size_t file_;
+            ckcore::tuint64 offset_;
+            ckcore::tuint32 lba_;
+            ckcore::tuint32 length_;
+
+            Piece(size_t file,ckcore::tuint64 offset,ckcore::tuint32 lba,
+                  ckcore::tuint32 length) :
+                file_(file),offset_(offset),lba_(lba),length_(length) {}
+
+            bool operator<(const Piece &piece) const
+            {
+                return lba_ < piece.lba_;
+            }
+        };
+
+        MmcDevice &device_;
+        SectorCache cache_;
+        Type type_;
+        File root_;
+
+        // ISO9660 state.
+        unsigned int susp_skip_;                // Bytes to skip in system use areas.
+
+        // UDF state.
+        std::vector<PartitionMap> maps_;
+
+        bool read(ckcore::tuint32 lba,ckcore::tuint32 count,
+                  std::vector<unsigned char> &data);
+        bool read_data(const File &file,std::vector<unsigned char> &data);
+
+        bool open_iso();
+        bool parse_iso_record(const unsigned char *record,File &file,
+                              bool &skip);
+        void parse_rock_ridge(const unsigned char *record,File &file,
+                              bool &skip);
+        bool list_iso(const File &dir,std::vector<File> &files);
+
+        bool open_udf();
+        bool read_tag(ckcore::tuint32 lba,ckcore::tuint16 id,unsigned char *buffer);
+        bool map_block(ckcore::tuint16 part,ckcore::tuint32 lbn,
+                       ckcore::tuint32 &lba,ckcore::tuint32 &avail);
+        bool add_extent(File &file,ckcore::tuint16 part,ckcore::tuint32 lbn,
+                        ckcore::tuint32 length,bool recorded);
+        bool read_allocs(File &file,ckcore::tuint16 part,const unsigned char *ad,
+                         ckcore::tuint32 ad_len,unsigned int ad_type);
+        bool read_icb(ckcore::tuint16 part,ckcore::tuint32 lbn,File &file);
+        bool list_udf(const File &dir,std::vector<File> &files);
+
+    public:
+        FileSystem(MmcDevice &device);
+        ~FileSystem();
+
+        bool open();
+        void close();
+        Type type() const;
+
+        const File &root() const;
+        bool list(const File &dir,std::vector<File> &files);
+        bool collect(const File &dir,std::vector<File> &files);
+        bool find(const ckcore::tchar *path,File &file);
+
+        bool extract(const std::vector<File> &files,Sink &sink);
+    };
+};
@@ -0,0 +1,86 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/hash.hh
+ * @brief Defines checksum and message digest classes.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <ckcore/types.hh>
+
+namespace ckmmc
+{
+    /**
+     * @brief CRC-32 class.
+     * Calculates the IEEE 802.3 CRC-32 checksum, eight bytes at a time.
+     */
+    class Crc32
+    {
+    private:
+        ckcore::tuint32 crc_;
+
+    public:
+        Crc32();
+
+        void reset();
+        void update(const unsigned char *data,size_t len);
+        ckcore::tuint32 checksum() const;
+    };
+
+    /**
+     * @brief MD5 class.
+     */
+    class Md5
+    {
+    private:
+        ckcore::tuint32 state_[4];
+        ckcore::tuint64 count_;
+        unsigned char block_[64];
+
+        void transform(const unsigned char *block);
+
+    public:
+        Md5();
+
+        void reset();
+        void update(const unsigned char *data,size_t len);
+        void digest(unsigned char digest[16]);
+    };
+
+    /**
+     * @brief SHA-256 class.
+     */
+    class Sha256
+    {
+    private:
+        ckcore::tuint32 state_[8];
+        ckcore::tuint64 count_;
+        unsigned char block_[64];
+
+        void transform(const unsigned char *block);
+
+    public:
+        Sha256();
+
+        void reset();
+        void update(const unsigned char *data,size_t len);
+        void digest(unsigned char digest[32]);
+    };
+};
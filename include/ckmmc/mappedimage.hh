@@ -0,0 +1,104 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/mappedimage.hh
+ * @brief Defines the memory mapped image class.
+ */
+
+#pragma once
+#ifdef _WINDOWS
+#include <windows.h>
+#endif
+#include <ckcore/types.hh>
+#include "ckmmc/streamwriter.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Memory mapped image class.
+     * Reads a disc image through read-only views of the file mapped one
+     * window at a time. Chunks of a mapped window are submitted to a stream
+     * writer directly, chunks that do not satisfy the alignment required by
+     * the host adapter are copied through the writer FIFO instead. The next
+     * window is prefetched while the current one is written and windows are
+     * released from the system cache once written.
+     */
+    class MappedImage
+    {
+    public:
+        /**
+         * Defines mapping constants.
+         */
+        enum
+        {
+            ckWINDOW_SIZE = 64 * 1024 * 1024,
+            ckMAX_WINDOWS = 4
+        };
+
+    private:
+        /**
+         * @brief Mapped window class.
+         */
+        class Window
+        {
+        public:
+            const unsigned char *data_;
+            ckcore::tuint64 offset_;
+            ckcore::tuint32 size_;
+            ckcore::tuint32 end_block_;     // Blocks submitted up to the end of the window.
+        };
+
+#ifdef _WINDOWS
+        HANDLE file_;
+        HANDLE mapping_;
+#else
+        int fd_;
+#endif
+        ckcore::tuint64 size_;
+        ckcore::tuint32 granularity_;       // Alignment of window offsets.
+
+        Window windows_[ckMAX_WINDOWS];
+        unsigned int head_;                 // Number of mapped windows.
+        unsigned int tail_;                 // Number of unmapped windows.
+
+        ckcore::tuint32 mapped_blocks_;
+        ckcore::tuint32 copied_blocks_;
+
+        // Prevent copying.
+        MappedImage(const MappedImage &image);
+        MappedImage &operator=(const MappedImage &image);
+
+        bool map(ckcore::tuint64 offset,Window &window);
+        void unmap(Window &window);
+
+    public:
+        MappedImage();
+        ~MappedImage();
+
+        bool open(const ckcore::tchar *path);
+        void close();
+        bool is_open() const;
+
+        bool write(StreamWriter &writer,ckcore::tuint32 block_len);
+
+        ckcore::tuint64 size() const;
+        ckcore::tuint32 mapped_blocks() const;
+        ckcore::tuint32 copied_blocks() const;
+    };
+};
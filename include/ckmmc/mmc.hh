@@ -103,6 +103,43 @@ namespace ckmmc
         };
     };
 
+    /**
+     * @brief Class representing mode page 0x01 data.
+     * The read/write error recovery parameters control how hard the device
+     * tries to recover data before reporting an error.
+     */
+    class ScsiModePage01
+    {
+    public:
+        /**
+         * Defines mode page constants.
+         */
+        enum
+        {
+            ckFAIL_FAST_TIME_LIMIT = 100    // Recovery time limit in milliseconds.
+        };
+
+    public:
+        unsigned char page_code_;
+        bool ps_;
+        unsigned char page_len_;
+        bool awre_;                         // Automatic write reallocation enabled.
+        bool arre_;                         // Automatic read reallocation enabled.
+        bool tb_;                           // Transfer block.
+        bool rc_;                           // Read continuous.
+        bool per_;                          // Post error.
+        bool dte_;                          // Disable transfer on error.
+        bool dcr_;                          // Disable correction.
+        unsigned char read_retry_count_;
+        unsigned char emcdr_;
+        unsigned char write_retry_count_;
+        ckcore::tuint16 recovery_time_limit_;   // In milliseconds.
+
+        bool parse(unsigned char *buffer);
+        bool read(unsigned char *buffer,size_t buffer_len);
+        void reset_fail_fast();
+    };
+
     /**
      * @brief Class representing mode page 0x05 data.
      */
@@ -313,4 +350,83 @@ namespace ckmmc
 
         bool parse(unsigned char *buffer);
     };
+
+    /**
+     * @brief Class representing fixed format sense data.
+     */
+    class ScsiSenseData
+    {
+    public:
+        /**
+         * Defines sense keys.
+         */
+        enum
+        {
+            ckSENSE_NO_SENSE = 0x00,
+            ckSENSE_RECOVERED_ERROR = 0x01,
+            ckSENSE_NOT_READY = 0x02,
+            ckSENSE_MEDIUM_ERROR = 0x03,
+            ckSENSE_HARDWARE_ERROR = 0x04,
+            ckSENSE_ILLEGAL_REQUEST = 0x05,
+            ckSENSE_UNIT_ATTENTION = 0x06,
+            ckSENSE_DATA_PROTECT = 0x07,
+            ckSENSE_BLANK_CHECK = 0x08,
+            ckSENSE_ABORTED_COMMAND = 0x0b
+        };
+
+        /**
+         * Defines additional sense codes.
+         */
+        enum
+        {
+            ckASC_NOT_READY = 0x04,
+            ckASC_LBA_OUT_OF_RANGE = 0x21,
+            ckASC_MEDIUM_CHANGED = 0x28,
+            ckASC_MEDIUM_NOT_PRESENT = 0x3a
+        };
+
+        /**
+         * Defines additional sense code qualifiers.
+         */
+        enum
+        {
+            ckASCQ_LONG_WRITE_IN_PROGRESS = 0x08
+        };
+
+        bool valid_;
+        unsigned char response_code_;
+        bool ili_;
+        unsigned char sense_key_;
+        ckcore::tuint32 info_;
+        unsigned char asc_;
+        unsigned char ascq_;
+
+        bool parse(unsigned char *buffer);
+    };
+
+    /**
+     * @brief Class representing a media event status descriptor.
+     */
+    class ScsiMediaEvent
+    {
+    public:
+        /**
+         * Defines media event codes.
+         */
+        enum
+        {
+            ckMEDIA_EVENT_NO_CHANGE = 0x00,
+            ckMEDIA_EVENT_EJECT_REQUEST = 0x01,
+            ckMEDIA_EVENT_NEW_MEDIA = 0x02,
+            ckMEDIA_EVENT_MEDIA_REMOVAL = 0x03,
+            ckMEDIA_EVENT_MEDIA_CHANGED = 0x04
+        };
+
+        bool nea_;
+        unsigned char event_code_;
+        bool media_present_;
+        bool door_open_;
+
+        bool parse(unsigned char *buffer);
+    };
 };
@@ -24,10 +24,16 @@
 #pragma once
 #include <vector>
 #include <ckcore/types.hh>
+#include "ckmmc/commandprofile.hh"
+#include "ckmmc/quirks.hh"
 #include "ckmmc/scsidevice.hh"
 
 namespace ckmmc
 {
+    class BlockDevice;
+    class ScsiModePage01;
+    class ScsiSenseData;
+
     class MmcDevice : public ScsiDevice
     {
     public:
@@ -38,7 +44,12 @@ namespace ckmmc
         {
             ckCMD_INQUIRY = 0x12,
             ckCMD_READ_CAPACITY = 0x25,
+            ckCMD_READ10 = 0x28,
+            ckCMD_READ12 = 0xa8,
+            ckCMD_WRITE10 = 0x2a,
+            ckCMD_READ_BUFFER_CAPACITY = 0x5c,
             ckCMD_READ_TOC_PMA_ATIP = 0x43,
+            ckCMD_READ_SUBCHANNEL = 0x42,
             ckCMD_GET_CONFIGURATION = 0x46,
             ckCMD_READ_DISC_INFORMATION = 0x51,
             ckCMD_READ_DISC_STRUCTURE = 0xad,
@@ -56,7 +67,8 @@ namespace ckmmc
             ckCMD_MODE_SELECT10 = 0x55,
             ckCMD_REQUEST_SENSE = 0x03,
             ckCMD_READ_CD = 0xbe,
-            ckCMD_READ_TRACK_INFORMATION = 0x52
+            ckCMD_READ_TRACK_INFORMATION = 0x52,
+            ckCMD_REPORT_SUPPORTED_OPCODES = 0xa3
         };
 
         /**
@@ -240,6 +252,59 @@ namespace ckmmc
             ckWM_INTERNAL_COUNT
         };
 
+        /**
+         * Defines data paths for reading 2048 byte sectors.
+         */
+        enum DataPath
+        {
+            ckDP_SCSI,      // Read using SCSI commands.
+            ckDP_BLOCK      // Read through the operating system block device.
+        };
+
+        /**
+         * Defines the sub-channel data returned by READ CD.
+         */
+        enum ReadCdSubchannel
+        {
+            ckRCS_NONE = 0x00,
+            ckRCS_RAW = 0x01,       // 96 bytes of raw interleaved P-W data.
+            ckRCS_Q = 0x02,         // 16 bytes of formatted Q data.
+            ckRCS_RW = 0x04         // 96 bytes of de-interleaved R-W data.
+        };
+
+        /**
+         * @brief Read error class.
+         * Describes a range of sectors which could not be read.
+         */
+        class ReadError
+        {
+        public:
+            ckcore::tuint32 lba_;
+            ckcore::tuint32 count_;
+            unsigned char sense_key_;
+            unsigned char asc_;
+            unsigned char ascq_;
+
+            /**
+             * Constructs a ReadError object.
+             */
+            ReadError(ckcore::tuint32 lba,ckcore::tuint32 count,unsigned char sense_key,
+                      unsigned char asc,unsigned char ascq) :
+                lba_(lba),count_(count),sense_key_(sense_key),asc_(asc),ascq_(ascq) {}
+        };
+
+    private:
+        /**
+         * Defines transfer calibration constants.
+         */
+        enum
+        {
+            ckTRANSFER_DEFAULT_LEN = 64 * 1024,     // Used until calibrated.
+            ckTRANSFER_PROBE_LIMIT = 4096 * 1024,   // Used if the adapter limit is unknown.
+            ckTRANSFER_MIN_LEN = 32 * 1024,         // Smallest benchmarked length.
+            ckTRANSFER_BENCH_SIZE = 8192 * 1024     // Bytes read per benchmarked length.
+        };
+
     protected:
         ckcore::tchar vendor_[9];
         ckcore::tchar identifier_[17];
@@ -252,8 +317,31 @@ namespace ckmmc
         std::vector<ckcore::tuint32> read_speeds_;  // Used for caching read speeds (kB/s).
         std::vector<ckcore::tuint32> write_speeds_; // Used for caching write speeds (kB/s).
 
-        bool is_yamaha() const;
-        bool is_plextor() const;
+        DriveQuirks quirks_;
+        CommandProfile commands_;
+
+        ckcore::tuint32 max_transfer_;      // Maximum transfer length in bytes, 0 if unknown.
+        ckcore::tuint32 transfer_len_;      // Preferred transfer length in bytes.
+        ckcore::tuint32 alignment_mask_;    // Required buffer alignment mask.
+        bool read_offset_known_;
+        ckcore::tint32 read_offset_;        // Audio read offset in samples.
+
+        unsigned char error_recovery_[32];  // Last selected mode page 0x01 data.
+        ckcore::tuint16 error_recovery_len_;
+
+        DataPath data_path_;
+        BlockDevice *block_device_;
+
+        void init_transfer();
+        static void add_read_error(std::vector<ReadError> &errors,ckcore::tuint32 lba,
+                                   ckcore::tuint32 count,unsigned char sense_key,
+                                   unsigned char asc,unsigned char ascq);
+
+        bool command_allowed(const unsigned char *cdb) const;
+        long command_timeout(const unsigned char *cdb) const;
+        void command_completed(const unsigned char *cdb,bool success,
+                               ckcore::tuint64 elapsed);
+        void reset_completed(ResetLevel level);
 
     public:
         MmcDevice(const Address &addr);
@@ -262,6 +350,22 @@ namespace ckmmc
         const ckcore::tchar *vendor() const;
         const ckcore::tchar *identifier() const;
         const ckcore::tchar *revision() const;
+        const DriveQuirks &quirks() const;
+        const CommandProfile &commands() const;
+
+        ckcore::tuint32 max_transfer() const;
+        ckcore::tuint32 transfer_len() const;
+        ckcore::tuint32 alignment_mask() const;
+        bool calibrate_transfer();
+        bool read_offset(ckcore::tint32 &offset) const;
+        void read_offset(ckcore::tint32 offset);
+
+        bool data_path(DataPath path);
+        DataPath data_path() const;
+
+        bool read_sectors(ckcore::tuint32 lba,ckcore::tuint32 count,
+                          unsigned char *buffer,ckcore::tuint32 buffer_len,
+                          std::vector<ReadError> &errors);
 
         const std::vector<ckcore::tuint32> &read_speeds();
         const std::vector<ckcore::tuint32> &write_speeds();
@@ -283,5 +387,27 @@ namespace ckmmc
                         ckcore::tuint16 buffer_len);
         bool mode_select(unsigned char *buffer,ckcore::tuint16 buffer_len,
                          bool save_page,bool page_format);      
+        bool get_error_recovery(ScsiModePage01 &page);
+        bool set_error_recovery(const ScsiModePage01 &page);
+        bool report_supported_opcodes(unsigned char *buffer,
+                                      ckcore::tuint32 buffer_len);
+        bool get_event_status(unsigned char class_mask,unsigned char *buffer,
+                              ckcore::tuint16 buffer_len);
+        bool read_capacity(ckcore::tuint32 &last_lba,ckcore::tuint32 &block_len);
+        bool read10(ckcore::tuint32 lba,ckcore::tuint16 num_blocks,
+                    unsigned char *buffer,ckcore::tuint32 buffer_len);
+        bool read_cd(ckcore::tuint32 lba,ckcore::tuint32 count,bool c2,
+                     ReadCdSubchannel sub,unsigned char *buffer,
+                     ckcore::tuint32 buffer_len);
+        static ckcore::tuint32 read_cd_frame_len(bool c2,ReadCdSubchannel sub);
+        bool read_cd_q(ckcore::tuint32 lba,unsigned char *buffer,ckcore::tuint32 buffer_len);
+        bool read_toc(unsigned char *buffer,ckcore::tuint16 buffer_len);
+        bool read_subchannel(unsigned char format,unsigned char track,
+                             unsigned char *buffer,ckcore::tuint16 buffer_len);
+        bool write10(ckcore::tuint32 lba,ckcore::tuint16 num_blocks,
+                     const unsigned char *buffer,ckcore::tuint32 buffer_len,
+                     ScsiSenseData &sense_data);
+        bool read_buffer_capacity(ckcore::tuint32 &buffer_len,
+                                  ckcore::tuint32 &buffer_free);
     };
 };
@@ -0,0 +1,74 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/offsetdetector.hh
+ * @brief Defines the read offset detector class.
+ */
+
+#pragma once
+#include <complex>
+#include <vector>
+#include <ckcore/types.hh>
+#include "ckmmc/audioreader.hh"
+#include "ckmmc/mmcdevice.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Read offset detector class.
+     * Detects the audio read offset of a device by reading a region around a
+     * reference extract of the inserted disc and locating the reference in
+     * the read audio. The location is found by cross-correlating the signals
+     * using the FFT, the best candidates are then confirmed by comparing the
+     * samples.
+     */
+    class OffsetDetector
+    {
+    public:
+        /**
+         * Defines detector constants.
+         */
+        enum
+        {
+            ckFRAME_SAMPLES = 588,
+            ckMARGIN_FRAMES = 6,            // Largest detected offset in frames.
+            ckCANDIDATES = 4                // Correlation peaks compared.
+        };
+
+    private:
+        MmcDevice &device_;
+        AudioReader reader_;
+
+        // Prevent copying.
+        OffsetDetector(const OffsetDetector &detector);
+        OffsetDetector &operator=(const OffsetDetector &detector);
+
+        static void fft(std::vector<std::complex<double> > &data,bool inverse);
+        static void load(const unsigned char *data,ckcore::tuint32 count,
+                         std::vector<std::complex<double> > &signal);
+
+    public:
+        OffsetDetector(MmcDevice &device);
+        ~OffsetDetector();
+
+        bool detect(ckcore::tuint32 lba,const unsigned char *reference,ckcore::tuint32 count,
+                    ckcore::tint32 &offset);
+        bool calibrate(ckcore::tuint32 lba,const unsigned char *reference,ckcore::tuint32 count);
+    };
+};
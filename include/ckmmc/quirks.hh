@@ -0,0 +1,75 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/quirks.hh
+ * @brief Defines the drive quirks database.
+ */
+
+#pragma once
+#include <ckcore/types.hh>
+
+namespace ckmmc
+{
+    /**
+     * @brief Drive quirks class.
+     * Describes known deviations from the expected behaviour of a specific
+     * drive model. The quirks are looked up in a static table keyed by the
+     * vendor and product identifiers, optionally limited to a range of
+     * firmware revisions.
+     */
+    class DriveQuirks
+    {
+    public:
+        /**
+         * Defines quirk flags.
+         */
+        enum
+        {
+            ckQUIRK_SKIP_GET_PERFORMANCE = 0x0001,  // Use mode page 0x2a write speeds.
+            ckQUIRK_SKIP_GET_CONFIGURATION = 0x0002,
+            ckQUIRK_SKIP_WRITE_MODE_PROBE = 0x0004, // Don't probe any write modes.
+            ckQUIRK_SKIP_RAW_PROBE = 0x0008,        // Don't probe raw write modes.
+            ckQUIRK_SKIP_LAYER_JUMP_PROBE = 0x0010, // Don't probe layer jump recording.
+            ckQUIRK_AUDIO_MASTER_PROBE = 0x0020,    // Probe for audio master writing.
+            ckQUIRK_FORCE_SPEED_PROBE = 0x0040,     // Probe for Yamaha force speed.
+            ckQUIRK_VARIREC = 0x0080                // Supports Plextor VariRec.
+        };
+
+    private:
+        ckcore::tuint32 flags_;
+        ckcore::tuint32 max_transfer_;
+        unsigned char hangs_[256 / 8];
+        unsigned char timeouts_[256];
+
+        void merge(unsigned int index);
+
+    public:
+        DriveQuirks();
+        ~DriveQuirks();
+
+        void clear();
+        bool lookup(const ckcore::tchar *vendor,const ckcore::tchar *identifier,
+                    const ckcore::tchar *revision);
+
+        bool has(ckcore::tuint32 flag) const;
+        bool hangs(unsigned char opcode) const;
+        long timeout(unsigned char opcode) const;
+        ckcore::tuint32 max_transfer() const;
+    };
+};
@@ -0,0 +1,137 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/rescuer.hh
+ * @brief Defines the multi-pass data rescue class.
+ */
+
+#pragma once
+#ifdef _WINDOWS
+#include <windows.h>
+#endif
+#include <ckcore/types.hh>
+#include "ckmmc/buffer.hh"
+#include "ckmmc/mmcdevice.hh"
+#include "ckmmc/sectormap.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Multi-pass data rescue class.
+     * Copies 2048 byte sectors from damaged media to an image file, saving
+     * as much good data as possible before spending time on bad areas:
+     *
+     *  1. Copy pass: large reads with drive retries disabled. After a failed
+     *     read an exponentially growing area is skipped.
+     *  2. Fill pass: the areas skipped in the first pass are read the same
+     *     way without skipping.
+     *  3. Scrape pass: the sectors of failed reads are read one at a time.
+     *  4. Retry passes: the remaining failed sectors are read one at a time
+     *     with drive retries enabled.
+     *
+     * The progress is kept in a sector map which is saved regularly. Calling
+     * rescue() with an existing map resumes the job, also using a different
+     * drive.
+     */
+    class Rescuer
+    {
+    public:
+        /**
+         * Defines the rescue passes.
+         */
+        enum Pass
+        {
+            ckPASS_COPY,
+            ckPASS_FILL,
+            ckPASS_SCRAPE,
+            ckPASS_RETRY        // First of the retry passes.
+        };
+
+        /**
+         * Defines rescue constants.
+         */
+        enum
+        {
+            ckMIN_SKIP = 128,                   // Sectors skipped after the first failure.
+            ckMAX_SKIP = 65536,                 // Upper limit of the skip size in sectors.
+            ckRETRY_COUNT = 255,                // Drive read retries in the retry passes.
+            ckSECTOR_TIMEOUT = 60,              // Single sector read timeout in seconds.
+            ckRETRY_TIMEOUT = 1,                // Additional read timeout in seconds per retry.
+            ckDEFAULT_RETRY_PASSES = 3,
+            ckSAVE_INTERVAL = 30 * 1000 * 1000  // Microseconds between map saves.
+        };
+
+    private:
+        /**
+         * Defines results of a single read.
+         */
+        enum ReadResult
+        {
+            ckREAD_GOOD,
+            ckREAD_FAILED,      // The sectors could not be read.
+            ckREAD_ABORT        // The device or media is no longer usable.
+        };
+
+        MmcDevice &device_;
+        SectorMap map_;
+        const ckcore::tchar *map_path_;
+        ckcore::tuint64 last_save_;
+        unsigned int retry_passes_;
+        volatile long stop_;
+
+        AlignedBuffer buffer_;
+        ckcore::tuint32 chunk_blocks_;
+
+#ifdef _WINDOWS
+        HANDLE image_;
+#else
+        int image_;
+#endif
+
+        // Prevent copying.
+        Rescuer(const Rescuer &rescuer);
+        Rescuer &operator=(const Rescuer &rescuer);
+
+        bool open_image(const ckcore::tchar *path);
+        bool write_image(ckcore::tuint32 lba,const unsigned char *data,ckcore::tuint32 count);
+        bool flush_image();
+        bool close_image(ckcore::tuint32 count);
+
+        ReadResult read(ckcore::tuint32 lba,ckcore::tuint32 count);
+        void update(ckcore::tuint32 lba,ckcore::tuint32 count,SectorMap::State state);
+        bool save_map();
+
+        bool copy_pass(bool skip);
+        bool sector_pass(SectorMap::State state);
+
+    public:
+        Rescuer(MmcDevice &device);
+        ~Rescuer();
+
+        void retry_passes(unsigned int passes);
+        unsigned int retry_passes() const;
+
+        bool rescue(const ckcore::tchar *image_path,const ckcore::tchar *map_path);
+        bool rescue(const ckcore::tchar *image_path,const ckcore::tchar *map_path,
+                    ckcore::tuint32 lba,ckcore::tuint32 count);
+        void stop();
+
+        const SectorMap &map() const;
+    };
+};
@@ -23,6 +23,7 @@
 
 #pragma once
 #include <ckcore/types.hh>
+#include "ckmmc/sync.hh"
 
 namespace ckmmc
 {
@@ -90,11 +91,81 @@ namespace ckmmc
             ckSCSISTAT_QUEUE_FULL = 0x28
         };
 
+        /**
+         * Defines device health states.
+         */
+        enum Health
+        {
+            ckHEALTH_GOOD,          // The device responds normally.
+            ckHEALTH_SUSPECT,       // A command has stalled, the device is being recovered.
+            ckHEALTH_QUARANTINED,   // The device is temporarily isolated.
+            ckHEALTH_FAILED         // The device did not recover and has been isolated.
+        };
+
+        /**
+         * Defines reset levels, in escalation order.
+         */
+        enum ResetLevel
+        {
+            ckRESET_ABORT,          // Abort outstanding commands.
+            ckRESET_DEVICE,         // Reset the device (logical unit).
+            ckRESET_BUS             // Reset the bus the device is attached to.
+        };
+
+        /**
+         * @brief Device health callback interface.
+         * The callback is called on the thread whose command changed the
+         * health state, without holding any device locks. Devices used from
+         * several threads may call it concurrently.
+         */
+        class HealthCallback
+        {
+        public:
+            /**
+             * Called when the health state of a device has changed.
+             * @param [in] device The device.
+             * @param [in] health The new health state.
+             */
+            virtual void event_health(ScsiDevice &device,Health health) = 0;
+        };
+
+    private:
+        /**
+         * Defines watchdog constants.
+         */
+        enum
+        {
+            ckWATCHDOG_STALL_TIME = 10,         // Commands failing in transport after this
+                                                // many seconds are considered stalled.
+            ckWATCHDOG_QUARANTINE_TIME = 15,    // Initial quarantine time in seconds.
+            ckWATCHDOG_MAX_STALLS = 4           // Stalls before the device is failed.
+        };
+
     protected:
         Address addr_;
 
+        virtual bool command_allowed(const unsigned char *cdb) const;
+        virtual long command_timeout(const unsigned char *cdb) const;
+        virtual void command_completed(const unsigned char *cdb,bool success,
+                                       ckcore::tuint64 elapsed);
+        virtual void reset_completed(ResetLevel level);
+
     private:
         ScsiDriver &driver_;
+        long timeout_;
+
+        // Watchdog state, the health members are protected by the mutex.
+        bool watchdog_;
+        mutable Mutex health_mutex_;
+        Health health_;
+        HealthCallback *health_callback_;
+        unsigned int stalls_;
+        ckcore::tuint64 quarantine_end_;
+
+        bool admit();
+        void complete(bool transported,ckcore::tuint64 elapsed);
+        bool change_health(Health health);
+        void notify_health(Health health);
 
     public:
         ScsiDevice(const Address &addr);
@@ -103,8 +174,19 @@ namespace ckmmc
         const Address &address() const;
 
         bool timeout(long timeout);
+        long timeout() const;
+
+        void watchdog(bool enable);
+        bool watchdog() const;
+
+        Health health() const;
+        void health_callback(HealthCallback *callback);
+        void recover();
+        bool reset(ResetLevel level);
 
         bool silence(bool enable);
+        bool transfer_limits(ckcore::tuint32 &max_transfer,
+                             ckcore::tuint32 &alignment_mask);
 
         bool transport(unsigned char *cdb,unsigned char cdb_len,
                        unsigned char *data,unsigned long data_len,
@@ -114,5 +196,11 @@ namespace ckmmc
                                   unsigned char *data,unsigned long data_len,
                                   ScsiDevice::TransportMode mode,
                                   unsigned char *sense,unsigned char &result);
+
+        bool transport_with_sense(unsigned char *cdb,unsigned char cdb_len,
+                                  unsigned char *data,unsigned long data_len,
+                                  ScsiDevice::TransportMode mode,
+                                  unsigned char *sense,unsigned char &result,
+                                  unsigned long &transferred);
     };
 };
@@ -54,6 +54,13 @@ namespace ckmmc
          */
         bool silence(bool enable) { silent_ = enable; return true; };
 
+        /**
+         * Checks if writing to the program log or error is disabled.
+         * @return If the driver is silenced true is returned, if not false is
+         *         returned.
+         */
+        bool silent() const { return silent_; };
+
         /**
          * Scans the system for devices.
          * @param [out] addresses Vector containing addresses of all detected
@@ -63,28 +70,39 @@ namespace ckmmc
         virtual bool scan(std::vector<ScsiDevice::Address> &addresses) = 0;
 
         /**
-         * Transports data from or to the device using SCSI commands.
-         * @param [in] device The device to transport the command to.
-         * @param [in] cdb Buffer to command descriptor block.
-         * @param [in] cdb_len Length of the command descriptor block.
-         * @param [in] data Pointer to data buffer for either receiving or
-         *                  writing data.
-         * @param [in] data_len Length of the data buffer.
-         * @param [in] mode Specifies the transport mode.
-         * @param [in] silent Set to true to prevent any information to be
-         *                    written to the program log.
-         * @return If the transport was successfully carried through true is
-         *         returned, if not false is returned.
+         * Obtains the vendor and product identifiers of a device without
+         * sending any commands to it. Drivers that can not obtain this
+         * information from the operating system should return false.
+         * @param [in] addr The device address.
+         * @param [out] vendor The device vendor.
+         * @param [out] identifier The device product identifier.
+         * @return If the identity is known true is returned, if not false is
+         *         returned.
+         */
+        virtual bool identify(const ScsiDevice::Address &addr,
+                              ckcore::tstring &vendor,
+                              ckcore::tstring &identifier) { return false; };
+
+        /**
+         * Obtains the transfer limits of the host adapter a device is
+         * attached to. Drivers that can not obtain this information should
+         * return false.
+         * @param [in] addr The device address.
+         * @param [out] max_transfer The maximum number of bytes that can be
+         *                           transferred in a single command.
+         * @param [out] alignment_mask The required data buffer alignment
+         *                             mask.
+         * @return If the limits are known true is returned, if not false is
+         *         returned.
          */
-        virtual bool transport(ScsiDevice &device,
-                               unsigned char *cdb,unsigned char cdb_len,
-                               unsigned char *data,unsigned long data_len,
-                               ScsiDevice::TransportMode mode) = 0;
+        virtual bool transfer_limits(const ScsiDevice::Address &addr,
+                                     ckcore::tuint32 &max_transfer,
+                                     ckcore::tuint32 &alignment_mask) { return false; };
 
         /**
-         * Transports data from or to the device using SCSI commands. This is
-         * similar to the transport function with the exception that the sense
-         * and result is written back to the caller.
+         * Transports data from or to the device using SCSI commands. The
+         * sense and result is written back to the caller, failed commands
+         * are logged by ScsiDevice.
          * @param [in] device The device to transport the command to.
          * @param [in] cdb Buffer to command descriptor block.
          * @param [in] cdb_len Length of the command descriptor block.
@@ -94,8 +112,9 @@ namespace ckmmc
          * @param [in] mode Specifies the transport mode.
          * @param [out] sense Pointer to sense buffer.
          * @param [out] result Contains the transport result.
-         * @param [in] silent Set to true to prevent any information to be
-         *                    written to the program log.
+         * @param [out] transferred The number of bytes actually transferred.
+         * @param [in] timeout The command timeout in seconds. If negative the
+         *                     driver default timeout will be used.
          * @return If the transport was successfully carried through true is
          *         returned, if not false is returned.
          */
@@ -103,6 +122,16 @@ namespace ckmmc
                                           unsigned char *cdb,unsigned char cdb_len,
                                           unsigned char *data,unsigned long data_len,
                                           ScsiDevice::TransportMode mode,
-                                          unsigned char *sense,unsigned char &result) = 0;
+                                          unsigned char *sense,unsigned char &result,
+                                          unsigned long &transferred,long timeout) = 0;
+
+        /**
+         * Resets a device or the bus it is attached to. This is used for
+         * recovering devices that have stopped responding.
+         * @param [in] device The device to reset.
+         * @param [in] level The reset level.
+         * @return If successful true is returned, if not false is returned.
+         */
+        virtual bool reset(ScsiDevice &device,ScsiDevice::ResetLevel level) = 0;
     };
 };
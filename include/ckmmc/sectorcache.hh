@@ -0,0 +1,146 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/sectorcache.hh
+ * @brief Defines the sector cache class.
+ */
+
+#pragma once
+#include <map>
+#include <vector>
+#include <ckcore/types.hh>
+#include "ckmmc/buffer.hh"
+#include "ckmmc/mmcdevice.hh"
+#include "ckmmc/sync.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Sector cache class.
+     * Caches 2048 byte data sectors in blocks of consecutive sectors. The
+     * blocks are spread over a number of shards, each with its own lock and
+     * LRU list, so threads reading different parts of the disc rarely
+     * contend. Cache hits never wait for the device.
+     *
+     * When sequential reads are detected the cache reads ahead of the
+     * requested range. The read ahead window grows for as long as the stream
+     * continues. The device is polled for media events and all cached data
+     * is dropped when the medium has been changed.
+     */
+    class SectorCache
+    {
+    public:
+        /**
+         * Defines cache constants.
+         */
+        enum
+        {
+            ckBLOCK_SECTORS = 16,                   // Sectors per cache block.
+            ckBLOCK_SIZE = ckBLOCK_SECTORS * 2048,
+            ckNUM_SHARDS = 8,
+            ckDEFAULT_BUDGET = 32 * 1024 * 1024,
+            ckMIN_READ_AHEAD = 2,                   // Initial read ahead window in blocks.
+            ckMAX_READ_AHEAD = 64,                  // Maximum read ahead window in blocks.
+            ckSEQ_THRESHOLD = 2,                    // Sequential reads before reading ahead.
+            ckMEDIA_POLL_INTERVAL = 1000            // Milliseconds between media checks.
+        };
+
+    private:
+        /**
+         * @brief Cache entry class.
+         */
+        class Entry
+        {
+        public:
+            ckcore::tuint32 block_;
+            ckcore::tuint32 count_;         // Number of valid sectors.
+            unsigned char *data_;
+            Entry *prev_;
+            Entry *next_;
+        };
+
+        /**
+         * @brief Cache shard class.
+         */
+        class Shard
+        {
+        public:
+            Mutex mutex_;
+            AlignedBuffer slab_;
+            std::vector<Entry> entries_;
+            std::vector<Entry *> free_;
+            std::map<ckcore::tuint32,Entry *> map_;
+            Entry *head_;                   // Most recently used entry.
+            Entry *tail_;                   // Least recently used entry.
+
+            Shard() : head_(NULL),tail_(NULL) {}
+        };
+
+        MmcDevice &device_;
+        Shard shards_[ckNUM_SHARDS];
+        ckcore::tuint32 budget_;
+
+        // Device state, protected by device_mutex_.
+        Mutex device_mutex_;
+        AlignedBuffer staging_;
+        ckcore::tuint32 num_sectors_;       // Sectors on the medium, 0 if unknown.
+        bool poll_media_;
+        ckcore::tuint32 read_ahead_;        // Current read ahead window in blocks.
+        std::vector<MmcDevice::ReadError> fetch_errors_;
+
+        // Stream detection state.
+        volatile long next_lba_;            // Sector following the last read.
+        volatile long seq_reads_;           // Consecutive sequential reads.
+        volatile long last_poll_;           // Time of the last media check in milliseconds.
+
+        volatile long hits_;
+        volatile long misses_;
+
+        Shard &shard(ckcore::tuint32 block);
+        static void unlink(Shard &shard,Entry *entry);
+        static void push_front(Shard &shard,Entry *entry);
+        static void clear(Shard &shard);
+
+        bool contains(ckcore::tuint32 block);
+        bool lookup(ckcore::tuint32 block,ckcore::tuint32 offset,
+                    ckcore::tuint32 count,unsigned char *buffer);
+        void insert(ckcore::tuint32 block,const unsigned char *data,
+                    ckcore::tuint32 count);
+
+        void poll();
+        void drop();
+        bool fetch(ckcore::tuint32 lba,ckcore::tuint32 count,
+                   unsigned char *buffer,std::vector<MmcDevice::ReadError> &errors);
+
+    public:
+        SectorCache(MmcDevice &device,ckcore::tuint32 budget = ckDEFAULT_BUDGET);
+        ~SectorCache();
+
+        bool budget(ckcore::tuint32 budget);
+        ckcore::tuint32 budget() const;
+
+        bool read(ckcore::tuint32 lba,ckcore::tuint32 count,
+                  unsigned char *buffer,ckcore::tuint32 buffer_len,
+                  std::vector<MmcDevice::ReadError> &errors);
+        void invalidate();
+
+        ckcore::tuint32 hits() const;
+        ckcore::tuint32 misses() const;
+    };
+};
@@ -0,0 +1,99 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/sectormap.hh
+ * @brief Defines the run-length sector map class.
+ */
+
+#pragma once
+#include <vector>
+#include <ckcore/types.hh>
+
+namespace ckmmc
+{
+    /**
+     * @brief Run-length sector map class.
+     * Keeps track of the state of every sector in a range as a sorted list of
+     * runs of sectors sharing the same state. The map can be saved to and
+     * loaded from a text file so that an interrupted job can be resumed, the
+     * file is replaced atomically so a crash never leaves a partial map.
+     */
+    class SectorMap
+    {
+    public:
+        /**
+         * Defines sector states, the values are used in the map file.
+         */
+        enum State
+        {
+            ckSTATE_UNTRIED = '?',      // Not read yet.
+            ckSTATE_SKIPPED = '*',      // Part of a failed multi-sector read.
+            ckSTATE_FAILED = '-',       // Failed as a single sector.
+            ckSTATE_GOOD = '+'          // Read and stored.
+        };
+
+        /**
+         * @brief Run class.
+         * Describes a range of sectors in the same state.
+         */
+        class Run
+        {
+        public:
+            ckcore::tuint32 lba_;
+            ckcore::tuint32 count_;
+            State state_;
+
+            /**
+             * Constructs a Run object.
+             */
+            Run(ckcore::tuint32 lba,ckcore::tuint32 count,State state) :
+                lba_(lba),count_(count),state_(state) {}
+        };
+
+    private:
+        std::vector<Run> runs_;     // Sorted, adjacent runs never share state.
+        ckcore::tuint32 pass_;
+
+        static bool run_less(ckcore::tuint32 lba,const Run &run);
+        size_t locate(ckcore::tuint32 lba) const;
+
+    public:
+        SectorMap();
+        ~SectorMap();
+
+        void reset(ckcore::tuint32 lba,ckcore::tuint32 count);
+        void set(ckcore::tuint32 lba,ckcore::tuint32 count,State state);
+        State state(ckcore::tuint32 lba) const;
+        bool find(State state,ckcore::tuint32 from,ckcore::tuint32 &lba,
+                  ckcore::tuint32 &count) const;
+        ckcore::tuint64 count(State state) const;
+
+        ckcore::tuint32 first() const;
+        ckcore::tuint32 end() const;
+        const std::vector<Run> &runs() const;
+
+        void pass(ckcore::tuint32 pass);
+        ckcore::tuint32 pass() const;
+
+        bool save(const ckcore::tchar *path) const;
+        bool load(const ckcore::tchar *path);
+
+        static bool exists(const ckcore::tchar *path);
+    };
+};
@@ -0,0 +1,148 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/secureripper.hh
+ * @brief Defines the secure audio ripper class.
+ */
+
+#pragma once
+#include <map>
+#include <vector>
+#include <ckcore/types.hh>
+#include "ckmmc/audioreader.hh"
+#include "ckmmc/mmcdevice.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Secure audio ripper class.
+     * Extracts audio and verifies every frame by two independent reads. The
+     * range is processed in segments larger than the drive cache. Each
+     * segment is read twice: the first pass produces the output and the
+     * second pass is compared to it. Both reads of a frame are separated by
+     * a full segment so the second read can not be served from the cache.
+     * Only frames where the passes disagree are read again, after reading
+     * a distant area to flush the cache, until two reads of the frame match.
+     *
+     * Drives that are not accurate stream may return data shifted by a
+     * number of samples. Reads are made overlapping and aligned to the
+     * already extracted audio by searching for a matching run of samples.
+     */
+    class SecureRipper
+    {
+    public:
+        /**
+         * Defines ripper constants.
+         */
+        enum
+        {
+            ckFRAME_SAMPLES = 588,          // Stereo samples per frame.
+            ckMAX_CHUNK_FRAMES = 32,        // Frames per read, excluding overlap.
+            ckOVERLAP_FRAMES = 3,           // Overlap for alignment.
+            ckPROBE_SAMPLES = 256,          // Samples matched for alignment.
+            ckPROBE_COUNT = 4,              // Runs of samples tried for alignment.
+            ckALIGN_RETRIES = 3,
+            ckMAX_JITTER = 2 * 588,         // Largest shift searched, in samples.
+            ckMIN_SEGMENT_FRAMES = 1024,
+            ckDEFAULT_CACHE_SIZE = 2048,    // kB, used if the drive reports none.
+            ckDEFAULT_MAX_REREADS = 16
+        };
+
+        /**
+         * @brief Audio sink interface.
+         * Receives the audio of each segment once it has been verified, in
+         * disc order.
+         */
+        class Sink
+        {
+        public:
+            virtual ~Sink() {}
+
+            /**
+             * Called when a segment of audio has been extracted.
+             * @param [in] lba The address of the first frame.
+             * @param [in] data The audio data.
+             * @param [in] count The number of frames.
+             */
+            virtual void audio(ckcore::tuint32 lba,const unsigned char *data,
+                               ckcore::tuint32 count) = 0;
+        };
+
+    private:
+        MmcDevice &device_;
+        AudioReader reader_;
+        bool search_;                   // False for accurate stream drives.
+        unsigned int max_rereads_;
+        ckcore::tuint32 leadout_;
+        Sink *sink_;
+
+        // State of the current rip.
+        ckcore::tuint32 lba_;
+        ckcore::tuint32 count_;
+        ckcore::tuint32 end_lba_;       // The lead-out address, 0 if unknown.
+        ckcore::tuint32 read_end_;      // Reads end before this frame.
+        unsigned char *out_;
+        std::vector<bool> verified_;
+        std::map<ckcore::tuint32,std::vector<unsigned char> > candidates_;
+        std::vector<unsigned char> chunk_;
+        int jitter_;
+        ckcore::tuint32 cache_frames_;
+        ckcore::tuint32 chunk_frames_;
+
+        ckcore::tuint64 frames_read_;
+        ckcore::tuint64 reread_frames_;
+        ckcore::tuint32 max_jitter_;
+
+        // Prevent copying.
+        SecureRipper(const SecureRipper &ripper);
+        SecureRipper &operator=(const SecureRipper &ripper);
+
+        static bool match(const unsigned char *data1,const unsigned char *data2,
+                          ckcore::tuint32 len);
+
+        ckcore::tuint32 read_chunk(ckcore::tuint32 first,ckcore::tuint32 count);
+        bool align(ckcore::tuint32 chunk_samples,ckcore::tint64 chunk_start,
+                   ckcore::tuint64 probe,int &jitter);
+        ckcore::tuint64 probe_pos(ckcore::tuint32 frame) const;
+        void note_jitter(int jitter);
+        void defeat_cache(ckcore::tuint32 frame);
+
+        void extract_pass(ckcore::tuint32 first,ckcore::tuint32 end);
+        void verify_pass(ckcore::tuint32 first,ckcore::tuint32 end);
+        void reread(ckcore::tuint32 first,ckcore::tuint32 end);
+        bool compare(ckcore::tuint32 frame,const unsigned char *data);
+
+    public:
+        SecureRipper(MmcDevice &device);
+        ~SecureRipper();
+
+        void max_rereads(unsigned int rereads);
+        unsigned int max_rereads() const;
+        void leadout(ckcore::tuint32 lba);
+        ckcore::tuint32 leadout() const;
+        void sink(Sink *sink);
+
+        bool rip(ckcore::tuint32 lba,ckcore::tuint32 count,unsigned char *audio,
+                 std::vector<ckcore::tuint32> &unverified);
+
+        ckcore::tuint64 frames_read() const;
+        ckcore::tuint64 reread_frames() const;
+        ckcore::tuint32 max_jitter() const;
+    };
+};
@@ -0,0 +1,35 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/simd.hh
+ * @brief Defines the SIMD instruction sets available to the compiler.
+ */
+
+#pragma once
+
+/*
+ * CK_MMC_SSE2 is defined if SSE2 instructions may be used. The 32-bit
+ * Visual C++ compiler only targets SSE2 capable processors when building
+ * with /arch:SSE2, which sets _M_IX86_FP to 2. All x64 processors support
+ * SSE2.
+ */
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define CK_MMC_SSE2
+#include <emmintrin.h>
+#endif
@@ -0,0 +1,126 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/streamreader.hh
+ * @brief Defines the stream reader class.
+ */
+
+#pragma once
+#include <vector>
+#include <ckcore/types.hh>
+#include "ckmmc/buffer.hh"
+#include "ckmmc/mmcdevice.hh"
+#include "ckmmc/sync.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Stream reader class.
+     * Reads a range of sectors sequentially in a separate thread, ahead of
+     * the consumer. Read data is passed to the consumer through a lock-free
+     * single producer single consumer ring of buffers. The consumer leases
+     * the buffers directly, no data is copied. The number of buffers the
+     * producer may fill ahead of the consumer adapts to the consumer speed,
+     * but never drops below the number of leased buffers plus one.
+     *
+     * The device must not be used by other threads while the reader is
+     * running.
+     */
+    class StreamReader : public Thread
+    {
+    public:
+        /**
+         * Defines ring constants.
+         */
+        enum
+        {
+            ckMAX_DEPTH = 32,
+            ckMIN_DEPTH = 2,
+            ckADAPT_INTERVAL = 16       // Chunks between depth adjustments.
+        };
+
+        /**
+         * @brief Buffer lease class.
+         * Describes a chunk of read sectors. The data remains valid until the
+         * lease is released.
+         */
+        class Lease
+        {
+        public:
+            const unsigned char *data_;
+            ckcore::tuint32 lba_;
+            ckcore::tuint32 count_;
+            const std::vector<MmcDevice::ReadError> *errors_;
+        };
+
+    private:
+        /**
+         * @brief Ring slot class.
+         */
+        class Slot
+        {
+        public:
+            AlignedBuffer buffer_;
+            ckcore::tuint32 lba_;
+            ckcore::tuint32 count_;
+            std::vector<MmcDevice::ReadError> errors_;
+        };
+
+        MmcDevice &device_;
+        Slot slots_[ckMAX_DEPTH];
+        unsigned int num_slots_;
+
+        ckcore::tuint32 lba_;
+        ckcore::tuint32 count_;
+        ckcore::tuint32 chunk_blocks_;
+
+        // Shared state.
+        volatile long head_;            // Number of chunks filled by the producer.
+        volatile long tail_;            // Number of chunks released by the consumer.
+        volatile long depth_;           // Chunks the producer may fill ahead.
+        volatile long leased_;          // Number of outstanding leases.
+        volatile long stop_;
+        volatile long finished_;
+        volatile long empty_waits_;     // Times the consumer found the ring empty.
+        Event space_event_;
+        Event data_event_;
+
+        // Producer state.
+        unsigned int full_waits_;       // Times the producer found the ring full.
+        unsigned int adapt_count_;
+
+        void adapt();
+
+    protected:
+        void run();
+
+    public:
+        StreamReader(MmcDevice &device);
+        ~StreamReader();
+
+        bool start(ckcore::tuint32 lba,ckcore::tuint32 count,
+                   unsigned int max_depth = ckMAX_DEPTH);
+        void stop();
+
+        bool lease(Lease &lease);
+        void release();
+
+        unsigned int depth() const;
+    };
+};
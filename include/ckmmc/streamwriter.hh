@@ -0,0 +1,165 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/streamwriter.hh
+ * @brief Defines the stream writer class.
+ */
+
+#pragma once
+#include <ckcore/types.hh>
+#include "ckmmc/buffer.hh"
+#include "ckmmc/mmcdevice.hh"
+#include "ckmmc/sync.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Stream writer class.
+     * Writes a stream of blocks sequentially using WRITE(10) in a separate
+     * thread. The producer fills buffers leased from a large host FIFO while
+     * the writer thread drains it. Submissions are paced using READ BUFFER
+     * CAPACITY so that the device buffer is kept close to full without
+     * blocking the device on a full buffer. Data already in memory may also
+     * be submitted without being copied to the FIFO.
+     *
+     * The write parameters must have been set up before starting the writer
+     * and the device must not be used by other threads while the writer is
+     * running.
+     */
+    class StreamWriter : public Thread
+    {
+    public:
+        /**
+         * Defines writer constants.
+         */
+        enum
+        {
+            ckMAX_SLOTS = 1024,
+            ckMIN_SLOTS = 4,
+            ckDEFAULT_FIFO_SIZE = 32 * 1024 * 1024,
+            ckPOLL_INTERVAL = 10,           // Milliseconds between polls of a full device buffer.
+            ckLONG_WRITE_TIMEOUT = 60000    // Milliseconds to wait for a busy device.
+        };
+
+        /**
+         * @brief Buffer lease class.
+         * Describes an empty FIFO buffer to be filled by the producer.
+         */
+        class Lease
+        {
+        public:
+            unsigned char *data_;
+            ckcore::tuint32 blocks_;        // Capacity in blocks.
+        };
+
+        /**
+         * @brief Writer metrics class.
+         * Snapshot of the buffer levels and events, safe to take while the
+         * writer is running.
+         */
+        class Metrics
+        {
+        public:
+            ckcore::tuint32 host_size_;     // Host FIFO size in bytes.
+            ckcore::tuint32 host_fill_;     // Bytes waiting in the host FIFO.
+            ckcore::tuint32 drive_size_;    // Device buffer size in bytes.
+            ckcore::tuint32 drive_fill_;    // Bytes in the device buffer at the last poll.
+            ckcore::tuint32 written_;       // Number of blocks written.
+            ckcore::tuint32 host_waits_;    // Times the writer found the host FIFO empty.
+            ckcore::tuint32 underruns_;     // Times the device buffer ran empty.
+            ckcore::tuint32 underrun_lba_;  // Address being written at the last underrun.
+            bool burn_proof_;               // Device can recover from underruns.
+        };
+
+    private:
+        /**
+         * @brief FIFO slot class.
+         */
+        class Slot
+        {
+        public:
+            AlignedBuffer buffer_;
+            const unsigned char *data_;     // Data to write, buffer_ or submitted data.
+            ckcore::tuint32 blocks_;
+        };
+
+        MmcDevice &device_;
+        Slot slots_[ckMAX_SLOTS];
+        unsigned int num_slots_;
+
+        ckcore::tuint32 lba_;
+        ckcore::tuint32 block_len_;
+        ckcore::tuint32 chunk_blocks_;
+        ckcore::tuint32 alignment_mask_;
+        bool burn_proof_;
+
+        // Shared state.
+        volatile long head_;            // Number of slots committed by the producer.
+        volatile long tail_;            // Number of slots written by the writer.
+        volatile long stop_;
+        volatile long done_;            // Set when the producer has no more data.
+        volatile long finished_;        // Set when the writer thread has ended.
+        volatile long failed_;
+        volatile long host_fill_;
+        volatile long drive_size_;
+        volatile long drive_fill_;
+        volatile long written_;
+        volatile long host_waits_;
+        volatile long underruns_;
+        volatile long underrun_lba_;
+        Event space_event_;
+        Event data_event_;
+        Event stop_event_;
+
+        // Producer state.
+        bool leased_;
+        ckcore::tuint32 queued_;        // Number of blocks committed or submitted.
+
+        // Writer state.
+        bool pacing_;
+        bool underrun_;
+        ckcore::tuint32 drive_free_;    // Estimated free device buffer space.
+
+        bool wait_slot();
+        bool pace(ckcore::tuint32 lba,ckcore::tuint32 bytes);
+        bool write(ckcore::tuint32 lba,const unsigned char *data,ckcore::tuint32 blocks);
+
+    protected:
+        void run();
+
+    public:
+        StreamWriter(MmcDevice &device);
+        ~StreamWriter();
+
+        bool start(ckcore::tuint32 lba,ckcore::tuint32 block_len,
+                   ckcore::tuint32 fifo_size = ckDEFAULT_FIFO_SIZE);
+        bool finish();
+        void stop();
+
+        bool lease(Lease &lease);
+        bool commit(ckcore::tuint32 blocks);
+        bool submit(const unsigned char *data,ckcore::tuint32 blocks);
+        bool wait(ckcore::tuint32 blocks);
+
+        ckcore::tuint32 queued() const;
+        ckcore::tuint32 chunk_blocks() const;
+
+        void metrics(Metrics &metrics);
+    };
+};
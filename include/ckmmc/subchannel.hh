@@ -0,0 +1,73 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/subchannel.hh
+ * @brief Defines the sub-channel conversion class.
+ */
+
+#pragma once
+#include <ckcore/types.hh>
+
+namespace ckmmc
+{
+    /**
+     * @brief Sub-channel conversion class.
+     * Converts the 96 bytes of P-W sub-channel data stored with each sector
+     * between the following layouts:
+     * - Raw: the bits of all eight channels interleaved, as read or written
+     *   using ScsiModePage05::ckDB_RAW_2352_PW.
+     * - Cooked: each channel stored as 12 consecutive bytes, P first.
+     * - Packed: the R-W channels as de-interleaved 6-bit symbols, one per
+     *   byte, as written using ScsiModePage05::ckDB_RAW_2352_PW_PACK.
+     *
+     * Raw and packed batches are addressed using a stride so that sub-channel
+     * data stored after the sector data can be processed in place.
+     */
+    class Subchannel
+    {
+    public:
+        /**
+         * Defines sub-channel constants.
+         */
+        enum
+        {
+            ckSUBCH_SIZE = 96,
+            ckCHANNEL_SIZE = 12,
+            ckPACK_SIZE = 24,
+            ckPACKS = 4,                // Packs per sector.
+            ckQ_OFFSET = 12,            // Q channel in cooked data.
+            ckQ_MAX_REPAIR_BYTES = 4    // Bytes that may differ from a predicted Q.
+        };
+
+    public:
+        static void deinterleave(const unsigned char *raw,unsigned char *cooked,
+                                 ckcore::tuint32 count,ckcore::tuint32 stride);
+        static void interleave(const unsigned char *cooked,unsigned char *raw,
+                               ckcore::tuint32 count,ckcore::tuint32 stride);
+
+        static void unpack_rw(const unsigned char *raw,unsigned char *packed,
+                              ckcore::tuint32 count,ckcore::tuint32 stride);
+        static void pack_rw(const unsigned char *packed,unsigned char *raw,
+                            ckcore::tuint32 count,ckcore::tuint32 stride);
+
+        static ckcore::tuint16 crc_q(const unsigned char *q);
+        static bool check_q(const unsigned char *q);
+        static bool repair_q(unsigned char *q,const unsigned char *prev_q);
+    };
+};
@@ -0,0 +1,154 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/surfacescan.hh
+ * @brief Defines the surface scan class.
+ */
+
+#pragma once
+#include <vector>
+#include <ckcore/types.hh>
+#include "ckmmc/buffer.hh"
+#include "ckmmc/mmcdevice.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Surface scan class.
+     * Reads a disc in fixed size chunks recording the latency, throughput,
+     * number of attempts and error class of every chunk. The chunks are
+     * summarized into a fixed number of zones and a score which can be used
+     * for grading media and for finding discs that are starting to degrade.
+     *
+     * The post error bit of the device is enabled during the scan so that
+     * errors corrected by the drive are reported as recovered errors.
+     */
+    class SurfaceScan
+    {
+    public:
+        /**
+         * Defines error classes, ordered by severity.
+         */
+        enum ErrorClass
+        {
+            ckEC_NONE,
+            ckEC_RECOVERED,     // Read after drive or host recovery.
+            ckEC_MEDIUM,        // Unreadable, medium error.
+            ckEC_HARDWARE,      // Unreadable, hardware error.
+            ckEC_OTHER          // Unreadable, other error.
+        };
+
+        /**
+         * Defines scan constants.
+         */
+        enum
+        {
+            ckDEFAULT_CHUNK_SECTORS = 32,
+            ckDEFAULT_HOST_RETRIES = 2,
+            ckNUM_ZONES = 64,
+            ckSLOW_FACTOR = 4           // Chunks this much slower than the median are slow.
+        };
+
+        /**
+         * @brief Chunk class.
+         * Describes the result of reading one chunk.
+         */
+        class Chunk
+        {
+        public:
+            ckcore::tuint32 lba_;
+            ckcore::tuint32 count_;
+            ckcore::tuint32 latency_;       // Microseconds, all attempts.
+            unsigned char attempts_;
+            ErrorClass error_class_;
+            unsigned char sense_key_;
+            unsigned char asc_;
+            unsigned char ascq_;
+
+            /**
+             * Constructs a Chunk object.
+             */
+            Chunk(ckcore::tuint32 lba,ckcore::tuint32 count) :
+                lba_(lba),count_(count),latency_(0),attempts_(0),
+                error_class_(ckEC_NONE),sense_key_(0),asc_(0),ascq_(0) {}
+
+            ckcore::tuint32 throughput() const;
+        };
+
+        /**
+         * @brief Zone class.
+         * Summarizes a range of chunks. Sector counts refer to sectors in
+         * chunks of the specific category.
+         */
+        class Zone
+        {
+        public:
+            ckcore::tuint32 lba_;
+            ckcore::tuint32 count_;
+            ckcore::tuint32 min_latency_;   // Microseconds.
+            ckcore::tuint32 avg_latency_;   // Microseconds.
+            ckcore::tuint32 max_latency_;   // Microseconds.
+            ckcore::tuint32 throughput_;    // kB/s.
+            ckcore::tuint32 slow_;
+            ckcore::tuint32 recovered_;
+            ckcore::tuint32 errors_;
+
+            /**
+             * Constructs a Zone object.
+             */
+            Zone(ckcore::tuint32 lba) :
+                lba_(lba),count_(0),min_latency_(0),avg_latency_(0),max_latency_(0),
+                throughput_(0),slow_(0),recovered_(0),errors_(0) {}
+        };
+
+    private:
+        MmcDevice &device_;
+        ckcore::tuint32 chunk_sectors_;
+        unsigned int host_retries_;
+        volatile long stop_;
+        AlignedBuffer buffer_;
+
+        std::vector<Chunk> chunks_;
+        std::vector<Zone> zones_;
+        ckcore::tuint32 slow_latency_;
+        unsigned int score_;
+
+        bool read(Chunk &chunk);
+        void summarize();
+
+    public:
+        SurfaceScan(MmcDevice &device);
+        ~SurfaceScan();
+
+        void chunk_sectors(ckcore::tuint32 sectors);
+        ckcore::tuint32 chunk_sectors() const;
+        void host_retries(unsigned int retries);
+        unsigned int host_retries() const;
+
+        bool scan();
+        bool scan(ckcore::tuint32 lba,ckcore::tuint32 count);
+        void stop();
+
+        const std::vector<Chunk> &chunks() const;
+        const std::vector<Zone> &zones() const;
+        unsigned int score() const;
+        ckcore::tstring zone_map() const;
+        ckcore::tstring csv() const;
+    };
+};
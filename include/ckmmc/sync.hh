@@ -0,0 +1,142 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/sync.hh
+ * @brief Defines thread and synchronization classes.
+ */
+
+#pragma once
+#ifdef _WINDOWS
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/time.h>
+#endif
+#include <ckcore/types.hh>
+
+namespace ckmmc
+{
+    /**
+     * @brief Thread class.
+     * Base class for objects running code in a separate thread. Derived
+     * classes implement the run function.
+     */
+    class Thread
+    {
+    private:
+#ifdef _WINDOWS
+        HANDLE handle_;
+
+        static DWORD WINAPI entry(LPVOID param);
+#else
+        pthread_t handle_;
+        bool started_;
+
+        static void *entry(void *param);
+#endif
+
+        // Prevent copying.
+        Thread(const Thread &thread);
+        Thread &operator=(const Thread &thread);
+
+    protected:
+        virtual void run() = 0;
+
+    public:
+        Thread();
+        virtual ~Thread();
+
+        bool start();
+        bool join();
+    };
+
+    /**
+     * @brief Mutex class.
+     */
+    class Mutex
+    {
+    private:
+#ifdef _WINDOWS
+        CRITICAL_SECTION cs_;
+#else
+        pthread_mutex_t mutex_;
+#endif
+
+        // Prevent copying.
+        Mutex(const Mutex &mutex);
+        Mutex &operator=(const Mutex &mutex);
+
+    public:
+        Mutex();
+        ~Mutex();
+
+        void lock();
+        void unlock();
+    };
+
+    /**
+     * @brief Scoped mutex lock class.
+     */
+    class ScopedLock
+    {
+    private:
+        Mutex &mutex_;
+
+    public:
+        ScopedLock(Mutex &mutex) : mutex_(mutex) { mutex_.lock(); }
+        ~ScopedLock() { mutex_.unlock(); }
+    };
+
+    /**
+     * @brief Auto-reset event class.
+     * A signaled event releases one waiting thread and is then reset. If no
+     * thread is waiting the event stays signaled until a thread waits on it.
+     */
+    class Event
+    {
+    private:
+#ifdef _WINDOWS
+        HANDLE handle_;
+#else
+        pthread_mutex_t mutex_;
+        pthread_cond_t cond_;
+        bool signaled_;
+#endif
+
+        // Prevent copying.
+        Event(const Event &event);
+        Event &operator=(const Event &event);
+
+    public:
+        Event();
+        ~Event();
+
+        void set();
+        void wait();
+        bool wait(ckcore::tuint32 timeout);
+    };
+
+    namespace atomic
+    {
+        long load(volatile long *value);
+        void store(volatile long *value,long new_value);
+        long add(volatile long *value,long delta);
+        long exchange(volatile long *value,long new_value);
+    };
+};
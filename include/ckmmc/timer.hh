@@ -0,0 +1,48 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file include/ckmmc/timer.hh
+ * @brief Defines the high resolution timer class.
+ */
+
+#pragma once
+#include <ckcore/types.hh>
+
+namespace ckmmc
+{
+    /**
+     * @brief High resolution timer class.
+     * Used for measuring command latencies. All time values are measured in
+     * microseconds.
+     */
+    class Timer
+    {
+    private:
+        ckcore::tuint64 start_;
+
+    public:
+        Timer();
+        ~Timer();
+
+        void reset();
+        ckcore::tuint64 elapsed() const;
+
+        static ckcore::tuint64 now();
+    };
+};
@@ -190,8 +190,15 @@ namespace ckmmc
     class AspiDriver : public ScsiDriver
     {
     private:
+        enum
+        {
+            ckASPI_DEFAULT_TIMEOUT = 60,
+            ckASPI_ABORT_TIMEOUT = 5
+        };
+
         HINSTANCE dll_instance_;
         bool driver_loaded_;
+        long timeout_;
 
         // wnaspi32.dll symbols.
         typedef unsigned long (*tGetASPI32SupportInfo)();
@@ -202,6 +209,9 @@ namespace ckmmc
         bool driver_load();
         bool driver_unload();
 
+        void execute(SRB_ExecSCSICmd &srb_cmd,long timeout);
+        bool reset_device(BYTE ha_id,BYTE target,BYTE lun);
+
     public:
         AspiDriver();
         ~AspiDriver();
@@ -213,15 +223,17 @@ namespace ckmmc
 
         bool scan(std::vector<ScsiDevice::Address> &addresses);
 
-        bool transport(ScsiDevice &device,
-                       unsigned char *cdb,unsigned char cdb_len,
-                       unsigned char *data,unsigned long data_len,
-                       ScsiDevice::TransportMode mode);
+        bool transfer_limits(const ScsiDevice::Address &addr,
+                             ckcore::tuint32 &max_transfer,
+                             ckcore::tuint32 &alignment_mask);
 
         bool transport_with_sense(ScsiDevice &device,
                                   unsigned char *cdb,unsigned char cdb_len,
                                   unsigned char *data,unsigned long data_len,
                                   ScsiDevice::TransportMode mode,
-                                  unsigned char *sense,unsigned char &result);
+                                  unsigned char *sense,unsigned char &result,
+                                  unsigned long &transferred,long timeout);
+
+        bool reset(ScsiDevice &device,ScsiDevice::ResetLevel level);
     };
 };
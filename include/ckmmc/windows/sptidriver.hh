@@ -27,6 +27,7 @@
 #include <map>
 #include <ckcore/types.hh>
 #include "ckmmc/scsidriver.hh"
+#include "ckmmc/sync.hh"
 
 namespace ckmmc
 {
@@ -41,11 +42,37 @@ namespace ckmmc
             ckSPTI_DEFAULT_TIMEOUT = 60
         };
 
+        /**
+         * @brief Scoped device handle reference.
+         * Keeps a device handle open for as long as the object exists.
+         */
+        class ScopedHandle
+        {
+        private:
+            SptiDriver &driver_;
+            ckcore::tchar drive_letter_;
+            HANDLE handle_;
+
+        public:
+            ScopedHandle(SptiDriver &driver,const ScsiDevice::Address &addr);
+            ~ScopedHandle();
+
+            HANDLE handle() const { return handle_; }
+        };
+
+        friend class ScopedHandle;
+
         bool ctcm_;
         long timeout_;
+
+        // Device handles are shared between threads. Handles that have been
+        // retired by an abort stay open until their last user releases them.
+        Mutex handles_mutex_;
         std::map<ckcore::tchar,HANDLE> handles_;
+        std::map<HANDLE,unsigned int> handle_users_;
 
-        HANDLE get_handle(ScsiDevice &device);
+        HANDLE acquire_handle(const ScsiDevice::Address &addr);
+        void release_handle(ckcore::tchar drive_letter,HANDLE handle);
 
     public:
         SptiDriver(bool ctcm);
@@ -60,15 +87,21 @@ namespace ckmmc
 
         bool scan(std::vector<ScsiDevice::Address> &addresses);
 
-        bool transport(ScsiDevice &device,
-                       unsigned char *cdb,unsigned char cdb_len,
-                       unsigned char *data,unsigned long data_len,
-                       ScsiDevice::TransportMode mode);
+        bool identify(const ScsiDevice::Address &addr,
+                      ckcore::tstring &vendor,
+                      ckcore::tstring &identifier);
+
+        bool transfer_limits(const ScsiDevice::Address &addr,
+                             ckcore::tuint32 &max_transfer,
+                             ckcore::tuint32 &alignment_mask);
 
         bool transport_with_sense(ScsiDevice &device,
                                   unsigned char *cdb,unsigned char cdb_len,
                                   unsigned char *data,unsigned long data_len,
                                   ScsiDevice::TransportMode mode,
-                                  unsigned char *sense,unsigned char &result);
+                                  unsigned char *sense,unsigned char &result,
+                                  unsigned long &transferred,long timeout);
+
+        bool reset(ScsiDevice &device,ScsiDevice::ResetLevel level);
     };
 };
@@ -0,0 +1,603 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ckcore/convert.hh>
+#include <ckcore/log.hh>
+#include "ckmmc/simd.hh"
+#include "ckmmc/accuraterip.hh"
+
+namespace ckmmc
+{
+    /**
+     * Reads a little endian 32-bit integer.
+     * @param [in] data Pointer to the integer.
+     * @return The integer value.
+     */
+    static ckcore::tuint32 read_le32(const unsigned char *data)
+    {
+        return static_cast<ckcore::tuint32>(data[0]) |
+               (static_cast<ckcore::tuint32>(data[1]) << 8) |
+               (static_cast<ckcore::tuint32>(data[2]) << 16) |
+               (static_cast<ckcore::tuint32>(data[3]) << 24);
+    }
+
+    /**
+     * Constructs an AccurateRip object.
+     * @param [in] lbas The start addresses of the audio tracks.
+     * @param [in] leadout The address following the last audio track.
+     */
+    AccurateRip::AccurateRip(const std::vector<ckcore::tuint32> &lbas,ckcore::tuint32 leadout) :
+        lbas_(lbas),leadout_(leadout),end_(0),pos_(0),range_(ckMAX_OFFSET_RANGE)
+    {
+        variants_.resize(1);
+        reset();
+    }
+
+    /**
+     * Destructs the AccurateRip object.
+     */
+    AccurateRip::~AccurateRip()
+    {
+    }
+
+    /**
+     * Adds the products of a run of samples and their positions to the
+     * checksums.
+     * @param [in] data The samples.
+     * @param [in] count The number of samples.
+     * @param [in] index The position of the first sample in the track,
+     *                   starting at one.
+     * @param [in,out] v1 The v1 checksum.
+     * @param [in,out] v2 The v2 checksum.
+     * @param [in,out] total The sum of the samples.
+     */
+    void AccurateRip::sum(const unsigned char *data,ckcore::tuint32 count,
+                          ckcore::tuint32 index,ckcore::tuint32 &v1,ckcore::tuint32 &v2,
+                          ckcore::tuint32 &total)
+    {
+        ckcore::tuint32 i = 0;
+#ifdef CK_MMC_SSE2
+        // The samples are multiplied as 64-bit products, two lanes at a time.
+        // The v1 checksum is the sum of the low halves and the v2 checksum the
+        // sum of both halves.
+        __m128i pos = _mm_setr_epi32(index,index + 1,index + 2,index + 3);
+        __m128i step = _mm_set1_epi32(4);
+        __m128i low_mask = _mm_setr_epi32(-1,0,-1,0);
+        __m128i acc_v1 = _mm_setzero_si128();
+        __m128i acc_v2 = _mm_setzero_si128();
+        __m128i acc_total = _mm_setzero_si128();
+
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i * 4));
+
+            __m128i even = _mm_mul_epu32(samples,pos);
+            __m128i odd = _mm_mul_epu32(_mm_srli_epi64(samples,32),_mm_srli_epi64(pos,32));
+
+            acc_v1 = _mm_add_epi32(acc_v1,_mm_and_si128(even,low_mask));
+            acc_v1 = _mm_add_epi32(acc_v1,_mm_and_si128(odd,low_mask));
+            acc_v2 = _mm_add_epi32(acc_v2,even);
+            acc_v2 = _mm_add_epi32(acc_v2,odd);
+            acc_total = _mm_add_epi32(acc_total,samples);
+
+            pos = _mm_add_epi32(pos,step);
+        }
+
+        ckcore::tuint32 lanes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes),acc_v1);
+        v1 += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes),acc_v2);
+        v2 += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes),acc_total);
+        total += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+        for (; i < count; i++)
+        {
+            ckcore::tuint32 sample = read_le32(data + i * 4);
+            ckcore::tuint64 product = static_cast<ckcore::tuint64>(sample) * (index + i);
+
+            v1 += static_cast<ckcore::tuint32>(product);
+            v2 += static_cast<ckcore::tuint32>(product) + static_cast<ckcore::tuint32>(product >> 32);
+            total += sample;
+        }
+    }
+
+    /**
+     * Copies the part of a run of samples that falls within a window.
+     * @param [in] data The samples.
+     * @param [in] pos The disc position of the first sample.
+     * @param [in] count The number of samples.
+     * @param [in] start The disc position of the first sample in the window.
+     * @param [in,out] samples The window samples.
+     */
+    void AccurateRip::copy(const unsigned char *data,ckcore::tint64 pos,ckcore::tint64 count,
+                           ckcore::tint64 start,std::vector<ckcore::tuint32> &samples)
+    {
+        ckcore::tint64 first = pos > start ? pos : start;
+        ckcore::tint64 end = start + static_cast<ckcore::tint64>(samples.size());
+        if (pos + count < end)
+            end = pos + count;
+
+        for (ckcore::tint64 i = first; i < end; i++)
+            samples[static_cast<size_t>(i - start)] = read_le32(data + (i - pos) * 4);
+    }
+
+    /**
+     * Resets the checksums and calculates the track layout.
+     */
+    void AccurateRip::reset()
+    {
+        pos_ = 0;
+        end_ = lbas_.empty() || leadout_ < lbas_[0] ? 0 :
+               static_cast<ckcore::tint64>(leadout_ - lbas_[0]) * ckFRAME_SAMPLES;
+
+        tracks_.clear();
+        tracks_.resize(lbas_.size());
+        for (size_t i = 0; i < lbas_.size(); i++)
+        {
+            Track &track = tracks_[i];
+            track.start_ = static_cast<ckcore::tint64>(lbas_[i] - lbas_[0]) * ckFRAME_SAMPLES;
+
+            ckcore::tint64 end = i + 1 < lbas_.size() ?
+                static_cast<ckcore::tint64>(lbas_[i + 1] - lbas_[0]) * ckFRAME_SAMPLES : end_;
+
+            // The first track is checked from the last sample of its fifth
+            // frame, the last track is checked up to its last five frames.
+            track.first_ = i == 0 ? track.start_ + ckSKIP_SAMPLES - 1 : track.start_;
+            track.last_ = i + 1 == lbas_.size() ? end - ckSKIP_SAMPLES - 1 : end - 1;
+
+            track.head_.assign(2 * range_ + 1,0);
+            track.tail_.assign(2 * range_ + 1,0);
+        }
+
+        for (size_t i = 0; i < variants_.size(); i++)
+        {
+            variants_[i].v1_.assign(lbas_.size(),0);
+            variants_[i].v2_.assign(lbas_.size(),0);
+            variants_[i].ctdb_.reset();
+        }
+    }
+
+    /**
+     * Returns the product of a sample and its position in a track, as used
+     * by the v1 checksum.
+     * @param [in] track The track.
+     * @param [in] pos The disc position of the sample, it must be within the
+     *                 samples stored around the checked range of the track.
+     * @return The product.
+     */
+    ckcore::tuint32 AccurateRip::weighted(const Track &track,ckcore::tint64 pos) const
+    {
+        ckcore::tuint32 sample = 0;
+        if (pos - (track.first_ - range_) <= 2 * range_)
+            sample = track.head_[static_cast<size_t>(pos - (track.first_ - range_))];
+        else
+            sample = track.tail_[static_cast<size_t>(pos - (track.last_ - range_))];
+
+        return sample * static_cast<ckcore::tuint32>(pos - track.start_ + 1);
+    }
+
+    /**
+     * Calculates the v1 checksums for all offsets once all audio has been
+     * received. The checksum of the range shifted by k samples is
+     * W(k) - k * S(k), where W(k) is the sum of the products of the samples
+     * in the shifted range and their unshifted positions and S(k) is the sum
+     * of the samples in the shifted range. Both are updated one sample at a
+     * time from the stored samples at the range boundaries.
+     */
+    void AccurateRip::finish()
+    {
+        for (size_t i = 0; i < tracks_.size(); i++)
+        {
+            Track &track = tracks_[i];
+            track.v1_.assign(2 * range_ + 1,0);
+
+            if (track.last_ < track.first_)
+                continue;
+
+            ckcore::tuint32 w = variants_[0].v1_[i];
+            ckcore::tuint32 s = track.sum_;
+            track.v1_[range_] = w;
+
+            for (int k = 1; k <= range_; k++)
+            {
+                w += weighted(track,track.last_ + k) - weighted(track,track.first_ + k - 1);
+                s += track.tail_[range_ + k] - track.head_[range_ + k - 1];
+                track.v1_[range_ + k] = w - static_cast<ckcore::tuint32>(k) * s;
+            }
+
+            w = variants_[0].v1_[i];
+            s = track.sum_;
+            for (int k = -1; k >= -range_; k--)
+            {
+                w += weighted(track,track.first_ + k) - weighted(track,track.last_ + k + 1);
+                s += track.head_[range_ + k] - track.tail_[range_ + k + 1];
+                track.v1_[range_ + k] = w - static_cast<ckcore::tuint32>(k) * s;
+            }
+        }
+    }
+
+    /**
+     * Sets the range of offsets for which v1 checksums are calculated. The
+     * range must be set before any audio is delivered.
+     * @param [in] range The largest offset in samples.
+     */
+    void AccurateRip::offset_range(int range)
+    {
+        range_ = range < 0 ? 0 : range > ckMAX_OFFSET_RANGE ? ckMAX_OFFSET_RANGE : range;
+        reset();
+    }
+
+    /**
+     * Adds an offset for which the v2 checksums and the CUETools database CRC
+     * are calculated. Each offset requires one more pass over the samples
+     * in memory. Offsets must be added before any audio is delivered.
+     * @param [in] offset The offset in samples, it must be within the offset
+     *                    range.
+     */
+    void AccurateRip::add_offset(int offset)
+    {
+        if (offset > range_ || offset < -range_)
+            return;
+
+        for (size_t i = 0; i < variants_.size(); i++)
+        {
+            if (variants_[i].offset_ == offset)
+                return;
+        }
+
+        variants_.push_back(Variant());
+        variants_.back().offset_ = offset;
+        reset();
+    }
+
+    /**
+     * Adds audio to the checksums. The audio must start at the first audio
+     * track and be delivered in disc order.
+     * @param [in] data The audio data.
+     * @param [in] count The number of frames.
+     */
+    void AccurateRip::update(const unsigned char *data,ckcore::tuint32 count)
+    {
+        ckcore::tint64 num_samples = static_cast<ckcore::tint64>(count) * ckFRAME_SAMPLES;
+        if (num_samples > end_ - pos_)
+            num_samples = end_ - pos_;
+
+        if (num_samples <= 0)
+            return;
+
+        ckcore::tint64 chunk_end = pos_ + num_samples;
+
+        for (size_t i = 0; i < variants_.size(); i++)
+        {
+            Variant &variant = variants_[i];
+            int offset = variant.offset_;
+
+            for (size_t j = 0; j < tracks_.size(); j++)
+            {
+                Track &track = tracks_[j];
+
+                ckcore::tint64 first = track.first_ + offset > pos_ ? track.first_ + offset : pos_;
+                ckcore::tint64 end = track.last_ + offset + 1 < chunk_end ?
+                                     track.last_ + offset + 1 : chunk_end;
+                if (first >= end)
+                    continue;
+
+                ckcore::tuint32 total = 0;
+                sum(data + (first - pos_) * 4,static_cast<ckcore::tuint32>(end - first),
+                    static_cast<ckcore::tuint32>(first - offset - track.start_ + 1),
+                    variant.v1_[j],variant.v2_[j],total);
+
+                if (offset == 0)
+                    track.sum_ += total;
+            }
+
+            ckcore::tint64 first = ckCTDB_SKIP_SAMPLES + offset > pos_ ?
+                                   ckCTDB_SKIP_SAMPLES + offset : pos_;
+            ckcore::tint64 end = end_ - ckCTDB_SKIP_SAMPLES + offset < chunk_end ?
+                                 end_ - ckCTDB_SKIP_SAMPLES + offset : chunk_end;
+            if (first < end)
+            {
+                variant.ctdb_.update(data + (first - pos_) * 4,
+                                     static_cast<size_t>(end - first) * 4);
+            }
+        }
+
+        for (size_t i = 0; i < tracks_.size(); i++)
+        {
+            copy(data,pos_,num_samples,tracks_[i].first_ - range_,tracks_[i].head_);
+            copy(data,pos_,num_samples,tracks_[i].last_ - range_,tracks_[i].tail_);
+        }
+
+        pos_ = chunk_end;
+        if (pos_ == end_)
+            finish();
+    }
+
+    /**
+     * Receives audio from a SecureRipper.
+     * @param [in] lba The address of the first frame.
+     * @param [in] data The audio data.
+     * @param [in] count The number of frames.
+     */
+    void AccurateRip::audio(ckcore::tuint32 lba,const unsigned char *data,ckcore::tuint32 count)
+    {
+        if (lbas_.empty() ||
+            static_cast<ckcore::tint64>(lba) != lbas_[0] + pos_ / ckFRAME_SAMPLES)
+        {
+            ckcore::log::print_line(ckT("[accuraterip]: audio at %u not in disc order."),lba);
+            return;
+        }
+
+        update(data,count);
+    }
+
+    /**
+     * Checks if the audio of all tracks has been received.
+     * @return If all audio has been received true is returned, if not false
+     *         is returned.
+     */
+    bool AccurateRip::complete() const
+    {
+        return end_ > 0 && pos_ == end_;
+    }
+
+    /**
+     * Returns the v1 checksum of a track.
+     * @param [in] track The index of the track.
+     * @param [in] offset The offset in samples, it must be within the offset
+     *                    range.
+     * @param [out] crc The checksum.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool AccurateRip::v1(unsigned int track,int offset,ckcore::tuint32 &crc) const
+    {
+        if (!complete() || track >= tracks_.size() || offset > range_ || offset < -range_)
+            return false;
+
+        crc = tracks_[track].v1_[range_ + offset];
+        return true;
+    }
+
+    /**
+     * Returns the v2 checksum of a track.
+     * @param [in] track The index of the track.
+     * @param [in] offset The offset in samples, zero or an offset added
+     *                    using add_offset().
+     * @param [out] crc The checksum.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool AccurateRip::v2(unsigned int track,int offset,ckcore::tuint32 &crc) const
+    {
+        if (!complete() || track >= tracks_.size())
+            return false;
+
+        for (size_t i = 0; i < variants_.size(); i++)
+        {
+            if (variants_[i].offset_ == offset)
+            {
+                crc = variants_[i].v2_[track];
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * Returns the CUETools database CRC of the disc, the CRC-32 of all audio
+     * except the first and last ten frames.
+     * @param [in] offset The offset in samples, zero or an offset added
+     *                    using add_offset().
+     * @param [out] crc The CRC.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool AccurateRip::ctdb_crc(int offset,ckcore::tuint32 &crc) const
+    {
+        if (!complete())
+            return false;
+
+        for (size_t i = 0; i < variants_.size(); i++)
+        {
+            if (variants_[i].offset_ == offset)
+            {
+                crc = variants_[i].ctdb_.checksum();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * Returns the first AccurateRip disc identifier, the sum of all track
+     * addresses and the lead-out address.
+     * @return The disc identifier.
+     */
+    ckcore::tuint32 AccurateRip::disc_id1() const
+    {
+        ckcore::tuint32 id = leadout_;
+        for (size_t i = 0; i < lbas_.size(); i++)
+            id += lbas_[i];
+
+        return id;
+    }
+
+    /**
+     * Returns the second AccurateRip disc identifier, the sum of all track
+     * addresses multiplied by their track numbers.
+     * @return The disc identifier.
+     */
+    ckcore::tuint32 AccurateRip::disc_id2() const
+    {
+        ckcore::tuint32 id = leadout_ * static_cast<ckcore::tuint32>(lbas_.size() + 1);
+        for (size_t i = 0; i < lbas_.size(); i++)
+            id += (lbas_[i] > 0 ? lbas_[i] : 1) * static_cast<ckcore::tuint32>(i + 1);
+
+        return id;
+    }
+
+    /**
+     * Returns the CDDB disc identifier.
+     * @return The disc identifier.
+     */
+    ckcore::tuint32 AccurateRip::cddb_id() const
+    {
+        if (lbas_.empty())
+            return 0;
+
+        ckcore::tuint32 sum = 0;
+        for (size_t i = 0; i < lbas_.size(); i++)
+        {
+            for (ckcore::tuint32 sec = (lbas_[i] + 150) / 75; sec > 0; sec /= 10)
+                sum += sec % 10;
+        }
+
+        ckcore::tuint32 len = (leadout_ + 150) / 75 - (lbas_[0] + 150) / 75;
+        return ((sum % 255) << 24) | (len << 8) | static_cast<ckcore::tuint32>(lbas_.size());
+    }
+
+    /**
+     * Returns the name of the AccurateRip database file of the disc.
+     * @return The file name.
+     */
+    ckcore::tstring AccurateRip::dbar_name() const
+    {
+        ckcore::tchar name[64];
+        ckcore::convert::sprintf(name,sizeof(name),ckT("dBAR-%.3u-%.8x-%.8x-%.8x.bin"),
+                                 static_cast<ckcore::tuint32>(lbas_.size()),
+                                 disc_id1(),disc_id2(),cddb_id());
+        return name;
+    }
+
+    /**
+     * Loads the AccurateRip database file of the disc. The file consists of
+     * one or more responses, each holding a header with the track count and
+     * the disc identifiers followed by the confidence, checksum and frame
+     * 450 checksum of each track. Responses for other discs are ignored.
+     * @param [in] data The file contents.
+     * @param [in] len The size of the file in bytes.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool AccurateRip::load(const unsigned char *data,size_t len)
+    {
+        entries_.clear();
+        entries_.resize(lbas_.size());
+
+        size_t pos = 0;
+        while (pos < len)
+        {
+            if (len - pos < 13)
+                return false;
+
+            unsigned int num_tracks = data[pos];
+            ckcore::tuint32 id1 = read_le32(data + pos + 1);
+            ckcore::tuint32 id2 = read_le32(data + pos + 5);
+            ckcore::tuint32 cddb = read_le32(data + pos + 9);
+            pos += 13;
+
+            if (len - pos < num_tracks * 9)
+                return false;
+
+            bool match = num_tracks == lbas_.size() && id1 == disc_id1() &&
+                         id2 == disc_id2() && cddb == cddb_id();
+
+            for (unsigned int i = 0; i < num_tracks; i++,pos += 9)
+            {
+                if (!match)
+                    continue;
+
+                Entry entry;
+                entry.confidence_ = data[pos];
+                entry.crc_ = read_le32(data + pos + 1);
+                entry.frame450_crc_ = read_le32(data + pos + 5);
+                entries_[i].push_back(entry);
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Looks up the checksums of a track in the loaded database file. The
+     * checksums of offset zero are tried first, then the v1 checksums of
+     * all other offsets and the v2 checksums of the added offsets.
+     * @param [in] track The index of the track.
+     * @param [out] match The best match.
+     * @return If a match was found true is returned, if not false is
+     *         returned.
+     */
+    bool AccurateRip::verify(unsigned int track,Match &match) const
+    {
+        match = Match();
+        if (!complete() || track >= entries_.size())
+            return false;
+
+        const std::vector<Entry> &entries = entries_[track];
+        bool found = false;
+
+        // Offset zero.
+        ckcore::tuint32 crc_v1 = 0,crc_v2 = 0;
+        v1(track,0,crc_v1);
+        v2(track,0,crc_v2);
+
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (entries[i].crc_ != crc_v1 && entries[i].crc_ != crc_v2)
+                continue;
+
+            if (entries[i].confidence_ > match.confidence_)
+            {
+                match.offset_ = 0;
+                match.v2_ = entries[i].crc_ == crc_v2;
+                match.confidence_ = entries[i].confidence_;
+                found = true;
+            }
+        }
+
+        if (found)
+            return true;
+
+        // Other pressings.
+        for (int offset = -range_; offset <= range_; offset++)
+        {
+            if (offset == 0)
+                continue;
+
+            v1(track,offset,crc_v1);
+            bool has_v2 = v2(track,offset,crc_v2);
+
+            for (size_t i = 0; i < entries.size(); i++)
+            {
+                bool is_v2 = has_v2 && entries[i].crc_ == crc_v2;
+                if (entries[i].crc_ != crc_v1 && !is_v2)
+                    continue;
+
+                if (entries[i].confidence_ > match.confidence_)
+                {
+                    match.offset_ = offset;
+                    match.v2_ = is_v2;
+                    match.confidence_ = entries[i].confidence_;
+                    found = true;
+                }
+            }
+        }
+
+        return found;
+    }
+};
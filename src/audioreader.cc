@@ -0,0 +1,332 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <string.h>
+#include <ckcore/log.hh>
+#include "ckmmc/audioreader.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs an AudioReader object. C2 error pointers are enabled if the
+     * device supports them.
+     * @param [in] device The device to read from.
+     */
+    AudioReader::AudioReader(MmcDevice &device) : device_(device),
+        c2_(device.support(MmcDevice::ckDEVICE_C2_POINTERS)),sub_(MmcDevice::ckRCS_NONE),
+        swap_(false),
+        c2_retries_(ckDEFAULT_C2_RETRIES)
+    {
+    }
+
+    /**
+     * Destructs the AudioReader object.
+     */
+    AudioReader::~AudioReader()
+    {
+    }
+
+    /**
+     * Returns the size of the requested sub-channel data of one frame.
+     * @return The sub-channel data size in bytes.
+     */
+    ckcore::tuint32 AudioReader::sub_size() const
+    {
+        return MmcDevice::read_cd_frame_len(false,sub_) - ckFRAME_SIZE;
+    }
+
+    /**
+     * Checks if any C2 error bit is set.
+     * @param [in] c2 The C2 error bits of one frame.
+     * @return If the frame has C2 errors true is returned, if not false is
+     *         returned.
+     */
+    bool AudioReader::has_c2_errors(const unsigned char *c2)
+    {
+        for (unsigned int i = 0; i < ckC2_SIZE; i++)
+        {
+            if (c2[i] != 0)
+                return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * Copies a frame returned by READ CD into the output buffers.
+     * @param [in] frame The frame as returned by the device.
+     * @param [in] index The index of the frame in the output buffers.
+     * @param [out] audio The audio output buffer.
+     * @param [out] c2 The C2 output buffer, may be NULL.
+     * @param [out] sub The sub-channel output buffer, may be NULL.
+     */
+    void AudioReader::store(const unsigned char *frame,ckcore::tuint32 index,
+                            unsigned char *audio,unsigned char *c2,unsigned char *sub) const
+    {
+        unsigned char *audio_frame = audio + static_cast<size_t>(index) * ckFRAME_SIZE;
+        if (swap_)
+        {
+            for (unsigned int i = 0; i < ckFRAME_SIZE; i += 2)
+            {
+                audio_frame[i] = frame[i + 1];
+                audio_frame[i + 1] = frame[i];
+            }
+        }
+        else
+        {
+            memcpy(audio_frame,frame,ckFRAME_SIZE);
+        }
+
+        frame += ckFRAME_SIZE;
+        if (c2_)
+        {
+            if (c2 != NULL)
+                memcpy(c2 + static_cast<size_t>(index) * ckC2_SIZE,frame,ckC2_SIZE);
+
+            frame += ckC2_SIZE;
+        }
+
+        if (sub != NULL && sub_ != MmcDevice::ckRCS_NONE)
+            memcpy(sub + static_cast<size_t>(index) * sub_size(),frame,sub_size());
+    }
+
+    /**
+     * Reads a range of frames into the output buffers. If the range can not
+     * be read using a single command the frames are read one at a time.
+     * Frames that can not be read are zero filled with all C2 error bits set.
+     * @param [in] lba The address of the first frame.
+     * @param [in] index The index of the first frame in the output buffers.
+     * @param [in] count The number of frames, must fit the internal buffer.
+     * @param [out] audio The audio output buffer.
+     * @param [out] c2 The C2 output buffer, may be NULL.
+     * @param [out] sub The sub-channel output buffer, may be NULL.
+     * @param [out] flagged Indices of frames with C2 errors.
+     * @param [out] bad_frames Addresses of frames that could not be read.
+     */
+    void AudioReader::read_frames(ckcore::tuint32 lba,ckcore::tuint32 index,
+                                  ckcore::tuint32 count,unsigned char *audio,
+                                  unsigned char *c2,unsigned char *sub,
+                                  std::vector<ckcore::tuint32> &flagged,
+                                  std::vector<ckcore::tuint32> &bad_frames)
+    {
+        ckcore::tuint32 frame_len = MmcDevice::read_cd_frame_len(c2_,sub_);
+
+        if (device_.read_cd(lba,count,c2_,sub_,buffer_.data(),buffer_.size()))
+        {
+            for (ckcore::tuint32 i = 0; i < count; i++)
+            {
+                const unsigned char *frame = buffer_.data() + static_cast<size_t>(i) * frame_len;
+                store(frame,index + i,audio,c2,sub);
+
+                if (c2_ && has_c2_errors(frame + ckFRAME_SIZE))
+                    flagged.push_back(index + i);
+            }
+
+            return;
+        }
+
+        if (count > 1)
+        {
+            for (ckcore::tuint32 i = 0; i < count; i++)
+                read_frames(lba + i,index + i,1,audio,c2,sub,flagged,bad_frames);
+
+            return;
+        }
+
+        memset(audio + static_cast<size_t>(index) * ckFRAME_SIZE,0,ckFRAME_SIZE);
+        if (c2_ && c2 != NULL)
+            memset(c2 + static_cast<size_t>(index) * ckC2_SIZE,0xff,ckC2_SIZE);
+        if (sub != NULL && sub_ != MmcDevice::ckRCS_NONE)
+            memset(sub + static_cast<size_t>(index) * sub_size(),0,sub_size());
+
+        bad_frames.push_back(lba);
+    }
+
+    /**
+     * Enables or disables C2 error pointers.
+     * @param [in] enable Set to true to enable C2 error pointers.
+     * @return If the requested mode is supported by the device true is
+     *         returned, if not false is returned.
+     */
+    bool AudioReader::c2(bool enable)
+    {
+        if (enable && !device_.support(MmcDevice::ckDEVICE_C2_POINTERS))
+            return false;
+
+        c2_ = enable;
+        return true;
+    }
+
+    /**
+     * Checks if C2 error pointers are enabled.
+     * @return If C2 error pointers are enabled true is returned, if not
+     *         false is returned.
+     */
+    bool AudioReader::c2() const
+    {
+        return c2_;
+    }
+
+    /**
+     * Selects the sub-channel data to read along with the audio.
+     * @param [in] sub The sub-channel data.
+     */
+    void AudioReader::subchannel(MmcDevice::ReadCdSubchannel sub)
+    {
+        sub_ = sub;
+    }
+
+    /**
+     * Returns the sub-channel data read along with the audio.
+     * @return The sub-channel data.
+     */
+    MmcDevice::ReadCdSubchannel AudioReader::subchannel() const
+    {
+        return sub_;
+    }
+
+    /**
+     * Enables or disables byte swapping of audio samples. This is the only
+     * way of handling devices returning samples MSB first, no such devices
+     * are detected automatically.
+     * @param [in] swap Set to true if the device returns samples MSB first.
+     */
+    void AudioReader::byte_swap(bool swap)
+    {
+        swap_ = swap;
+    }
+
+    /**
+     * Checks if audio samples are byte swapped.
+     * @return If samples are byte swapped true is returned, if not false is
+     *         returned.
+     */
+    bool AudioReader::byte_swap() const
+    {
+        return swap_;
+    }
+
+    /**
+     * Sets how many times frames with C2 errors are read again.
+     * @param [in] retries The number of retries.
+     */
+    void AudioReader::c2_retries(unsigned int retries)
+    {
+        c2_retries_ = retries;
+    }
+
+    /**
+     * Returns how many times frames with C2 errors are read again.
+     * @return The number of retries.
+     */
+    unsigned int AudioReader::c2_retries() const
+    {
+        return c2_retries_;
+    }
+
+    /**
+     * Reads a range of audio frames.
+     * @param [in] lba The address of the first frame.
+     * @param [in] count The number of frames to read.
+     * @param [out] audio Buffer receiving count * ckFRAME_SIZE bytes of audio.
+     * @param [out] c2 Buffer receiving count * ckC2_SIZE bytes of C2 error
+     *                 bits, may be NULL. Only written if C2 error pointers
+     *                 are enabled.
+     * @param [out] sub Buffer receiving the sub-channel data of each frame,
+     *                  may be NULL. Only written if sub-channel data is
+     *                  selected.
+     * @param [out] bad_frames Addresses of frames that could not be read or
+     *                         still had C2 errors after all retries.
+     * @return If all frames were read without errors true is returned, if
+     *         not false is returned.
+     */
+    bool AudioReader::read(ckcore::tuint32 lba,ckcore::tuint32 count,unsigned char *audio,
+                           unsigned char *c2,unsigned char *sub,
+                           std::vector<ckcore::tuint32> &bad_frames)
+    {
+        bad_frames.clear();
+
+        ckcore::tuint32 frame_len = MmcDevice::read_cd_frame_len(c2_,sub_);
+        ckcore::tuint32 max_frames = device_.transfer_len() / frame_len;
+        if (max_frames == 0)
+            max_frames = 1;
+
+        if (buffer_.size() < max_frames * frame_len && !buffer_.allocate(max_frames * frame_len))
+            return false;
+
+        std::vector<ckcore::tuint32> flagged;
+        for (ckcore::tuint32 pos = 0; pos < count; pos += max_frames)
+        {
+            ckcore::tuint32 num_frames = count - pos < max_frames ? count - pos : max_frames;
+            read_frames(lba + pos,pos,num_frames,audio,c2,sub,flagged,bad_frames);
+        }
+
+        // Read runs of consecutive frames with C2 errors again, keeping the
+        // frames that are read without errors.
+        for (unsigned int retry = 0; retry < c2_retries_ && !flagged.empty(); retry++)
+        {
+            std::vector<ckcore::tuint32> remaining;
+
+            size_t i = 0;
+            while (i < flagged.size())
+            {
+                size_t j = i + 1;
+                while (j < flagged.size() && flagged[j] == flagged[j - 1] + 1 &&
+                       j - i < max_frames)
+                {
+                    j++;
+                }
+
+                ckcore::tuint32 num_frames = static_cast<ckcore::tuint32>(j - i);
+                if (device_.read_cd(lba + flagged[i],num_frames,c2_,sub_,buffer_.data(),buffer_.size()))
+                {
+                    for (ckcore::tuint32 k = 0; k < num_frames; k++)
+                    {
+                        const unsigned char *frame = buffer_.data() + static_cast<size_t>(k) * frame_len;
+                        if (has_c2_errors(frame + ckFRAME_SIZE))
+                            remaining.push_back(flagged[i + k]);
+                        else
+                            store(frame,flagged[i + k],audio,c2,sub);
+                    }
+                }
+                else
+                {
+                    remaining.insert(remaining.end(),flagged.begin() + i,flagged.begin() + j);
+                }
+
+                i = j;
+            }
+
+            flagged.swap(remaining);
+        }
+
+        for (size_t i = 0; i < flagged.size(); i++)
+            bad_frames.push_back(lba + flagged[i]);
+
+        std::sort(bad_frames.begin(),bad_frames.end());
+
+        if (!bad_frames.empty())
+        {
+            ckcore::log::print_line(ckT("[audioreader]: %u frames could not be read without errors."),
+                                    static_cast<ckcore::tuint32>(bad_frames.size()));
+        }
+
+        return bad_frames.empty();
+    }
+};
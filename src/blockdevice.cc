@@ -0,0 +1,232 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <ckcore/log.hh>
+#include "ckmmc/blockdevice.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs a closed BlockDevice object.
+     */
+    BlockDevice::BlockDevice()
+    {
+#ifdef _WINDOWS
+        handle_ = INVALID_HANDLE_VALUE;
+        for (unsigned int i = 0; i < ckMAX_IN_FLIGHT; i++)
+            events_[i] = NULL;
+#else
+        fd_ = -1;
+#endif
+    }
+
+    /**
+     * Destructs the BlockDevice object.
+     */
+    BlockDevice::~BlockDevice()
+    {
+        close();
+    }
+
+    /**
+     * Opens the block device of a SCSI device.
+     * @param [in] addr The SCSI device address. The address must contain
+     *                  the device name.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool BlockDevice::open(const ScsiDevice::Address &addr)
+    {
+        close();
+
+        if (addr.device_.empty())
+            return false;
+
+#ifdef _WINDOWS
+        ckcore::tchar drive_str[7];
+        lstrcpy(drive_str,ckT("\\\\.\\X:"));
+        drive_str[4] = addr.device_[0];
+
+        handle_ = CreateFile(drive_str,GENERIC_READ,FILE_SHARE_READ | FILE_SHARE_WRITE,NULL,
+                             OPEN_EXISTING,FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED,NULL);
+        if (handle_ == INVALID_HANDLE_VALUE)
+            return false;
+
+        for (unsigned int i = 0; i < ckMAX_IN_FLIGHT; i++)
+        {
+            events_[i] = CreateEvent(NULL,TRUE,FALSE,NULL);
+            if (events_[i] == NULL)
+            {
+                close();
+                return false;
+            }
+        }
+#else
+        int flags = O_RDONLY;
+#ifdef O_DIRECT
+        flags |= O_DIRECT;
+#endif
+        fd_ = ::open(addr.device_.c_str(),flags);
+        if (fd_ == -1)
+            return false;
+#endif
+        return true;
+    }
+
+    /**
+     * Closes the block device.
+     */
+    void BlockDevice::close()
+    {
+#ifdef _WINDOWS
+        for (unsigned int i = 0; i < ckMAX_IN_FLIGHT; i++)
+        {
+            if (events_[i] != NULL)
+            {
+                CloseHandle(events_[i]);
+                events_[i] = NULL;
+            }
+        }
+
+        if (handle_ != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(handle_);
+            handle_ = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (fd_ != -1)
+        {
+            ::close(fd_);
+            fd_ = -1;
+        }
+#endif
+    }
+
+    /**
+     * Checks if the block device is open.
+     * @return If the device is open true is returned, if not false is
+     *         returned.
+     */
+    bool BlockDevice::is_open() const
+    {
+#ifdef _WINDOWS
+        return handle_ != INVALID_HANDLE_VALUE;
+#else
+        return fd_ != -1;
+#endif
+    }
+
+    /**
+     * Reads 2048 byte sectors from the block device. The range is split into
+     * requests of the specified length, up to ckMAX_IN_FLIGHT of which are
+     * issued before waiting for the oldest one to complete.
+     * @param [in] lba The first sector to read.
+     * @param [in] count The number of sectors to read.
+     * @param [out] buffer The buffer to which the sectors will be written,
+     *                     must be aligned to the sector size.
+     * @param [in] chunk_len The number of bytes to read in each request, must
+     *                       be a multiple of the sector size.
+     * @return If all sectors were read true is returned, if not false is
+     *         returned.
+     */
+    bool BlockDevice::read(ckcore::tuint32 lba,ckcore::tuint32 count,
+                           unsigned char *buffer,ckcore::tuint32 chunk_len)
+    {
+        if (!is_open() || (reinterpret_cast<size_t>(buffer) & (ckSECTOR_SIZE - 1)) != 0)
+            return false;
+
+        ckcore::tuint32 chunk_blocks = chunk_len / ckSECTOR_SIZE;
+        if (chunk_blocks == 0)
+            chunk_blocks = 1;
+
+        ckcore::tuint32 num_chunks = (count + chunk_blocks - 1) / chunk_blocks;
+
+#ifdef _WINDOWS
+        OVERLAPPED overlapped[ckMAX_IN_FLIGHT];
+        DWORD lengths[ckMAX_IN_FLIGHT];
+
+        bool res = true;
+        ckcore::tuint32 issued = 0,completed = 0;
+        while (completed < num_chunks)
+        {
+            // Keep the queue filled.
+            while (res && issued < num_chunks && issued - completed < ckMAX_IN_FLIGHT)
+            {
+                unsigned int slot = issued % ckMAX_IN_FLIGHT;
+                ckcore::tuint32 first = issued * chunk_blocks;
+                ckcore::tuint32 num_blocks = count - first < chunk_blocks ? count - first : chunk_blocks;
+                ckcore::tuint64 offset = (static_cast<ckcore::tuint64>(lba) + first) * ckSECTOR_SIZE;
+
+                memset(&overlapped[slot],0,sizeof(OVERLAPPED));
+                overlapped[slot].Offset = static_cast<DWORD>(offset & 0xffffffff);
+                overlapped[slot].OffsetHigh = static_cast<DWORD>(offset >> 32);
+                overlapped[slot].hEvent = events_[slot];
+                lengths[slot] = num_blocks * ckSECTOR_SIZE;
+
+                if (!ReadFile(handle_,buffer + static_cast<size_t>(first) * ckSECTOR_SIZE,
+                              lengths[slot],NULL,&overlapped[slot]) &&
+                    GetLastError() != ERROR_IO_PENDING)
+                {
+                    ckcore::log::print_line(ckT("[blockdevice]: ReadFile failed (%d)."),GetLastError());
+                    res = false;
+                    break;
+                }
+
+                issued++;
+            }
+
+            if (completed == issued)
+                break;
+
+            // Wait for the oldest request.
+            unsigned int slot = completed % ckMAX_IN_FLIGHT;
+            DWORD read = 0;
+            if (!GetOverlappedResult(handle_,&overlapped[slot],&read,TRUE) ||
+                read != lengths[slot])
+            {
+                // Cancel the remaining requests, they must still be waited
+                // for since they refer to the stack allocated structures.
+                if (res)
+                    CancelIo(handle_);
+                res = false;
+            }
+
+            completed++;
+        }
+
+        return res;
+#else
+        for (ckcore::tuint32 i = 0; i < num_chunks; i++)
+        {
+            ckcore::tuint32 first = i * chunk_blocks;
+            ckcore::tuint32 num_blocks = count - first < chunk_blocks ? count - first : chunk_blocks;
+            size_t len = static_cast<size_t>(num_blocks) * ckSECTOR_SIZE;
+
+            ssize_t read = pread(fd_,buffer + static_cast<size_t>(first) * ckSECTOR_SIZE,len,
+                                 static_cast<off_t>((static_cast<ckcore::tuint64>(lba) + first) * ckSECTOR_SIZE));
+            if (read != static_cast<ssize_t>(len))
+                return false;
+        }
+
+        return true;
+#endif
+    }
+};
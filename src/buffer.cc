@@ -0,0 +1,131 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef _WINDOWS
+#include <windows.h>
+#else
+#include <stdlib.h>
+#endif
+#include "ckmmc/buffer.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs an empty AlignedBuffer object.
+     */
+    AlignedBuffer::AlignedBuffer() : data_(NULL),block_(NULL),size_(0)
+    {
+    }
+
+    /**
+     * Constructs an AlignedBuffer object and allocates memory for it. If the
+     * allocation fails the buffer will be empty.
+     * @param [in] size The buffer size in bytes.
+     */
+    AlignedBuffer::AlignedBuffer(ckcore::tuint32 size) :
+        data_(NULL),block_(NULL),size_(0)
+    {
+        allocate(size);
+    }
+
+    /**
+     * Destructs the AlignedBuffer object.
+     */
+    AlignedBuffer::~AlignedBuffer()
+    {
+        free();
+    }
+
+    /**
+     * Allocates memory for the buffer. Any previously allocated memory will
+     * be released.
+     * @param [in] size The buffer size in bytes.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool AlignedBuffer::allocate(ckcore::tuint32 size)
+    {
+        free();
+
+        if (size == 0)
+            return true;
+
+#ifdef _WINDOWS
+        // Memory returned by VirtualAlloc is always page aligned.
+        block_ = VirtualAlloc(NULL,size,MEM_COMMIT | MEM_RESERVE,PAGE_READWRITE);
+        if (block_ == NULL)
+            return false;
+
+        data_ = static_cast<unsigned char *>(block_);
+#else
+        block_ = malloc(size + ckBUFFER_ALIGNMENT - 1);
+        if (block_ == NULL)
+            return false;
+
+        size_t addr = reinterpret_cast<size_t>(block_);
+        addr = (addr + ckBUFFER_ALIGNMENT - 1) & ~static_cast<size_t>(ckBUFFER_ALIGNMENT - 1);
+        data_ = reinterpret_cast<unsigned char *>(addr);
+#endif
+        size_ = size;
+        return true;
+    }
+
+    /**
+     * Releases the memory of the buffer.
+     */
+    void AlignedBuffer::free()
+    {
+        if (block_ == NULL)
+            return;
+
+#ifdef _WINDOWS
+        VirtualFree(block_,0,MEM_RELEASE);
+#else
+        ::free(block_);
+#endif
+        data_ = NULL;
+        block_ = NULL;
+        size_ = 0;
+    }
+
+    /**
+     * Returns a pointer to the buffer data.
+     * @return Pointer to the buffer data, NULL if the buffer is empty.
+     */
+    unsigned char *AlignedBuffer::data()
+    {
+        return data_;
+    }
+
+    /**
+     * Returns a pointer to the buffer data.
+     * @return Pointer to the buffer data, NULL if the buffer is empty.
+     */
+    const unsigned char *AlignedBuffer::data() const
+    {
+        return data_;
+    }
+
+    /**
+     * Returns the size of the buffer.
+     * @return The buffer size in bytes.
+     */
+    ckcore::tuint32 AlignedBuffer::size() const
+    {
+        return size_;
+    }
+};
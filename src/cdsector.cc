@@ -0,0 +1,707 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "ckmmc/simd.hh"
+#include "ckmmc/cdsector.hh"
+
+// The P and Q codes operate on the 2340 bytes following the sync pattern.
+#define CK_MMC_ECC_OFFSET       12
+#define CK_MMC_ECC_SIZE         2340
+#define CK_MMC_P_OFFSET         2064    // Relative to the ECC offset.
+#define CK_MMC_Q_OFFSET         2236    // Relative to the ECC offset.
+#define CK_MMC_P_COLUMNS        86
+#define CK_MMC_P_ROWS           24
+#define CK_MMC_Q_DIAGONALS      52
+#define CK_MMC_Q_LENGTH         43
+
+namespace ckmmc
+{
+    /**
+     * @brief CD-ROM code table class.
+     * Tables for the slice-by-8 EDC calculation and the GF(2^8) arithmetic
+     * of the P and Q codes, generated once when the library is loaded.
+     */
+    class CdSectorTables
+    {
+    public:
+        ckcore::tuint32 edc_[8][256];
+        unsigned char mul2_[256];       // Multiplication by alpha.
+        unsigned char div3_[256];       // Division by alpha + 1.
+        unsigned char exp_[512];
+        unsigned char log_[256];
+        unsigned char scramble_[CK_MMC_ECC_SIZE];
+
+        CdSectorTables()
+        {
+            for (ckcore::tuint32 i = 0; i < 256; i++)
+            {
+                ckcore::tuint32 edc = i;
+                for (int j = 0; j < 8; j++)
+                    edc = (edc >> 1) ^ ((edc & 1) ? 0xd8018001 : 0);
+
+                edc_[0][i] = edc;
+            }
+
+            for (ckcore::tuint32 i = 0; i < 256; i++)
+            {
+                for (int j = 1; j < 8; j++)
+                    edc_[j][i] = (edc_[j - 1][i] >> 8) ^ edc_[0][edc_[j - 1][i] & 0xff];
+            }
+
+            // The field is generated by x^8 + x^4 + x^3 + x^2 + 1.
+            for (unsigned int i = 0; i < 256; i++)
+            {
+                mul2_[i] = static_cast<unsigned char>((i << 1) ^ ((i & 0x80) ? 0x11d : 0));
+                div3_[i ^ mul2_[i]] = static_cast<unsigned char>(i);
+            }
+
+            unsigned int value = 1;
+            for (unsigned int i = 0; i < 255; i++)
+            {
+                exp_[i] = exp_[i + 255] = static_cast<unsigned char>(value);
+                log_[value] = static_cast<unsigned char>(i);
+                value = mul2_[value];
+            }
+
+            exp_[510] = exp_[511] = 0;
+            log_[0] = 0;
+
+            // The scrambler is a 15-bit shift register using x^15 + x + 1,
+            // loaded with 1 at the start of each sector.
+            ckcore::tuint32 reg = 1;
+            for (unsigned int i = 0; i < CK_MMC_ECC_SIZE; i++)
+            {
+                unsigned char value = 0;
+                for (int j = 0; j < 8; j++)
+                {
+                    value |= static_cast<unsigned char>((reg & 1) << j);
+
+                    ckcore::tuint32 feedback = (reg ^ (reg >> 1)) & 1;
+                    reg = (reg >> 1) | (feedback << 14);
+                }
+
+                scramble_[i] = value;
+            }
+        }
+    };
+
+    static const CdSectorTables tables;
+
+    static const unsigned char sync_pattern[12] =
+    {
+        0x00,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0x00
+    };
+
+    /**
+     * Calculates the parity bytes of a set of interleaved Reed-Solomon
+     * codewords.
+     * @param [in] data The data covered by the code.
+     * @param [in] major_count The number of codewords.
+     * @param [in] minor_count The number of data bytes in each codeword.
+     * @param [in] major_mult The distance between pairs of codewords.
+     * @param [in] minor_inc The distance between bytes in a codeword.
+     * @param [out] parity Receives the first parity byte of each codeword,
+     *                     followed by the second parity byte of each
+     *                     codeword.
+     */
+    static void ecc_block(const unsigned char *data,unsigned int major_count,
+                          unsigned int minor_count,unsigned int major_mult,
+                          unsigned int minor_inc,unsigned char *parity)
+    {
+        unsigned int size = major_count * minor_count;
+
+        for (unsigned int major = 0; major < major_count; major++)
+        {
+            unsigned int index = (major >> 1) * major_mult + (major & 1);
+
+            unsigned char a = 0,b = 0;
+            for (unsigned int minor = 0; minor < minor_count; minor++)
+            {
+                unsigned char value = data[index];
+                index += minor_inc;
+                if (index >= size)
+                    index -= size;
+
+                a = tables.mul2_[a ^ value];
+                b ^= value;
+            }
+
+            a = tables.div3_[tables.mul2_[a] ^ b];
+            parity[major] = a;
+            parity[major + major_count] = a ^ b;
+        }
+    }
+
+    /**
+     * Calculates the P parity bytes. The P codewords are the columns of the
+     * 24 rows of 86 bytes, all columns are calculated in parallel.
+     * @param [in] data The data covered by the code.
+     * @param [out] parity Receives the two parity rows.
+     */
+    static void ecc_p(const unsigned char *data,unsigned char *parity)
+    {
+        unsigned char a[CK_MMC_P_COLUMNS],b[CK_MMC_P_COLUMNS];
+        unsigned int col = 0;
+
+#ifdef CK_MMC_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i poly = _mm_set1_epi8(0x1d);
+
+        for (; col + 16 <= CK_MMC_P_COLUMNS; col += 16)
+        {
+            __m128i va = zero,vb = zero;
+            for (unsigned int row = 0; row < CK_MMC_P_ROWS; row++)
+            {
+                __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+                    data + row * CK_MMC_P_COLUMNS + col));
+
+                // Multiply by alpha, reducing bytes with the high bit set.
+                va = _mm_xor_si128(va,value);
+                __m128i carry = _mm_and_si128(_mm_cmpgt_epi8(zero,va),poly);
+                va = _mm_xor_si128(_mm_add_epi8(va,va),carry);
+                vb = _mm_xor_si128(vb,value);
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(a + col),va);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(b + col),vb);
+        }
+#endif
+        for (; col < CK_MMC_P_COLUMNS; col++)
+        {
+            unsigned char va = 0,vb = 0;
+            for (unsigned int row = 0; row < CK_MMC_P_ROWS; row++)
+            {
+                unsigned char value = data[row * CK_MMC_P_COLUMNS + col];
+                va = tables.mul2_[va ^ value];
+                vb ^= value;
+            }
+
+            a[col] = va;
+            b[col] = vb;
+        }
+
+        for (col = 0; col < CK_MMC_P_COLUMNS; col++)
+        {
+            unsigned char p = tables.div3_[tables.mul2_[a[col]] ^ b[col]];
+            parity[col] = p;
+            parity[col + CK_MMC_P_COLUMNS] = p ^ b[col];
+        }
+    }
+
+    /**
+     * Corrects single byte errors in a set of interleaved Reed-Solomon
+     * codewords. The codewords are laid out as by ecc_block() with the two
+     * parity bytes appended.
+     * @param [in,out] data The data covered by the code.
+     * @param [in,out] parity The parity bytes.
+     * @param [in] major_count The number of codewords.
+     * @param [in] minor_count The number of data bytes in each codeword.
+     * @param [in] major_mult The distance between pairs of codewords.
+     * @param [in] minor_inc The distance between bytes in a codeword.
+     * @param [out] failed Set to true if a codeword has more than one error.
+     * @return The number of corrected bytes.
+     */
+    static unsigned int ecc_block_correct(unsigned char *data,unsigned char *parity,
+                                          unsigned int major_count,unsigned int minor_count,
+                                          unsigned int major_mult,unsigned int minor_inc,
+                                          bool &failed)
+    {
+        unsigned int size = major_count * minor_count;
+        unsigned int length = minor_count + 2;
+        unsigned int corrected = 0;
+
+        for (unsigned int major = 0; major < major_count; major++)
+        {
+            // The syndromes are the sum of the bytes and the sum of the bytes
+            // weighted by alpha^(length - 1 - i).
+            unsigned char s0 = 0,s1 = 0;
+
+            unsigned int index = (major >> 1) * major_mult + (major & 1);
+            for (unsigned int minor = 0; minor < minor_count; minor++)
+            {
+                s0 ^= data[index];
+                s1 = tables.mul2_[s1] ^ data[index];
+
+                index += minor_inc;
+                if (index >= size)
+                    index -= size;
+            }
+
+            s0 ^= parity[major] ^ parity[major + major_count];
+            s1 = tables.mul2_[tables.mul2_[s1] ^ parity[major]] ^ parity[major + major_count];
+
+            if (s0 == 0 && s1 == 0)
+                continue;
+
+            if (s0 == 0 || s1 == 0)
+            {
+                failed = true;
+                continue;
+            }
+
+            // A single error e at position j gives s0 = e and
+            // s1 = e * alpha^(length - 1 - j).
+            unsigned int power = (tables.log_[s1] + 255 - tables.log_[s0]) % 255;
+            if (power >= length)
+            {
+                failed = true;
+                continue;
+            }
+
+            unsigned int pos = length - 1 - power;
+            if (pos == minor_count)
+            {
+                parity[major] ^= s0;
+            }
+            else if (pos == minor_count + 1)
+            {
+                parity[major + major_count] ^= s0;
+            }
+            else
+            {
+                index = ((major >> 1) * major_mult + (major & 1) + pos * minor_inc) % size;
+                data[index] ^= s0;
+            }
+
+            corrected++;
+        }
+
+        return corrected;
+    }
+
+    /**
+     * Calculates the BCD encoded MSF address stored in a sector header.
+     * @param [in] lba The logical address of the sector.
+     * @param [out] addr Receives the three address bytes.
+     */
+    static void header_addr(ckcore::tuint32 lba,unsigned char *addr)
+    {
+        lba += 150;
+        unsigned char min = static_cast<unsigned char>(lba / (60 * 75));
+        unsigned char sec = static_cast<unsigned char>((lba / 75) % 60);
+        unsigned char frame = static_cast<unsigned char>(lba % 75);
+
+        addr[0] = static_cast<unsigned char>(((min / 10) << 4) | (min % 10));
+        addr[1] = static_cast<unsigned char>(((sec / 10) << 4) | (sec % 10));
+        addr[2] = static_cast<unsigned char>(((frame / 10) << 4) | (frame % 10));
+    }
+
+    /**
+     * Writes the sync pattern and header of a sector.
+     * @param [out] sector The sector.
+     * @param [in] lba The logical address of the sector.
+     * @param [in] mode The sector mode.
+     */
+    void CdSector::header(unsigned char *sector,ckcore::tuint32 lba,unsigned char mode)
+    {
+        memcpy(sector,sync_pattern,sizeof(sync_pattern));
+
+        header_addr(lba,sector + 12);
+        sector[15] = mode;
+    }
+
+    /**
+     * Calculates the P and Q parity of a sector.
+     * @param [in,out] sector The sector.
+     */
+    void CdSector::ecc_encode(unsigned char *sector)
+    {
+        unsigned char *data = sector + CK_MMC_ECC_OFFSET;
+
+        ecc_p(data,data + CK_MMC_P_OFFSET);
+        ecc_block(data,CK_MMC_Q_DIAGONALS,CK_MMC_Q_LENGTH,CK_MMC_P_COLUMNS,
+                  CK_MMC_P_COLUMNS + 2,data + CK_MMC_Q_OFFSET);
+    }
+
+    /**
+     * Corrects the P and Q codewords of a sector. The P and Q codes are
+     * applied alternately since each may correct the errors the other
+     * could not.
+     * @param [in,out] sector The sector.
+     * @param [out] failed Set to true if errors remain.
+     * @return The number of corrected bytes.
+     */
+    unsigned int CdSector::ecc_correct(unsigned char *sector,bool &failed)
+    {
+        unsigned char *data = sector + CK_MMC_ECC_OFFSET;
+        unsigned int corrected = 0;
+
+        for (unsigned int round = 0; round < ckCORRECT_ROUNDS; round++)
+        {
+            failed = false;
+
+            unsigned int fixed = ecc_block_correct(data,data + CK_MMC_P_OFFSET,CK_MMC_P_COLUMNS,
+                                                   CK_MMC_P_ROWS,2,CK_MMC_P_COLUMNS,failed);
+            fixed += ecc_block_correct(data,data + CK_MMC_Q_OFFSET,CK_MMC_Q_DIAGONALS,
+                                       CK_MMC_Q_LENGTH,CK_MMC_P_COLUMNS,CK_MMC_P_COLUMNS + 2,
+                                       failed);
+
+            corrected += fixed;
+            if (fixed == 0)
+                break;
+        }
+
+        return corrected;
+    }
+
+    /**
+     * Calculates the EDC of a block of data. The EDC is a 32-bit CRC using
+     * the polynomial (x^16 + x^15 + x^2 + 1)(x^16 + x^2 + x + 1), calculated
+     * eight bytes at a time.
+     * @param [in] data The data.
+     * @param [in] len The number of bytes.
+     * @return The EDC.
+     */
+    ckcore::tuint32 CdSector::edc(const unsigned char *data,size_t len)
+    {
+        const ckcore::tuint32 (*t)[256] = tables.edc_;
+        ckcore::tuint32 edc = 0;
+
+        for (; len >= 8; len -= 8, data += 8)
+        {
+            ckcore::tuint32 lo = edc ^ (data[0] | data[1] << 8 | data[2] << 16 |
+                                        static_cast<ckcore::tuint32>(data[3]) << 24);
+            edc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+                  t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+                  t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+        }
+
+        while (len-- > 0)
+            edc = (edc >> 8) ^ t[0][(edc ^ *data++) & 0xff];
+
+        return edc;
+    }
+
+    /**
+     * Scrambles or descrambles a raw sector, the operation is its own
+     * inverse. Everything but the sync pattern is scrambled.
+     * @param [in,out] sector The sector.
+     */
+    void CdSector::scramble(unsigned char *sector)
+    {
+        unsigned char *data = sector + CK_MMC_ECC_OFFSET;
+        const unsigned char *table = tables.scramble_;
+        unsigned int i = 0;
+
+#ifdef CK_MMC_SSE2
+        for (; i + 16 <= CK_MMC_ECC_SIZE; i += 16)
+        {
+            __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            __m128i key = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i),_mm_xor_si128(value,key));
+        }
+#endif
+        for (; i < CK_MMC_ECC_SIZE; i++)
+            data[i] ^= table[i];
+    }
+
+    /**
+     * Writes a little endian 32-bit integer.
+     * @param [in] value The value.
+     * @param [out] buffer The buffer to write to.
+     */
+    static void write_edc(ckcore::tuint32 value,unsigned char *buffer)
+    {
+        buffer[0] = static_cast<unsigned char>(value & 0xff);
+        buffer[1] = static_cast<unsigned char>((value >> 8) & 0xff);
+        buffer[2] = static_cast<unsigned char>((value >> 16) & 0xff);
+        buffer[3] = static_cast<unsigned char>((value >> 24) & 0xff);
+    }
+
+    /**
+     * Reads a little endian 32-bit integer.
+     * @param [in] buffer The buffer to read from.
+     * @return The value.
+     */
+    static ckcore::tuint32 read_edc(const unsigned char *buffer)
+    {
+        return static_cast<ckcore::tuint32>(buffer[0]) |
+               (static_cast<ckcore::tuint32>(buffer[1]) << 8) |
+               (static_cast<ckcore::tuint32>(buffer[2]) << 16) |
+               (static_cast<ckcore::tuint32>(buffer[3]) << 24);
+    }
+
+    /**
+     * Builds a raw Mode 1 sector. The sync pattern, header, EDC and ECC are
+     * written around the user data.
+     * @param [in,out] sector The sector, the 2048 bytes of user data must be
+     *                        stored at ckDATA_OFFSET.
+     * @param [in] lba The logical address of the sector.
+     */
+    void CdSector::encode_mode1(unsigned char *sector,ckcore::tuint32 lba)
+    {
+        header(sector,lba,1);
+
+        write_edc(edc(sector,2064),sector + 2064);
+        memset(sector + 2068,0,8);
+
+        ecc_encode(sector);
+    }
+
+    /**
+     * Builds a raw Mode 2 Form 1 sector. The header is not covered by the
+     * ECC in Mode 2 and is treated as zero when calculating it.
+     * @param [in,out] sector The sector, the sub-header must be stored at
+     *                        ckSUBHEADER_OFFSET and the 2048 bytes of user
+     *                        data at ckMODE2_DATA_OFFSET.
+     * @param [in] lba The logical address of the sector.
+     */
+    void CdSector::encode_mode2_form1(unsigned char *sector,ckcore::tuint32 lba)
+    {
+        header(sector,lba,2);
+
+        write_edc(edc(sector + 16,2056),sector + 2072);
+
+        unsigned char addr[4];
+        memcpy(addr,sector + 12,4);
+        memset(sector + 12,0,4);
+        ecc_encode(sector);
+        memcpy(sector + 12,addr,4);
+    }
+
+    /**
+     * Builds a raw Mode 2 Form 2 sector. Form 2 sectors have no ECC.
+     * @param [in,out] sector The sector, the sub-header must be stored at
+     *                        ckSUBHEADER_OFFSET and the 2324 bytes of user
+     *                        data at ckMODE2_DATA_OFFSET.
+     * @param [in] lba The logical address of the sector.
+     */
+    void CdSector::encode_mode2_form2(unsigned char *sector,ckcore::tuint32 lba)
+    {
+        header(sector,lba,2);
+
+        write_edc(edc(sector + 16,2332),sector + 2348);
+    }
+
+    /**
+     * Determines the type of a raw sector from its header and sub-header.
+     * @param [in] sector The sector.
+     * @return The sector type.
+     */
+    CdSector::Type CdSector::type(const unsigned char *sector)
+    {
+        if (memcmp(sector,sync_pattern,sizeof(sync_pattern)) != 0)
+            return ckTYPE_UNKNOWN;
+
+        switch (sector[15])
+        {
+            case 1:
+                return ckTYPE_MODE1;
+
+            case 2:
+                // Check the form bit of the sub-mode byte.
+                return (sector[18] & 0x20) ? ckTYPE_MODE2_FORM2 : ckTYPE_MODE2_FORM1;
+
+            default:
+                return ckTYPE_UNKNOWN;
+        }
+    }
+
+    /**
+     * Verifies the EDC of a raw sector.
+     * @param [in] sector The sector.
+     * @return If the sector is intact true is returned, if not false is
+     *         returned.
+     */
+    bool CdSector::check(const unsigned char *sector)
+    {
+        switch (type(sector))
+        {
+            case ckTYPE_MODE1:
+                return edc(sector,2064) == read_edc(sector + 2064);
+
+            case ckTYPE_MODE2_FORM1:
+                return edc(sector + 16,2056) == read_edc(sector + 2072);
+
+            case ckTYPE_MODE2_FORM2:
+                // The EDC is optional in Form 2 sectors.
+                return read_edc(sector + 2348) == 0 ||
+                       edc(sector + 16,2332) == read_edc(sector + 2348);
+
+            default:
+                return false;
+        }
+    }
+
+    /**
+     * Repairs a raw sector using the P and Q codes. Each codeword can
+     * correct a single byte, bytes the P code can not correct may be
+     * corrected by the Q code and the other way around. The parity bytes are
+     * repaired as well, after which the result is verified using the EDC.
+     * @param [in,out] sector The sector.
+     * @return If the sector is intact or was repaired true is returned, if
+     *         not false is returned and the sector should be read again.
+     */
+    bool CdSector::correct(unsigned char *sector)
+    {
+        bool failed = false;
+
+        switch (type(sector))
+        {
+            case ckTYPE_MODE1:
+                ecc_correct(sector,failed);
+                break;
+
+            case ckTYPE_MODE2_FORM1:
+            {
+                unsigned char addr[4];
+                memcpy(addr,sector + 12,4);
+                memset(sector + 12,0,4);
+                ecc_correct(sector,failed);
+                memcpy(sector + 12,addr,4);
+                break;
+            }
+
+            case ckTYPE_MODE2_FORM2:
+                return check(sector);
+
+            default:
+                return false;
+        }
+
+        return !failed && check(sector);
+    }
+
+    /**
+     * Converts a batch of raw sectors to cooked sectors in place. Each
+     * sector is descrambled if necessary, its sync pattern, address and mode
+     * are validated and the part selected by the data block type is moved
+     * to the front of the buffer. Sectors failing validation are converted
+     * anyway but reported to the caller.
+     * @param [in,out] buffer The raw sectors, receives the cooked sectors
+     *                        stored back to back.
+     * @param [in] count The number of sectors.
+     * @param [in] stride The size of each raw sector, at least
+     *                    ckSECTOR_SIZE. Any sub-channel data following the
+     *                    sector is discarded.
+     * @param [in] lba The logical address of the first sector.
+     * @param [in] scrambled Set to true if the sectors must be descrambled.
+     * @param [in] block The cooked data block type.
+     * @param [out] invalid Receives the indices of the sectors that failed
+     *                      validation.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool CdSector::cook(unsigned char *buffer,ckcore::tuint32 count,
+                        ckcore::tuint32 stride,ckcore::tuint32 lba,bool scrambled,
+                        ScsiModePage05::DataBlock block,
+                        std::vector<ckcore::tuint32> &invalid)
+    {
+        if (stride < ckSECTOR_SIZE)
+            return false;
+
+        size_t offset = 0,size = 0;
+        switch (block)
+        {
+            case ScsiModePage05::ckDB_RAW_2352:
+            case ScsiModePage05::ckDB_RAW_2352_PQ:
+            case ScsiModePage05::ckDB_RAW_2352_PW_PACK:
+            case ScsiModePage05::ckDB_RAW_2352_PW:
+                offset = 0;
+                size = ckSECTOR_SIZE;
+                break;
+
+            case ScsiModePage05::ckDB_MODE_1_2048:
+                offset = ckDATA_OFFSET;
+                size = ckMODE1_DATA_SIZE;
+                break;
+
+            case ScsiModePage05::ckDB_MODE_2_2336:
+                offset = ckDATA_OFFSET;
+                size = 2336;
+                break;
+
+            case ScsiModePage05::ckDB_MODE_2_XA_FORM_1_2048:
+                offset = ckMODE2_DATA_OFFSET;
+                size = ckMODE2_FORM1_DATA_SIZE;
+                break;
+
+            case ScsiModePage05::ckDB_MODE_2_XA_FORM_1_2056:
+                offset = ckSUBHEADER_OFFSET;
+                size = ckMODE2_FORM1_DATA_SIZE + 8;
+                break;
+
+            case ScsiModePage05::ckDB_MODE_2_XA_FORM_2_2324:
+                offset = ckMODE2_DATA_OFFSET;
+                size = ckMODE2_FORM2_DATA_SIZE;
+                break;
+
+            case ScsiModePage05::ckDB_MODE_2_XA_MIXED_2332:
+                offset = ckSUBHEADER_OFFSET;
+                size = ckMODE2_FORM2_DATA_SIZE + 8;
+                break;
+
+            default:
+                return false;
+        }
+
+        unsigned char *dst = buffer;
+        for (ckcore::tuint32 i = 0; i < count; i++)
+        {
+            unsigned char *sector = buffer + static_cast<size_t>(i) * stride;
+            if (scrambled)
+                scramble(sector);
+
+            unsigned char addr[3];
+            header_addr(lba + i,addr);
+
+            bool valid = memcmp(sector,sync_pattern,sizeof(sync_pattern)) == 0 &&
+                         memcmp(sector + 12,addr,sizeof(addr)) == 0;
+            if (valid)
+            {
+                Type sector_type = type(sector);
+                switch (block)
+                {
+                    case ScsiModePage05::ckDB_MODE_1_2048:
+                        valid = sector_type == ckTYPE_MODE1;
+                        break;
+
+                    case ScsiModePage05::ckDB_MODE_2_2336:
+                    case ScsiModePage05::ckDB_MODE_2_XA_MIXED_2332:
+                        valid = sector_type == ckTYPE_MODE2_FORM1 ||
+                                sector_type == ckTYPE_MODE2_FORM2;
+                        break;
+
+                    case ScsiModePage05::ckDB_MODE_2_XA_FORM_1_2048:
+                    case ScsiModePage05::ckDB_MODE_2_XA_FORM_1_2056:
+                        valid = sector_type == ckTYPE_MODE2_FORM1;
+                        break;
+
+                    case ScsiModePage05::ckDB_MODE_2_XA_FORM_2_2324:
+                        valid = sector_type == ckTYPE_MODE2_FORM2;
+                        break;
+
+                    default:
+                        break;
+                }
+            }
+
+            if (!valid)
+                invalid.push_back(i);
+
+            // The cooked sector never starts after the raw sector it is moved
+            // from, the two may however overlap.
+            if (dst != sector + offset)
+                memmove(dst,sector + offset,size);
+
+            dst += size;
+        }
+
+        return true;
+    }
+};
@@ -0,0 +1,233 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "ckmmc/mmc.hh"
+#include "ckmmc/mmcdevice.hh"
+#include "ckmmc/commandprofile.hh"
+
+namespace ckmmc
+{
+    /**
+     * Checks if a command may access the medium. Such commands may have to
+     * wait for the disc to spin up, for layer jumps, OPC or drive error
+     * recovery, none of which are reflected in the latencies of healthy
+     * completions.
+     * @param [in] opcode The command operation code.
+     * @return If the command may access the medium true is returned, if not
+     *         false is returned.
+     */
+    static bool media_access(unsigned char opcode)
+    {
+        switch (opcode)
+        {
+            case MmcDevice::ckCMD_TEST_UNIT_READY:
+            case MmcDevice::ckCMD_REQUEST_SENSE:
+            case MmcDevice::ckCMD_INQUIRY:
+            case MmcDevice::ckCMD_GET_CONFIGURATION:
+            case MmcDevice::ckCMD_GET_EVENT_STATUS_NOTIFICATION:
+            case MmcDevice::ckCMD_MODE_SENSE10:
+            case MmcDevice::ckCMD_READ_BUFFER_CAPACITY:
+            case MmcDevice::ckCMD_REPORT_SUPPORTED_OPCODES:
+                return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Constructs an empty CommandProfile object.
+     */
+    CommandProfile::CommandProfile()
+    {
+        clear();
+    }
+
+    /**
+     * Destructs the CommandProfile object.
+     */
+    CommandProfile::~CommandProfile()
+    {
+    }
+
+    /**
+     * Removes all reported and learned information.
+     */
+    void CommandProfile::clear()
+    {
+        reported_ = false;
+        memset(supported_,0,sizeof(supported_));
+        memset(timeouts_,0,sizeof(timeouts_));
+        memset(samples_,0,sizeof(samples_));
+        memset(num_samples_,0,sizeof(num_samples_));
+    }
+
+    /**
+     * Parses the data returned by a REPORT SUPPORTED OPERATION CODES command
+     * requesting all commands together with their timeout descriptors. The
+     * list of supported commands is only used if the returned data covers
+     * the complete list, a truncated list would otherwise block commands
+     * that the device implements.
+     * @param [in] buffer The returned data.
+     * @param [in] buffer_len The size of the buffer.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool CommandProfile::parse(unsigned char *buffer,ckcore::tuint32 buffer_len)
+    {
+        if (buffer_len < 4)
+            return false;
+
+        ckcore::tuint32 data_len = read_uint32_msbf(buffer) + 4;
+        bool complete = true;
+        if (data_len > buffer_len)
+        {
+            data_len = buffer_len;
+            complete = false;
+        }
+
+        memset(supported_,0,sizeof(supported_));
+        memset(timeouts_,0,sizeof(timeouts_));
+
+        ckcore::tuint32 num_cmds = 0;
+        ckcore::tuint32 pos = 4;
+        while (pos + 8 <= data_len)
+        {
+            unsigned char *desc = buffer + pos;
+            unsigned char opcode = desc[0];
+            bool ctdp = (desc[5] & 0x02) != 0;
+
+            supported_[opcode >> 3] |= 1 << (opcode & 7);
+            num_cmds++;
+
+            pos += 8;
+
+            // Command timeouts descriptor.
+            if (ctdp)
+            {
+                if (pos + 12 > data_len)
+                {
+                    complete = false;
+                    break;
+                }
+
+                unsigned char *tdesc = buffer + pos;
+                ckcore::tuint32 nominal = read_uint32_msbf(tdesc + 4);
+                ckcore::tuint32 recommended = read_uint32_msbf(tdesc + 8);
+
+                // Service actions of the same operation code share the timeout,
+                // the longest one is used.
+                ckcore::tuint32 timeout = recommended != 0 ? recommended : nominal;
+                if (timeout > timeouts_[opcode])
+                    timeouts_[opcode] = timeout;
+
+                pos += read_uint16_msbf(tdesc) + 2;
+            }
+        }
+
+        // Descriptors that don't end exactly at the end of the data indicate
+        // that the list has been cut short.
+        if (pos != data_len)
+            complete = false;
+
+        // Some devices accept the command but return an empty list, which
+        // should not be interpreted as if no commands are supported.
+        reported_ = complete && num_cmds > 0;
+        return reported_;
+    }
+
+    /**
+     * Checks if the device has reported its supported commands.
+     * @return If the supported commands are known true is returned, if not
+     *         false is returned.
+     */
+    bool CommandProfile::reported() const
+    {
+        return reported_;
+    }
+
+    /**
+     * Checks if the device supports the specified command.
+     * @param [in] opcode The command operation code.
+     * @return If the command is supported, or if the supported commands are
+     *         not known, true is returned. Otherwise false is returned.
+     */
+    bool CommandProfile::supported(unsigned char opcode) const
+    {
+        if (!reported_)
+            return true;
+
+        return (supported_[opcode >> 3] & (1 << (opcode & 7))) != 0;
+    }
+
+    /**
+     * Records the latency of a successfully completed command.
+     * @param [in] opcode The command operation code.
+     * @param [in] elapsed The command latency in microseconds.
+     */
+    void CommandProfile::record(unsigned char opcode,ckcore::tuint64 elapsed)
+    {
+        ckcore::tuint64 ms = elapsed / 1000;
+
+        unsigned int bucket = 0;
+        while (bucket < ckNUM_BUCKETS - 1 && (static_cast<ckcore::tuint64>(1) << bucket) <= ms)
+            bucket++;
+
+        samples_[opcode][bucket]++;
+        num_samples_[opcode]++;
+    }
+
+    /**
+     * Returns the timeout to use for the specified command. The timeout
+     * reported by the device is preferred. If not available the timeout is
+     * estimated from the 99th percentile of the recorded latencies. Learned
+     * timeouts of commands that may access the medium are never shorter
+     * than the default driver timeout.
+     * @param [in] opcode The command operation code.
+     * @return The timeout in seconds, -1 if not known.
+     */
+    long CommandProfile::timeout(unsigned char opcode) const
+    {
+        if (timeouts_[opcode] != 0)
+            return static_cast<long>(timeouts_[opcode]);
+
+        ckcore::tuint32 num_samples = num_samples_[opcode];
+        if (num_samples < ckMIN_SAMPLES)
+            return -1;
+
+        // Find the bucket containing the 99th percentile.
+        ckcore::tuint32 limit = num_samples - num_samples / 100;
+        ckcore::tuint32 count = 0;
+
+        unsigned int bucket = 0;
+        for (; bucket < ckNUM_BUCKETS - 1; bucket++)
+        {
+            count += samples_[opcode][bucket];
+            if (count >= limit)
+                break;
+        }
+
+        // The last bucket is unbounded, don't guess.
+        if (bucket == ckNUM_BUCKETS - 1)
+            return -1;
+
+        long timeout = static_cast<long>(((static_cast<ckcore::tuint32>(1) << bucket) *
+                                          ckTIMEOUT_FACTOR + 999) / 1000);
+        long min_timeout = media_access(opcode) ? ckMIN_MEDIA_TIMEOUT : ckMIN_TIMEOUT;
+        return timeout < min_timeout ? min_timeout : timeout;
+    }
+};
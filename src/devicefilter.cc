@@ -0,0 +1,203 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ckmmc/devicefilter.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs a DeviceFilter object. A default constructed filter
+     * accepts all devices.
+     */
+    DeviceFilter::DeviceFilter() :
+        all_features_(0),any_features_(0),recorder_(false)
+    {
+    }
+
+    /**
+     * Destructs the DeviceFilter object.
+     */
+    DeviceFilter::~DeviceFilter()
+    {
+    }
+
+    /**
+     * Checks if a string starts with the specified prefix. The comparison is
+     * not case sensitive.
+     * @param [in] str The string to test.
+     * @param [in] prefix The prefix to look for.
+     * @return If str starts with prefix true is returned, if not false is
+     *         returned.
+     */
+    bool DeviceFilter::match_prefix(const ckcore::tchar *str,
+                                    const ckcore::tstring &prefix)
+    {
+        for (size_t i = 0; i < prefix.size(); i++)
+        {
+            ckcore::tchar c1 = str[i];
+            ckcore::tchar c2 = prefix[i];
+
+            if (c1 == '\0')
+                return false;
+
+            if (c1 >= 'a' && c1 <= 'z')
+                c1 -= 'a' - 'A';
+            if (c2 >= 'a' && c2 <= 'z')
+                c2 -= 'a' - 'A';
+
+            if (c1 != c2)
+                return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Adds a bus to the list of accepted buses. If no bus has been added
+     * devices on all buses are accepted.
+     * @param [in] bus The bus number to accept.
+     */
+    void DeviceFilter::bus(ckcore::tint32 bus)
+    {
+        buses_.push_back(bus);
+    }
+
+    /**
+     * Sets the vendor prefix that devices must match.
+     * @param [in] vendor The vendor prefix, or NULL to accept all vendors.
+     */
+    void DeviceFilter::vendor(const ckcore::tchar *vendor)
+    {
+        vendor_ = vendor != NULL ? vendor : ckT("");
+    }
+
+    /**
+     * Sets the product identifier prefix that devices must match.
+     * @param [in] identifier The identifier prefix, or NULL to accept all
+     *                        products.
+     */
+    void DeviceFilter::identifier(const ckcore::tchar *identifier)
+    {
+        identifier_ = identifier != NULL ? identifier : ckT("");
+    }
+
+    /**
+     * Requires devices to support the specified feature.
+     * @param [in] feature The feature that must be supported.
+     */
+    void DeviceFilter::require(Device::Feature feature)
+    {
+        all_features_ |= static_cast<ckcore::tuint64>(1) << feature;
+    }
+
+    /**
+     * Requires devices to support at least one of the features added using
+     * this function.
+     * @param [in] feature One of the features that may be supported.
+     */
+    void DeviceFilter::require_any(Device::Feature feature)
+    {
+        any_features_ |= static_cast<ckcore::tuint64>(1) << feature;
+    }
+
+    /**
+     * Requires devices to have recording capabilities.
+     */
+    void DeviceFilter::require_recorder()
+    {
+        recorder_ = true;
+    }
+
+    /**
+     * Checks if the filter depends on the device identity.
+     * @return If the filter has vendor or product criteria true is returned,
+     *         if not false is returned.
+     */
+    bool DeviceFilter::has_identity() const
+    {
+        return !vendor_.empty() || !identifier_.empty();
+    }
+
+    /**
+     * Checks if a device address is accepted by the filter. This test does
+     * not require any communication with the device.
+     * @param [in] addr The device address.
+     * @return If the address is accepted true is returned, if not false is
+     *         returned.
+     */
+    bool DeviceFilter::match_address(const ScsiDevice::Address &addr) const
+    {
+        if (buses_.empty())
+            return true;
+
+        std::vector<ckcore::tint32>::const_iterator it;
+        for (it = buses_.begin(); it != buses_.end(); it++)
+        {
+            if (*it == addr.bus_)
+                return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * Checks if a device identity is accepted by the filter.
+     * @param [in] vendor The device vendor.
+     * @param [in] identifier The device product identifier.
+     * @return If the identity is accepted true is returned, if not false is
+     *         returned.
+     */
+    bool DeviceFilter::match_identity(const ckcore::tchar *vendor,
+                                      const ckcore::tchar *identifier) const
+    {
+        if (!vendor_.empty() && !match_prefix(vendor,vendor_))
+            return false;
+
+        if (!identifier_.empty() && !match_prefix(identifier,identifier_))
+            return false;
+
+        return true;
+    }
+
+    /**
+     * Checks if the features of a device is accepted by the filter. The
+     * device capabilities must have been refreshed before calling this
+     * function.
+     * @param [in] device The device to test.
+     * @return If the device features are accepted true is returned, if not
+     *         false is returned.
+     */
+    bool DeviceFilter::match_features(Device &device) const
+    {
+        if (recorder_ && !device.recorder())
+            return false;
+
+        bool any = any_features_ == 0;
+        for (int i = 0; i < Device::ckINTERNAL_NUM_FEAT; i++)
+        {
+            ckcore::tuint64 mask = static_cast<ckcore::tuint64>(1) << i;
+            if ((all_features_ & mask) && !device.support(static_cast<Device::Feature>(i)))
+                return false;
+
+            if ((any_features_ & mask) && device.support(static_cast<Device::Feature>(i)))
+                any = true;
+        }
+
+        return any;
+    }
+};
@@ -27,7 +27,7 @@ namespace ckmmc
      * Constructs an DeviceManager object.
      */
     DeviceManager::DeviceManager() :
-        driver_(ScsiDriverSelector::driver())
+        driver_(ScsiDriverSelector::driver()),health_callback_(NULL)
     {
     }
 
@@ -56,9 +56,13 @@ namespace ckmmc
      * Scans the system for devices.
      * @param [in] callback Optional pointer to a callback object that will be
      *                      notified how the scanning progresses.
+     * @param [in] filter Optional pointer to a filter describing which
+     *                    devices to keep. Devices rejected by the address or
+     *                    identity criteria of the filter will not be
+     *                    instantiated at all.
      * @return If successfull true is returned, otherwise false is returned.
      */
-    bool DeviceManager::scan(ScanCallback *callback)
+    bool DeviceManager::scan(ScanCallback *callback,const DeviceFilter *filter)
     {
         // Remove any previous devices.
         clear();
@@ -75,35 +79,92 @@ namespace ckmmc
         std::vector<ScsiDevice::Address>::iterator it_addr;
         for (it_addr = addresses.begin(); it_addr != addresses.end(); it_addr++)
         {
-            devices_.push_back(new Device(*it_addr));
-
-            if (callback != NULL)
+            if (filter != NULL)
             {
-                // See if we should keep the device.
-                if (!callback->event_device(*it_addr))
+                // Skip devices on buses we're not interested in.
+                if (!filter->match_address(*it_addr))
+                    continue;
+
+                // If the driver knows the device identity we can test it
+                // without sending any commands to the device.
+                if (filter->has_identity())
                 {
-                    delete devices_.back();
-                    devices_.pop_back();
+                    ckcore::tstring vendor,identifier;
+                    if (driver_.identify(*it_addr,vendor,identifier) &&
+                        !filter->match_identity(vendor.c_str(),identifier.c_str()))
+                    {
+                        continue;
+                    }
                 }
             }
+
+            Device *device = new Device(*it_addr);
+            device->health_callback(health_callback_);
+
+            // Test the identity reported by the device itself.
+            if (filter != NULL && !filter->match_identity(device->vendor(),device->identifier()))
+            {
+                delete device;
+                continue;
+            }
+
+            // See if we should keep the device.
+            if (callback != NULL && !callback->event_device(*it_addr))
+            {
+                delete device;
+                continue;
+            }
+
+            devices_.push_back(device);
         }
 
         if (callback != NULL)
             callback->event_status(ScanCallback::ckEVENT_DEV_CAP);
 
         // Refresh the devices.
-        std::vector<Device *>::iterator it;
-        for (it = devices_.begin(); it != devices_.end(); it++)
+        std::vector<Device *>::iterator it = devices_.begin();
+        while (it != devices_.end())
         {
-            if (!(*it)->refresh())
+            // Don't let a device that has stopped responding hold up the scan.
+            if ((*it)->health() >= ScsiDevice::ckHEALTH_QUARANTINED)
+            {
+                ckcore::log::print_line(ckT("[device]: skipping unresponsive device %s."),
+                                        (*it)->name());
+            }
+            else if (!(*it)->refresh())
             {
                 ckcore::log::print_line(ckT("[device]: unable to refresh device capabilities."));
             }
+
+            // Remove devices lacking the requested features.
+            if (filter != NULL && !filter->match_features(**it))
+            {
+                delete *it;
+                it = devices_.erase(it);
+            }
+            else
+            {
+                it++;
+            }
         }
 
         return true;
     }
 
+    /**
+     * Sets the callback object to notify when the health state of any
+     * managed device changes.
+     * @param [in] callback Pointer to callback object, may be NULL.
+     */
+    void DeviceManager::health_callback(ScsiDevice::HealthCallback *callback)
+    {
+        health_callback_ = callback;
+
+        std::vector<Device *>::iterator it;
+        for (it = devices_.begin(); it != devices_.end(); it++)
+            (*it)->health_callback(callback);
+    }
+
     /**
      * Returns a vector containing all known devices.
      * @return A vector containing all known devices.
@@ -0,0 +1,354 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef _WINDOWS
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+#include <string.h>
+#include <ckcore/log.hh>
+#include "ckmmc/directfile.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs a closed DirectFile object.
+     */
+    DirectFile::DirectFile() : head_(0),tail_(0),sparse_(false),failed_(false),
+        size_(0),hole_bytes_(0)
+    {
+#ifdef _WINDOWS
+        handle_ = INVALID_HANDLE_VALUE;
+        for (unsigned int i = 0; i < ckMAX_PENDING; i++)
+            events_[i] = NULL;
+#else
+        fd_ = -1;
+#endif
+    }
+
+    /**
+     * Destructs the DirectFile object.
+     */
+    DirectFile::~DirectFile()
+    {
+        close();
+    }
+
+    /**
+     * Checks if a buffer contains only zeros.
+     * @param [in] data The buffer, must be aligned to the size of a pointer.
+     * @param [in] len The buffer size, must be a multiple of the size of a
+     *                 pointer.
+     * @return If the buffer contains only zeros true is returned, if not
+     *         false is returned.
+     */
+    bool DirectFile::is_zero(const unsigned char *data,ckcore::tuint32 len)
+    {
+        const size_t *words = reinterpret_cast<const size_t *>(data);
+        const size_t *end = words + len / sizeof(size_t);
+
+        for (; words + 4 <= end; words += 4)
+        {
+            if ((words[0] | words[1] | words[2] | words[3]) != 0)
+                return false;
+        }
+
+        for (; words < end; words++)
+        {
+            if (*words != 0)
+                return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Creates a file, an existing file is overwritten. The file is made
+     * sparse if the file system supports it.
+     * @param [in] path The file path.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool DirectFile::create(const ckcore::tchar *path)
+    {
+        close();
+
+        head_ = tail_ = 0;
+        failed_ = false;
+        size_ = 0;
+        hole_bytes_ = 0;
+
+#ifdef _WINDOWS
+        handle_ = CreateFile(path,GENERIC_WRITE,0,NULL,CREATE_ALWAYS,
+                             FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED,NULL);
+        if (handle_ == INVALID_HANDLE_VALUE)
+        {
+            ckcore::log::print_line(ckT("[directfile]: unable to create file (%d)."),GetLastError());
+            return false;
+        }
+
+        for (unsigned int i = 0; i < ckMAX_PENDING; i++)
+        {
+            events_[i] = CreateEvent(NULL,TRUE,FALSE,NULL);
+            if (events_[i] == NULL)
+            {
+                close();
+                return false;
+            }
+        }
+
+        // Request a sparse file, the handle is overlapped so the request must
+        // be as well.
+        OVERLAPPED overlapped;
+        memset(&overlapped,0,sizeof(OVERLAPPED));
+        overlapped.hEvent = events_[0];
+
+        DWORD returned = 0;
+        sparse_ = DeviceIoControl(handle_,FSCTL_SET_SPARSE,NULL,0,NULL,0,&returned,&overlapped) ||
+                  (GetLastError() == ERROR_IO_PENDING &&
+                   GetOverlappedResult(handle_,&overlapped,&returned,TRUE));
+#else
+        int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+        fd_ = ::open(path,flags | O_DIRECT,0644);
+        if (fd_ == -1 && errno == EINVAL)
+#endif
+            fd_ = ::open(path,flags,0644);
+        if (fd_ == -1)
+            return false;
+
+        // Holes are created by seeking past unwritten regions.
+        sparse_ = true;
+#endif
+        return true;
+    }
+
+    /**
+     * Completes all pending writes, sets the file size and closes the file.
+     * @return If all writes were successful true is returned, if not false is
+     *         returned.
+     */
+    bool DirectFile::close()
+    {
+        if (!is_open())
+            return true;
+
+        while (tail_ != head_)
+            complete();
+
+        bool res = !failed_;
+
+#ifdef _WINDOWS
+        // Unaligned final writes were padded, trim the file to its real size.
+        LARGE_INTEGER size;
+        size.QuadPart = static_cast<LONGLONG>(size_);
+        if (!SetFilePointerEx(handle_,size,NULL,FILE_BEGIN) || !SetEndOfFile(handle_))
+        {
+            ckcore::log::print_line(ckT("[directfile]: unable to set file size (%d)."),GetLastError());
+            res = false;
+        }
+
+        for (unsigned int i = 0; i < ckMAX_PENDING; i++)
+        {
+            if (events_[i] != NULL)
+            {
+                CloseHandle(events_[i]);
+                events_[i] = NULL;
+            }
+        }
+
+        CloseHandle(handle_);
+        handle_ = INVALID_HANDLE_VALUE;
+#else
+        if (ftruncate(fd_,static_cast<off_t>(size_)) != 0)
+            res = false;
+
+        ::close(fd_);
+        fd_ = -1;
+#endif
+        tail_buffer_.free();
+        return res;
+    }
+
+    /**
+     * Checks if the file is open.
+     * @return If the file is open true is returned, if not false is
+     *         returned.
+     */
+    bool DirectFile::is_open() const
+    {
+#ifdef _WINDOWS
+        return handle_ != INVALID_HANDLE_VALUE;
+#else
+        return fd_ != -1;
+#endif
+    }
+
+    /**
+     * Issues a write. If ckMAX_PENDING writes are pending the oldest write is
+     * completed first.
+     * @param [in] offset The file offset, must be a multiple of ckALIGNMENT.
+     * @param [in] data The data to write, must be aligned to ckALIGNMENT and
+     *                  remain valid until the write has been completed.
+     * @param [in] len The number of bytes to write. Only the last write of a
+     *                 file may have a length that is not a multiple of
+     *                 ckALIGNMENT.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool DirectFile::write(ckcore::tuint64 offset,const unsigned char *data,ckcore::tuint32 len)
+    {
+        if (!is_open() || failed_)
+            return false;
+
+        if ((offset & (ckALIGNMENT - 1)) != 0 ||
+            (reinterpret_cast<size_t>(data) & (ckALIGNMENT - 1)) != 0)
+        {
+            ckcore::log::print_line(ckT("[directfile]: unaligned write."));
+            return false;
+        }
+
+        if (head_ - tail_ >= ckMAX_PENDING && !complete())
+            return false;
+
+        unsigned int slot = head_ % ckMAX_PENDING;
+        active_[slot] = false;
+        lengths_[slot] = len;
+
+        if (offset + len > size_)
+            size_ = offset + len;
+
+        // Leave zero chunks as holes.
+        if (sparse_ && (len & (ckALIGNMENT - 1)) == 0 && is_zero(data,len))
+        {
+            hole_bytes_ += len;
+            head_++;
+            return true;
+        }
+
+        // Pad an unaligned final write.
+        ckcore::tuint32 write_len = len;
+        if ((len & (ckALIGNMENT - 1)) != 0)
+        {
+            write_len = (len + ckALIGNMENT - 1) & ~(ckALIGNMENT - 1);
+            if (!tail_buffer_.allocate(write_len))
+                return false;
+
+            memcpy(tail_buffer_.data(),data,len);
+            memset(tail_buffer_.data() + len,0,write_len - len);
+            data = tail_buffer_.data();
+        }
+
+#ifdef _WINDOWS
+        OVERLAPPED &overlapped = overlapped_[slot];
+        memset(&overlapped,0,sizeof(OVERLAPPED));
+        overlapped.Offset = static_cast<DWORD>(offset & 0xffffffff);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        overlapped.hEvent = events_[slot];
+
+        if (!WriteFile(handle_,data,write_len,NULL,&overlapped) &&
+            GetLastError() != ERROR_IO_PENDING)
+        {
+            ckcore::log::print_line(ckT("[directfile]: WriteFile failed (%d)."),GetLastError());
+            failed_ = true;
+            return false;
+        }
+
+        active_[slot] = true;
+        lengths_[slot] = write_len;
+#else
+        ssize_t written = pwrite(fd_,data,write_len,static_cast<off_t>(offset));
+        if (written != static_cast<ssize_t>(write_len))
+        {
+            failed_ = true;
+            return false;
+        }
+#endif
+        head_++;
+        return true;
+    }
+
+    /**
+     * Waits for the oldest pending write to complete.
+     * @return If the write was successful true is returned, if not false is
+     *         returned.
+     */
+    bool DirectFile::complete()
+    {
+        if (tail_ == head_)
+            return true;
+
+#ifdef _WINDOWS
+        unsigned int slot = tail_ % ckMAX_PENDING;
+        tail_++;
+
+        if (active_[slot])
+        {
+            DWORD written = 0;
+            if (!GetOverlappedResult(handle_,&overlapped_[slot],&written,TRUE) ||
+                written != lengths_[slot])
+            {
+                ckcore::log::print_line(ckT("[directfile]: write failed (%d)."),GetLastError());
+                failed_ = true;
+            }
+        }
+#else
+        tail_++;
+#endif
+        return !failed_;
+    }
+
+    /**
+     * Returns the number of writes that have not been completed.
+     * @return The number of pending writes.
+     */
+    unsigned int DirectFile::pending() const
+    {
+        return head_ - tail_;
+    }
+
+    /**
+     * Checks if zero chunks are left as holes.
+     * @return If the file is sparse true is returned, if not false is
+     *         returned.
+     */
+    bool DirectFile::sparse() const
+    {
+        return sparse_;
+    }
+
+    /**
+     * Returns the file size.
+     * @return The file size in bytes.
+     */
+    ckcore::tuint64 DirectFile::size() const
+    {
+        return size_;
+    }
+
+    /**
+     * Returns the number of bytes left as holes.
+     * @return The number of unwritten zero bytes.
+     */
+    ckcore::tuint64 DirectFile::hole_bytes() const
+    {
+        return hole_bytes_;
+    }
+};
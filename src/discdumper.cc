@@ -0,0 +1,301 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <ckcore/log.hh>
+#include "ckmmc/directfile.hh"
+#include "ckmmc/discdumper.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs a HashThread object.
+     * @param [in] hashes Bit mask of hash algorithms to calculate.
+     */
+    DiscDumper::HashThread::HashThread(unsigned int hashes) : hashes_(hashes),
+        head_(0),tail_(0),stop_(0)
+    {
+    }
+
+    /**
+     * Destructs the HashThread object.
+     */
+    DiscDumper::HashThread::~HashThread()
+    {
+        stop();
+    }
+
+    /**
+     * Hash thread, hashes chunks until stopped.
+     */
+    void DiscDumper::HashThread::run()
+    {
+        for (;;)
+        {
+            // The stop flag must be read before the head, all chunks pushed
+            // before stopping are hashed.
+            bool stopped = atomic::load(&stop_) != 0;
+            if (tail_ == atomic::load(&head_))
+            {
+                if (stopped)
+                    break;
+
+                job_event_.wait();
+                continue;
+            }
+
+            unsigned int job = tail_ % ckMAX_JOBS;
+            if (hashes_ & ckHASH_CRC32)
+                crc32_.update(data_[job],len_[job]);
+            if (hashes_ & ckHASH_MD5)
+                md5_.update(data_[job],len_[job]);
+            if (hashes_ & ckHASH_SHA256)
+                sha256_.update(data_[job],len_[job]);
+
+            atomic::add(&tail_,1);
+            done_event_.set();
+        }
+    }
+
+    /**
+     * Queues a chunk for hashing. The data must remain valid until the chunk
+     * has been hashed.
+     * @param [in] data The chunk data.
+     * @param [in] len The chunk size in bytes.
+     */
+    void DiscDumper::HashThread::push(const unsigned char *data,ckcore::tuint32 len)
+    {
+        while (head_ - atomic::load(&tail_) >= ckMAX_JOBS)
+            done_event_.wait();
+
+        data_[head_ % ckMAX_JOBS] = data;
+        len_[head_ % ckMAX_JOBS] = len;
+
+        atomic::add(&head_,1);
+        job_event_.set();
+    }
+
+    /**
+     * Waits until a number of chunks have been hashed.
+     * @param [in] count The number of chunks, counted from the start.
+     */
+    void DiscDumper::HashThread::wait(long count)
+    {
+        while (atomic::load(&tail_) < count)
+            done_event_.wait();
+    }
+
+    /**
+     * Hashes all queued chunks and stops the thread.
+     */
+    void DiscDumper::HashThread::stop()
+    {
+        atomic::store(&stop_,1);
+        job_event_.set();
+        join();
+    }
+
+    /**
+     * Constructs a DiscDumper object.
+     * @param [in] device The device to read from.
+     */
+    DiscDumper::DiscDumper(MmcDevice &device) : device_(device),crc32_(0),
+        size_(0),hole_bytes_(0)
+    {
+        memset(md5_,0,sizeof(md5_));
+        memset(sha256_,0,sizeof(sha256_));
+    }
+
+    /**
+     * Destructs the DiscDumper object.
+     */
+    DiscDumper::~DiscDumper()
+    {
+    }
+
+    /**
+     * Dumps all sectors on the inserted disc to an image file.
+     * @param [in] path The image file path.
+     * @param [in] hashes Bit mask of hash algorithms to calculate.
+     * @return If all sectors were read and written true is returned, if not
+     *         false is returned.
+     */
+    bool DiscDumper::dump(const ckcore::tchar *path,unsigned int hashes)
+    {
+        ckcore::tuint32 last_lba = 0,block_len = 0;
+        if (!device_.read_capacity(last_lba,block_len) || block_len != 2048)
+        {
+            ckcore::log::print_line(ckT("[discdumper]: unable to determine disc capacity."));
+            return false;
+        }
+
+        return dump(path,0,last_lba + 1,hashes);
+    }
+
+    /**
+     * Dumps a range of sectors to an image file. Unreadable sectors are
+     * written as zeros and reported in the error map.
+     * @param [in] path The image file path.
+     * @param [in] lba The first sector to dump.
+     * @param [in] count The number of sectors to dump.
+     * @param [in] hashes Bit mask of hash algorithms to calculate.
+     * @return If all sectors were read and written true is returned, if not
+     *         false is returned.
+     */
+    bool DiscDumper::dump(const ckcore::tchar *path,ckcore::tuint32 lba,
+                          ckcore::tuint32 count,unsigned int hashes)
+    {
+        errors_.clear();
+        crc32_ = 0;
+        memset(md5_,0,sizeof(md5_));
+        memset(sha256_,0,sizeof(sha256_));
+        size_ = 0;
+        hole_bytes_ = 0;
+
+        DirectFile file;
+        if (!file.create(path))
+            return false;
+
+        HashThread hasher(hashes);
+        if (!hasher.start())
+            return false;
+
+        StreamReader reader(device_);
+        if (!reader.start(lba,count))
+            return false;
+
+        bool res = true;
+
+        long issued = 0,retired = 0;
+        while (res)
+        {
+            // Retire the oldest chunk once it has been written and hashed.
+            if (issued - retired >= ckMAX_IN_FLIGHT)
+            {
+                res = file.complete();
+                hasher.wait(++retired);
+                reader.release();
+                continue;
+            }
+
+            StreamReader::Lease lease;
+            if (!reader.lease(lease))
+                break;
+
+            errors_.insert(errors_.end(),lease.errors_->begin(),lease.errors_->end());
+
+            ckcore::tuint32 len = lease.count_ * 2048;
+            hasher.push(lease.data_,len);
+            res = file.write(static_cast<ckcore::tuint64>(lease.lba_ - lba) * 2048,
+                             lease.data_,len);
+            issued++;
+        }
+
+        while (retired < issued)
+        {
+            if (!file.complete())
+                res = false;
+
+            hasher.wait(++retired);
+            reader.release();
+        }
+
+        reader.stop();
+        hasher.stop();
+
+        if (!file.close())
+            res = false;
+
+        size_ = file.size();
+        hole_bytes_ = file.hole_bytes();
+
+        if (hashes & ckHASH_CRC32)
+            crc32_ = hasher.crc32_.checksum();
+        if (hashes & ckHASH_MD5)
+            hasher.md5_.digest(md5_);
+        if (hashes & ckHASH_SHA256)
+            hasher.sha256_.digest(sha256_);
+
+        if (size_ != static_cast<ckcore::tuint64>(count) * 2048)
+            res = false;
+
+        if (!errors_.empty())
+        {
+            ckcore::log::print_line(ckT("[discdumper]: %u unreadable ranges were written as zeros."),
+                                    static_cast<ckcore::tuint32>(errors_.size()));
+            res = false;
+        }
+
+        return res;
+    }
+
+    /**
+     * Returns the ranges of sectors that could not be read during the last
+     * dump.
+     * @return The error map.
+     */
+    const std::vector<MmcDevice::ReadError> &DiscDumper::errors() const
+    {
+        return errors_;
+    }
+
+    /**
+     * Returns the CRC-32 checksum of the last image.
+     * @return The CRC-32 checksum.
+     */
+    ckcore::tuint32 DiscDumper::crc32() const
+    {
+        return crc32_;
+    }
+
+    /**
+     * Returns the MD5 digest of the last image.
+     * @return Pointer to the 16 byte digest.
+     */
+    const unsigned char *DiscDumper::md5() const
+    {
+        return md5_;
+    }
+
+    /**
+     * Returns the SHA-256 digest of the last image.
+     * @return Pointer to the 32 byte digest.
+     */
+    const unsigned char *DiscDumper::sha256() const
+    {
+        return sha256_;
+    }
+
+    /**
+     * Returns the size of the last image.
+     * @return The image size in bytes.
+     */
+    ckcore::tuint64 DiscDumper::size() const
+    {
+        return size_;
+    }
+
+    /**
+     * Returns the number of bytes of the last image that were left as holes.
+     * @return The number of unwritten zero bytes.
+     */
+    ckcore::tuint64 DiscDumper::hole_bytes() const
+    {
+        return hole_bytes_;
+    }
+};
@@ -0,0 +1,389 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <ckcore/log.hh>
+#include <ckcore/string.hh>
+#include "ckmmc/mmc.hh"
+#include "ckmmc/scsisilencer.hh"
+#include "ckmmc/disclayout.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs a DiscLayout object.
+     * @param [in] device The device containing the disc.
+     */
+    DiscLayout::DiscLayout(MmcDevice &device) : device_(device),leadout_(0),reads_(0)
+    {
+    }
+
+    /**
+     * Destructs the DiscLayout object.
+     */
+    DiscLayout::~DiscLayout()
+    {
+    }
+
+    /**
+     * Converts a binary coded decimal value.
+     * @param [in] value The BCD value.
+     * @return The binary value.
+     */
+    unsigned char DiscLayout::bcd(unsigned char value)
+    {
+        return (value >> 4) * 10 + (value & 0x0f);
+    }
+
+    /**
+     * Reads the track start addresses from the table of contents.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool DiscLayout::read_toc()
+    {
+        unsigned char buffer[4 + (ckMAX_TRACKS + 1) * 8];
+        if (!device_.read_toc(buffer,sizeof(buffer)))
+            return false;
+
+        size_t len = read_uint16_msbf(buffer) + 2;
+        if (len > sizeof(buffer))
+            len = sizeof(buffer);
+
+        for (size_t pos = 4; pos + 8 <= len; pos += 8)
+        {
+            unsigned char *desc = buffer + pos;
+            if (desc[2] == 0xaa)
+            {
+                leadout_ = read_uint32_msbf(desc + 4);
+                continue;
+            }
+
+            Track track;
+            track.number_ = desc[2];
+            track.control_ = desc[1] & 0x0f;
+            track.start_ = read_uint32_msbf(desc + 4);
+            track.pregap_ = track.start_;
+            tracks_.push_back(track);
+        }
+
+        return !tracks_.empty() && leadout_ != 0;
+    }
+
+    /**
+     * Reads the Q sub-channel of a frame and checks if it contains the
+     * position of the frame (mode 1 Q data).
+     * @param [in] lba The frame address.
+     * @param [out] q The Q sub-channel data, must be 16 bytes.
+     * @param [out] mode1 Set to true if the frame contains its position.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool DiscLayout::read_q(ckcore::tuint32 lba,unsigned char *q,bool &mode1)
+    {
+        reads_++;
+        if (!device_.read_cd_q(lba,q,16))
+            return false;
+
+        mode1 = (q[0] & 0x0f) == 0x01;
+        return true;
+    }
+
+    /**
+     * Reads the track and index of a frame from its Q sub-channel. Frames
+     * carrying the media catalog number or ISRC don't contain the position,
+     * it is then derived from the closest frames before and after the frame.
+     * If those are on different sides of a boundary the relative time of the
+     * following frame tells on which side the frame is when the boundary is
+     * the start of index 1. Other boundaries can't be resolved from the Q
+     * sub-channel, the frame is then considered part of the following frame.
+     * @param [in] lba The frame address.
+     * @param [out] track The track number, 0xaa in the lead-out.
+     * @param [out] index The index number.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool DiscLayout::read_position(ckcore::tuint32 lba,unsigned char &track,
+                                   unsigned char &index)
+    {
+        unsigned char q[16];
+        bool mode1 = false;
+        if (!read_q(lba,q,mode1))
+            return false;
+
+        ckcore::tuint32 next_dist = 0;
+        for (ckcore::tuint32 i = 1; !mode1 && i <= ckQ_PROBE_FRAMES; i++)
+        {
+            if (!read_q(lba + i,q,mode1))
+                return false;
+
+            next_dist = i;
+        }
+
+        if (!mode1)
+            return false;
+
+        track = q[1] == 0xaa ? 0xaa : bcd(q[1]);
+        index = bcd(q[2]);
+        if (next_dist == 0)
+            return true;
+
+        // Find the closest preceding frame containing its position.
+        unsigned char prev_q[16];
+        bool prev_mode1 = false;
+        for (ckcore::tuint32 i = 1; !prev_mode1 && i <= ckQ_PROBE_FRAMES && i <= lba; i++)
+        {
+            if (!read_q(lba - i,prev_q,prev_mode1))
+                return false;
+        }
+
+        if (!prev_mode1)
+            return true;
+
+        unsigned char prev_track = prev_q[1] == 0xaa ? 0xaa : bcd(prev_q[1]);
+        unsigned char prev_index = bcd(prev_q[2]);
+        if (prev_track == track && prev_index == index)
+            return true;
+
+        // The relative time counts the frames since the start of index 1.
+        if (track != 0xaa && index == 1)
+        {
+            ckcore::tuint32 rel = (bcd(q[3]) * 60 + bcd(q[4])) * 75 + bcd(q[5]);
+            if (rel < next_dist)
+            {
+                track = prev_track;
+                index = prev_index;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Locates the pregap of a track. The frames between the start of the
+     * previous track and the start of the track belong to the previous track
+     * followed by the pregap.
+     * @param [in] i The index of the track.
+     */
+    void DiscLayout::find_pregap(size_t i)
+    {
+        Track &track = tracks_[i];
+        if (i == 0)
+        {
+            // Audio before the first track is part of its pregap.
+            track.pregap_ = 0;
+            return;
+        }
+
+        ckcore::tuint32 lo = tracks_[i - 1].start_;
+        ckcore::tuint32 hi = track.start_;
+
+        while (hi - lo > 1)
+        {
+            ckcore::tuint32 mid = lo + (hi - lo) / 2;
+
+            unsigned char num = 0,index = 0;
+            if (!read_position(mid,num,index))
+            {
+                ckcore::log::print_line(ckT("[disclayout]: unable to read the position of frame %u."),mid);
+                return;
+            }
+
+            if (num == track.number_)
+                hi = mid;
+            else
+                lo = mid;
+        }
+
+        track.pregap_ = hi;
+    }
+
+    /**
+     * Locates the index changes following index 1 of a track.
+     * @param [in] i The index of the track.
+     */
+    void DiscLayout::find_indexes(size_t i)
+    {
+        Track &track = tracks_[i];
+        ckcore::tuint32 end = i + 1 < tracks_.size() ? tracks_[i + 1].pregap_ : leadout_;
+        if (end <= track.start_ + 1)
+            return;
+
+        ckcore::tuint32 lo = track.start_;
+        unsigned char cur = 1;
+
+        unsigned char num = 0,index = 0;
+        if (!read_position(end - 1,num,index) || num != track.number_ || index <= cur)
+            return;
+
+        unsigned char last = index;
+        while (cur < last)
+        {
+            // Find the first frame with an index above the current one.
+            ckcore::tuint32 hi = end - 1;
+            while (hi - lo > 1)
+            {
+                ckcore::tuint32 mid = lo + (hi - lo) / 2;
+                if (!read_position(mid,num,index))
+                {
+                    ckcore::log::print_line(ckT("[disclayout]: unable to read the position of frame %u."),mid);
+                    return;
+                }
+
+                if (num == track.number_ && index > cur)
+                    hi = mid;
+                else
+                    lo = mid;
+            }
+
+            if (!read_position(hi,num,index) || index <= cur)
+                return;
+
+            // Skipped index numbers start at the same frame.
+            for (; cur < index; cur++)
+                track.indexes_.push_back(hi);
+
+            lo = hi;
+        }
+    }
+
+    /**
+     * Reads the ISRC of an audio track.
+     * @param [in] i The index of the track.
+     */
+    void DiscLayout::read_isrc(size_t i)
+    {
+        Track &track = tracks_[i];
+        if (track.control_ & ckCONTROL_DATA)
+            return;
+
+        unsigned char buffer[24];
+        if (!device_.read_subchannel(0x03,track.number_,buffer,sizeof(buffer)))
+            return;
+
+        // Check the TCVal bit.
+        if (buffer[4] != 0x03 || !(buffer[8] & 0x80))
+            return;
+
+        char isrc[13];
+        memcpy(isrc,buffer + 9,12);
+        isrc[12] = '\0';
+
+        ckcore::tchar isrc_str[13];
+        ckcore::string::ansi_to_auto(isrc,isrc_str,13);
+        track.isrc_ = isrc_str;
+    }
+
+    /**
+     * Reads the media catalog number.
+     */
+    void DiscLayout::read_mcn()
+    {
+        unsigned char buffer[24];
+        if (!device_.read_subchannel(0x02,0,buffer,sizeof(buffer)))
+            return;
+
+        // Check the MCVal bit.
+        if (buffer[4] != 0x02 || !(buffer[8] & 0x80))
+            return;
+
+        char mcn[14];
+        memcpy(mcn,buffer + 9,13);
+        mcn[13] = '\0';
+
+        ckcore::tchar mcn_str[14];
+        ckcore::string::ansi_to_auto(mcn,mcn_str,14);
+        mcn_ = mcn_str;
+    }
+
+    /**
+     * Detects the layout of the inserted disc.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool DiscLayout::detect()
+    {
+        tracks_.clear();
+        leadout_ = 0;
+        mcn_.clear();
+        reads_ = 0;
+
+        if (!read_toc())
+        {
+            ckcore::log::print_line(ckT("[disclayout]: unable to read the table of contents."));
+            return false;
+        }
+
+        {
+            // Frames between sessions can't be read, such failures are
+            // expected.
+            ScsiSilencer silencer(device_);
+
+            for (size_t i = 0; i < tracks_.size(); i++)
+                find_pregap(i);
+
+            for (size_t i = 0; i < tracks_.size(); i++)
+                find_indexes(i);
+        }
+
+        if (device_.support(MmcDevice::ckDEVICE_ISRC))
+        {
+            for (size_t i = 0; i < tracks_.size(); i++)
+                read_isrc(i);
+        }
+
+        if (device_.support(MmcDevice::ckDEVICE_UPC))
+            read_mcn();
+
+        ckcore::log::print_line(ckT("[disclayout]: %u tracks detected using %u sub-channel reads."),
+                                static_cast<ckcore::tuint32>(tracks_.size()),reads_);
+        return true;
+    }
+
+    /**
+     * Returns the detected tracks.
+     * @return The tracks.
+     */
+    const std::vector<DiscLayout::Track> &DiscLayout::tracks() const
+    {
+        return tracks_;
+    }
+
+    /**
+     * Returns the address of the lead-out.
+     * @return The lead-out address.
+     */
+    ckcore::tuint32 DiscLayout::leadout() const
+    {
+        return leadout_;
+    }
+
+    /**
+     * Returns the media catalog number.
+     * @return The media catalog number, empty if unknown.
+     */
+    const ckcore::tstring &DiscLayout::mcn() const
+    {
+        return mcn_;
+    }
+
+    /**
+     * Returns the number of sub-channel reads made by the last detection.
+     * @return The number of reads.
+     */
+    ckcore::tuint32 DiscLayout::reads() const
+    {
+        return reads_;
+    }
+};
@@ -0,0 +1,159 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ckmmc/driveprofile.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs a DriveProfileStore object.
+     */
+    DriveProfileStore::DriveProfileStore()
+    {
+    }
+
+    /**
+     * Destructs the DriveProfileStore object.
+     */
+    DriveProfileStore::~DriveProfileStore()
+    {
+    }
+
+    /**
+     * Returns the drive profile store instance.
+     * @return The drive profile store instance.
+     */
+    DriveProfileStore &DriveProfileStore::instance()
+    {
+        static DriveProfileStore store;
+        return store;
+    }
+
+    /**
+     * Creates a profile key from a drive identity.
+     * @param [in] vendor The device vendor.
+     * @param [in] identifier The device product identifier.
+     * @param [in] revision The device firmware revision.
+     * @return The profile key.
+     */
+    ckcore::tstring DriveProfileStore::key(const ckcore::tchar *vendor,
+                                           const ckcore::tchar *identifier,
+                                           const ckcore::tchar *revision)
+    {
+        ckcore::tstring key = vendor;
+        key += ckT("|");
+        key += identifier;
+        key += ckT("|");
+        key += revision;
+
+        return key;
+    }
+
+    /**
+     * Finds the profile of a drive.
+     * @param [in] key The profile key.
+     * @param [out] profile The drive profile.
+     * @return If a profile was found true is returned, if not false is
+     *         returned.
+     */
+    bool DriveProfileStore::find(const ckcore::tstring &key,DriveProfile &profile) const
+    {
+        std::map<ckcore::tstring,DriveProfile>::const_iterator it = profiles_.find(key);
+        if (it == profiles_.end())
+            return false;
+
+        profile = it->second;
+        return true;
+    }
+
+    /**
+     * Stores the profile of a drive, replacing any previous profile.
+     * @param [in] key The profile key.
+     * @param [in] profile The drive profile.
+     */
+    void DriveProfileStore::store(const ckcore::tstring &key,const DriveProfile &profile)
+    {
+        profiles_[key] = profile;
+    }
+
+    /**
+     * Removes all profiles.
+     */
+    void DriveProfileStore::clear()
+    {
+        profiles_.clear();
+    }
+
+    /**
+     * Serializes all profiles. Each profile is written on a separate line
+     * with tab separated fields, the profile key comes first.
+     * @return The serialized profiles.
+     */
+    ckcore::tstring DriveProfileStore::save() const
+    {
+        ckcore::tstringstream stream;
+
+        std::map<ckcore::tstring,DriveProfile>::const_iterator it;
+        for (it = profiles_.begin(); it != profiles_.end(); it++)
+        {
+            stream << it->first << ckT("\t")
+                   << it->second.max_transfer_ << ckT("\t")
+                   << it->second.best_transfer_ << ckT("\t")
+                   << (it->second.read_offset_known_ ? 1 : 0) << ckT("\t")
+                   << it->second.read_offset_ << ckT("\n");
+        }
+
+        return stream.str();
+    }
+
+    /**
+     * Loads profiles previously serialized using save(). Loaded profiles
+     * replace profiles with the same key. Missing trailing fields are left
+     * at their default values.
+     * @param [in] data The serialized profiles.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool DriveProfileStore::load(const ckcore::tstring &data)
+    {
+        ckcore::tstringstream stream(data);
+        ckcore::tstring line;
+
+        while (std::getline(stream,line))
+        {
+            if (line.empty())
+                continue;
+
+            size_t delim = line.find(ckT('\t'));
+            if (delim == ckcore::tstring::npos || delim == 0)
+                return false;
+
+            DriveProfile profile;
+
+            ckcore::tstringstream fields(line.substr(delim + 1));
+            fields >> profile.max_transfer_ >> profile.best_transfer_;
+
+            int read_offset_known = 0;
+            if (fields >> read_offset_known >> profile.read_offset_)
+                profile.read_offset_known_ = read_offset_known != 0;
+
+            profiles_[line.substr(0,delim)] = profile;
+        }
+
+        return true;
+    }
+};
@@ -0,0 +1,119 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "ckmmc/errorrecoveryscope.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs an ErrorRecoveryScope object saving the current error
+     * recovery parameters of the device.
+     * @param [in] device The device.
+     */
+    ErrorRecoveryScope::ErrorRecoveryScope(MmcDevice &device) : device_(device),
+        valid_(false),changed_(false)
+    {
+        memset(&saved_,0,sizeof(ScsiModePage01));
+        valid_ = device_.get_error_recovery(saved_);
+    }
+
+    /**
+     * Destructs the ErrorRecoveryScope object, restoring the saved
+     * parameters.
+     */
+    ErrorRecoveryScope::~ErrorRecoveryScope()
+    {
+        restore();
+    }
+
+    /**
+     * Checks if the parameters of the device could be saved. If not, none
+     * of the functions changing them will succeed.
+     * @return If the parameters were saved true is returned, if not false is
+     *         returned.
+     */
+    bool ErrorRecoveryScope::valid() const
+    {
+        return valid_;
+    }
+
+    /**
+     * Returns the parameters saved when the scope was constructed.
+     * @return The saved parameters.
+     */
+    const ScsiModePage01 &ErrorRecoveryScope::saved() const
+    {
+        return saved_;
+    }
+
+    /**
+     * Changes the error recovery parameters of the device.
+     * @param [in] page The new parameters.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool ErrorRecoveryScope::apply(const ScsiModePage01 &page)
+    {
+        if (!valid_)
+            return false;
+
+        // Assume that a failed request may have been partially applied.
+        changed_ = true;
+        return device_.set_error_recovery(page);
+    }
+
+    /**
+     * Makes the device report unreadable sectors as quickly as possible.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool ErrorRecoveryScope::fail_fast()
+    {
+        ScsiModePage01 page = saved_;
+        page.reset_fail_fast();
+
+        return apply(page);
+    }
+
+    /**
+     * Changes the number of times the device retries reading a sector before
+     * reporting an error. Other parameters are restored to their saved
+     * values.
+     * @param [in] count The number of retries.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool ErrorRecoveryScope::read_retries(unsigned char count)
+    {
+        ScsiModePage01 page = saved_;
+        page.read_retry_count_ = count;
+
+        return apply(page);
+    }
+
+    /**
+     * Restores the saved parameters if they have been changed.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool ErrorRecoveryScope::restore()
+    {
+        if (!changed_)
+            return true;
+
+        changed_ = false;
+        return device_.set_error_recovery(saved_);
+    }
+};
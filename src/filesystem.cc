@@ -0,0 +1,1252 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <ckcore/log.hh>
+#include "ckmmc/buffer.hh"
+#include "ckmmc/filesystem.hh"
+
+namespace ckmmc
+{
+    /**
+     * Defines UDF descriptor tag identifiers.
+     */
+    enum
+    {
+        ckUDF_TAG_AVDP = 2,
+        ckUDF_TAG_PD = 5,
+        ckUDF_TAG_LVD = 6,
+        ckUDF_TAG_TD = 8,
+        ckUDF_TAG_FSD = 256,
+        ckUDF_TAG_FID = 257,
+        ckUDF_TAG_AED = 258,
+        ckUDF_TAG_FE = 261,
+        ckUDF_TAG_EFE = 266
+    };
+
+    static ckcore::tuint16 read_uint16_lsbf(const unsigned char *buffer)
+    {
+        return static_cast<ckcore::tuint16>(buffer[0] | (buffer[1] << 8));
+    }
+
+    static ckcore::tuint32 read_uint32_lsbf(const unsigned char *buffer)
+    {
+        return static_cast<ckcore::tuint32>(buffer[0]) |
+               static_cast<ckcore::tuint32>(buffer[1]) << 8 |
+               static_cast<ckcore::tuint32>(buffer[2]) << 16 |
+               static_cast<ckcore::tuint32>(buffer[3]) << 24;
+    }
+
+    static ckcore::tuint64 read_uint64_lsbf(const unsigned char *buffer)
+    {
+        return static_cast<ckcore::tuint64>(read_uint32_lsbf(buffer)) |
+               static_cast<ckcore::tuint64>(read_uint32_lsbf(buffer + 4)) << 32;
+    }
+
+    /**
+     * Appends a character to a string. Characters that can not be
+     * represented are replaced by underscores.
+     * @param [in, out] str The string.
+     * @param [in] c The character code.
+     */
+    static void append_char(ckcore::tstring &str,ckcore::tuint16 c)
+    {
+        if (sizeof(ckcore::tchar) == 1 && c > 0xff)
+            c = '_';
+
+        str.push_back(static_cast<ckcore::tchar>(c));
+    }
+
+    /**
+     * Decodes an OSTA compressed unicode string.
+     * @param [in] buffer The encoded string, starting with the compression
+     *                    identifier.
+     * @param [in] len The length of the encoded string in bytes.
+     * @param [out] str The decoded string.
+     */
+    static void decode_cs0(const unsigned char *buffer,size_t len,ckcore::tstring &str)
+    {
+        str.clear();
+        if (len == 0)
+            return;
+
+        if (buffer[0] == 16)
+        {
+            for (size_t i = 1; i + 1 < len; i += 2)
+                append_char(str,static_cast<ckcore::tuint16>(buffer[i] << 8 | buffer[i + 1]));
+        }
+        else
+        {
+            for (size_t i = 1; i < len; i++)
+                append_char(str,buffer[i]);
+        }
+    }
+
+    /**
+     * Compares two file names, ignoring the case of ASCII letters.
+     * @param [in] name1 The first name.
+     * @param [in] name2 The second name.
+     * @return If the names are equal true is returned, if not false is
+     *         returned.
+     */
+    static bool equal_nocase(const ckcore::tstring &name1,const ckcore::tstring &name2)
+    {
+        if (name1.size() != name2.size())
+            return false;
+
+        for (size_t i = 0; i < name1.size(); i++)
+        {
+            ckcore::tchar c1 = name1[i];
+            ckcore::tchar c2 = name2[i];
+
+            if (c1 >= 'a' && c1 <= 'z')
+                c1 -= 'a' - 'A';
+            if (c2 >= 'a' && c2 <= 'z')
+                c2 -= 'a' - 'A';
+
+            if (c1 != c2)
+                return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Returns the number of sectors covered by a number of bytes.
+     */
+    static ckcore::tuint32 num_sectors(ckcore::tuint32 len)
+    {
+        return len / 2048 + (len % 2048 != 0 ? 1 : 0);
+    }
+
+    /**
+     * Constructs a FileSystem object.
+     * @param [in] device The device to read from.
+     */
+    FileSystem::FileSystem(MmcDevice &device) : device_(device),
+        cache_(device,ckMETADATA_CACHE_SIZE),type_(ckFS_NONE),susp_skip_(0)
+    {
+    }
+
+    /**
+     * Destructs the FileSystem object.
+     */
+    FileSystem::~FileSystem()
+    {
+    }
+
+    /**
+     * Reads metadata sectors through the sector cache.
+     * @param [in] lba The first sector to read.
+     * @param [in] count The number of sectors to read.
+     * @param [out] data The read data.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool FileSystem::read(ckcore::tuint32 lba,ckcore::tuint32 count,
+                          std::vector<unsigned char> &data)
+    {
+        data.resize(count * 2048);
+        if (count == 0)
+            return true;
+
+        std::vector<MmcDevice::ReadError> errors;
+        return cache_.read(lba,count,&data[0],static_cast<ckcore::tuint32>(data.size()),errors);
+    }
+
+    /**
+     * Reads the complete contents of a small file, used for reading
+     * directories.
+     * @param [in] file The file to read.
+     * @param [out] data The file contents.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool FileSystem::read_data(const File &file,std::vector<unsigned char> &data)
+    {
+        // Directories larger than this are considered corrupt.
+        if (file.size_ > 64 * 1024 * 1024)
+            return false;
+
+        if (!file.inline_.empty())
+        {
+            data = file.inline_;
+            data.resize(static_cast<size_t>(file.size_));
+            return true;
+        }
+
+        data.clear();
+        data.reserve(static_cast<size_t>(file.size_));
+
+        std::vector<unsigned char> extent_data;
+        for (size_t i = 0; i < file.extents_.size(); i++)
+        {
+            const Extent &extent = file.extents_[i];
+            if (extent.recorded_)
+            {
+                if (!read(extent.lba_,num_sectors(extent.length_),extent_data))
+                    return false;
+
+                data.insert(data.end(),extent_data.begin(),extent_data.begin() + extent.length_);
+            }
+            else
+            {
+                data.insert(data.end(),extent.length_,0);
+            }
+        }
+
+        data.resize(static_cast<size_t>(file.size_));
+        return true;
+    }
+
+    /**
+     * Parses an ISO9660 directory record.
+     * @param [in] record The directory record.
+     * @param [out] file The described file.
+     * @param [out] skip Set to true if the record should not be listed.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool FileSystem::parse_iso_record(const unsigned char *record,File &file,
+                                      bool &skip)
+    {
+        skip = false;
+
+        unsigned char len = record[0];
+        unsigned char name_len = record[32];
+        if (len < 34 || 33 + name_len > len)
+            return false;
+
+        unsigned char flags = record[25];
+
+        file.name_.clear();
+        file.directory_ = (flags & 0x02) != 0;
+        file.size_ = read_uint32_lsbf(record + 10);
+        file.extents_.clear();
+        file.extents_.push_back(Extent(read_uint32_lsbf(record + 2) + record[1],
+                                       read_uint32_lsbf(record + 10),true));
+
+        // Skip the current and parent directory entries and associated files.
+        if ((name_len == 1 && record[33] <= 1) || (flags & 0x04))
+            skip = true;
+
+        const unsigned char *name = record + 33;
+        if (type_ == ckFS_JOLIET)
+        {
+            for (unsigned char i = 0; i + 1 < name_len; i += 2)
+                append_char(file.name_,static_cast<ckcore::tuint16>(name[i] << 8 | name[i + 1]));
+        }
+        else
+        {
+            for (unsigned char i = 0; i < name_len; i++)
+                append_char(file.name_,name[i]);
+        }
+
+        // Remove file version and trailing period.
+        size_t delim = file.name_.rfind(';');
+        if (delim != ckcore::tstring::npos)
+            file.name_.erase(delim);
+        if (!file.name_.empty() && file.name_[file.name_.size() - 1] == '.')
+            file.name_.erase(file.name_.size() - 1);
+
+        if (type_ == ckFS_ROCK_RIDGE)
+            parse_rock_ridge(record,file,skip);
+
+        return true;
+    }
+
+    /**
+     * Parses the Rock Ridge entries in the system use area of an ISO9660
+     * directory record.
+     * @param [in] record The directory record.
+     * @param [in, out] file The described file.
+     * @param [out] skip Set to true if the record describes a relocated
+     *                   directory.
+     */
+    void FileSystem::parse_rock_ridge(const unsigned char *record,File &file,
+                                      bool &skip)
+    {
+        unsigned char name_len = record[32];
+        size_t pos = 33 + name_len + (name_len % 2 == 0 ? 1 : 0) + susp_skip_;
+
+        std::vector<unsigned char> area(record + (pos < record[0] ? pos : record[0]),record + record[0]);
+        std::vector<unsigned char> sector;
+        ckcore::tstring name;
+
+        // Limit the number of continuation areas to guard against loops.
+        for (unsigned int areas = 0; areas < 16; areas++)
+        {
+            ckcore::tuint32 ce_lba = 0,ce_offset = 0,ce_len = 0;
+
+            pos = 0;
+            while (pos + 4 <= area.size())
+            {
+                const unsigned char *entry = &area[pos];
+                unsigned char entry_len = entry[2];
+                if (entry_len < 4 || pos + entry_len > area.size())
+                    break;
+
+                if (entry[0] == 'N' && entry[1] == 'M' && entry_len >= 5)
+                {
+                    // Ignore current and parent directory names.
+                    if ((entry[4] & 0x06) == 0)
+                    {
+                        for (unsigned char i = 5; i < entry_len; i++)
+                            append_char(name,entry[i]);
+                    }
+                }
+                else if (entry[0] == 'C' && entry[1] == 'E' && entry_len >= 28)
+                {
+                    ce_lba = read_uint32_lsbf(entry + 4);
+                    ce_offset = read_uint32_lsbf(entry + 12);
+                    ce_len = read_uint32_lsbf(entry + 20);
+                }
+                else if (entry[0] == 'R' && entry[1] == 'E')
+                {
+                    skip = true;
+                }
+                else if (entry[0] == 'C' && entry[1] == 'L' && entry_len >= 12)
+                {
+                    // The directory has been relocated, the size is found in
+                    // the current directory entry of the relocated directory.
+                    ckcore::tuint32 lba = read_uint32_lsbf(entry + 4);
+                    if (read(lba,1,sector) && sector[0] >= 34)
+                    {
+                        file.directory_ = true;
+                        file.size_ = read_uint32_lsbf(&sector[10]);
+                        file.extents_.clear();
+                        file.extents_.push_back(Extent(lba,read_uint32_lsbf(&sector[10]),true));
+                    }
+                }
+                else if (entry[0] == 'S' && entry[1] == 'T')
+                {
+                    break;
+                }
+
+                pos += entry_len;
+            }
+
+            if (ce_len == 0 || ce_offset + ce_len > 2048 || !read(ce_lba,1,sector))
+                break;
+
+            area.assign(sector.begin() + ce_offset,sector.begin() + ce_offset + ce_len);
+        }
+
+        if (!name.empty())
+            file.name_ = name;
+    }
+
+    /**
+     * Opens an ISO9660 file system. Rock Ridge names are preferred over
+     * Joliet names, which are preferred over plain ISO9660 names.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool FileSystem::open_iso()
+    {
+        std::vector<unsigned char> sector;
+
+        File pvd_root,svd_root;
+        bool pvd = false,joliet = false,skip = false;
+
+        type_ = ckFS_ISO9660;
+        for (ckcore::tuint32 lba = 16; lba < 16 + 64; lba++)
+        {
+            if (!read(lba,1,sector))
+                return false;
+
+            const unsigned char *vd = &sector[0];
+            if (memcmp(vd + 1,"CD001",5) != 0 || vd[0] == 255)
+                break;
+
+            if (vd[0] == 1 && !pvd)
+            {
+                pvd = parse_iso_record(vd + 156,pvd_root,skip);
+            }
+            else if (vd[0] == 2 && !joliet && vd[88] == '%' && vd[89] == '/' &&
+                     (vd[90] == '@' || vd[90] == 'C' || vd[90] == 'E'))
+            {
+                joliet = parse_iso_record(vd + 156,svd_root,skip);
+            }
+        }
+
+        if (!pvd)
+        {
+            type_ = ckFS_NONE;
+            return false;
+        }
+
+        // Look for the SUSP indicator in the first root directory record.
+        if (read(pvd_root.extents_[0].lba_,1,sector) && sector[0] >= 34 + 7)
+        {
+            const unsigned char *su = &sector[34];
+            if (su[0] == 'S' && su[1] == 'P' && su[4] == 0xbe && su[5] == 0xef)
+            {
+                susp_skip_ = su[6];
+                type_ = ckFS_ROCK_RIDGE;
+            }
+        }
+
+        if (type_ != ckFS_ROCK_RIDGE && joliet)
+        {
+            type_ = ckFS_JOLIET;
+            root_ = svd_root;
+        }
+        else
+        {
+            root_ = pvd_root;
+        }
+
+        root_.name_.clear();
+        root_.directory_ = true;
+        return true;
+    }
+
+    /**
+     * Lists the contents of an ISO9660 directory.
+     * @param [in] dir The directory.
+     * @param [out] files The directory contents.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool FileSystem::list_iso(const File &dir,std::vector<File> &files)
+    {
+        std::vector<unsigned char> data;
+        if (!read_data(dir,data))
+            return false;
+
+        bool multi_extent = false;
+
+        size_t pos = 0;
+        while (pos < data.size())
+        {
+            // Records do not cross sector boundaries.
+            unsigned char len = data[pos];
+            if (len == 0)
+            {
+                pos = (pos / 2048 + 1) * 2048;
+                continue;
+            }
+
+            if (pos + len > data.size())
+                break;
+
+            File file;
+            bool skip = false;
+            if (parse_iso_record(&data[pos],file,skip) && !skip)
+            {
+                if (multi_extent && !files.empty() && files.back().name_ == file.name_)
+                {
+                    files.back().size_ += file.size_;
+                    files.back().extents_.push_back(file.extents_[0]);
+                }
+                else
+                {
+                    file.path_ = dir.path_.empty() ? file.name_ : dir.path_ + ckT("/") + file.name_;
+                    files.push_back(file);
+                }
+
+                multi_extent = (data[pos + 25] & 0x80) != 0;
+            }
+
+            pos += len;
+        }
+
+        return true;
+    }
+
+    /**
+     * Reads a UDF descriptor and verifies its tag.
+     * @param [in] lba The sector containing the descriptor.
+     * @param [in] id The expected tag identifier, 0 to accept any tag.
+     * @param [out] buffer Buffer of 2048 bytes receiving the descriptor.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool FileSystem::read_tag(ckcore::tuint32 lba,ckcore::tuint16 id,unsigned char *buffer)
+    {
+        std::vector<unsigned char> sector;
+        if (!read(lba,1,sector))
+            return false;
+
+        memcpy(buffer,&sector[0],2048);
+
+        unsigned char checksum = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            if (i != 4)
+                checksum += buffer[i];
+        }
+
+        if (checksum != buffer[4])
+            return false;
+
+        return id == 0 || read_uint16_lsbf(buffer) == id;
+    }
+
+    /**
+     * Translates a logical block number in a UDF partition into a sector
+     * address.
+     * @param [in] part The partition reference number.
+     * @param [in] lbn The logical block number.
+     * @param [out] lba The sector address.
+     * @param [out] avail The number of consecutive blocks starting at the
+     *                    sector.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool FileSystem::map_block(ckcore::tuint16 part,ckcore::tuint32 lbn,
+                               ckcore::tuint32 &lba,ckcore::tuint32 &avail)
+    {
+        if (part >= maps_.size())
+            return false;
+
+        const PartitionMap &map = maps_[part];
+        if (!map.metadata_)
+        {
+            lba = map.start_ + lbn;
+            avail = 0xffffffff - lbn;
+            return true;
+        }
+
+        // Blocks of a metadata partition are stored in the metadata file.
+        for (size_t i = 0; i < map.extents_.size(); i++)
+        {
+            ckcore::tuint32 blocks = map.extents_[i].length_ / 2048;
+            if (lbn < blocks)
+            {
+                lba = map.extents_[i].lba_ + lbn;
+                avail = blocks - lbn;
+                return true;
+            }
+
+            lbn -= blocks;
+        }
+
+        return false;
+    }
+
+    /**
+     * Adds an extent to a UDF file, the extent is split if it is not
+     * contiguous on disc.
+     * @param [in, out] file The file.
+     * @param [in] part The partition reference number.
+     * @param [in] lbn The first logical block of the extent.
+     * @param [in] length The extent length in bytes.
+     * @param [in] recorded Set to false if the extent is not recorded.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool FileSystem::add_extent(File &file,ckcore::tuint16 part,ckcore::tuint32 lbn,
+                                ckcore::tuint32 length,bool recorded)
+    {
+        if (!recorded)
+        {
+            file.extents_.push_back(Extent(0,length,false));
+            return true;
+        }
+
+        while (length > 0)
+        {
+            ckcore::tuint32 lba = 0,avail = 0;
+            if (!map_block(part,lbn,lba,avail))
+                return false;
+
+            ckcore::tuint64 avail_bytes = static_cast<ckcore::tuint64>(avail) * 2048;
+            ckcore::tuint32 cur = length < avail_bytes ? length : static_cast<ckcore::tuint32>(avail_bytes);
+
+            // Merge with the previous extent if contiguous.
+            if (!file.extents_.empty())
+            {
+                Extent &last = file.extents_.back();
+                if (last.recorded_ && last.length_ % 2048 == 0 &&
+                    last.lba_ + last.length_ / 2048 == lba &&
+                    static_cast<ckcore::tuint64>(last.length_) + cur <= 0x7ffff800)
+                {
+                    last.length_ += cur;
+                    length -= cur;
+                    lbn += cur / 2048;
+                    continue;
+                }
+            }
+
+            file.extents_.push_back(Extent(lba,cur,true));
+            length -= cur;
+            lbn += cur / 2048;
+        }
+
+        return true;
+    }
+
+    /**
+     * Reads the allocation descriptors of a UDF file entry, following
+     * allocation extent descriptors.
+     * @param [in, out] file The file.
+     * @param [in] part The partition reference number of the file entry.
+     * @param [in] ad The first allocation descriptor.
+     * @param [in] ad_len The length of the allocation descriptors in bytes.
+     * @param [in] ad_type The allocation descriptor type.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool FileSystem::read_allocs(File &file,ckcore::tuint16 part,const unsigned char *ad,
+                                 ckcore::tuint32 ad_len,unsigned int ad_type)
+    {
+        size_t ad_size = ad_type == 0 ? 8 : ad_type == 1 ? 16 : 20;
+        if (ad_type > 2)
+            return false;
+
+        unsigned char buffer[2048];
+        std::vector<unsigned char> next;
+
+        // Limit the number of allocation extents to guard against loops.
+        unsigned int num_aed = 0;
+
+        size_t pos = 0;
+        while (pos + ad_size <= ad_len)
+        {
+            ckcore::tuint32 len_field = read_uint32_lsbf(ad + pos);
+            ckcore::tuint32 length = len_field & 0x3fffffff;
+            unsigned int kind = len_field >> 30;
+            if (length == 0)
+                break;
+
+            ckcore::tuint32 lbn = 0;
+            ckcore::tuint16 ad_part = part;
+            switch (ad_type)
+            {
+                case 0:
+                    lbn = read_uint32_lsbf(ad + pos + 4);
+                    break;
+
+                case 1:
+                    lbn = read_uint32_lsbf(ad + pos + 4);
+                    ad_part = read_uint16_lsbf(ad + pos + 8);
+                    break;
+
+                case 2:
+                    lbn = read_uint32_lsbf(ad + pos + 12);
+                    ad_part = read_uint16_lsbf(ad + pos + 16);
+                    break;
+            }
+
+            if (kind == 3)
+            {
+                // Continue with the next allocation extent.
+                ckcore::tuint32 lba = 0,avail = 0;
+                if (++num_aed > 1024 || !map_block(ad_part,lbn,lba,avail) ||
+                    !read_tag(lba,ckUDF_TAG_AED,buffer))
+                {
+                    return false;
+                }
+
+                ad_len = read_uint32_lsbf(buffer + 20);
+                if (ad_len > 2048 - 24)
+                    return false;
+
+                next.assign(buffer + 24,buffer + 24 + ad_len);
+                ad = next.empty() ? buffer : &next[0];
+                pos = 0;
+                continue;
+            }
+
+            if (!add_extent(file,ad_part,lbn,length,kind == 0))
+                return false;
+
+            pos += ad_size;
+        }
+
+        return true;
+    }
+
+    /**
+     * Reads a UDF file entry.
+     * @param [in] part The partition reference number.
+     * @param [in] lbn The logical block of the file entry.
+     * @param [in, out] file The file.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool FileSystem::read_icb(ckcore::tuint16 part,ckcore::tuint32 lbn,File &file)
+    {
+        ckcore::tuint32 lba = 0,avail = 0;
+        if (!map_block(part,lbn,lba,avail))
+            return false;
+
+        unsigned char buffer[2048];
+        if (!read_tag(lba,0,buffer))
+            return false;
+
+        ckcore::tuint16 id = read_uint16_lsbf(buffer);
+        if (id != ckUDF_TAG_FE && id != ckUDF_TAG_EFE)
+            return false;
+
+        file.directory_ = buffer[27] == 4;
+        file.size_ = read_uint64_lsbf(buffer + 56);
+        file.extents_.clear();
+        file.inline_.clear();
+
+        ckcore::tuint32 base = id == ckUDF_TAG_FE ? 176 : 216;
+        ckcore::tuint32 ea_len = read_uint32_lsbf(buffer + base - 8);
+        ckcore::tuint32 ad_len = read_uint32_lsbf(buffer + base - 4);
+        if (ea_len > 2048 || ad_len > 2048 || base + ea_len + ad_len > 2048)
+            return false;
+
+        const unsigned char *ad = buffer + base + ea_len;
+
+        unsigned int ad_type = read_uint16_lsbf(buffer + 34) & 0x07;
+        if (ad_type == 3)
+        {
+            file.inline_.assign(ad,ad + ad_len);
+            return true;
+        }
+
+        if (!read_allocs(file,part,ad,ad_len,ad_type))
+            return false;
+
+        // The last extent may be longer than the file.
+        ckcore::tuint64 total = 0;
+        for (size_t i = 0; i < file.extents_.size(); i++)
+        {
+            if (total >= file.size_)
+            {
+                file.extents_.erase(file.extents_.begin() + i,file.extents_.end());
+                break;
+            }
+
+            if (total + file.extents_[i].length_ > file.size_)
+                file.extents_[i].length_ = static_cast<ckcore::tuint32>(file.size_ - total);
+
+            total += file.extents_[i].length_;
+        }
+
+        return true;
+    }
+
+    /**
+     * Opens a UDF file system, metadata partitions are supported.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool FileSystem::open_udf()
+    {
+        unsigned char buffer[2048];
+
+        // Locate an anchor volume descriptor pointer.
+        std::vector<ckcore::tuint32> anchors;
+        anchors.push_back(256);
+
+        ckcore::tuint32 last_lba = 0,block_len = 0;
+        if (device_.read_capacity(last_lba,block_len) && last_lba > 512)
+        {
+            anchors.push_back(last_lba - 256);
+            anchors.push_back(last_lba);
+        }
+
+        bool found = false;
+        for (size_t i = 0; i < anchors.size() && !found; i++)
+            found = read_tag(anchors[i],ckUDF_TAG_AVDP,buffer);
+
+        if (!found)
+            return false;
+
+        ckcore::tuint32 vds_len = read_uint32_lsbf(buffer + 16) / 2048;
+        ckcore::tuint32 vds_lba = read_uint32_lsbf(buffer + 20);
+
+        // Walk the main volume descriptor sequence.
+        std::vector<std::pair<ckcore::tuint16,ckcore::tuint32> > partitions;
+        std::vector<unsigned char> lvd;
+
+        for (ckcore::tuint32 i = 0; i < vds_len && i < 256; i++)
+        {
+            if (!read_tag(vds_lba + i,0,buffer))
+                continue;
+
+            ckcore::tuint16 id = read_uint16_lsbf(buffer);
+            if (id == ckUDF_TAG_PD)
+                partitions.push_back(std::make_pair(read_uint16_lsbf(buffer + 22),
+                                                    read_uint32_lsbf(buffer + 188)));
+            else if (id == ckUDF_TAG_LVD && lvd.empty())
+                lvd.assign(buffer,buffer + 2048);
+            else if (id == ckUDF_TAG_TD)
+                break;
+        }
+
+        if (lvd.empty() || partitions.empty() || read_uint32_lsbf(&lvd[212]) != 2048)
+            return false;
+
+        // Parse partition maps.
+        maps_.clear();
+
+        ckcore::tuint32 map_table_len = read_uint32_lsbf(&lvd[264]);
+        ckcore::tuint32 num_maps = read_uint32_lsbf(&lvd[268]);
+        if (440 + map_table_len > lvd.size())
+            return false;
+
+        size_t pos = 440;
+        for (ckcore::tuint32 i = 0; i < num_maps && pos + 6 <= 440 + map_table_len; i++)
+        {
+            const unsigned char *map = &lvd[pos];
+
+            PartitionMap part_map;
+            if (map[0] == 1)
+            {
+                part_map.number_ = read_uint16_lsbf(map + 4);
+            }
+            else if (map[0] == 2 && pos + 64 <= lvd.size())
+            {
+                part_map.number_ = read_uint16_lsbf(map + 38);
+
+                const char *ident = reinterpret_cast<const char *>(map + 5);
+                if (memcmp(ident,"*UDF Metadata Partition",23) == 0)
+                {
+                    part_map.metadata_ = true;
+                    part_map.metadata_lbn_ = read_uint32_lsbf(map + 40);
+                    part_map.mirror_lbn_ = read_uint32_lsbf(map + 44);
+                }
+                else if (memcmp(ident,"*UDF Sparable Partition",23) != 0)
+                {
+                    // Virtual partitions are not supported.
+                    ckcore::log::print_line(ckT("[filesystem]: unsupported UDF partition map."));
+                    return false;
+                }
+            }
+            else
+            {
+                return false;
+            }
+
+            bool resolved = false;
+            for (size_t j = 0; j < partitions.size(); j++)
+            {
+                if (partitions[j].first == part_map.number_)
+                {
+                    part_map.start_ = partitions[j].second;
+                    resolved = true;
+                }
+            }
+
+            if (!resolved)
+                return false;
+
+            maps_.push_back(part_map);
+            pos += map[1];
+        }
+
+        // Locate the metadata files, they live in the physical partition
+        // with the same partition number.
+        for (size_t i = 0; i < maps_.size(); i++)
+        {
+            if (!maps_[i].metadata_)
+                continue;
+
+            ckcore::tuint16 phys = 0xffff;
+            for (size_t j = 0; j < maps_.size(); j++)
+            {
+                if (!maps_[j].metadata_ && maps_[j].number_ == maps_[i].number_)
+                    phys = static_cast<ckcore::tuint16>(j);
+            }
+
+            File metadata;
+            if (phys == 0xffff ||
+                (!read_icb(phys,maps_[i].metadata_lbn_,metadata) &&
+                 !read_icb(phys,maps_[i].mirror_lbn_,metadata)))
+            {
+                ckcore::log::print_line(ckT("[filesystem]: unable to read UDF metadata file."));
+                return false;
+            }
+
+            maps_[i].extents_ = metadata.extents_;
+        }
+
+        // Read the file set descriptor.
+        ckcore::tuint32 lba = 0,avail = 0;
+        if (!map_block(read_uint16_lsbf(&lvd[256]),read_uint32_lsbf(&lvd[252]),lba,avail) ||
+            !read_tag(lba,ckUDF_TAG_FSD,buffer))
+        {
+            return false;
+        }
+
+        root_ = File();
+        if (!read_icb(read_uint16_lsbf(buffer + 408),read_uint32_lsbf(buffer + 404),root_) ||
+            !root_.directory_)
+        {
+            return false;
+        }
+
+        type_ = ckFS_UDF;
+        return true;
+    }
+
+    /**
+     * Lists the contents of a UDF directory.
+     * @param [in] dir The directory.
+     * @param [out] files The directory contents.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool FileSystem::list_udf(const File &dir,std::vector<File> &files)
+    {
+        std::vector<unsigned char> data;
+        if (!read_data(dir,data))
+            return false;
+
+        size_t pos = 0;
+        while (pos + 38 <= data.size())
+        {
+            const unsigned char *fid = &data[pos];
+            if (read_uint16_lsbf(fid) != ckUDF_TAG_FID)
+                break;
+
+            unsigned char characteristics = fid[18];
+            unsigned char name_len = fid[19];
+            ckcore::tuint16 impl_len = read_uint16_lsbf(fid + 36);
+            if (pos + 38 + impl_len + name_len > data.size())
+                break;
+
+            // Skip deleted files and the parent directory.
+            if ((characteristics & 0x0c) == 0)
+            {
+                File file;
+                decode_cs0(fid + 38 + impl_len,name_len,file.name_);
+
+                if (read_icb(read_uint16_lsbf(fid + 28),read_uint32_lsbf(fid + 24),file))
+                {
+                    file.path_ = dir.path_.empty() ? file.name_ : dir.path_ + ckT("/") + file.name_;
+                    files.push_back(file);
+                }
+                else
+                {
+                    ckcore::log::print_line(ckT("[filesystem]: unable to read UDF file entry."));
+                }
+            }
+
+            pos += (38 + impl_len + name_len + 3) & ~3;
+        }
+
+        return true;
+    }
+
+    /**
+     * Opens the file system of the inserted disc. UDF is preferred over
+     * ISO9660 on bridge discs.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool FileSystem::open()
+    {
+        close();
+
+        if (open_udf())
+            return true;
+
+        maps_.clear();
+        return open_iso();
+    }
+
+    /**
+     * Closes the file system and drops all cached metadata.
+     */
+    void FileSystem::close()
+    {
+        type_ = ckFS_NONE;
+        root_ = File();
+        susp_skip_ = 0;
+        maps_.clear();
+
+        cache_.invalidate();
+    }
+
+    /**
+     * Returns the type of the opened file system.
+     * @return The file system type.
+     */
+    FileSystem::Type FileSystem::type() const
+    {
+        return type_;
+    }
+
+    /**
+     * Returns the root directory.
+     * @return The root directory.
+     */
+    const FileSystem::File &FileSystem::root() const
+    {
+        return root_;
+    }
+
+    /**
+     * Lists the contents of a directory.
+     * @param [in] dir The directory.
+     * @param [out] files The directory contents.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool FileSystem::list(const File &dir,std::vector<File> &files)
+    {
+        files.clear();
+        if (!dir.directory_)
+            return false;
+
+        switch (type_)
+        {
+            case ckFS_ISO9660:
+            case ckFS_JOLIET:
+            case ckFS_ROCK_RIDGE:
+                return list_iso(dir,files);
+
+            case ckFS_UDF:
+                return list_udf(dir,files);
+
+            default:
+                return false;
+        }
+    }
+
+    /**
+     * Collects all files in a directory tree.
+     * @param [in] dir The root of the tree.
+     * @param [in, out] files The files in the tree are added to this list.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool FileSystem::collect(const File &dir,std::vector<File> &files)
+    {
+        std::vector<File> dirs;
+        dirs.push_back(dir);
+
+        // Guard against directory loops.
+        size_t num_dirs = 0;
+
+        while (!dirs.empty())
+        {
+            File cur = dirs.back();
+            dirs.pop_back();
+
+            if (++num_dirs > 65536)
+                return false;
+
+            std::vector<File> contents;
+            if (!list(cur,contents))
+                return false;
+
+            for (size_t i = 0; i < contents.size(); i++)
+            {
+                if (contents[i].directory_)
+                    dirs.push_back(contents[i]);
+                else
+                    files.push_back(contents[i]);
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Finds a file by its path. Path components may be separated by slashes
+     * or backslashes. Plain ISO9660 names are compared without regard to
+     * case.
+     * @param [in] path The path relative to the root directory.
+     * @param [out] file The found file.
+     * @return If the file was found true is returned, if not false is
+     *         returned.
+     */
+    bool FileSystem::find(const ckcore::tchar *path,File &file)
+    {
+        File cur = root_;
+
+        const ckcore::tchar *p = path;
+        while (*p != '\0')
+        {
+            while (*p == '/' || *p == '\\')
+                p++;
+
+            ckcore::tstring name;
+            while (*p != '\0' && *p != '/' && *p != '\\')
+                name.push_back(*p++);
+
+            if (name.empty())
+                break;
+
+            std::vector<File> contents;
+            if (!list(cur,contents))
+                return false;
+
+            bool found = false;
+            for (size_t i = 0; i < contents.size() && !found; i++)
+            {
+                if (contents[i].name_ == name ||
+                    (type_ == ckFS_ISO9660 && equal_nocase(contents[i].name_,name)))
+                {
+                    cur = contents[i];
+                    found = true;
+                }
+            }
+
+            if (!found)
+                return false;
+        }
+
+        file = cur;
+        return true;
+    }
+
+    /**
+     * Extracts a number of files in a single pass over the disc. The extents
+     * of all files are sorted by their location and read in LBA order. Small
+     * gaps between extents are read through instead of seeking.
+     * @param [in] files The files to extract, directories are ignored.
+     * @param [in] sink The sink receiving the file data.
+     * @return If all files were extracted true is returned, if not false is
+     *         returned.
+     */
+    bool FileSystem::extract(const std::vector<File> &files,Sink &sink)
+    {
+        bool res = true;
+
+        std::vector<Piece> pieces;
+        std::vector<unsigned char> zeros;
+
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            const File &file = files[i];
+            if (file.directory_)
+                continue;
+
+            if (!file.inline_.empty())
+            {
+                ckcore::tuint32 len = static_cast<ckcore::tuint32>(file.inline_.size());
+                if (file.size_ < len)
+                    len = static_cast<ckcore::tuint32>(file.size_);
+
+                if (!sink.write(i,0,&file.inline_[0],len))
+                    return false;
+
+                continue;
+            }
+
+            ckcore::tuint64 offset = 0;
+            for (size_t j = 0; j < file.extents_.size(); j++)
+            {
+                const Extent &extent = file.extents_[j];
+                if (extent.recorded_ && extent.length_ > 0)
+                {
+                    pieces.push_back(Piece(i,offset,extent.lba_,extent.length_));
+                }
+                else if (!extent.recorded_)
+                {
+                    if (zeros.empty())
+                        zeros.resize(64 * 1024,0);
+
+                    for (ckcore::tuint32 pos = 0; pos < extent.length_;)
+                    {
+                        ckcore::tuint32 len = extent.length_ - pos;
+                        if (len > zeros.size())
+                            len = static_cast<ckcore::tuint32>(zeros.size());
+
+                        if (!sink.write(i,offset + pos,&zeros[0],len))
+                            return false;
+
+                        pos += len;
+                    }
+                }
+
+                offset += extent.length_;
+            }
+        }
+
+        std::stable_sort(pieces.begin(),pieces.end());
+
+        AlignedBuffer buffer;
+        if (!pieces.empty() && !buffer.allocate(ckEXTRACT_BUFFER_SIZE))
+        {
+            ckcore::log::print_line(ckT("[filesystem]: unable to allocate extraction buffer."));
+            return false;
+        }
+
+        ckcore::tuint32 window_sectors = buffer.size() / 2048;
+        std::vector<MmcDevice::ReadError> errors;
+
+        size_t i = 0;
+        while (i < pieces.size())
+        {
+            // Group pieces that are close enough to be read in one pass.
+            ckcore::tuint32 run_first = pieces[i].lba_;
+            ckcore::tuint32 run_end = run_first + num_sectors(pieces[i].length_);
+
+            size_t j = i + 1;
+            while (j < pieces.size() &&
+                   (pieces[j].lba_ <= run_end || pieces[j].lba_ - run_end <= ckMAX_GAP))
+            {
+                ckcore::tuint32 end = pieces[j].lba_ + num_sectors(pieces[j].length_);
+                if (end > run_end)
+                    run_end = end;
+                j++;
+            }
+
+            size_t first_active = i;
+            for (ckcore::tuint32 win = run_first; win < run_end;)
+            {
+                ckcore::tuint32 win_count = run_end - win < window_sectors ?
+                    run_end - win : window_sectors;
+                ckcore::tuint32 win_end = win + win_count;
+
+                // Unreadable sectors are zero filled and reported below.
+                device_.read_sectors(win,win_count,buffer.data(),buffer.size(),errors);
+
+                while (first_active < j &&
+                       pieces[first_active].lba_ + num_sectors(pieces[first_active].length_) <= win)
+                {
+                    first_active++;
+                }
+
+                for (size_t k = first_active; k < j && pieces[k].lba_ < win_end; k++)
+                {
+                    const Piece &piece = pieces[k];
+                    ckcore::tuint32 piece_end = piece.lba_ + num_sectors(piece.length_);
+                    if (piece_end <= win)
+                        continue;
+
+                    ckcore::tuint32 first = piece.lba_ > win ? piece.lba_ : win;
+                    ckcore::tuint32 end = piece_end < win_end ? piece_end : win_end;
+
+                    ckcore::tuint32 byte_first = (first - piece.lba_) * 2048;
+                    ckcore::tuint32 byte_end = (end - piece.lba_) * 2048;
+                    if (byte_end > piece.length_ || byte_end < byte_first)
+                        byte_end = piece.length_;
+
+                    if (!sink.write(piece.file_,piece.offset_ + byte_first,
+                                    buffer.data() + (first - win) * 2048,byte_end - byte_first))
+                    {
+                        return false;
+                    }
+
+                    for (size_t e = 0; e < errors.size(); e++)
+                    {
+                        ckcore::tuint32 err_first = errors[e].lba_ > first ? errors[e].lba_ : first;
+                        ckcore::tuint32 err_end = errors[e].lba_ + errors[e].count_ < end ?
+                            errors[e].lba_ + errors[e].count_ : end;
+                        if (err_first >= err_end)
+                            continue;
+
+                        ckcore::tuint32 err_byte_first = (err_first - piece.lba_) * 2048;
+                        ckcore::tuint32 err_byte_end = (err_end - piece.lba_) * 2048;
+                        if (err_byte_end > piece.length_)
+                            err_byte_end = piece.length_;
+
+                        sink.error(piece.file_,piece.offset_ + err_byte_first,
+                                   err_byte_end - err_byte_first);
+                        res = false;
+                    }
+                }
+
+                win = win_end;
+            }
+
+            i = j;
+        }
+
+        return res;
+    }
+};
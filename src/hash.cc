@@ -0,0 +1,400 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "ckmmc/hash.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief CRC-32 lookup table class.
+     * Table for slice-by-8 CRC-32 calculation, generated once when the
+     * library is loaded.
+     */
+    class Crc32Table
+    {
+    public:
+        ckcore::tuint32 table_[8][256];
+
+        Crc32Table()
+        {
+            for (ckcore::tuint32 i = 0; i < 256; i++)
+            {
+                ckcore::tuint32 crc = i;
+                for (int j = 0; j < 8; j++)
+                    crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+
+                table_[0][i] = crc;
+            }
+
+            for (ckcore::tuint32 i = 0; i < 256; i++)
+            {
+                for (int j = 1; j < 8; j++)
+                    table_[j][i] = (table_[j - 1][i] >> 8) ^ table_[0][table_[j - 1][i] & 0xff];
+            }
+        }
+    };
+
+    static const Crc32Table crc32_table;
+
+    /**
+     * Constructs a Crc32 object.
+     */
+    Crc32::Crc32() : crc_(0xffffffff)
+    {
+    }
+
+    /**
+     * Restarts the checksum calculation.
+     */
+    void Crc32::reset()
+    {
+        crc_ = 0xffffffff;
+    }
+
+    /**
+     * Adds data to the checksum.
+     * @param [in] data The data.
+     * @param [in] len The number of bytes.
+     */
+    void Crc32::update(const unsigned char *data,size_t len)
+    {
+        const ckcore::tuint32 (*t)[256] = crc32_table.table_;
+        ckcore::tuint32 crc = crc_;
+
+        for (; len >= 8; len -= 8, data += 8)
+        {
+            ckcore::tuint32 lo = crc ^ (data[0] | data[1] << 8 | data[2] << 16 |
+                                        static_cast<ckcore::tuint32>(data[3]) << 24);
+            crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+                  t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+                  t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+        }
+
+        while (len-- > 0)
+            crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xff];
+
+        crc_ = crc;
+    }
+
+    /**
+     * Returns the checksum of the data added so far.
+     * @return The CRC-32 checksum.
+     */
+    ckcore::tuint32 Crc32::checksum() const
+    {
+        return crc_ ^ 0xffffffff;
+    }
+
+    static inline ckcore::tuint32 rol(ckcore::tuint32 x,int n)
+    {
+        return (x << n) | (x >> (32 - n));
+    }
+
+    static inline ckcore::tuint32 ror(ckcore::tuint32 x,int n)
+    {
+        return (x >> n) | (x << (32 - n));
+    }
+
+    /**
+     * Constructs an Md5 object.
+     */
+    Md5::Md5()
+    {
+        reset();
+    }
+
+    /**
+     * Processes one 64 byte block.
+     * @param [in] block The block.
+     */
+    void Md5::transform(const unsigned char *block)
+    {
+        static const ckcore::tuint32 k[64] =
+        {
+            0xd76aa478,0xe8c7b756,0x242070db,0xc1bdceee,0xf57c0faf,0x4787c62a,0xa8304613,0xfd469501,
+            0x698098d8,0x8b44f7af,0xffff5bb1,0x895cd7be,0x6b901122,0xfd987193,0xa679438e,0x49b40821,
+            0xf61e2562,0xc040b340,0x265e5a51,0xe9b6c7aa,0xd62f105d,0x02441453,0xd8a1e681,0xe7d3fbc8,
+            0x21e1cde6,0xc33707d6,0xf4d50d87,0x455a14ed,0xa9e3e905,0xfcefa3f8,0x676f02d9,0x8d2a4c8a,
+            0xfffa3942,0x8771f681,0x6d9d6122,0xfde5380c,0xa4beea44,0x4bdecfa9,0xf6bb4b60,0xbebfbc70,
+            0x289b7ec6,0xeaa127fa,0xd4ef3085,0x04881d05,0xd9d4d039,0xe6db99e5,0x1fa27cf8,0xc4ac5665,
+            0xf4292244,0x432aff97,0xab9423a7,0xfc93a039,0x655b59c3,0x8f0ccc92,0xffeff47d,0x85845dd1,
+            0x6fa87e4f,0xfe2ce6e0,0xa3014314,0x4e0811a1,0xf7537e82,0xbd3af235,0x2ad7d2bb,0xeb86d391
+        };
+
+        static const int r[64] =
+        {
+            7,12,17,22,7,12,17,22,7,12,17,22,7,12,17,22,
+            5,9,14,20,5,9,14,20,5,9,14,20,5,9,14,20,
+            4,11,16,23,4,11,16,23,4,11,16,23,4,11,16,23,
+            6,10,15,21,6,10,15,21,6,10,15,21,6,10,15,21
+        };
+
+        ckcore::tuint32 w[16];
+        for (int i = 0; i < 16; i++)
+        {
+            w[i] = block[i * 4] | block[i * 4 + 1] << 8 | block[i * 4 + 2] << 16 |
+                   static_cast<ckcore::tuint32>(block[i * 4 + 3]) << 24;
+        }
+
+        ckcore::tuint32 a = state_[0],b = state_[1],c = state_[2],d = state_[3];
+        for (int i = 0; i < 64; i++)
+        {
+            ckcore::tuint32 f;
+            int g;
+            if (i < 16)
+            {
+                f = (b & c) | (~b & d);
+                g = i;
+            }
+            else if (i < 32)
+            {
+                f = (d & b) | (~d & c);
+                g = (5 * i + 1) & 15;
+            }
+            else if (i < 48)
+            {
+                f = b ^ c ^ d;
+                g = (3 * i + 5) & 15;
+            }
+            else
+            {
+                f = c ^ (b | ~d);
+                g = (7 * i) & 15;
+            }
+
+            ckcore::tuint32 tmp = d;
+            d = c;
+            c = b;
+            b = b + rol(a + f + k[i] + w[g],r[i]);
+            a = tmp;
+        }
+
+        state_[0] += a;
+        state_[1] += b;
+        state_[2] += c;
+        state_[3] += d;
+    }
+
+    /**
+     * Restarts the digest calculation.
+     */
+    void Md5::reset()
+    {
+        state_[0] = 0x67452301;
+        state_[1] = 0xefcdab89;
+        state_[2] = 0x98badcfe;
+        state_[3] = 0x10325476;
+        count_ = 0;
+    }
+
+    /**
+     * Adds data to the digest.
+     * @param [in] data The data.
+     * @param [in] len The number of bytes.
+     */
+    void Md5::update(const unsigned char *data,size_t len)
+    {
+        size_t used = static_cast<size_t>(count_ & 63);
+        count_ += len;
+
+        if (used > 0)
+        {
+            size_t fill = 64 - used;
+            if (len < fill)
+            {
+                memcpy(block_ + used,data,len);
+                return;
+            }
+
+            memcpy(block_ + used,data,fill);
+            transform(block_);
+            data += fill;
+            len -= fill;
+        }
+
+        for (; len >= 64; len -= 64, data += 64)
+            transform(data);
+
+        memcpy(block_,data,len);
+    }
+
+    /**
+     * Finishes the digest calculation.
+     * @param [out] digest The MD5 digest.
+     */
+    void Md5::digest(unsigned char digest[16])
+    {
+        ckcore::tuint64 bits = count_ << 3;
+
+        unsigned char pad[72];
+        memset(pad,0,sizeof(pad));
+        pad[0] = 0x80;
+
+        size_t used = static_cast<size_t>(count_ & 63);
+        size_t pad_len = used < 56 ? 56 - used : 120 - used;
+        for (int i = 0; i < 8; i++)
+            pad[pad_len + i] = static_cast<unsigned char>(bits >> (i * 8));
+
+        update(pad,pad_len + 8);
+
+        for (int i = 0; i < 16; i++)
+            digest[i] = static_cast<unsigned char>(state_[i >> 2] >> ((i & 3) * 8));
+    }
+
+    /**
+     * Constructs a Sha256 object.
+     */
+    Sha256::Sha256()
+    {
+        reset();
+    }
+
+    /**
+     * Processes one 64 byte block.
+     * @param [in] block The block.
+     */
+    void Sha256::transform(const unsigned char *block)
+    {
+        static const ckcore::tuint32 k[64] =
+        {
+            0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+            0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+            0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+            0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+            0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+            0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+            0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+            0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
+        };
+
+        ckcore::tuint32 w[64];
+        for (int i = 0; i < 16; i++)
+        {
+            w[i] = static_cast<ckcore::tuint32>(block[i * 4]) << 24 | block[i * 4 + 1] << 16 |
+                   block[i * 4 + 2] << 8 | block[i * 4 + 3];
+        }
+
+        for (int i = 16; i < 64; i++)
+        {
+            ckcore::tuint32 s0 = ror(w[i - 15],7) ^ ror(w[i - 15],18) ^ (w[i - 15] >> 3);
+            ckcore::tuint32 s1 = ror(w[i - 2],17) ^ ror(w[i - 2],19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        ckcore::tuint32 a = state_[0],b = state_[1],c = state_[2],d = state_[3];
+        ckcore::tuint32 e = state_[4],f = state_[5],g = state_[6],h = state_[7];
+        for (int i = 0; i < 64; i++)
+        {
+            ckcore::tuint32 s1 = ror(e,6) ^ ror(e,11) ^ ror(e,25);
+            ckcore::tuint32 ch = (e & f) ^ (~e & g);
+            ckcore::tuint32 t1 = h + s1 + ch + k[i] + w[i];
+            ckcore::tuint32 s0 = ror(a,2) ^ ror(a,13) ^ ror(a,22);
+            ckcore::tuint32 maj = (a & b) ^ (a & c) ^ (b & c);
+            ckcore::tuint32 t2 = s0 + maj;
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state_[0] += a;
+        state_[1] += b;
+        state_[2] += c;
+        state_[3] += d;
+        state_[4] += e;
+        state_[5] += f;
+        state_[6] += g;
+        state_[7] += h;
+    }
+
+    /**
+     * Restarts the digest calculation.
+     */
+    void Sha256::reset()
+    {
+        state_[0] = 0x6a09e667;
+        state_[1] = 0xbb67ae85;
+        state_[2] = 0x3c6ef372;
+        state_[3] = 0xa54ff53a;
+        state_[4] = 0x510e527f;
+        state_[5] = 0x9b05688c;
+        state_[6] = 0x1f83d9ab;
+        state_[7] = 0x5be0cd19;
+        count_ = 0;
+    }
+
+    /**
+     * Adds data to the digest.
+     * @param [in] data The data.
+     * @param [in] len The number of bytes.
+     */
+    void Sha256::update(const unsigned char *data,size_t len)
+    {
+        size_t used = static_cast<size_t>(count_ & 63);
+        count_ += len;
+
+        if (used > 0)
+        {
+            size_t fill = 64 - used;
+            if (len < fill)
+            {
+                memcpy(block_ + used,data,len);
+                return;
+            }
+
+            memcpy(block_ + used,data,fill);
+            transform(block_);
+            data += fill;
+            len -= fill;
+        }
+
+        for (; len >= 64; len -= 64, data += 64)
+            transform(data);
+
+        memcpy(block_,data,len);
+    }
+
+    /**
+     * Finishes the digest calculation.
+     * @param [out] digest The SHA-256 digest.
+     */
+    void Sha256::digest(unsigned char digest[32])
+    {
+        ckcore::tuint64 bits = count_ << 3;
+
+        unsigned char pad[72];
+        memset(pad,0,sizeof(pad));
+        pad[0] = 0x80;
+
+        size_t used = static_cast<size_t>(count_ & 63);
+        size_t pad_len = used < 56 ? 56 - used : 120 - used;
+        for (int i = 0; i < 8; i++)
+            pad[pad_len + i] = static_cast<unsigned char>(bits >> ((7 - i) * 8));
+
+        update(pad,pad_len + 8);
+
+        for (int i = 0; i < 32; i++)
+            digest[i] = static_cast<unsigned char>(state_[i >> 2] >> ((3 - (i & 3)) * 8));
+    }
+};
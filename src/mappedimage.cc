@@ -0,0 +1,363 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef _WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include <string.h>
+#include <ckcore/log.hh>
+#include "ckmmc/mappedimage.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs a closed MappedImage object.
+     */
+    MappedImage::MappedImage() : size_(0),granularity_(0),head_(0),tail_(0),
+        mapped_blocks_(0),copied_blocks_(0)
+    {
+#ifdef _WINDOWS
+        file_ = INVALID_HANDLE_VALUE;
+        mapping_ = NULL;
+#else
+        fd_ = -1;
+#endif
+    }
+
+    /**
+     * Destructs the MappedImage object.
+     */
+    MappedImage::~MappedImage()
+    {
+        close();
+    }
+
+    /**
+     * Maps a window of the file.
+     * @param [in] offset The file offset of the window, must be a multiple
+     *                    of the mapping granularity.
+     * @param [out] window The mapped window.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool MappedImage::map(ckcore::tuint64 offset,Window &window)
+    {
+        ckcore::tuint64 size = size_ - offset;
+        if (size > ckWINDOW_SIZE)
+            size = ckWINDOW_SIZE;
+
+#ifdef _WINDOWS
+        void *data = MapViewOfFile(mapping_,FILE_MAP_READ,
+                                   static_cast<DWORD>(offset >> 32),
+                                   static_cast<DWORD>(offset & 0xffffffff),
+                                   static_cast<SIZE_T>(size));
+        if (data == NULL)
+        {
+            ckcore::log::print_line(ckT("[mappedimage]: MapViewOfFile failed (%d)."),GetLastError());
+            return false;
+        }
+#else
+        void *data = mmap(NULL,static_cast<size_t>(size),PROT_READ,MAP_SHARED,fd_,
+                          static_cast<off_t>(offset));
+        if (data == MAP_FAILED)
+        {
+            ckcore::log::print_line(ckT("[mappedimage]: mmap failed."));
+            return false;
+        }
+
+        madvise(data,static_cast<size_t>(size),MADV_SEQUENTIAL);
+
+        // Start reading the next window while this one is written.
+#ifdef POSIX_FADV_WILLNEED
+        if (offset + size < size_)
+        {
+            posix_fadvise(fd_,static_cast<off_t>(offset + size),ckWINDOW_SIZE,
+                          POSIX_FADV_WILLNEED);
+        }
+#endif
+#endif
+        window.data_ = static_cast<const unsigned char *>(data);
+        window.offset_ = offset;
+        window.size_ = static_cast<ckcore::tuint32>(size);
+        window.end_block_ = 0;
+        return true;
+    }
+
+    /**
+     * Unmaps a window, the window must have been written.
+     * @param [in] window The window to unmap.
+     */
+    void MappedImage::unmap(Window &window)
+    {
+#ifdef _WINDOWS
+        UnmapViewOfFile(window.data_);
+#else
+        munmap(const_cast<unsigned char *>(window.data_),window.size_);
+
+        // The data will not be read again, release it from the cache.
+#ifdef POSIX_FADV_DONTNEED
+        posix_fadvise(fd_,static_cast<off_t>(window.offset_),window.size_,
+                      POSIX_FADV_DONTNEED);
+#endif
+#endif
+        window.data_ = NULL;
+    }
+
+    /**
+     * Opens an image file.
+     * @param [in] path The file path.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool MappedImage::open(const ckcore::tchar *path)
+    {
+        close();
+
+#ifdef _WINDOWS
+        file_ = CreateFile(path,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,NULL);
+        if (file_ == INVALID_HANDLE_VALUE)
+        {
+            ckcore::log::print_line(ckT("[mappedimage]: unable to open file (%d)."),GetLastError());
+            return false;
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_,&size))
+        {
+            close();
+            return false;
+        }
+
+        size_ = static_cast<ckcore::tuint64>(size.QuadPart);
+
+        // Empty files can not be mapped.
+        if (size_ > 0)
+        {
+            mapping_ = CreateFileMapping(file_,NULL,PAGE_READONLY,0,0,NULL);
+            if (mapping_ == NULL)
+            {
+                ckcore::log::print_line(ckT("[mappedimage]: unable to create file mapping (%d)."),
+                                        GetLastError());
+                close();
+                return false;
+            }
+        }
+
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        granularity_ = info.dwAllocationGranularity;
+#else
+        fd_ = ::open(path,O_RDONLY);
+        if (fd_ == -1)
+        {
+            ckcore::log::print_line(ckT("[mappedimage]: unable to open file."));
+            return false;
+        }
+
+        struct stat info;
+        if (fstat(fd_,&info) != 0)
+        {
+            close();
+            return false;
+        }
+
+        size_ = static_cast<ckcore::tuint64>(info.st_size);
+        granularity_ = static_cast<ckcore::tuint32>(sysconf(_SC_PAGESIZE));
+#endif
+        head_ = tail_ = 0;
+        mapped_blocks_ = 0;
+        copied_blocks_ = 0;
+        return true;
+    }
+
+    /**
+     * Unmaps all windows and closes the file.
+     */
+    void MappedImage::close()
+    {
+        for (; tail_ != head_; tail_++)
+            unmap(windows_[tail_ % ckMAX_WINDOWS]);
+
+#ifdef _WINDOWS
+        if (mapping_ != NULL)
+        {
+            CloseHandle(mapping_);
+            mapping_ = NULL;
+        }
+
+        if (file_ != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file_);
+            file_ = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (fd_ != -1)
+        {
+            ::close(fd_);
+            fd_ = -1;
+        }
+#endif
+        size_ = 0;
+    }
+
+    /**
+     * Checks if an image file is open.
+     * @return If a file is open true is returned, if not false is returned.
+     */
+    bool MappedImage::is_open() const
+    {
+#ifdef _WINDOWS
+        return file_ != INVALID_HANDLE_VALUE;
+#else
+        return fd_ != -1;
+#endif
+    }
+
+    /**
+     * Writes the whole image using a stream writer. The function returns when
+     * all blocks have been written, it does not finish the writer. A final
+     * partial block is padded with zeros. The writer may already have been
+     * used to write other data. The writer must be stopped before the image
+     * is closed if the function fails.
+     * @param [in] writer The started stream writer.
+     * @param [in] block_len The size of each block in bytes, must match the
+     *                       block size the writer was started with.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool MappedImage::write(StreamWriter &writer,ckcore::tuint32 block_len)
+    {
+        if (!is_open() || block_len == 0)
+            return false;
+
+        ckcore::tuint64 total = (size_ + block_len - 1) / block_len;
+        if (total > 0xffffffff)
+            return false;
+
+        mapped_blocks_ = 0;
+        copied_blocks_ = 0;
+
+        // The writer counts blocks from the start of the stream, which may
+        // include data queued before the image.
+        ckcore::tuint32 base = writer.queued();
+
+        ckcore::tuint32 chunk_blocks = writer.chunk_blocks();
+        ckcore::tuint32 pos = 0;
+        while (pos < total)
+        {
+            ckcore::tuint32 blocks = static_cast<ckcore::tuint32>(total - pos);
+            if (blocks > chunk_blocks)
+                blocks = chunk_blocks;
+
+            ckcore::tuint64 offset = static_cast<ckcore::tuint64>(pos) * block_len;
+            ckcore::tuint64 end = offset + static_cast<ckcore::tuint64>(blocks) * block_len;
+            ckcore::tuint64 avail_end = end < size_ ? end : size_;
+
+            // Map a new window if the chunk is not covered by the current one.
+            Window *window = head_ != tail_ ? &windows_[(head_ - 1) % ckMAX_WINDOWS] : NULL;
+            if (window == NULL || avail_end > window->offset_ + window->size_)
+            {
+                // Reuse the oldest window once the writer is done with it.
+                if (head_ - tail_ == ckMAX_WINDOWS)
+                {
+                    Window &oldest = windows_[tail_ % ckMAX_WINDOWS];
+                    if (!writer.wait(base + oldest.end_block_))
+                        return false;
+
+                    unmap(oldest);
+                    tail_++;
+                }
+
+                window = &windows_[head_ % ckMAX_WINDOWS];
+                if (!map(offset - offset % granularity_,*window))
+                    return false;
+
+                head_++;
+            }
+
+            const unsigned char *data = window->data_ + (offset - window->offset_);
+
+            // Submit the mapped data directly, copy it if it's misaligned or
+            // ends in a partial block.
+            if (end == avail_end && writer.submit(data,blocks))
+            {
+                mapped_blocks_ += blocks;
+            }
+            else
+            {
+                StreamWriter::Lease lease;
+                if (!writer.lease(lease))
+                    return false;
+
+                size_t len = static_cast<size_t>(avail_end - offset);
+                memcpy(lease.data_,data,len);
+                memset(lease.data_ + len,0,static_cast<size_t>(blocks) * block_len - len);
+
+                if (!writer.commit(blocks))
+                    return false;
+
+                copied_blocks_ += blocks;
+            }
+
+            pos += blocks;
+            window->end_block_ = pos;
+        }
+
+        // The mapped data must remain valid until it has been written.
+        bool res = writer.wait(base + pos);
+
+        for (; tail_ != head_; tail_++)
+            unmap(windows_[tail_ % ckMAX_WINDOWS]);
+
+        ckcore::log::print_line(ckT("[mappedimage]: %u blocks submitted from the mapping, %u copied."),
+                                mapped_blocks_,copied_blocks_);
+        return res;
+    }
+
+    /**
+     * Returns the size of the image file.
+     * @return The file size in bytes.
+     */
+    ckcore::tuint64 MappedImage::size() const
+    {
+        return size_;
+    }
+
+    /**
+     * Returns the number of blocks written directly from the mapped file by
+     * the last write.
+     * @return The number of blocks.
+     */
+    ckcore::tuint32 MappedImage::mapped_blocks() const
+    {
+        return mapped_blocks_;
+    }
+
+    /**
+     * Returns the number of blocks copied through the writer FIFO by the
+     * last write.
+     * @return The number of blocks.
+     */
+    ckcore::tuint32 MappedImage::copied_blocks() const
+    {
+        return copied_blocks_;
+    }
+};
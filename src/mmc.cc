@@ -70,6 +70,111 @@ namespace ckmmc
         buffer[3] = static_cast<unsigned char>(i & 0xff);
     }
 
+    /**
+     * Parses a buffer containing mode page 01 raw data as defined in MMC 5
+     * into a readable structure. This buffer should include the mode
+     * parameter header as defined in SPC 4 - table 291. Devices may return
+     * the short version of the page lacking the write retry count and the
+     * recovery time limit, those fields are then set to zero.
+     * @param [in] buffer Buffer to parse from.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool ScsiModePage01::parse(unsigned char *buffer)
+    {
+        // Validate page length.
+        ckcore::tuint16 page_len = read_uint16_msbf(buffer) - 6;
+        if (page_len < 8)
+            return false;
+
+        buffer += 8;
+
+        // Validate page code.
+        unsigned char page_code = buffer[0] & 0x3f;
+        if (page_code != 0x01)
+            return false;
+
+        page_code_ = page_code;
+        ps_ = (buffer[0] & 0x80) > 0;
+        page_len_ = buffer[1];
+        awre_ = (buffer[2] & 0x80) > 0;
+        arre_ = (buffer[2] & 0x40) > 0;
+        tb_ = (buffer[2] & 0x20) > 0;
+        rc_ = (buffer[2] & 0x10) > 0;
+        per_ = (buffer[2] & 0x04) > 0;
+        dte_ = (buffer[2] & 0x02) > 0;
+        dcr_ = (buffer[2] & 0x01) > 0;
+        read_retry_count_ = buffer[3];
+        emcdr_ = buffer[7] & 0x03;
+
+        if (page_len_ >= 0x0a && page_len >= 12)
+        {
+            write_retry_count_ = buffer[8];
+            recovery_time_limit_ = read_uint16_msbf(buffer + 10);
+        }
+        else
+        {
+            write_retry_count_ = 0;
+            recovery_time_limit_ = 0;
+        }
+
+        return true;
+    }
+
+    /**
+     * Reads the local data into a binary buffer. Only the page data will be
+     * written into the buffer, not any header as used in the parse function.
+     * @param [out] buffer The buffer to write the data into.
+     * @param [in] buffer_len The size of the buffer in bytes.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool ScsiModePage01::read(unsigned char *buffer,size_t buffer_len)
+    {
+        if (page_len_ < 0x06 || buffer_len < static_cast<size_t>(page_len_) + 2)
+            return false;
+
+        // Clear the buffer.
+        memset(buffer,0,buffer_len);
+
+        buffer[0] |= page_code_ & 0x3f;
+        buffer[0] |= ps_ ? 0x80 : 0x00;
+        buffer[1]  = page_len_;
+        buffer[2] |= awre_ ? 0x80 : 0x00;
+        buffer[2] |= arre_ ? 0x40 : 0x00;
+        buffer[2] |= tb_ ? 0x20 : 0x00;
+        buffer[2] |= rc_ ? 0x10 : 0x00;
+        buffer[2] |= per_ ? 0x04 : 0x00;
+        buffer[2] |= dte_ ? 0x02 : 0x00;
+        buffer[2] |= dcr_ ? 0x01 : 0x00;
+        buffer[3]  = read_retry_count_;
+        buffer[7] |= emcdr_ & 0x03;
+
+        if (page_len_ >= 0x0a)
+        {
+            buffer[8] = write_retry_count_;
+            write_uint16_msbf(recovery_time_limit_,buffer + 10);
+        }
+
+        return true;
+    }
+
+    /**
+     * Resets the mode page into a state where the device reports unreadable
+     * sectors as quickly as possible. Error correction stays enabled and
+     * recovered errors are not reported, data returned without an error can
+     * still be trusted.
+     */
+    void ScsiModePage01::reset_fail_fast()
+    {
+        rc_ = false;
+        per_ = false;
+        dte_ = false;
+        dcr_ = false;
+        read_retry_count_ = 0;
+
+        if (page_len_ >= 0x0a)
+            recovery_time_limit_ = ckFAIL_FAST_TIME_LIMIT;
+    }
+
     /**
      * Parses a buffer containing mode page 05 raw data as defined in MMC 2 -
      * table 123 into a readable structure. This buffer should include the mode
@@ -381,4 +486,42 @@ namespace ckmmc
 
         return true;
     }
+
+    /**
+     * Parses a buffer containing fixed format sense data as defined in SPC 3
+     * - table 26 into a readable structure.
+     * @param [in] buffer Buffer to parse from.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool ScsiSenseData::parse(unsigned char *buffer)
+    {
+        valid_ = (buffer[0] & 0x80) > 0;
+        response_code_ = buffer[0] & 0x7f;
+        ili_ = (buffer[2] & 0x20) > 0;
+        sense_key_ = buffer[2] & 0x0f;
+        info_ = read_uint32_msbf(buffer + 3);
+        asc_ = buffer[12];
+        ascq_ = buffer[13];
+
+        // Only fixed format sense data is supported.
+        return response_code_ == 0x70 || response_code_ == 0x71;
+    }
+
+    /**
+     * Parses a buffer containing the response of a media class GET EVENT
+     * STATUS NOTIFICATION command as defined in MMC 5 - table 163 into a
+     * readable structure.
+     * @param [in] buffer Buffer to parse from.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool ScsiMediaEvent::parse(unsigned char *buffer)
+    {
+        nea_ = (buffer[2] & 0x80) > 0;
+        event_code_ = nea_ ? ckMEDIA_EVENT_NO_CHANGE : buffer[4] & 0x0f;
+        door_open_ = (buffer[5] & 0x01) > 0;
+        media_present_ = (buffer[5] & 0x02) > 0;
+
+        // The drive may report another notification class.
+        return !nea_ && (buffer[2] & 0x07) == 0x04;
+    }
 };
@@ -18,7 +18,11 @@
 
 #include <ckcore/log.hh>
 #include <ckcore/string.hh>
+#include "ckmmc/blockdevice.hh"
+#include "ckmmc/buffer.hh"
+#include "ckmmc/driveprofile.hh"
 #include "ckmmc/scsisilencer.hh"
+#include "ckmmc/timer.hh"
 #include "ckmmc/mmc.hh"
 #include "ckmmc/mmcdevice.hh"
 
@@ -27,9 +31,13 @@ namespace ckmmc
     /**
      * Constructs a MmcDevice object.
      */
-    MmcDevice::MmcDevice(const Address &addr) : ScsiDevice(addr),write_modes_(0),features_(0)
+    MmcDevice::MmcDevice(const Address &addr) : ScsiDevice(addr),write_modes_(0),features_(0),
+        max_transfer_(0),transfer_len_(ckTRANSFER_DEFAULT_LEN),alignment_mask_(0),
+        read_offset_known_(false),read_offset_(0),error_recovery_len_(0),
+        data_path_(ckDP_SCSI),block_device_(NULL)
     {
         memset(properties_,0,sizeof(properties_));
+        memset(error_recovery_,0,sizeof(error_recovery_));
 
         vendor_[0] = '\0';
         identifier_[0] = '\0';
@@ -45,6 +53,25 @@ namespace ckmmc
             ckcore::string::ansi_to_auto(inquiry_data.vendor_,vendor_,9);
             ckcore::string::ansi_to_auto(inquiry_data.product_,identifier_,17);
             ckcore::string::ansi_to_auto(inquiry_data.rev_,revision_,5);
+
+            if (quirks_.lookup(vendor_,identifier_,revision_))
+            {
+                ckcore::log::print_line(ckT("[mmcdevice]: using quirks for %s %s %s."),
+                                        vendor_,identifier_,revision_);
+            }
+
+            // Try to obtain the supported commands and their timeouts, few
+            // MMC devices implement this command so don't complain.
+            std::vector<unsigned char> opcodes_buffer(8192);
+
+            ScsiSilencer silencer(*this);
+            if (report_supported_opcodes(&opcodes_buffer[0],
+                                         static_cast<ckcore::tuint32>(opcodes_buffer.size())))
+            {
+                commands_.parse(&opcodes_buffer[0],static_cast<ckcore::tuint32>(opcodes_buffer.size()));
+            }
+
+            init_transfer();
         }
         else
         {
@@ -58,24 +85,126 @@ namespace ckmmc
      */
     MmcDevice::~MmcDevice()
     {
+        delete block_device_;
+    }
+
+    /**
+     * Initializes the transfer length limits from the host adapter limits,
+     * the quirks table and any stored calibration results. The stored audio
+     * read offset is also restored.
+     */
+    void MmcDevice::init_transfer()
+    {
+        if (!transfer_limits(max_transfer_,alignment_mask_))
+        {
+            max_transfer_ = 0;
+            alignment_mask_ = 0;
+        }
+
+        // The device itself may be more limited than the host adapter.
+        ckcore::tuint32 quirk_max = quirks_.max_transfer();
+        if (quirk_max != 0 && (max_transfer_ == 0 || quirk_max < max_transfer_))
+            max_transfer_ = quirk_max;
+
+        DriveProfile profile;
+        if (DriveProfileStore::instance().find(DriveProfileStore::key(vendor_,identifier_,revision_),profile))
+        {
+            if (profile.max_transfer_ != 0 &&
+                (max_transfer_ == 0 || profile.max_transfer_ < max_transfer_))
+            {
+                max_transfer_ = profile.max_transfer_;
+            }
+
+            if (profile.best_transfer_ != 0)
+                transfer_len_ = profile.best_transfer_;
+
+            read_offset_known_ = profile.read_offset_known_;
+            read_offset_ = profile.read_offset_;
+        }
+
+        if (max_transfer_ != 0 && transfer_len_ > max_transfer_)
+            transfer_len_ = max_transfer_ - max_transfer_ % 2048;
+    }
+
+    /**
+     * Checks if a command may be sent to the device. Commands that are known
+     * to hang the device are blocked.
+     * @param [in] cdb The command descriptor block.
+     * @return If the command may be sent true is returned, if not false is
+     *         returned.
+     */
+    bool MmcDevice::command_allowed(const unsigned char *cdb) const
+    {
+        if (quirks_.hangs(cdb[0]))
+        {
+            ckcore::log::print_line(ckT("[mmcdevice]: command 0x%.2x is known to hang the device, skipping."),
+                                    cdb[0]);
+            return false;
+        }
+
+        if (!commands_.supported(cdb[0]))
+        {
+            ckcore::log::print_line(ckT("[mmcdevice]: command 0x%.2x is not supported by the device, skipping."),
+                                    cdb[0]);
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Returns the timeout to use for a command. Timeouts from the quirks
+     * table are preferred, followed by a timeout explicitly configured on the
+     * device and timeouts reported or learned by the command profile.
+     * @param [in] cdb The command descriptor block.
+     * @return The timeout value in seconds, negative if the driver default
+     *         should be used.
+     */
+    long MmcDevice::command_timeout(const unsigned char *cdb) const
+    {
+        long timeout = quirks_.timeout(cdb[0]);
+        if (timeout >= 0)
+            return timeout;
+
+        // A timeout explicitly configured on the device takes precedence over
+        // learned timeouts.
+        timeout = ScsiDevice::command_timeout(cdb);
+        if (timeout >= 0)
+            return timeout;
+
+        return commands_.timeout(cdb[0]);
     }
 
     /**
-     * Checks if the recorder is of Yamaha brand.
-     * @return If a Yamaha recorder true is returned, if not false is returned.
+     * Records the latency of successfully completed commands in the command
+     * profile.
+     * @param [in] cdb The command descriptor block.
+     * @param [in] success true if the command completed successfully.
+     * @param [in] elapsed The command latency in microseconds.
      */
-    bool MmcDevice::is_yamaha() const
+    void MmcDevice::command_completed(const unsigned char *cdb,bool success,
+                                      ckcore::tuint64 elapsed)
     {
-        return ckcore::string::astrncmp(vendor_,ckT("YAMAHA"),6) == 0;
+        if (success)
+            commands_.record(cdb[0],elapsed);
     }
 
     /**
-     * Checks if the recorder is of Plextor brand.
-     * @return If a Plextor recorder true is returned, if not false is returned.
+     * Selects the last selected error recovery parameters again after the
+     * device has been reset, a reset returns them to their defaults.
+     * Aborting outstanding commands leaves the parameters intact.
+     * @param [in] level The reset level.
      */
-    bool MmcDevice::is_plextor() const
+    void MmcDevice::reset_completed(ResetLevel level)
     {
-        return ckcore::string::astrncmp(vendor_,ckT("PLEXTOR"),7) == 0;
+        if (level == ckRESET_ABORT || error_recovery_len_ == 0)
+            return;
+
+        unsigned char buffer[sizeof(error_recovery_)];
+        memcpy(buffer,error_recovery_,sizeof(buffer));
+
+        if (!mode_select(buffer,error_recovery_len_,false,true))
+            ckcore::log::print_line(ckT("[mmcdevice]: unable to restore mode page 0x01 after reset."));
     }
 
     /**
@@ -105,6 +234,191 @@ namespace ckmmc
         return revision_;
     }
 
+    /**
+     * Returns the known quirks of the device.
+     * @return The device quirks.
+     */
+    const DriveQuirks &MmcDevice::quirks() const
+    {
+        return quirks_;
+    }
+
+    /**
+     * Returns the command profile of the device.
+     * @return The command profile.
+     */
+    const CommandProfile &MmcDevice::commands() const
+    {
+        return commands_;
+    }
+
+    /**
+     * Returns the maximum number of bytes that can be transferred in a single
+     * command.
+     * @return The maximum transfer length in bytes, 0 if unknown.
+     */
+    ckcore::tuint32 MmcDevice::max_transfer() const
+    {
+        return max_transfer_;
+    }
+
+    /**
+     * Returns the preferred number of bytes to transfer in a single command.
+     * Until the device has been calibrated a conservative default is used.
+     * @return The preferred transfer length in bytes.
+     */
+    ckcore::tuint32 MmcDevice::transfer_len() const
+    {
+        return transfer_len_;
+    }
+
+    /**
+     * Returns the data buffer alignment required by the host adapter.
+     * @return The alignment mask.
+     */
+    ckcore::tuint32 MmcDevice::alignment_mask() const
+    {
+        return alignment_mask_;
+    }
+
+    /**
+     * Calibrates the transfer length. The largest working transfer length is
+     * found by probing, starting from the host adapter limit and halving the
+     * length on failure. A few transfer lengths are then benchmarked using
+     * sequential reads and the fastest one is selected. The result is stored
+     * in the drive profile store so that other devices of the same model
+     * don't have to be calibrated. A readable data disc must be inserted.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool MmcDevice::calibrate_transfer()
+    {
+        ckcore::tuint32 last_lba = 0,block_len = 0;
+        if (!read_capacity(last_lba,block_len) || block_len != 2048)
+        {
+            ckcore::log::print_line(ckT("[mmcdevice]: transfer calibration requires a data disc."));
+            return false;
+        }
+
+        ckcore::tuint64 num_bytes = (static_cast<ckcore::tuint64>(last_lba) + 1) * 2048;
+
+        // Find the largest working transfer length.
+        ckcore::tuint32 limit = max_transfer_ != 0 ? max_transfer_ : ckTRANSFER_PROBE_LIMIT;
+        if (limit > 0xffff * 2048)
+            limit = 0xffff * 2048;
+        if (limit > num_bytes)
+            limit = static_cast<ckcore::tuint32>(num_bytes);
+        limit -= limit % 2048;
+
+        AlignedBuffer buffer(limit);
+        if (buffer.data() == NULL)
+            return false;
+
+        ckcore::tuint32 max_len = 0;
+        {
+            ScsiSilencer silencer(*this);
+            for (ckcore::tuint32 len = limit; len >= 2048; len = (len >> 1) - ((len >> 1) % 2048))
+            {
+                if (read10(0,static_cast<ckcore::tuint16>(len / 2048),buffer.data(),len))
+                {
+                    max_len = len;
+                    break;
+                }
+            }
+        }
+
+        if (max_len == 0)
+        {
+            ckcore::log::print_line(ckT("[mmcdevice]: unable to find a working transfer length."));
+            return false;
+        }
+
+        // Benchmark transfer lengths, each length reads its own region of the
+        // disc to avoid measuring the device cache. Larger lengths are
+        // preferred unless a smaller one is noticeably faster.
+        ckcore::tuint32 best_len = max_len;
+        double best_rate = 0.0;
+
+        ckcore::tuint64 pos = max_len;
+        for (ckcore::tuint32 len = max_len; len >= ckTRANSFER_MIN_LEN || len == max_len;
+             len = (len >> 1) - ((len >> 1) % 2048))
+        {
+            ckcore::tuint32 bench_size = ckTRANSFER_BENCH_SIZE - ckTRANSFER_BENCH_SIZE % len;
+            if (pos + bench_size > num_bytes)
+                break;
+
+            Timer timer;
+            for (ckcore::tuint32 done = 0; done < bench_size; done += len, pos += len)
+            {
+                if (!read10(static_cast<ckcore::tuint32>(pos / 2048),
+                            static_cast<ckcore::tuint16>(len / 2048),buffer.data(),len))
+                {
+                    ckcore::log::print_line(ckT("[mmcdevice]: transfer calibration read failed."));
+                    return false;
+                }
+            }
+
+            ckcore::tuint64 elapsed = timer.elapsed();
+            double rate = static_cast<double>(bench_size) / static_cast<double>(elapsed + 1);
+
+            ckcore::log::print_line(ckT("[mmcdevice]: transfer length %u: %u KiB/s."),
+                                    len,static_cast<ckcore::tuint32>(rate * 1000000.0 / 1024.0));
+
+            if (rate > best_rate * 1.05)
+            {
+                best_rate = rate;
+                best_len = len;
+            }
+        }
+
+        max_transfer_ = max_len;
+        transfer_len_ = best_len;
+
+        ckcore::tstring key = DriveProfileStore::key(vendor_,identifier_,revision_);
+
+        DriveProfile profile;
+        DriveProfileStore::instance().find(key,profile);
+        profile.max_transfer_ = max_len;
+        profile.best_transfer_ = best_len;
+        DriveProfileStore::instance().store(key,profile);
+        return true;
+    }
+
+    /**
+     * Returns the audio read offset of the device. Sample p of the disc is
+     * returned by the device at position p + offset.
+     * @param [out] offset The read offset in samples.
+     * @return If the read offset is known true is returned, if not false is
+     *         returned.
+     */
+    bool MmcDevice::read_offset(ckcore::tint32 &offset) const
+    {
+        if (!read_offset_known_)
+            return false;
+
+        offset = read_offset_;
+        return true;
+    }
+
+    /**
+     * Sets the audio read offset of the device. The offset is stored in the
+     * drive profile store so that other devices of the same model don't
+     * have to be calibrated.
+     * @param [in] offset The read offset in samples.
+     */
+    void MmcDevice::read_offset(ckcore::tint32 offset)
+    {
+        read_offset_known_ = true;
+        read_offset_ = offset;
+
+        ckcore::tstring key = DriveProfileStore::key(vendor_,identifier_,revision_);
+
+        DriveProfile profile;
+        DriveProfileStore::instance().find(key,profile);
+        profile.read_offset_known_ = true;
+        profile.read_offset_ = offset;
+        DriveProfileStore::instance().store(key,profile);
+    }
+
     /**
      * Obtains the supported read speeds of the inserted medium.
      * @param [out] speeds List of read speeds measured in kilo bytes per second.
@@ -347,7 +661,15 @@ namespace ckmmc
         }
 
         // Setup write speeds (if the device have recording capabilities).
-        if (recorder())
+        if (recorder() && quirks_.has(DriveQuirks::ckQUIRK_SKIP_GET_PERFORMANCE))
+        {
+            write_speeds_.clear();
+
+            std::vector<ckcore::tuint16>::iterator it;
+            for (it = mode_page_2a.write_spds_.begin(); it != mode_page_2a.write_spds_.end(); it++)
+                write_speeds_.push_back(static_cast<ckcore::tuint32>(*it));
+        }
+        else if (recorder())
         {
             write_speeds_.clear();
 
@@ -415,7 +737,7 @@ namespace ckmmc
         }
 
         // Try to obtain the supported write modes.
-        if (recorder())
+        if (recorder() && !quirks_.has(DriveQuirks::ckQUIRK_SKIP_WRITE_MODE_PROBE))
         {
             // Request mode page 0x05.
             if (!mode_sense(0x05,buffer,sizeof(buffer)))
@@ -471,7 +793,8 @@ namespace ckmmc
             mode_page_05.track_mode_ = ScsiModePage05::ckTM_DATA;
             mode_page_05.data_block_type_ = ScsiModePage05::ckDB_RAW_2352_PQ;
 
-            if (mode_select(buffer,page_len,false,true))
+            if (!quirks_.has(DriveQuirks::ckQUIRK_SKIP_RAW_PROBE) &&
+                mode_select(buffer,page_len,false,true))
             {
                 mode_page_05.data_block_type_ = ScsiModePage05::ckDB_RAW_2352_PW_PACK;
                 if (mode_select(buffer,page_len,false,true))
@@ -491,8 +814,11 @@ namespace ckmmc
             mode_page_05.track_mode_ = ScsiModePage05::ckTM_DATA;
             mode_page_05.data_block_type_ = ScsiModePage05::ckDB_RAW_2352_PW;
 
-            if (mode_select(buffer,page_len,false,true))
+            if (!quirks_.has(DriveQuirks::ckQUIRK_SKIP_LAYER_JUMP_PROBE) &&
+                mode_select(buffer,page_len,false,true))
+            {
                 write_modes_ |= static_cast<ckcore::tuint16>(1) << ckWM_LAYER_JUMP;
+            }
         }
 
         // Finally try to detect vendor specific features.
@@ -515,8 +841,8 @@ namespace ckmmc
 
             ckcore::tuint16 page_len = read_uint16_msbf(buffer) + 2;
 
-            // Check for Yamaha and Plextor features.
-            if (is_yamaha() || is_plextor())
+            // Check for audio master support.
+            if (quirks_.has(DriveQuirks::ckQUIRK_AUDIO_MASTER_PROBE))
             {
                 // Reset the mode page.
                 mode_page_05.reset_tao();
@@ -536,26 +862,24 @@ namespace ckmmc
                     features_ |= static_cast<ckcore::tuint64>(1) << ckDEVICE_AUDIO_MASTER;
             }
 
-            // Check for Yamaha features.
-            if (is_yamaha())
+            // Check for Yamaha force speed support.
+            if (quirks_.has(DriveQuirks::ckQUIRK_FORCE_SPEED_PROBE))
             {
                 if (mode_page_05.page_len_ >= 26)
                     features_ |= static_cast<ckcore::tuint64>(1) << ckDEVICE_FORCE_SPEED;
             }
 
-            // Check for plextor features.
-            if (is_plextor())
-            {
-                // FIXME: Add a check since not all plextor drives support VARIREC.
+            // Check for Plextor VariRec support.
+            if (quirks_.has(DriveQuirks::ckQUIRK_VARIREC))
                 features_ |= static_cast<ckcore::tuint64>(1) << ckDEVICE_VARIREC;
-            }
         }
 
         // Obtain configuration feature set.
         unsigned char feature_buffer[32 * 1024];
         memset(feature_buffer,0,sizeof(feature_buffer));
 
-        if (get_configuration(feature_buffer,sizeof(feature_buffer)))
+        if (!quirks_.has(DriveQuirks::ckQUIRK_SKIP_GET_CONFIGURATION) &&
+            get_configuration(feature_buffer,sizeof(feature_buffer)))
         {
             unsigned char *ptr = feature_buffer;
             unsigned char *ptr_end = &feature_buffer[sizeof(feature_buffer)];
@@ -804,4 +1128,626 @@ namespace ckmmc
 
         return true;
     }
+
+    /**
+     * Requests the current read/write error recovery parameters (mode page
+     * 0x01) from the device.
+     * @param [out] page The error recovery parameters.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool MmcDevice::get_error_recovery(ScsiModePage01 &page)
+    {
+        unsigned char buffer[32];
+        if (!mode_sense(0x01,buffer,sizeof(buffer)))
+        {
+            ckcore::log::print_line(ckT("[mmcdevice]: requesting mode sense for page 0x01 failed."));
+            return false;
+        }
+
+        if (!page.parse(buffer))
+        {
+            ckcore::log::print_line(ckT("[mmcdevice]: parsing of mode page 0x01 failed."));
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Changes the read/write error recovery parameters (mode page 0x01) of
+     * the device. The parameters are not saved, they revert to the defaults
+     * when the device is reset.
+     * @param [in] page The error recovery parameters.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool MmcDevice::set_error_recovery(const ScsiModePage01 &page)
+    {
+        unsigned char buffer[32];
+        memset(buffer,0,sizeof(buffer));
+
+        ScsiModePage01 mode_page_01 = page;
+        mode_page_01.ps_ = false;       // Reserved in MODE SELECT.
+        if (!mode_page_01.read(buffer + 8,sizeof(buffer) - 8))
+            return false;
+
+        ckcore::tuint16 page_len = 8 + 2 + mode_page_01.page_len_;
+
+        // MODE SELECT may modify the buffer, keep a copy for restoring the
+        // parameters after a reset.
+        unsigned char selected[sizeof(buffer)];
+        memcpy(selected,buffer,sizeof(buffer));
+
+        if (!mode_select(buffer,page_len,false,true))
+        {
+            ckcore::log::print_line(ckT("[mmcdevice]: unable to select mode page 0x01."));
+            return false;
+        }
+
+        memcpy(error_recovery_,selected,sizeof(error_recovery_));
+        error_recovery_len_ = page_len;
+        return true;
+    }
+
+    /**
+     * Executes a REPORT SUPPORTED OPERATION CODES command on the device
+     * requesting all supported commands including their command timeouts
+     * descriptors.
+     * @param [out] buffer The buffer to which the returned data will be
+     *                     written.
+     * @param [in] buffer_len The size of the specified buffer.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool MmcDevice::report_supported_opcodes(unsigned char *buffer,
+                                             ckcore::tuint32 buffer_len)
+    {
+        // Initialize buffer.
+        memset(buffer,0,buffer_len);
+
+        // Prepare CDB.
+        unsigned char cdb[16];
+        memset(cdb,0,sizeof(cdb));
+
+        cdb[0] = ckCMD_REPORT_SUPPORTED_OPCODES;
+        cdb[1] = 0x0c;      // Service action.
+        cdb[2] = 0x80;      // Return command timeouts descriptors, report all commands.
+        write_uint32_msbf(buffer_len,cdb + 6);  // Allocation length.
+
+        if (!transport(cdb,12,buffer,buffer_len,ScsiDevice::ckTM_READ))
+            return false;
+
+        return true;
+    }
+
+    /**
+     * Executes a polled GET EVENT STATUS NOTIFICATION command on the device.
+     * Reading an event consumes it.
+     * @param [in] class_mask Bit mask of requested notification classes.
+     * @param [out] buffer The buffer to which the event status will be
+     *                     written.
+     * @param [in] buffer_len The size of the specified buffer.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool MmcDevice::get_event_status(unsigned char class_mask,unsigned char *buffer,
+                                     ckcore::tuint16 buffer_len)
+    {
+        // Initialize buffer.
+        memset(buffer,0,buffer_len);
+
+        // Prepare CDB.
+        unsigned char cdb[16];
+        memset(cdb,0,sizeof(cdb));
+
+        cdb[0] = ckCMD_GET_EVENT_STATUS_NOTIFICATION;
+        cdb[1] = 0x01;      // Polled.
+        cdb[4] = class_mask;
+        write_uint16_msbf(buffer_len,cdb + 7);  // Allocation length.
+
+        if (!transport(cdb,10,buffer,buffer_len,ScsiDevice::ckTM_READ))
+            return false;
+
+        return true;
+    }
+
+    /**
+     * Adds a range of unreadable sectors to an error map. The range is merged
+     * with the previous one if they are adjacent and have the same cause.
+     * @param [in, out] errors The error map.
+     * @param [in] lba The first unreadable sector.
+     * @param [in] count The number of unreadable sectors.
+     * @param [in] sense_key The sense key.
+     * @param [in] asc The additional sense code.
+     * @param [in] ascq The additional sense code qualifier.
+     */
+    void MmcDevice::add_read_error(std::vector<ReadError> &errors,ckcore::tuint32 lba,
+                                   ckcore::tuint32 count,unsigned char sense_key,
+                                   unsigned char asc,unsigned char ascq)
+    {
+        if (!errors.empty())
+        {
+            ReadError &last = errors.back();
+            if (last.lba_ + last.count_ == lba && last.sense_key_ == sense_key &&
+                last.asc_ == asc && last.ascq_ == ascq)
+            {
+                last.count_ += count;
+                return;
+            }
+        }
+
+        errors.push_back(ReadError(lba,count,sense_key,asc,ascq));
+    }
+
+    /**
+     * Selects the data path used for reading 2048 byte sectors. The SCSI path
+     * is always used for control commands and raw reads.
+     * @param [in] path The data path to use.
+     * @return If successful true is returned, if the data path is not
+     *         available false is returned.
+     */
+    bool MmcDevice::data_path(DataPath path)
+    {
+        if (path == ckDP_BLOCK)
+        {
+            if (block_device_ == NULL)
+                block_device_ = new BlockDevice();
+
+            if (!block_device_->is_open() && !block_device_->open(addr_))
+            {
+                ckcore::log::print_line(ckT("[mmcdevice]: block device data path not available."));
+                return false;
+            }
+        }
+        else if (block_device_ != NULL)
+        {
+            block_device_->close();
+        }
+
+        data_path_ = path;
+        return true;
+    }
+
+    /**
+     * Returns the data path used for reading 2048 byte sectors.
+     * @return The current data path.
+     */
+    MmcDevice::DataPath MmcDevice::data_path() const
+    {
+        return data_path_;
+    }
+
+    /**
+     * Reads 2048 byte data sectors from the device. The request is split into
+     * commands of the preferred transfer length. Short transfers are resumed
+     * where they ended. When a command fails the sectors preceding the
+     * failing address reported in the sense data are kept, if no address is
+     * reported the range is narrowed down until the unreadable sectors are
+     * isolated. Unreadable sectors are zero filled and reported in the error
+     * map. Recovered errors are treated as successful reads.
+     *
+     * If the block device data path is selected the sectors are read through
+     * the block device. Should that fail the SCSI path is used instead to
+     * obtain a detailed error map.
+     * @param [in] lba The first sector to read.
+     * @param [in] count The number of sectors to read.
+     * @param [out] buffer The buffer to which the sectors will be written,
+     *                     must satisfy the host adapter alignment.
+     * @param [in] buffer_len The size of the specified buffer.
+     * @param [out] errors Ranges of sectors that could not be read.
+     * @return If all sectors were read true is returned, if not false is
+     *         returned.
+     */
+    bool MmcDevice::read_sectors(ckcore::tuint32 lba,ckcore::tuint32 count,
+                                 unsigned char *buffer,ckcore::tuint32 buffer_len,
+                                 std::vector<ReadError> &errors)
+    {
+        errors.clear();
+
+        if (buffer == NULL || static_cast<ckcore::tuint64>(count) * 2048 > buffer_len)
+            return false;
+
+        if ((reinterpret_cast<size_t>(buffer) & alignment_mask_) != 0)
+        {
+            ckcore::log::print_line(ckT("[mmcdevice]: read buffer does not satisfy the alignment mask 0x%x."),
+                                    alignment_mask_);
+            return false;
+        }
+
+        if (data_path_ == ckDP_BLOCK && block_device_ != NULL &&
+            block_device_->read(lba,count,buffer,transfer_len_))
+        {
+            return true;
+        }
+
+        ckcore::tuint32 max_blocks = transfer_len_ / 2048;
+        if (max_blocks == 0)
+            max_blocks = 1;
+
+        ckcore::tuint32 pos = 0;
+        ckcore::tuint32 chunk = max_blocks;
+        while (pos < count)
+        {
+            ckcore::tuint32 num_blocks = count - pos < chunk ? count - pos : chunk;
+            unsigned char *ptr = buffer + static_cast<size_t>(pos) * 2048;
+
+            // Prepare CDB.
+            unsigned char cdb[16];
+            memset(cdb,0,sizeof(cdb));
+
+            unsigned char cdb_len = 10;
+            if (num_blocks > 0xffff)
+            {
+                cdb[0] = ckCMD_READ12;
+                write_uint32_msbf(lba + pos,cdb + 2);
+                write_uint32_msbf(num_blocks,cdb + 6);
+                cdb_len = 12;
+            }
+            else
+            {
+                cdb[0] = ckCMD_READ10;
+                write_uint32_msbf(lba + pos,cdb + 2);
+                write_uint16_msbf(static_cast<ckcore::tuint16>(num_blocks),cdb + 7);
+            }
+
+            unsigned char sense[24];
+            memset(sense,0,sizeof(sense));
+            unsigned char result = 0;
+            unsigned long transferred = 0;
+
+            bool res = transport_with_sense(cdb,cdb_len,ptr,num_blocks * 2048,ScsiDevice::ckTM_READ,
+                                            sense,result,transferred);
+
+            ckcore::tuint32 done = static_cast<ckcore::tuint32>(transferred / 2048);
+            if (done > num_blocks)
+                done = num_blocks;
+
+            if (res && result == ckSCSISTAT_GOOD)
+            {
+                // Resume short transfers where they ended.
+                if (done == 0)
+                {
+                    add_read_error(errors,lba + pos,1,0,0,0);
+                    memset(ptr,0,2048);
+                    done = 1;
+                }
+
+                pos += done;
+                chunk = max_blocks;
+                continue;
+            }
+
+            // The transport itself failed, or the device is not in a state
+            // where further reads may succeed.
+            ScsiSenseData sense_data;
+            memset(&sense_data,0,sizeof(ScsiSenseData));
+            if (res && result == ckSCSISTAT_CHECK_CONDITION)
+                sense_data.parse(sense);
+
+            if (!res || result != ckSCSISTAT_CHECK_CONDITION ||
+                sense_data.sense_key_ == ScsiSenseData::ckSENSE_NOT_READY ||
+                sense_data.sense_key_ == ScsiSenseData::ckSENSE_UNIT_ATTENTION ||
+                (sense_data.sense_key_ == ScsiSenseData::ckSENSE_ILLEGAL_REQUEST &&
+                 sense_data.asc_ == ScsiSenseData::ckASC_LBA_OUT_OF_RANGE))
+            {
+                add_read_error(errors,lba + pos,count - pos,sense_data.sense_key_,
+                               sense_data.asc_,sense_data.ascq_);
+                memset(ptr,0,static_cast<size_t>(count - pos) * 2048);
+                break;
+            }
+
+            // The device recovered the data itself, it's only reported since
+            // post error reporting is enabled.
+            if (sense_data.sense_key_ == ScsiSenseData::ckSENSE_RECOVERED_ERROR)
+            {
+                pos += num_blocks;
+                chunk = max_blocks;
+                continue;
+            }
+
+            // The transfer length can't be trusted on errors since some
+            // drivers report the requested length regardless of how much data
+            // was transferred. Only the failing address reported in the sense
+            // data tells which sectors were read successfully.
+            if (sense_data.valid_ && sense_data.info_ >= lba + pos &&
+                sense_data.info_ < lba + pos + num_blocks)
+            {
+                pos = sense_data.info_ - lba;
+                ptr = buffer + static_cast<size_t>(pos) * 2048;
+            }
+            else if (num_blocks > 1)
+            {
+                // Narrow down the failing range.
+                chunk = (num_blocks + 1) >> 1;
+                continue;
+            }
+
+            add_read_error(errors,lba + pos,1,sense_data.sense_key_,
+                           sense_data.asc_,sense_data.ascq_);
+            memset(ptr,0,2048);
+            pos++;
+            chunk = max_blocks;
+        }
+
+        return errors.empty();
+    }
+
+    /**
+     * Executes a READ CAPACITY command on the device.
+     * @param [out] last_lba The address of the last readable block.
+     * @param [out] block_len The block length in bytes.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool MmcDevice::read_capacity(ckcore::tuint32 &last_lba,ckcore::tuint32 &block_len)
+    {
+        unsigned char buffer[8];
+        memset(buffer,0,sizeof(buffer));
+
+        // Prepare CDB.
+        unsigned char cdb[16];
+        memset(cdb,0,sizeof(cdb));
+
+        cdb[0] = ckCMD_READ_CAPACITY;
+
+        if (!transport(cdb,10,buffer,sizeof(buffer),ScsiDevice::ckTM_READ))
+            return false;
+
+        last_lba = read_uint32_msbf(buffer);
+        block_len = read_uint32_msbf(buffer + 4);
+        return true;
+    }
+
+    /**
+     * Executes a READ (10) command on the device.
+     * @param [in] lba The address of the first block to read.
+     * @param [in] num_blocks The number of blocks to read.
+     * @param [out] buffer The buffer to which the read data will be written.
+     * @param [in] buffer_len The size of the specified buffer.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool MmcDevice::read10(ckcore::tuint32 lba,ckcore::tuint16 num_blocks,
+                           unsigned char *buffer,ckcore::tuint32 buffer_len)
+    {
+        // Prepare CDB.
+        unsigned char cdb[16];
+        memset(cdb,0,sizeof(cdb));
+
+        cdb[0] = ckCMD_READ10;
+        write_uint32_msbf(lba,cdb + 2);
+        write_uint16_msbf(num_blocks,cdb + 7);
+
+        if (!transport(cdb,10,buffer,buffer_len,ScsiDevice::ckTM_READ))
+            return false;
+
+        return true;
+    }
+
+    /**
+     * Executes a READ CD command on the device, reading 2352 byte CD-DA
+     * frames. Each returned frame consists of the audio data followed by the
+     * optional C2 error bits (one bit per byte, 294 bytes) and the optional
+     * sub-channel data.
+     * @param [in] lba The first frame to read.
+     * @param [in] count The number of frames to read.
+     * @param [in] c2 Set to true to request C2 error pointers.
+     * @param [in] sub The sub-channel data to request.
+     * @param [out] buffer The buffer to which the frames will be written,
+     *                     must satisfy the host adapter alignment.
+     * @param [in] buffer_len The size of the specified buffer.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool MmcDevice::read_cd(ckcore::tuint32 lba,ckcore::tuint32 count,bool c2,
+                            ReadCdSubchannel sub,unsigned char *buffer,
+                            ckcore::tuint32 buffer_len)
+    {
+        if (count > 0xffffff ||
+            static_cast<ckcore::tuint64>(count) * read_cd_frame_len(c2,sub) > buffer_len)
+        {
+            return false;
+        }
+
+        // Prepare CDB.
+        unsigned char cdb[16];
+        memset(cdb,0,sizeof(cdb));
+
+        cdb[0] = ckCMD_READ_CD;
+        cdb[1] = 0x04;                  // Expected sector type: CD-DA.
+        write_uint32_msbf(lba,cdb + 2);
+        cdb[6] = static_cast<unsigned char>((count >> 16) & 0xff);
+        cdb[7] = static_cast<unsigned char>((count >> 8) & 0xff);
+        cdb[8] = static_cast<unsigned char>(count & 0xff);
+        cdb[9] = 0x10 | (c2 ? 0x02 : 0x00); // User data and C2 error bits.
+        cdb[10] = static_cast<unsigned char>(sub);
+
+        if (!transport(cdb,12,buffer,count * read_cd_frame_len(c2,sub),ScsiDevice::ckTM_READ))
+            return false;
+
+        return true;
+    }
+
+    /**
+     * Calculates the size of a frame returned by READ CD.
+     * @param [in] c2 True if C2 error pointers are requested.
+     * @param [in] sub The requested sub-channel data.
+     * @return The frame size in bytes.
+     */
+    ckcore::tuint32 MmcDevice::read_cd_frame_len(bool c2,ReadCdSubchannel sub)
+    {
+        ckcore::tuint32 len = 2352;
+        if (c2)
+            len += 294;
+
+        switch (sub)
+        {
+            case ckRCS_RAW:
+            case ckRCS_RW:
+                len += 96;
+                break;
+
+            case ckRCS_Q:
+                len += 16;
+                break;
+
+            default:
+                break;
+        }
+
+        return len;
+    }
+
+    /**
+     * Reads the formatted Q sub-channel of a single frame using the READ CD
+     * command. No user data is requested, so the frame may be of any type.
+     * @param [in] lba The frame to read.
+     * @param [out] buffer The buffer receiving the 16 byte Q sub-channel.
+     * @param [in] buffer_len The size of the specified buffer.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool MmcDevice::read_cd_q(ckcore::tuint32 lba,unsigned char *buffer,
+                              ckcore::tuint32 buffer_len)
+    {
+        if (buffer_len < 16)
+            return false;
+
+        // Prepare CDB.
+        unsigned char cdb[16];
+        memset(cdb,0,sizeof(cdb));
+
+        cdb[0] = ckCMD_READ_CD;
+        write_uint32_msbf(lba,cdb + 2);
+        cdb[8] = 1;
+        cdb[10] = ckRCS_Q;
+
+        if (!transport(cdb,12,buffer,16,ScsiDevice::ckTM_READ))
+            return false;
+
+        return true;
+    }
+
+    /**
+     * Reads the table of contents of the inserted disc, addressed using
+     * logical block addresses.
+     * @param [out] buffer The buffer receiving the TOC header followed by one
+     *                     8 byte descriptor per track and the lead-out.
+     * @param [in] buffer_len The size of the specified buffer.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool MmcDevice::read_toc(unsigned char *buffer,ckcore::tuint16 buffer_len)
+    {
+        memset(buffer,0,buffer_len);
+
+        // Prepare CDB.
+        unsigned char cdb[16];
+        memset(cdb,0,sizeof(cdb));
+
+        cdb[0] = ckCMD_READ_TOC_PMA_ATIP;
+        cdb[6] = 1;                     // Starting track.
+        write_uint16_msbf(buffer_len,cdb + 7);
+
+        if (!transport(cdb,10,buffer,buffer_len,ScsiDevice::ckTM_READ))
+            return false;
+
+        return true;
+    }
+
+    /**
+     * Executes a READ SUB-CHANNEL command on the device, requesting the Q
+     * sub-channel data.
+     * @param [in] format The sub-channel data format, 1 for the current
+     *                    position, 2 for the media catalog number and 3 for
+     *                    the ISRC of a track.
+     * @param [in] track The track number, used by the ISRC format.
+     * @param [out] buffer The buffer to which the data will be written.
+     * @param [in] buffer_len The size of the specified buffer.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool MmcDevice::read_subchannel(unsigned char format,unsigned char track,
+                                    unsigned char *buffer,ckcore::tuint16 buffer_len)
+    {
+        memset(buffer,0,buffer_len);
+
+        // Prepare CDB.
+        unsigned char cdb[16];
+        memset(cdb,0,sizeof(cdb));
+
+        cdb[0] = ckCMD_READ_SUBCHANNEL;
+        cdb[2] = 0x40;                  // SubQ.
+        cdb[3] = format;
+        cdb[6] = track;
+        write_uint16_msbf(buffer_len,cdb + 7);
+
+        if (!transport(cdb,10,buffer,buffer_len,ScsiDevice::ckTM_READ))
+            return false;
+
+        return true;
+    }
+
+    /**
+     * Writes blocks to the disc using the WRITE(10) command.
+     * @param [in] lba The first block to write.
+     * @param [in] num_blocks The number of blocks to write.
+     * @param [in] buffer The data to write.
+     * @param [in] buffer_len The size of the data in bytes.
+     * @param [out] sense_data Receives the sense data if the device reports
+     *                         an error.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool MmcDevice::write10(ckcore::tuint32 lba,ckcore::tuint16 num_blocks,
+                            const unsigned char *buffer,ckcore::tuint32 buffer_len,
+                            ScsiSenseData &sense_data)
+    {
+        memset(&sense_data,0,sizeof(ScsiSenseData));
+
+        // Prepare CDB.
+        unsigned char cdb[16];
+        memset(cdb,0,sizeof(cdb));
+
+        cdb[0] = ckCMD_WRITE10;
+        write_uint32_msbf(lba,cdb + 2);
+        write_uint16_msbf(num_blocks,cdb + 7);
+
+        unsigned char sense[24];
+        memset(sense,0,sizeof(sense));
+        unsigned char result = 0;
+
+        // The buffer is only read from in write mode.
+        if (!transport_with_sense(cdb,10,const_cast<unsigned char *>(buffer),buffer_len,
+                                  ScsiDevice::ckTM_WRITE,sense,result))
+        {
+            return false;
+        }
+
+        if (result == ckSCSISTAT_CHECK_CONDITION)
+            sense_data.parse(sense);
+
+        return result == ckSCSISTAT_GOOD;
+    }
+
+    /**
+     * Reads the size and free space of the device write buffer using the
+     * READ BUFFER CAPACITY command.
+     * @param [out] buffer_len The size of the buffer in bytes.
+     * @param [out] buffer_free The number of unused bytes in the buffer.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool MmcDevice::read_buffer_capacity(ckcore::tuint32 &buffer_len,
+                                         ckcore::tuint32 &buffer_free)
+    {
+        unsigned char buffer[12];
+        memset(buffer,0,sizeof(buffer));
+
+        // Prepare CDB.
+        unsigned char cdb[16];
+        memset(cdb,0,sizeof(cdb));
+
+        cdb[0] = ckCMD_READ_BUFFER_CAPACITY;
+        write_uint16_msbf(static_cast<ckcore::tuint16>(sizeof(buffer)),cdb + 7);
+
+        if (!transport(cdb,10,buffer,sizeof(buffer),ScsiDevice::ckTM_READ))
+            return false;
+
+        buffer_len = read_uint32_msbf(buffer + 4);
+        buffer_free = read_uint32_msbf(buffer + 8);
+        if (buffer_free > buffer_len)
+            buffer_free = buffer_len;
+
+        return true;
+    }
 };
@@ -0,0 +1,228 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <ckcore/log.hh>
+#include "ckmmc/offsetdetector.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs an OffsetDetector object.
+     * @param [in] device The device to calibrate.
+     */
+    OffsetDetector::OffsetDetector(MmcDevice &device) : device_(device),reader_(device)
+    {
+        reader_.c2(false);
+    }
+
+    /**
+     * Destructs the OffsetDetector object.
+     */
+    OffsetDetector::~OffsetDetector()
+    {
+    }
+
+    /**
+     * Calculates the discrete Fourier transform in place using the iterative
+     * radix-2 algorithm.
+     * @param [in,out] data The data, its size must be a power of two.
+     * @param [in] inverse Set to true to calculate the inverse transform.
+     *                     The result is not scaled.
+     */
+    void OffsetDetector::fft(std::vector<std::complex<double> > &data,bool inverse)
+    {
+        size_t n = data.size();
+
+        // Bit reversal permutation.
+        for (size_t i = 1,j = 0; i < n; i++)
+        {
+            size_t bit = n >> 1;
+            for (; j & bit; bit >>= 1)
+                j ^= bit;
+            j ^= bit;
+
+            if (i < j)
+                std::swap(data[i],data[j]);
+        }
+
+        const double pi = 3.14159265358979323846;
+        for (size_t len = 2; len <= n; len <<= 1)
+        {
+            double angle = (inverse ? 2.0 : -2.0) * pi / static_cast<double>(len);
+            std::complex<double> step(cos(angle),sin(angle));
+
+            for (size_t i = 0; i < n; i += len)
+            {
+                std::complex<double> w(1.0,0.0);
+                for (size_t j = 0; j < len / 2; j++)
+                {
+                    std::complex<double> u = data[i + j];
+                    std::complex<double> v = data[i + j + len / 2] * w;
+                    data[i + j] = u + v;
+                    data[i + j + len / 2] = u - v;
+                    w *= step;
+                }
+            }
+        }
+    }
+
+    /**
+     * Converts stereo samples to a mono signal.
+     * @param [in] data The samples.
+     * @param [in] count The number of samples.
+     * @param [out] signal The signal, it must hold at least count values.
+     *                     Remaining values are set to zero.
+     */
+    void OffsetDetector::load(const unsigned char *data,ckcore::tuint32 count,
+                              std::vector<std::complex<double> > &signal)
+    {
+        for (size_t i = 0; i < signal.size(); i++)
+        {
+            if (i < count)
+            {
+                ckcore::tint16 left = static_cast<ckcore::tint16>(data[i * 4] | (data[i * 4 + 1] << 8));
+                ckcore::tint16 right = static_cast<ckcore::tint16>(data[i * 4 + 2] | (data[i * 4 + 3] << 8));
+                signal[i] = std::complex<double>(static_cast<double>(left) + right,0.0);
+            }
+            else
+            {
+                signal[i] = 0.0;
+            }
+        }
+    }
+
+    /**
+     * Detects the read offset of the device.
+     * @param [in] lba The address of the reference audio. At least
+     *                 ckMARGIN_FRAMES frames must precede it on the disc.
+     * @param [in] reference The correct audio of the reference frames. The
+     *                       reference should not contain silence or
+     *                       repetitive audio.
+     * @param [in] count The number of reference frames.
+     * @param [out] offset The read offset in samples, sample p of the disc is
+     *                     returned by the device at position p + offset.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool OffsetDetector::detect(ckcore::tuint32 lba,const unsigned char *reference,
+                                ckcore::tuint32 count,ckcore::tint32 &offset)
+    {
+        if (lba < ckMARGIN_FRAMES || count == 0)
+            return false;
+
+        ckcore::tuint32 read_frames = count + 2 * ckMARGIN_FRAMES;
+        std::vector<unsigned char> audio(static_cast<size_t>(read_frames) * AudioReader::ckFRAME_SIZE);
+        std::vector<ckcore::tuint32> bad_frames;
+
+        if (!reader_.read(lba - ckMARGIN_FRAMES,read_frames,&audio[0],NULL,NULL,bad_frames) ||
+            !bad_frames.empty())
+        {
+            ckcore::log::print_line(ckT("[offsetdetector]: unable to read the reference region."));
+            return false;
+        }
+
+        ckcore::tuint32 read_samples = read_frames * ckFRAME_SAMPLES;
+        ckcore::tuint32 ref_samples = count * ckFRAME_SAMPLES;
+
+        size_t n = 1;
+        while (n < read_samples + ref_samples)
+            n <<= 1;
+
+        // The correlation of lag l is the sum of read[i + l] * reference[i],
+        // calculated as IFFT(FFT(read) * conj(FFT(reference))).
+        std::vector<std::complex<double> > read_signal(n),ref_signal(n);
+        load(&audio[0],read_samples,read_signal);
+        load(reference,ref_samples,ref_signal);
+
+        fft(read_signal,false);
+        fft(ref_signal,false);
+        for (size_t i = 0; i < n; i++)
+            read_signal[i] *= std::conj(ref_signal[i]);
+        fft(read_signal,true);
+
+        // Keep the strongest peaks, strongest first.
+        ckcore::tuint32 max_lag = read_samples - ref_samples;
+        ckcore::tuint32 lags[ckCANDIDATES];
+        double values[ckCANDIDATES];
+        unsigned int num_lags = 0;
+
+        for (ckcore::tuint32 lag = 0; lag <= max_lag; lag++)
+        {
+            double value = read_signal[lag].real();
+            if ((lag > 0 && read_signal[lag - 1].real() > value) ||
+                (lag < max_lag && read_signal[lag + 1].real() > value))
+            {
+                continue;
+            }
+
+            unsigned int pos = num_lags;
+            while (pos > 0 && values[pos - 1] < value)
+                pos--;
+
+            if (pos == ckCANDIDATES)
+                continue;
+
+            if (num_lags < ckCANDIDATES)
+                num_lags++;
+
+            for (unsigned int i = num_lags - 1; i > pos; i--)
+            {
+                lags[i] = lags[i - 1];
+                values[i] = values[i - 1];
+            }
+
+            lags[pos] = lag;
+            values[pos] = value;
+        }
+
+        for (unsigned int i = 0; i < num_lags; i++)
+        {
+            if (memcmp(&audio[static_cast<size_t>(lags[i]) * 4],reference,
+                       static_cast<size_t>(ref_samples) * 4) == 0)
+            {
+                offset = static_cast<ckcore::tint32>(lags[i]) - ckMARGIN_FRAMES * ckFRAME_SAMPLES;
+                return true;
+            }
+        }
+
+        ckcore::log::print_line(ckT("[offsetdetector]: the reference audio was not found."));
+        return false;
+    }
+
+    /**
+     * Detects the read offset of the device and stores it in the device and
+     * in the drive profile store.
+     * @param [in] lba The address of the reference audio.
+     * @param [in] reference The correct audio of the reference frames.
+     * @param [in] count The number of reference frames.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool OffsetDetector::calibrate(ckcore::tuint32 lba,const unsigned char *reference,
+                                   ckcore::tuint32 count)
+    {
+        ckcore::tint32 offset = 0;
+        if (!detect(lba,reference,count,offset))
+            return false;
+
+        ckcore::log::print_line(ckT("[offsetdetector]: read offset is %d samples."),offset);
+
+        device_.read_offset(offset);
+        return true;
+    }
+};
@@ -0,0 +1,478 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <vector>
+#include <ckcore/log.hh>
+#include "ckmmc/quirks.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Quirk table entry.
+     */
+    struct QuirkEntry
+    {
+        /**
+         * Defines entry limits.
+         */
+        enum
+        {
+            ckMAX_OPCODES = 4
+        };
+
+        const char *vendor_;
+        const char *product_;           // Empty string matches all products.
+        const char *rev_min_;           // NULL if unbounded.
+        const char *rev_max_;           // NULL if unbounded.
+        ckcore::tuint32 flags_;
+        ckcore::tuint32 max_transfer_;  // Maximum transfer size in bytes, 0 if not limited.
+        unsigned char num_hangs_;
+        unsigned char hangs_[ckMAX_OPCODES];
+        struct
+        {
+            unsigned char opcode_;
+            unsigned char timeout_;     // Timeout in seconds, 0 terminates the list.
+        } timeouts_[ckMAX_OPCODES];
+    };
+
+    /*
+     * The quirks table. Entries sharing the same vendor and product must be
+     * stored next to each other since only the first of them is referenced
+     * by the hash table. Entries with an empty product apply to all products
+     * of the vendor and are merged with the product specific entries.
+     */
+    static const QuirkEntry quirk_table[] =
+    {
+        // Plextor recorders may support audio master writing.
+        { "PLEXTOR","",NULL,NULL,
+          DriveQuirks::ckQUIRK_AUDIO_MASTER_PROBE,0,0,{ 0 },{ { 0,0 } } },
+
+        // Plextor VariRec capable CD recorders.
+        { "PLEXTOR","CD-R   PREMIUM",NULL,NULL,
+          DriveQuirks::ckQUIRK_VARIREC | DriveQuirks::ckQUIRK_SKIP_LAYER_JUMP_PROBE,
+          0,0,{ 0 },{ { 0,0 } } },
+        { "PLEXTOR","CD-R   PREMIUM2",NULL,NULL,
+          DriveQuirks::ckQUIRK_VARIREC | DriveQuirks::ckQUIRK_SKIP_LAYER_JUMP_PROBE,
+          0,0,{ 0 },{ { 0,0 } } },
+        { "PLEXTOR","CD-R   PX-W4824A",NULL,NULL,
+          DriveQuirks::ckQUIRK_VARIREC | DriveQuirks::ckQUIRK_SKIP_LAYER_JUMP_PROBE,
+          0,0,{ 0 },{ { 0,0 } } },
+        { "PLEXTOR","CD-R   PX-W5224A",NULL,NULL,
+          DriveQuirks::ckQUIRK_VARIREC | DriveQuirks::ckQUIRK_SKIP_LAYER_JUMP_PROBE,
+          0,0,{ 0 },{ { 0,0 } } },
+
+        // Plextor VariRec capable DVD recorders.
+        { "PLEXTOR","DVDR   PX-708A",NULL,NULL,
+          DriveQuirks::ckQUIRK_VARIREC,0,0,{ 0 },{ { 0,0 } } },
+        { "PLEXTOR","DVDR   PX-712A",NULL,NULL,
+          DriveQuirks::ckQUIRK_VARIREC,0,0,{ 0 },{ { 0,0 } } },
+        { "PLEXTOR","DVDR   PX-716A",NULL,NULL,
+          DriveQuirks::ckQUIRK_VARIREC,0,0,{ 0 },{ { 0,0 } } },
+        { "PLEXTOR","DVDR   PX-716AL",NULL,NULL,
+          DriveQuirks::ckQUIRK_VARIREC,0,0,{ 0 },{ { 0,0 } } },
+        { "PLEXTOR","DVDR   PX-755A",NULL,NULL,
+          DriveQuirks::ckQUIRK_VARIREC,0,0,{ 0 },{ { 0,0 } } },
+        { "PLEXTOR","DVDR   PX-760A",NULL,NULL,
+          DriveQuirks::ckQUIRK_VARIREC,0,0,{ 0 },{ { 0,0 } } },
+
+        // Doesn't support SET CD SPEED and stops responding when receiving it.
+        { "SAMSUNG","CD-ROM SCR-3231",NULL,NULL,
+          0,0,1,{ 0xbb },{ { 0,0 } } },
+
+        // Can't transfer more than 128 sectors of 512 bytes in one command.
+        { "TORiSAN","DVD-ROM DRD-N216",NULL,NULL,
+          0,64 * 1024,0,{ 0 },{ { 0,0 } } },
+
+        // Mishandles GET CONFIGURATION.
+        { "TOSHIBA","SD-W1101 DVD-RAM",NULL,NULL,
+          DriveQuirks::ckQUIRK_SKIP_GET_CONFIGURATION,0,0,{ 0 },{ { 0,0 } } },
+        { "TOSHIBA","SD-W1111 DVD-RAM",NULL,NULL,
+          DriveQuirks::ckQUIRK_SKIP_GET_CONFIGURATION,0,0,{ 0 },{ { 0,0 } } },
+
+        // Yamaha recorders may support audio master writing and force speed.
+        { "YAMAHA","",NULL,NULL,
+          DriveQuirks::ckQUIRK_AUDIO_MASTER_PROBE | DriveQuirks::ckQUIRK_FORCE_SPEED_PROBE,
+          0,0,{ 0 },{ { 0,0 } } }
+    };
+
+    /**
+     * Calculates the FNV-1a hash of a vendor and product identifier pair.
+     * @param [in] vendor The vendor identifier.
+     * @param [in] product The product identifier.
+     * @return The hash value.
+     */
+    template <typename T>
+    static ckcore::tuint32 quirk_hash(const T *vendor,const T *product)
+    {
+        ckcore::tuint32 hash = 0x811c9dc5;
+        for (; *vendor != '\0'; vendor++)
+            hash = (hash ^ static_cast<unsigned char>(*vendor)) * 0x01000193;
+
+        hash = (hash ^ 0) * 0x01000193;
+
+        for (; *product != '\0'; product++)
+            hash = (hash ^ static_cast<unsigned char>(*product)) * 0x01000193;
+
+        return hash;
+    }
+
+    /**
+     * Compares a table string with a device identifier string.
+     * @param [in] str1 The table string.
+     * @param [in] str2 The device identifier.
+     * @return An integer less than, equal to or greater than zero if str1 is
+     *         found to be less than, equal to or greater than str2.
+     */
+    static int quirk_strcmp(const char *str1,const ckcore::tchar *str2)
+    {
+        for (; *str1 != '\0' && static_cast<unsigned char>(*str1) == *str2; str1++,str2++)
+            ;
+
+        return static_cast<int>(static_cast<unsigned char>(*str1)) - static_cast<int>(*str2);
+    }
+
+    /**
+     * Checks if a table entry has the specified key.
+     * @param [in] entry The table entry.
+     * @param [in] vendor The vendor identifier.
+     * @param [in] product The product identifier.
+     * @return If the entry has the key true is returned, if not false is
+     *         returned.
+     */
+    static bool quirk_match(const QuirkEntry &entry,const ckcore::tchar *vendor,
+                            const ckcore::tchar *product)
+    {
+        return quirk_strcmp(entry.vendor_,vendor) == 0 &&
+               quirk_strcmp(entry.product_,product) == 0;
+    }
+
+    /**
+     * @brief Perfect hash table of the quirks table keys.
+     * A key is first hashed using FNV-1a, the result selects a displacement
+     * which is added to the hash before mixing it into a slot. The
+     * displacements are chosen so that no two keys share the same slot, a
+     * lookup therefore requires exactly one string comparison. Without
+     * constexpr support the displacements can't be searched by the compiler,
+     * instead they are searched once during static initialization. This
+     * keeps the table in sync with the keys without any generated data.
+     */
+    class QuirkHashTable
+    {
+    private:
+        enum
+        {
+            ckNUM_BUCKETS = 16,
+            ckNUM_SLOTS = 64,
+            ckMAX_DISPLACEMENT = 0x10000
+        };
+
+        ckcore::tuint32 displacements_[ckNUM_BUCKETS];
+        signed char slots_[ckNUM_SLOTS];
+        bool valid_;
+
+        /**
+         * Maps a key hash to a slot.
+         * @param [in] hash The FNV-1a hash of the key.
+         * @param [in] displacement The displacement of the key bucket.
+         * @return The slot index.
+         */
+        static unsigned int slot(ckcore::tuint32 hash,ckcore::tuint32 displacement)
+        {
+            ckcore::tuint32 h = hash + displacement;
+            h ^= h >> 16;
+            h *= 0x85ebca6b;
+            h ^= h >> 13;
+            h *= 0xc2b2ae35;
+            h ^= h >> 16;
+
+            return h % ckNUM_SLOTS;
+        }
+
+        /**
+         * Searches the displacements of all buckets. The buckets holding the
+         * most keys are the hardest to place and are placed first.
+         * @return If a perfect hash was found true is returned, if not false
+         *         is returned.
+         */
+        bool build()
+        {
+            const unsigned int num_entries = sizeof(quirk_table) / sizeof(QuirkEntry);
+
+            // Distribute the first entry of each key into the buckets.
+            std::vector<unsigned int> buckets[ckNUM_BUCKETS];
+            unsigned int num_keys = 0;
+            for (unsigned int i = 0; i < num_entries; i++)
+            {
+                const QuirkEntry &entry = quirk_table[i];
+                if (i > 0 && strcmp(entry.vendor_,quirk_table[i - 1].vendor_) == 0 &&
+                    strcmp(entry.product_,quirk_table[i - 1].product_) == 0)
+                {
+                    continue;
+                }
+
+                buckets[quirk_hash(entry.vendor_,entry.product_) % ckNUM_BUCKETS].push_back(i);
+                num_keys++;
+            }
+
+            if (num_keys > ckNUM_SLOTS / 2)
+                return false;
+
+            bool placed[ckNUM_BUCKETS];
+            memset(placed,0,sizeof(placed));
+
+            for (unsigned int n = 0; n < ckNUM_BUCKETS; n++)
+            {
+                unsigned int b = ckNUM_BUCKETS;
+                for (unsigned int i = 0; i < ckNUM_BUCKETS; i++)
+                {
+                    if (!placed[i] && (b == ckNUM_BUCKETS || buckets[i].size() > buckets[b].size()))
+                        b = i;
+                }
+
+                placed[b] = true;
+                if (buckets[b].empty())
+                    continue;
+
+                ckcore::tuint32 d = 0;
+                for (; d < ckMAX_DISPLACEMENT; d++)
+                {
+                    unsigned int i = 0;
+                    for (; i < buckets[b].size(); i++)
+                    {
+                        const QuirkEntry &entry = quirk_table[buckets[b][i]];
+                        unsigned int s = slot(quirk_hash(entry.vendor_,entry.product_),d);
+                        if (slots_[s] >= 0)
+                            break;
+
+                        slots_[s] = static_cast<signed char>(buckets[b][i]);
+                    }
+
+                    if (i == buckets[b].size())
+                        break;
+
+                    // Undo the partial placement and try the next displacement.
+                    for (unsigned int j = 0; j < i; j++)
+                    {
+                        const QuirkEntry &entry = quirk_table[buckets[b][j]];
+                        slots_[slot(quirk_hash(entry.vendor_,entry.product_),d)] = -1;
+                    }
+                }
+
+                if (d == ckMAX_DISPLACEMENT)
+                    return false;
+
+                displacements_[b] = d;
+            }
+
+            return true;
+        }
+
+    public:
+        QuirkHashTable() : valid_(false)
+        {
+            memset(displacements_,0,sizeof(displacements_));
+            memset(slots_,-1,sizeof(slots_));
+
+            valid_ = build();
+        }
+
+        /**
+         * Checks if the perfect hash was successfully built.
+         * @return If the hash table is valid true is returned, if not false
+         *         is returned.
+         */
+        bool valid() const
+        {
+            return valid_;
+        }
+
+        /**
+         * Finds the first table entry of the specified key.
+         * @param [in] vendor The vendor identifier.
+         * @param [in] product The product identifier.
+         * @return The index of the first entry of the key, -1 if the key is
+         *         not in the table.
+         */
+        int find(const ckcore::tchar *vendor,const ckcore::tchar *product) const
+        {
+            // Fall back to a linear search if no perfect hash could be found.
+            if (!valid_)
+            {
+                const unsigned int num_entries = sizeof(quirk_table) / sizeof(QuirkEntry);
+                for (unsigned int i = 0; i < num_entries; i++)
+                {
+                    if (quirk_match(quirk_table[i],vendor,product))
+                        return static_cast<int>(i);
+                }
+
+                return -1;
+            }
+
+            ckcore::tuint32 hash = quirk_hash(vendor,product);
+            int index = slots_[slot(hash,displacements_[hash % ckNUM_BUCKETS])];
+            if (index < 0 || !quirk_match(quirk_table[index],vendor,product))
+                return -1;
+
+            return index;
+        }
+    };
+
+    static const QuirkHashTable quirk_hash_table;
+
+    /**
+     * Constructs a DriveQuirks object without any quirks.
+     */
+    DriveQuirks::DriveQuirks()
+    {
+        clear();
+    }
+
+    /**
+     * Destructs the DriveQuirks object.
+     */
+    DriveQuirks::~DriveQuirks()
+    {
+    }
+
+    /**
+     * Merges the quirks of a table entry into this object.
+     * @param [in] index The table entry index.
+     */
+    void DriveQuirks::merge(unsigned int index)
+    {
+        const QuirkEntry &entry = quirk_table[index];
+
+        flags_ |= entry.flags_;
+
+        if (entry.max_transfer_ != 0 &&
+            (max_transfer_ == 0 || entry.max_transfer_ < max_transfer_))
+        {
+            max_transfer_ = entry.max_transfer_;
+        }
+
+        for (unsigned int i = 0; i < entry.num_hangs_; i++)
+            hangs_[entry.hangs_[i] >> 3] |= 1 << (entry.hangs_[i] & 7);
+
+        for (unsigned int i = 0; i < QuirkEntry::ckMAX_OPCODES &&
+             entry.timeouts_[i].timeout_ != 0; i++)
+        {
+            timeouts_[entry.timeouts_[i].opcode_] = entry.timeouts_[i].timeout_;
+        }
+    }
+
+    /**
+     * Removes all quirks.
+     */
+    void DriveQuirks::clear()
+    {
+        flags_ = 0;
+        max_transfer_ = 0;
+        memset(hangs_,0,sizeof(hangs_));
+        memset(timeouts_,0,sizeof(timeouts_));
+    }
+
+    /**
+     * Looks up the quirks of a drive. Vendor wide quirks are combined with
+     * the quirks of the specific product.
+     * @param [in] vendor The device vendor.
+     * @param [in] identifier The device product identifier.
+     * @param [in] revision The device firmware revision.
+     * @return If any quirks were found true is returned, if not false is
+     *         returned.
+     */
+    bool DriveQuirks::lookup(const ckcore::tchar *vendor,const ckcore::tchar *identifier,
+                             const ckcore::tchar *revision)
+    {
+#ifdef _DEBUG
+        if (!quirk_hash_table.valid())
+            ckcore::log::print_line(ckT("[quirks]: warning: no perfect hash found for the quirks table."));
+#endif
+        clear();
+
+        const unsigned int num_entries = sizeof(quirk_table) / sizeof(QuirkEntry);
+        const ckcore::tchar *products[2] = { ckT(""),identifier };
+
+        bool found = false;
+        for (unsigned int i = 0; i < 2; i++)
+        {
+            int first = quirk_hash_table.find(vendor,products[i]);
+            if (first < 0)
+                continue;
+
+            for (unsigned int j = first; j < num_entries; j++)
+            {
+                const QuirkEntry &entry = quirk_table[j];
+                if (!quirk_match(entry,vendor,products[i]))
+                    break;
+
+                if (entry.rev_min_ != NULL && quirk_strcmp(entry.rev_min_,revision) > 0)
+                    continue;
+                if (entry.rev_max_ != NULL && quirk_strcmp(entry.rev_max_,revision) < 0)
+                    continue;
+
+                merge(j);
+                found = true;
+            }
+        }
+
+        return found;
+    }
+
+    /**
+     * Checks if the drive has the specified quirk.
+     * @param [in] flag The quirk flag.
+     * @return If the drive has the quirk true is returned, if not false is
+     *         returned.
+     */
+    bool DriveQuirks::has(ckcore::tuint32 flag) const
+    {
+        return (flags_ & flag) != 0;
+    }
+
+    /**
+     * Checks if the drive is known to hang on the specified command.
+     * @param [in] opcode The command operation code.
+     * @return If the command is known to hang true is returned, if not false
+     *         is returned.
+     */
+    bool DriveQuirks::hangs(unsigned char opcode) const
+    {
+        return (hangs_[opcode >> 3] & (1 << (opcode & 7))) != 0;
+    }
+
+    /**
+     * Returns the known timeout of the specified command.
+     * @param [in] opcode The command operation code.
+     * @return The timeout in seconds, -1 if no timeout is known.
+     */
+    long DriveQuirks::timeout(unsigned char opcode) const
+    {
+        return timeouts_[opcode] != 0 ? timeouts_[opcode] : -1;
+    }
+
+    /**
+     * Returns the maximum number of bytes the drive can transfer in a single
+     * command.
+     * @return The maximum transfer size in bytes, 0 if not limited.
+     */
+    ckcore::tuint32 DriveQuirks::max_transfer() const
+    {
+        return max_transfer_;
+    }
+};
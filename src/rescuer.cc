@@ -0,0 +1,506 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <string.h>
+#include <ckcore/log.hh>
+#include "ckmmc/errorrecoveryscope.hh"
+#include "ckmmc/mmc.hh"
+#include "ckmmc/sync.hh"
+#include "ckmmc/timer.hh"
+#include "ckmmc/rescuer.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs a Rescuer object.
+     * @param [in] device The device to read from.
+     */
+    Rescuer::Rescuer(MmcDevice &device) : device_(device),map_path_(NULL),
+        last_save_(0),retry_passes_(ckDEFAULT_RETRY_PASSES),stop_(0),
+        chunk_blocks_(0)
+    {
+#ifdef _WINDOWS
+        image_ = INVALID_HANDLE_VALUE;
+#else
+        image_ = -1;
+#endif
+    }
+
+    /**
+     * Destructs the Rescuer object.
+     */
+    Rescuer::~Rescuer()
+    {
+    }
+
+    /**
+     * Opens the image file for writing. An existing image is kept so that
+     * a job can be resumed.
+     * @param [in] path The image file path.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool Rescuer::open_image(const ckcore::tchar *path)
+    {
+#ifdef _WINDOWS
+        image_ = CreateFile(path,GENERIC_WRITE,0,NULL,OPEN_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+        if (image_ == INVALID_HANDLE_VALUE)
+        {
+            ckcore::log::print_line(ckT("[rescuer]: unable to open image file (%d)."),GetLastError());
+            return false;
+        }
+#else
+        image_ = ::open(path,O_WRONLY | O_CREAT,0644);
+        if (image_ == -1)
+        {
+            ckcore::log::print_line(ckT("[rescuer]: unable to open image file."));
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    /**
+     * Writes sectors to the image file.
+     * @param [in] lba The address of the first sector.
+     * @param [in] data The sector data.
+     * @param [in] count The number of sectors.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool Rescuer::write_image(ckcore::tuint32 lba,const unsigned char *data,
+                              ckcore::tuint32 count)
+    {
+        ckcore::tuint64 offset = static_cast<ckcore::tuint64>(lba - map_.first()) * 2048;
+        ckcore::tuint32 len = count * 2048;
+
+#ifdef _WINDOWS
+        LARGE_INTEGER distance;
+        distance.QuadPart = offset;
+
+        DWORD written = 0;
+        if (!SetFilePointerEx(image_,distance,NULL,FILE_BEGIN) ||
+            !WriteFile(image_,data,len,&written,NULL) || written != len)
+        {
+            ckcore::log::print_line(ckT("[rescuer]: unable to write to image file (%d)."),GetLastError());
+            return false;
+        }
+#else
+        if (pwrite(image_,data,len,offset) != static_cast<ssize_t>(len))
+        {
+            ckcore::log::print_line(ckT("[rescuer]: unable to write to image file."));
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    /**
+     * Flushes all data written to the image file to disk.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool Rescuer::flush_image()
+    {
+#ifdef _WINDOWS
+        if (image_ != INVALID_HANDLE_VALUE && !FlushFileBuffers(image_))
+        {
+            ckcore::log::print_line(ckT("[rescuer]: unable to flush image file (%d)."),GetLastError());
+            return false;
+        }
+#else
+        if (image_ != -1 && fsync(image_) != 0)
+        {
+            ckcore::log::print_line(ckT("[rescuer]: unable to flush image file."));
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    /**
+     * Closes the image file, making sure that it covers all sectors.
+     * @param [in] count The number of sectors the image should cover.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool Rescuer::close_image(ckcore::tuint32 count)
+    {
+        ckcore::tuint64 size = static_cast<ckcore::tuint64>(count) * 2048;
+        bool res = true;
+
+#ifdef _WINDOWS
+        if (image_ == INVALID_HANDLE_VALUE)
+            return true;
+
+        LARGE_INTEGER cur_size;
+        if (GetFileSizeEx(image_,&cur_size) && static_cast<ckcore::tuint64>(cur_size.QuadPart) < size)
+        {
+            LARGE_INTEGER distance;
+            distance.QuadPart = size;
+            res = SetFilePointerEx(image_,distance,NULL,FILE_BEGIN) && SetEndOfFile(image_);
+        }
+
+        CloseHandle(image_);
+        image_ = INVALID_HANDLE_VALUE;
+#else
+        if (image_ == -1)
+            return true;
+
+        off_t cur_size = lseek(image_,0,SEEK_END);
+        if (cur_size != -1 && static_cast<ckcore::tuint64>(cur_size) < size)
+            res = ftruncate(image_,size) == 0;
+
+        ::close(image_);
+        image_ = -1;
+#endif
+        return res;
+    }
+
+    /**
+     * Reads sectors into the internal buffer using a single command.
+     * @param [in] lba The first sector.
+     * @param [in] count The number of sectors, must fit the buffer.
+     * @return The read result.
+     */
+    Rescuer::ReadResult Rescuer::read(ckcore::tuint32 lba,ckcore::tuint32 count)
+    {
+        // Prepare CDB.
+        unsigned char cdb[16];
+        memset(cdb,0,sizeof(cdb));
+
+        cdb[0] = MmcDevice::ckCMD_READ10;
+        write_uint32_msbf(lba,cdb + 2);
+        write_uint16_msbf(static_cast<ckcore::tuint16>(count),cdb + 7);
+
+        unsigned char sense[24];
+        memset(sense,0,sizeof(sense));
+        unsigned char result = 0;
+
+        bool res = device_.transport_with_sense(cdb,10,buffer_.data(),count * 2048,
+                                                ScsiDevice::ckTM_READ,sense,result);
+        if (res && result == ScsiDevice::ckSCSISTAT_GOOD)
+            return ckREAD_GOOD;
+
+        if (!res || result != ScsiDevice::ckSCSISTAT_CHECK_CONDITION)
+        {
+            ckcore::log::print_line(ckT("[rescuer]: transport failed at sector %u."),lba);
+            return ckREAD_ABORT;
+        }
+
+        ScsiSenseData sense_data;
+        memset(&sense_data,0,sizeof(ScsiSenseData));
+        sense_data.parse(sense);
+
+        // Media changes and drive failures must not be recorded as bad
+        // sectors.
+        if (sense_data.sense_key_ == ScsiSenseData::ckSENSE_NOT_READY ||
+            sense_data.sense_key_ == ScsiSenseData::ckSENSE_UNIT_ATTENTION ||
+            (sense_data.sense_key_ == ScsiSenseData::ckSENSE_ILLEGAL_REQUEST &&
+             sense_data.asc_ == ScsiSenseData::ckASC_LBA_OUT_OF_RANGE))
+        {
+            ckcore::log::print_line(ckT("[rescuer]: device not usable at sector %u (%.2X/%.2X/%.2X)."),
+                                    lba,sense_data.sense_key_,sense_data.asc_,sense_data.ascq_);
+            return ckREAD_ABORT;
+        }
+
+        return ckREAD_FAILED;
+    }
+
+    /**
+     * Updates the sector map, saving it if enough time has passed since it
+     * was last saved.
+     * @param [in] lba The first sector.
+     * @param [in] count The number of sectors.
+     * @param [in] state The new sector state.
+     */
+    void Rescuer::update(ckcore::tuint32 lba,ckcore::tuint32 count,SectorMap::State state)
+    {
+        map_.set(lba,count,state);
+
+        if (Timer::now() - last_save_ >= ckSAVE_INTERVAL)
+            save_map();
+    }
+
+    /**
+     * Saves the sector map. The image file is flushed first so that the map
+     * never marks sectors as good that have not reached the disk.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool Rescuer::save_map()
+    {
+        last_save_ = Timer::now();
+        return flush_image() && map_.save(map_path_);
+    }
+
+    /**
+     * Reads all untried sectors using reads as large as the transfer length.
+     * @param [in] skip If true, an area following a failed read is skipped.
+     *                  The skipped area doubles with each consecutive failure.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool Rescuer::copy_pass(bool skip)
+    {
+        ckcore::tuint32 skip_size = 0;
+        ckcore::tuint32 pos = map_.first();
+        ckcore::tuint32 lba = 0,count = 0;
+
+        while (atomic::load(&stop_) == 0 && map_.find(SectorMap::ckSTATE_UNTRIED,pos,lba,count))
+        {
+            ckcore::tuint32 num_blocks = count < chunk_blocks_ ? count : chunk_blocks_;
+
+            switch (read(lba,num_blocks))
+            {
+                case ckREAD_GOOD:
+                    if (!write_image(lba,buffer_.data(),num_blocks))
+                        return false;
+
+                    update(lba,num_blocks,SectorMap::ckSTATE_GOOD);
+                    pos = lba + num_blocks;
+                    skip_size = 0;
+                    break;
+
+                case ckREAD_FAILED:
+                    update(lba,num_blocks,SectorMap::ckSTATE_SKIPPED);
+                    pos = lba + num_blocks;
+
+                    if (skip)
+                    {
+                        skip_size = skip_size == 0 ? static_cast<ckcore::tuint32>(ckMIN_SKIP) : skip_size << 1;
+                        if (skip_size > ckMAX_SKIP)
+                            skip_size = ckMAX_SKIP;
+
+                        pos = map_.end() - pos < skip_size ? map_.end() : pos + skip_size;
+                    }
+                    break;
+
+                default:
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Reads all sectors in a specific state one sector at a time.
+     * @param [in] state The state of the sectors to read.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool Rescuer::sector_pass(SectorMap::State state)
+    {
+        ckcore::tuint32 pos = map_.first();
+        ckcore::tuint32 lba = 0,count = 0;
+
+        while (atomic::load(&stop_) == 0 && map_.find(state,pos,lba,count))
+        {
+            switch (read(lba,1))
+            {
+                case ckREAD_GOOD:
+                    if (!write_image(lba,buffer_.data(),1))
+                        return false;
+
+                    update(lba,1,SectorMap::ckSTATE_GOOD);
+                    break;
+
+                case ckREAD_FAILED:
+                    update(lba,1,SectorMap::ckSTATE_FAILED);
+                    break;
+
+                default:
+                    return false;
+            }
+
+            pos = lba + 1;
+        }
+
+        return true;
+    }
+
+    /**
+     * Sets the number of passes retrying failed sectors with drive retries
+     * enabled.
+     * @param [in] passes The number of retry passes.
+     */
+    void Rescuer::retry_passes(unsigned int passes)
+    {
+        retry_passes_ = passes;
+    }
+
+    /**
+     * Returns the number of retry passes.
+     * @return The number of retry passes.
+     */
+    unsigned int Rescuer::retry_passes() const
+    {
+        return retry_passes_;
+    }
+
+    /**
+     * Rescues all sectors on the inserted disc.
+     * @param [in] image_path The image file path.
+     * @param [in] map_path The sector map file path.
+     * @return If all sectors were rescued true is returned, if not false is
+     *         returned.
+     */
+    bool Rescuer::rescue(const ckcore::tchar *image_path,const ckcore::tchar *map_path)
+    {
+        ckcore::tuint32 last_lba = 0,block_len = 0;
+        if (!device_.read_capacity(last_lba,block_len) || block_len != 2048)
+        {
+            ckcore::log::print_line(ckT("[rescuer]: unable to determine disc capacity."));
+            return false;
+        }
+
+        return rescue(image_path,map_path,0,last_lba + 1);
+    }
+
+    /**
+     * Rescues a range of sectors. If the sector map file exists the job it
+     * describes is resumed, the image file must then be the one written by
+     * that job. Unreadable sectors are left unwritten in the image.
+     * @param [in] image_path The image file path.
+     * @param [in] map_path The sector map file path.
+     * @param [in] lba The first sector to rescue.
+     * @param [in] count The number of sectors to rescue.
+     * @return If all sectors were rescued true is returned, if not false is
+     *         returned.
+     */
+    bool Rescuer::rescue(const ckcore::tchar *image_path,const ckcore::tchar *map_path,
+                         ckcore::tuint32 lba,ckcore::tuint32 count)
+    {
+        atomic::store(&stop_,0);
+        map_path_ = map_path;
+
+        if (SectorMap::exists(map_path))
+        {
+            // Starting over would throw away the progress of the job.
+            if (!map_.load(map_path))
+            {
+                ckcore::log::print_line(ckT("[rescuer]: the sector map is corrupt, remove it to start a new job."));
+                return false;
+            }
+
+            if (map_.first() != lba || map_.end() != lba + count)
+            {
+                ckcore::log::print_line(ckT("[rescuer]: the sector map describes a different range."));
+                return false;
+            }
+
+            ckcore::log::print_line(ckT("[rescuer]: resuming in pass %u, %u sectors good."),
+                                    map_.pass(),static_cast<ckcore::tuint32>(map_.count(SectorMap::ckSTATE_GOOD)));
+        }
+        else
+        {
+            map_.reset(lba,count);
+        }
+
+        chunk_blocks_ = device_.transfer_len() / 2048;
+        if (chunk_blocks_ > 0xffff)
+            chunk_blocks_ = 0xffff;
+        if (chunk_blocks_ == 0)
+            chunk_blocks_ = 1;
+
+        if (!buffer_.allocate(chunk_blocks_ * 2048) || !open_image(image_path))
+            return false;
+
+        bool res = save_map();
+
+        // Failures to change the error recovery parameters only make the
+        // passes slower.
+        ErrorRecoveryScope recovery(device_);
+        if (!recovery.valid())
+            ckcore::log::print_line(ckT("[rescuer]: unable to control drive error recovery."));
+
+        // Reads of damaged sectors are expected to be slow, they must neither
+        // time out early nor be treated as stalled commands.
+        long timeout = device_.timeout();
+        bool watchdog = device_.watchdog();
+        device_.watchdog(false);
+
+        ckcore::tuint32 num_passes = ckPASS_RETRY + retry_passes_;
+        while (res && map_.pass() < num_passes && atomic::load(&stop_) == 0)
+        {
+            ckcore::tuint32 pass = map_.pass();
+            switch (pass)
+            {
+                case ckPASS_COPY:
+                    device_.timeout(timeout);
+                    recovery.fail_fast();
+                    res = copy_pass(true);
+                    break;
+
+                case ckPASS_FILL:
+                    device_.timeout(timeout);
+                    recovery.fail_fast();
+                    res = copy_pass(false);
+                    break;
+
+                case ckPASS_SCRAPE:
+                    device_.timeout(ckSECTOR_TIMEOUT);
+                    recovery.fail_fast();
+                    res = sector_pass(SectorMap::ckSTATE_SKIPPED);
+                    break;
+
+                default:
+                    device_.timeout(ckSECTOR_TIMEOUT + ckRETRY_COUNT * ckRETRY_TIMEOUT);
+                    recovery.read_retries(ckRETRY_COUNT);
+                    res = sector_pass(SectorMap::ckSTATE_FAILED);
+                    break;
+            }
+
+            if (res && atomic::load(&stop_) == 0)
+                map_.pass(pass + 1);
+
+            if (!save_map())
+                res = false;
+        }
+
+        recovery.restore();
+
+        device_.timeout(timeout);
+        device_.watchdog(watchdog);
+
+        if (!close_image(count))
+            res = false;
+
+        ckcore::tuint64 num_good = map_.count(SectorMap::ckSTATE_GOOD);
+        ckcore::log::print_line(ckT("[rescuer]: %u of %u sectors rescued."),
+                                static_cast<ckcore::tuint32>(num_good),count);
+
+        return res && num_good == count;
+    }
+
+    /**
+     * Requests a running rescue to stop. The sector map is saved and the job
+     * can be resumed later. This function may be called from any thread.
+     */
+    void Rescuer::stop()
+    {
+        atomic::store(&stop_,1);
+    }
+
+    /**
+     * Returns the sector map of the last rescue.
+     * @return The sector map.
+     */
+    const SectorMap &Rescuer::map() const
+    {
+        return map_;
+    }
+};
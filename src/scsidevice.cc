@@ -16,7 +16,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <ckcore/log.hh>
 #include "ckmmc/scsidriverselector.hh"
+#include "ckmmc/timer.hh"
 #include "ckmmc/scsidevice.hh"
 
 namespace ckmmc
@@ -26,7 +28,9 @@ namespace ckmmc
      */
     ScsiDevice::ScsiDevice(const Address &addr) :
         addr_(addr),
-        driver_(ckmmc::ScsiDriverSelector::driver())
+        driver_(ckmmc::ScsiDriverSelector::driver()),
+        timeout_(-1),watchdog_(true),health_(ckHEALTH_GOOD),health_callback_(NULL),
+        stalls_(0),quarantine_end_(0)
     {
     }
 
@@ -47,13 +51,309 @@ namespace ckmmc
     }
 
     /**
-     * Sets the command timeout value.
-     * @param [in] timeout The new timeout value.
+     * Checks if a command may be sent to the device. Commands are rejected
+     * without touching the device while it is quarantined. When the
+     * quarantine ends the next command is allowed through to probe the
+     * device.
+     * @return If the command may be sent true is returned, if not false is
+     *         returned.
+     */
+    bool ScsiDevice::admit()
+    {
+        health_mutex_.lock();
+
+        switch (health_)
+        {
+            case ckHEALTH_FAILED:
+                health_mutex_.unlock();
+                return false;
+
+            case ckHEALTH_QUARANTINED:
+                if (Timer::now() < quarantine_end_)
+                {
+                    health_mutex_.unlock();
+                    return false;
+                }
+
+                change_health(ckHEALTH_SUSPECT);
+                health_mutex_.unlock();
+
+                notify_health(ckHEALTH_SUSPECT);
+                return true;
+
+            default:
+                health_mutex_.unlock();
+                return true;
+        }
+    }
+
+    /**
+     * Updates the watchdog state after a command has completed. A command
+     * that could not be carried through, or timed out, after running for a
+     * long time is considered stalled. Commands completed by the device with
+     * an error status are not stalls, the device is responding even if slow
+     * media errors took a long time to report. For each consecutive stall
+     * the recovery escalates from aborting outstanding commands, to
+     * resetting the device and finally to resetting the bus. The device is
+     * quarantined after each stall with exponentially increasing quarantine
+     * time. Nothing is done while the watchdog is disabled.
+     *
+     * Stalls are detected when the driver returns, there is no timer
+     * interrupting a command in progress. A stuck command therefore still
+     * blocks its caller until the driver timeout expires, the watchdog only
+     * makes sure that the following commands fail immediately instead of
+     * each waiting for a timeout of its own.
+     * @param [in] transported Set to true if the command was carried through
+     *                         to the device and a status was returned.
+     * @param [in] elapsed The command execution time in microseconds.
+     */
+    void ScsiDevice::complete(bool transported,ckcore::tuint64 elapsed)
+    {
+        if (!watchdog_)
+            return;
+
+        health_mutex_.lock();
+
+        if (transported || elapsed < static_cast<ckcore::tuint64>(ckWATCHDOG_STALL_TIME) * 1000000)
+        {
+            // The device is responding, any earlier stall has been resolved.
+            bool changed = false;
+            if (health_ == ckHEALTH_SUSPECT)
+            {
+                stalls_ = 0;
+                changed = change_health(ckHEALTH_GOOD);
+            }
+
+            health_mutex_.unlock();
+
+            if (changed)
+                notify_health(ckHEALTH_GOOD);
+            return;
+        }
+
+        // Commands sent from other threads before the device was quarantined
+        // may stall as well, they are part of the stall already recovered.
+        if (health_ == ckHEALTH_QUARANTINED || health_ == ckHEALTH_FAILED)
+        {
+            health_mutex_.unlock();
+            return;
+        }
+
+        unsigned int stalls = ++stalls_;
+        Health health = stalls >= ckWATCHDOG_MAX_STALLS ?
+            ckHEALTH_FAILED : ckHEALTH_QUARANTINED;
+
+        // The device is quarantined before it's being reset to keep other
+        // threads from sending commands to it during the recovery.
+        quarantine_end_ = Timer::now() +
+            (static_cast<ckcore::tuint64>(ckWATCHDOG_QUARANTINE_TIME) << (stalls - 1)) * 1000000;
+        change_health(health);
+
+        health_mutex_.unlock();
+
+        ckcore::log::print_line(ckT("[scsidevice]: command stalled for %d ms on %d,%d,%d (stall %d)."),
+                                static_cast<int>(elapsed / 1000),addr_.bus_,addr_.target_,addr_.lun_,stalls);
+
+        notify_health(health);
+        if (health == ckHEALTH_FAILED)
+            return;
+
+        ResetLevel level = stalls == 1 ? ckRESET_ABORT :
+                           stalls == 2 ? ckRESET_DEVICE : ckRESET_BUS;
+        if (!reset(level))
+        {
+            ckcore::log::print_line(ckT("[scsidevice]: reset (level %d) failed on %d,%d,%d."),
+                                    static_cast<int>(level),addr_.bus_,addr_.target_,addr_.lun_);
+        }
+
+        // The quarantine time starts when the recovery is complete.
+        ScopedLock lock(health_mutex_);
+        if (health_ == ckHEALTH_QUARANTINED)
+        {
+            quarantine_end_ = Timer::now() +
+                (static_cast<ckcore::tuint64>(ckWATCHDOG_QUARANTINE_TIME) << (stalls - 1)) * 1000000;
+        }
+    }
+
+    /**
+     * Changes the health state. The health mutex must be held by the
+     * caller.
+     * @param [in] health The new health state.
+     * @return If the health state changed true is returned, if not false is
+     *         returned.
+     */
+    bool ScsiDevice::change_health(Health health)
+    {
+        if (health == health_)
+            return false;
+
+        health_ = health;
+        return true;
+    }
+
+    /**
+     * Notifies the health callback of a health state change. This must be
+     * called without holding the health mutex since the callback may call
+     * back into the device.
+     * @param [in] health The new health state.
+     */
+    void ScsiDevice::notify_health(Health health)
+    {
+        health_mutex_.lock();
+        HealthCallback *callback = health_callback_;
+        health_mutex_.unlock();
+
+        if (callback != NULL)
+            callback->event_health(*this,health);
+    }
+
+    /**
+     * Sets the command timeout value of this device.
+     * @param [in] timeout The new timeout value in seconds. If negative the
+     *                     default timeout of the driver will be used.
      * @return If successful true is returned, if not false is returned.
      */
     bool ScsiDevice::timeout(long timeout)
     {
-        return driver_.timeout(timeout);
+        timeout_ = timeout;
+        return true;
+    }
+
+    /**
+     * Returns the command timeout value of this device.
+     * @return The timeout value in seconds, negative if the driver default
+     *         is used.
+     */
+    long ScsiDevice::timeout() const
+    {
+        return timeout_;
+    }
+
+    /**
+     * Checks if a command may be sent to the device. Derived classes may
+     * override this function to block commands that are known to cause
+     * problems on the device.
+     * @param [in] cdb The command descriptor block.
+     * @return If the command may be sent true is returned, if not false is
+     *         returned.
+     */
+    bool ScsiDevice::command_allowed(const unsigned char *cdb) const
+    {
+        return true;
+    }
+
+    /**
+     * Returns the timeout to use for a command. Derived classes may override
+     * this function to provide command specific timeouts.
+     * @param [in] cdb The command descriptor block.
+     * @return The timeout value in seconds, negative if the driver default
+     *         should be used.
+     */
+    long ScsiDevice::command_timeout(const unsigned char *cdb) const
+    {
+        return timeout_;
+    }
+
+    /**
+     * Called when a command has been completed. Derived classes may override
+     * this function to collect command statistics.
+     * @param [in] cdb The command descriptor block.
+     * @param [in] success true if the command completed successfully.
+     * @param [in] elapsed The command latency in microseconds.
+     */
+    void ScsiDevice::command_completed(const unsigned char *cdb,bool success,
+                                       ckcore::tuint64 elapsed)
+    {
+    }
+
+    /**
+     * Called when the device or the bus it is attached to has been reset.
+     * A reset may return the device parameters to their defaults, derived
+     * classes may override this function to apply them again.
+     * @param [in] level The reset level.
+     */
+    void ScsiDevice::reset_completed(ResetLevel level)
+    {
+    }
+
+    /**
+     * Enables or disables the watchdog. Callers issuing commands that are
+     * expected to run for a long time, such as reads with many drive
+     * retries, should disable the watchdog so that slow commands are not
+     * treated as stalls. The watchdog does not interrupt commands in
+     * progress, see complete().
+     * @param [in] enable Set to true to enable the watchdog.
+     */
+    void ScsiDevice::watchdog(bool enable)
+    {
+        watchdog_ = enable;
+    }
+
+    /**
+     * Checks if the watchdog is enabled.
+     * @return If the watchdog is enabled true is returned, if not false is
+     *         returned.
+     */
+    bool ScsiDevice::watchdog() const
+    {
+        return watchdog_;
+    }
+
+    /**
+     * Returns the health state of the device.
+     * @return The device health state.
+     */
+    ScsiDevice::Health ScsiDevice::health() const
+    {
+        ScopedLock lock(health_mutex_);
+        return health_;
+    }
+
+    /**
+     * Sets the callback object to notify when the health state of the
+     * device changes. If the device is not healthy the callback will be
+     * notified immediately.
+     * @param [in] callback Pointer to callback object, may be NULL.
+     */
+    void ScsiDevice::health_callback(HealthCallback *callback)
+    {
+        health_mutex_.lock();
+        health_callback_ = callback;
+        Health health = health_;
+        health_mutex_.unlock();
+
+        if (callback != NULL && health != ckHEALTH_GOOD)
+            callback->event_health(*this,health);
+    }
+
+    /**
+     * Clears the watchdog state, allowing commands to be sent to a
+     * quarantined or failed device.
+     */
+    void ScsiDevice::recover()
+    {
+        health_mutex_.lock();
+        stalls_ = 0;
+        quarantine_end_ = 0;
+        bool changed = change_health(ckHEALTH_GOOD);
+        health_mutex_.unlock();
+
+        if (changed)
+            notify_health(ckHEALTH_GOOD);
+    }
+
+    /**
+     * Resets the device or the bus it is attached to.
+     * @param [in] level The reset level.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool ScsiDevice::reset(ResetLevel level)
+    {
+        if (!driver_.reset(*this,level))
+            return false;
+
+        reset_completed(level);
+        return true;
     }
 
     /**
@@ -66,6 +366,21 @@ namespace ckmmc
         return driver_.silence(enable);
     }
 
+    /**
+     * Obtains the transfer limits of the host adapter the device is attached
+     * to.
+     * @param [out] max_transfer The maximum number of bytes that can be
+     *                           transferred in a single command.
+     * @param [out] alignment_mask The required data buffer alignment mask.
+     * @return If the limits are known true is returned, if not false is
+     *         returned.
+     */
+    bool ScsiDevice::transfer_limits(ckcore::tuint32 &max_transfer,
+                                     ckcore::tuint32 &alignment_mask)
+    {
+        return driver_.transfer_limits(addr_,max_transfer,alignment_mask);
+    }
+
     /**
      * Transports data from or to the device using SCSI commands.
      * @param [in] cdb Buffer to command descriptor block.
@@ -74,8 +389,6 @@ namespace ckmmc
      *                  writing data.
      * @param [in] data_len Length of the data buffer.
      * @param [in] mode Specifies the transport mode.
-     * @param [in] timeout Specifies the maximum time to wait for the device to
-                           return from a command.
      * @return If the transport was successfully carried through true is
      *         returned, if not false is returned.
      */
@@ -83,7 +396,52 @@ namespace ckmmc
                                unsigned char *data,unsigned long data_len,
                                ScsiDevice::TransportMode mode)
     {
-        return driver_.transport(*this,cdb,cdb_len,data,data_len,mode);
+        if (!admit() || !command_allowed(cdb))
+            return false;
+
+        // The status is needed to tell transport failures from errors
+        // reported by the device.
+        unsigned char sense[24];
+        unsigned char result = 0;
+        unsigned long transferred = 0;
+
+        Timer timer;
+        bool res = driver_.transport_with_sense(*this,cdb,cdb_len,data,data_len,
+                                                mode,sense,result,transferred,
+                                                command_timeout(cdb));
+
+        ckcore::tuint64 elapsed = timer.elapsed();
+        complete(res,elapsed);
+        command_completed(cdb,res && result == ckSCSISTAT_GOOD,elapsed);
+
+        if (res && result != ckSCSISTAT_GOOD)
+        {
+            if (!driver_.silent())
+            {
+                ckcore::log::print_line(ckT("[scsidevice]: scsi command failed (0x%.2x)."),result);
+
+                // Dump CDB.
+                ckcore::log::print(ckT("[scsidevice]: > cdb: "));
+                for (unsigned int i = 0; i < cdb_len; i++)
+                {
+                    if (i == 0)
+                        ckcore::log::print(ckT("0x%.2x"),cdb[i]);
+                    else
+                        ckcore::log::print(ckT(",0x%.2x"),cdb[i]);
+                }
+
+                ckcore::log::print_line(ckT(""));
+
+                // Dump sense information.
+                ckcore::log::print_line(ckT("[scsidevice]: > sense key: 0x%x"),sense[2] & 0xf);
+                ckcore::log::print_line(ckT("[scsidevice]: > asc: 0x%.2x"),sense[12]);
+                ckcore::log::print_line(ckT("[scsidevice]: > ascq: 0x%.2x"),sense[13]);
+            }
+
+            return false;
+        }
+
+        return res;
     }
 
     /**
@@ -98,8 +456,6 @@ namespace ckmmc
      * @param [in] mode Specifies the transport mode.
      * @param [out] sense Pointer to sense buffer.
      * @param [out] result Contains the transport result.
-     * @param [in] timeout Specifies the maximum time to wait for the device to
-                           return from a command.
      * @return If the transport was successfully carried through true is
      *         returned, if not false is returned.
      */
@@ -108,7 +464,45 @@ namespace ckmmc
                                           ScsiDevice::TransportMode mode,
                                           unsigned char *sense,unsigned char &result)
     {
-        return driver_.transport_with_sense(*this,cdb,cdb_len,data,data_len,
-                                            mode,sense,result);
+        unsigned long transferred = 0;
+        return transport_with_sense(cdb,cdb_len,data,data_len,mode,sense,result,
+                                    transferred);
+    }
+
+    /**
+     * Transports data from or to the device using SCSI commands. This is
+     * similar to the transport function with the exception that the sense,
+     * result and number of transferred bytes are written back to the caller.
+     * @param [in] cdb Buffer to command descriptor block.
+     * @param [in] cdb_len Length of the command descriptor block.
+     * @param [in] data Pointer to data buffer for either receiving or
+     *                  writing data.
+     * @param [in] data_len Length of the data buffer.
+     * @param [in] mode Specifies the transport mode.
+     * @param [out] sense Pointer to sense buffer.
+     * @param [out] result Contains the transport result.
+     * @param [out] transferred The number of bytes actually transferred.
+     * @return If the transport was successfully carried through true is
+     *         returned, if not false is returned.
+     */
+    bool ScsiDevice::transport_with_sense(unsigned char *cdb,unsigned char cdb_len,
+                                          unsigned char *data,unsigned long data_len,
+                                          ScsiDevice::TransportMode mode,
+                                          unsigned char *sense,unsigned char &result,
+                                          unsigned long &transferred)
+    {
+        transferred = 0;
+        if (!admit() || !command_allowed(cdb))
+            return false;
+
+        Timer timer;
+        bool res = driver_.transport_with_sense(*this,cdb,cdb_len,data,data_len,
+                                                mode,sense,result,transferred,
+                                                command_timeout(cdb));
+
+        ckcore::tuint64 elapsed = timer.elapsed();
+        complete(res,elapsed);
+        command_completed(cdb,res && result == ckSCSISTAT_GOOD,elapsed);
+        return res;
     }
 };
@@ -0,0 +1,546 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <ckcore/log.hh>
+#include "ckmmc/mmc.hh"
+#include "ckmmc/scsisilencer.hh"
+#include "ckmmc/timer.hh"
+#include "ckmmc/sectorcache.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs a SectorCache object.
+     * @param [in] device The device to read from.
+     * @param [in] budget The maximum number of bytes used for cached data.
+     */
+    SectorCache::SectorCache(MmcDevice &device,ckcore::tuint32 budget) :
+        device_(device),budget_(0),num_sectors_(0),poll_media_(true),read_ahead_(0),
+        next_lba_(-1),seq_reads_(0),last_poll_(0),hits_(0),misses_(0)
+    {
+        if (!staging_.allocate(ckMAX_READ_AHEAD * ckBLOCK_SIZE))
+            ckcore::log::print_line(ckT("[sectorcache]: unable to allocate staging buffer."));
+
+        this->budget(budget);
+    }
+
+    /**
+     * Destructs the SectorCache object.
+     */
+    SectorCache::~SectorCache()
+    {
+    }
+
+    /**
+     * Returns the shard responsible for caching the specified block.
+     * @param [in] block The block index.
+     * @return The shard of the block.
+     */
+    SectorCache::Shard &SectorCache::shard(ckcore::tuint32 block)
+    {
+        // Spread consecutive blocks over all shards.
+        return shards_[((block * 0x9e3779b1) >> 16) % ckNUM_SHARDS];
+    }
+
+    /**
+     * Removes an entry from the LRU list of a shard. The shard must be
+     * locked.
+     * @param [in] shard The shard.
+     * @param [in] entry The entry to remove.
+     */
+    void SectorCache::unlink(Shard &shard,Entry *entry)
+    {
+        if (entry->prev_ != NULL)
+            entry->prev_->next_ = entry->next_;
+        else
+            shard.head_ = entry->next_;
+
+        if (entry->next_ != NULL)
+            entry->next_->prev_ = entry->prev_;
+        else
+            shard.tail_ = entry->prev_;
+
+        entry->prev_ = entry->next_ = NULL;
+    }
+
+    /**
+     * Inserts an entry first in the LRU list of a shard. The shard must be
+     * locked.
+     * @param [in] shard The shard.
+     * @param [in] entry The entry to insert.
+     */
+    void SectorCache::push_front(Shard &shard,Entry *entry)
+    {
+        entry->prev_ = NULL;
+        entry->next_ = shard.head_;
+
+        if (shard.head_ != NULL)
+            shard.head_->prev_ = entry;
+        else
+            shard.tail_ = entry;
+
+        shard.head_ = entry;
+    }
+
+    /**
+     * Removes all cached blocks from a shard. The shard must be locked.
+     * @param [in] shard The shard to clear.
+     */
+    void SectorCache::clear(Shard &shard)
+    {
+        shard.map_.clear();
+        shard.free_.clear();
+        shard.head_ = shard.tail_ = NULL;
+
+        for (size_t i = 0; i < shard.entries_.size(); i++)
+            shard.free_.push_back(&shard.entries_[i]);
+    }
+
+    /**
+     * Checks if a block is cached without affecting its LRU position.
+     * @param [in] block The block index.
+     * @return If the block is cached true is returned, if not false is
+     *         returned.
+     */
+    bool SectorCache::contains(ckcore::tuint32 block)
+    {
+        Shard &s = shard(block);
+        ScopedLock lock(s.mutex_);
+
+        return s.map_.find(block) != s.map_.end();
+    }
+
+    /**
+     * Copies sectors from a cached block.
+     * @param [in] block The block index.
+     * @param [in] offset The first sector to copy, relative to the block.
+     * @param [in] count The number of sectors to copy.
+     * @param [out] buffer The buffer to copy the sectors to.
+     * @return If the sectors are cached true is returned, if not false is
+     *         returned.
+     */
+    bool SectorCache::lookup(ckcore::tuint32 block,ckcore::tuint32 offset,
+                             ckcore::tuint32 count,unsigned char *buffer)
+    {
+        Shard &s = shard(block);
+        ScopedLock lock(s.mutex_);
+
+        std::map<ckcore::tuint32,Entry *>::iterator it = s.map_.find(block);
+        if (it == s.map_.end())
+            return false;
+
+        Entry *entry = it->second;
+        if (offset + count > entry->count_)
+            return false;
+
+        memcpy(buffer,entry->data_ + offset * 2048,count * 2048);
+
+        unlink(s,entry);
+        push_front(s,entry);
+        return true;
+    }
+
+    /**
+     * Inserts a block in the cache, evicting the least recently used block
+     * of the shard if necessary.
+     * @param [in] block The block index.
+     * @param [in] data The sector data.
+     * @param [in] count The number of sectors in the block. Only the last
+     *                   block on the medium may be incomplete.
+     */
+    void SectorCache::insert(ckcore::tuint32 block,const unsigned char *data,
+                             ckcore::tuint32 count)
+    {
+        Shard &s = shard(block);
+        ScopedLock lock(s.mutex_);
+
+        Entry *entry = NULL;
+
+        std::map<ckcore::tuint32,Entry *>::iterator it = s.map_.find(block);
+        if (it != s.map_.end())
+        {
+            entry = it->second;
+            unlink(s,entry);
+        }
+        else if (!s.free_.empty())
+        {
+            entry = s.free_.back();
+            s.free_.pop_back();
+        }
+        else if (s.tail_ != NULL)
+        {
+            entry = s.tail_;
+            unlink(s,entry);
+            s.map_.erase(entry->block_);
+        }
+        else
+        {
+            return;     // The cache is disabled.
+        }
+
+        entry->block_ = block;
+        entry->count_ = count;
+        memcpy(entry->data_,data,count * 2048);
+
+        s.map_[block] = entry;
+        push_front(s,entry);
+    }
+
+    /**
+     * Checks if the medium has been changed and drops all cached data if it
+     * has. The device is polled at most once every media poll interval.
+     */
+    void SectorCache::poll()
+    {
+        long now = static_cast<long>(Timer::now() / 1000);
+        long last = atomic::load(&last_poll_);
+        if (!poll_media_ ||
+            static_cast<unsigned long>(now) - static_cast<unsigned long>(last) < ckMEDIA_POLL_INTERVAL)
+        {
+            return;
+        }
+
+        // Only one thread needs to poll the device.
+        if (atomic::exchange(&last_poll_,now) != last)
+            return;
+
+        ScopedLock lock(device_mutex_);
+        if (!device_.commands().supported(MmcDevice::ckCMD_GET_EVENT_STATUS_NOTIFICATION))
+        {
+            poll_media_ = false;
+            return;
+        }
+
+        unsigned char buffer[8];
+        {
+            ScsiSilencer silencer(device_);
+            if (!device_.get_event_status(0x10,buffer,sizeof(buffer)))  // Media class.
+            {
+                // Rely on unit attention conditions reported by read commands.
+                ckcore::log::print_line(ckT("[sectorcache]: media events not supported, polling disabled."));
+                poll_media_ = false;
+                return;
+            }
+        }
+
+        ScsiMediaEvent event;
+        if (event.parse(buffer) && event.event_code_ != ScsiMediaEvent::ckMEDIA_EVENT_NO_CHANGE)
+        {
+            ckcore::log::print_line(ckT("[sectorcache]: media event %d, dropping cached data."),
+                                    event.event_code_);
+            drop();
+        }
+    }
+
+    /**
+     * Drops all cached data and device state. The device mutex must be
+     * locked.
+     */
+    void SectorCache::drop()
+    {
+        for (unsigned int i = 0; i < ckNUM_SHARDS; i++)
+        {
+            ScopedLock lock(shards_[i].mutex_);
+            clear(shards_[i]);
+        }
+
+        num_sectors_ = 0;
+        read_ahead_ = 0;
+    }
+
+    /**
+     * Reads sectors from the device and adds them to the cache. Whole blocks
+     * are read so that they can be cached, if the sectors are part of a
+     * sequential stream blocks following the range are read as well.
+     * @param [in] lba The first sector to read.
+     * @param [in] count The number of sectors to read.
+     * @param [out] buffer The buffer to which the requested sectors will be
+     *                     written.
+     * @param [in, out] errors Ranges of requested sectors that could not be
+     *                         read are added to this map.
+     * @return If all requested sectors were read true is returned, if not
+     *         false is returned.
+     */
+    bool SectorCache::fetch(ckcore::tuint32 lba,ckcore::tuint32 count,
+                            unsigned char *buffer,std::vector<MmcDevice::ReadError> &errors)
+    {
+        ScopedLock lock(device_mutex_);
+
+        if (staging_.data() == NULL)
+            return false;
+
+        if (num_sectors_ == 0)
+        {
+            ckcore::tuint32 last_lba = 0,block_len = 0;
+            if (device_.read_capacity(last_lba,block_len) && block_len == 2048)
+                num_sectors_ = last_lba + 1;
+        }
+
+        ckcore::tuint32 first = lba - lba % ckBLOCK_SECTORS;
+        ckcore::tuint32 end = lba + count;
+        end += (ckBLOCK_SECTORS - end % ckBLOCK_SECTORS) % ckBLOCK_SECTORS;
+
+        // Read ahead if the request is part of a sequential stream.
+        if (atomic::load(&seq_reads_) >= ckSEQ_THRESHOLD && num_sectors_ != 0)
+        {
+            read_ahead_ = read_ahead_ == 0 ? ckMIN_READ_AHEAD : read_ahead_ << 1;
+            if (read_ahead_ > ckMAX_READ_AHEAD)
+                read_ahead_ = ckMAX_READ_AHEAD;
+
+            end += read_ahead_ * ckBLOCK_SECTORS;
+        }
+        else
+        {
+            read_ahead_ = 0;
+        }
+
+        if (num_sectors_ != 0 && end > num_sectors_)
+            end = num_sectors_ > lba + count ? num_sectors_ : lba + count;
+
+        bool res = true;
+
+        ckcore::tuint32 max_chunk = staging_.size() / 2048;
+        for (ckcore::tuint32 chunk_lba = first; chunk_lba < end;)
+        {
+            ckcore::tuint32 chunk = end - chunk_lba < max_chunk ? end - chunk_lba : max_chunk;
+            bool read_ok = device_.read_sectors(chunk_lba,chunk,staging_.data(),
+                                                staging_.size(),fetch_errors_);
+
+            // Cache all blocks without errors.
+            for (ckcore::tuint32 pos = 0; pos < chunk; pos += ckBLOCK_SECTORS)
+            {
+                ckcore::tuint32 block_lba = chunk_lba + pos;
+                ckcore::tuint32 block_count = chunk - pos < ckBLOCK_SECTORS ?
+                    chunk - pos : ckBLOCK_SECTORS;
+
+                // Incomplete blocks are only cached at the end of the medium.
+                if (block_count < ckBLOCK_SECTORS && block_lba + block_count != num_sectors_)
+                    continue;
+
+                bool bad = false;
+                for (size_t i = 0; i < fetch_errors_.size() && !bad; i++)
+                {
+                    const MmcDevice::ReadError &err = fetch_errors_[i];
+                    bad = err.lba_ < block_lba + block_count && err.lba_ + err.count_ > block_lba;
+                }
+
+                if (!bad)
+                    insert(block_lba / ckBLOCK_SECTORS,staging_.data() + pos * 2048,block_count);
+            }
+
+            // Copy the requested sectors.
+            ckcore::tuint32 copy_first = chunk_lba > lba ? chunk_lba : lba;
+            ckcore::tuint32 copy_end = chunk_lba + chunk < lba + count ? chunk_lba + chunk : lba + count;
+            if (copy_first < copy_end)
+            {
+                memcpy(buffer + (copy_first - lba) * 2048,
+                       staging_.data() + (copy_first - chunk_lba) * 2048,
+                       (copy_end - copy_first) * 2048);
+            }
+
+            // Report errors in the requested range.
+            bool changed = false;
+            for (size_t i = 0; i < fetch_errors_.size(); i++)
+            {
+                const MmcDevice::ReadError &err = fetch_errors_[i];
+                if (err.sense_key_ == ScsiSenseData::ckSENSE_UNIT_ATTENTION ||
+                    err.asc_ == ScsiSenseData::ckASC_MEDIUM_NOT_PRESENT)
+                {
+                    changed = true;
+                }
+
+                ckcore::tuint32 err_first = err.lba_ > lba ? err.lba_ : lba;
+                ckcore::tuint32 err_end = err.lba_ + err.count_ < lba + count ?
+                    err.lba_ + err.count_ : lba + count;
+                if (err_first < err_end)
+                {
+                    errors.push_back(MmcDevice::ReadError(err_first,err_end - err_first,
+                                                          err.sense_key_,err.asc_,err.ascq_));
+                    res = false;
+                }
+            }
+
+            if (changed)
+            {
+                ckcore::log::print_line(ckT("[sectorcache]: medium changed, dropping cached data."));
+                drop();
+            }
+
+            chunk_lba += chunk;
+
+            // Do not continue reading ahead after errors.
+            if (!read_ok && chunk_lba >= lba + count)
+                break;
+        }
+
+        return res;
+    }
+
+    /**
+     * Sets the maximum amount of memory used for cached data. All cached
+     * data is dropped.
+     * @param [in] budget The memory budget in bytes, 0 disables caching.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool SectorCache::budget(ckcore::tuint32 budget)
+    {
+        ScopedLock lock(device_mutex_);
+
+        bool res = true;
+
+        ckcore::tuint32 shard_blocks = budget / ckBLOCK_SIZE / ckNUM_SHARDS;
+        for (unsigned int i = 0; i < ckNUM_SHARDS; i++)
+        {
+            Shard &s = shards_[i];
+            ScopedLock shard_lock(s.mutex_);
+
+            s.entries_.clear();
+            s.slab_.free();
+
+            if (shard_blocks > 0)
+            {
+                if (s.slab_.allocate(shard_blocks * ckBLOCK_SIZE))
+                {
+                    s.entries_.resize(shard_blocks);
+                    for (ckcore::tuint32 j = 0; j < shard_blocks; j++)
+                        s.entries_[j].data_ = s.slab_.data() + j * ckBLOCK_SIZE;
+                }
+                else
+                {
+                    res = false;
+                }
+            }
+
+            clear(s);
+        }
+
+        if (!res)
+        {
+            ckcore::log::print_line(ckT("[sectorcache]: unable to allocate %u bytes of cache memory."),
+                                    budget);
+        }
+
+        budget_ = budget;
+        return res;
+    }
+
+    /**
+     * Returns the maximum amount of memory used for cached data.
+     * @return The memory budget in bytes.
+     */
+    ckcore::tuint32 SectorCache::budget() const
+    {
+        return budget_;
+    }
+
+    /**
+     * Reads 2048 byte sectors, from the cache if possible. Unlike
+     * MmcDevice::read_sectors the buffer does not need to be aligned.
+     * @param [in] lba The first sector to read.
+     * @param [in] count The number of sectors to read.
+     * @param [out] buffer The buffer to which the read data will be written.
+     * @param [in] buffer_len The size of the specified buffer.
+     * @param [out] errors Ranges of sectors that could not be read.
+     * @return If all sectors were read true is returned, if not false is
+     *         returned.
+     */
+    bool SectorCache::read(ckcore::tuint32 lba,ckcore::tuint32 count,
+                           unsigned char *buffer,ckcore::tuint32 buffer_len,
+                           std::vector<MmcDevice::ReadError> &errors)
+    {
+        errors.clear();
+
+        if (buffer == NULL || static_cast<ckcore::tuint64>(count) * 2048 > buffer_len)
+            return false;
+
+        poll();
+
+        // Detect sequential streams.
+        if (atomic::exchange(&next_lba_,static_cast<long>(lba + count)) == static_cast<long>(lba))
+            atomic::add(&seq_reads_,1);
+        else
+            atomic::store(&seq_reads_,0);
+
+        bool res = true;
+
+        ckcore::tuint32 pos = 0;
+        while (pos < count)
+        {
+            ckcore::tuint32 cur = lba + pos;
+            ckcore::tuint32 block = cur / ckBLOCK_SECTORS;
+            ckcore::tuint32 num = ckBLOCK_SECTORS - cur % ckBLOCK_SECTORS;
+            if (num > count - pos)
+                num = count - pos;
+
+            if (lookup(block,cur % ckBLOCK_SECTORS,num,buffer + pos * 2048))
+            {
+                atomic::add(&hits_,1);
+                pos += num;
+                continue;
+            }
+
+            atomic::add(&misses_,1);
+
+            // Read all following blocks that are not cached at once.
+            ckcore::tuint32 miss_count = num;
+            while (pos + miss_count < count &&
+                   !contains((cur + miss_count) / ckBLOCK_SECTORS))
+            {
+                ckcore::tuint32 next = count - pos - miss_count;
+                miss_count += next < ckBLOCK_SECTORS ? next : ckBLOCK_SECTORS;
+            }
+
+            if (!fetch(cur,miss_count,buffer + pos * 2048,errors))
+                res = false;
+
+            pos += miss_count;
+        }
+
+        return res;
+    }
+
+    /**
+     * Drops all cached data. This must be called if the medium may have been
+     * changed without the device reporting it.
+     */
+    void SectorCache::invalidate()
+    {
+        ScopedLock lock(device_mutex_);
+        drop();
+    }
+
+    /**
+     * Returns the number of block lookups served from the cache.
+     * @return The number of cache hits.
+     */
+    ckcore::tuint32 SectorCache::hits() const
+    {
+        return static_cast<ckcore::tuint32>(hits_);
+    }
+
+    /**
+     * Returns the number of block lookups that required reading from the
+     * device.
+     * @return The number of cache misses.
+     */
+    ckcore::tuint32 SectorCache::misses() const
+    {
+        return static_cast<ckcore::tuint32>(misses_);
+    }
+};
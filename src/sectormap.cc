@@ -0,0 +1,465 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef _WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <string>
+#include <stdio.h>
+#include <ckcore/log.hh>
+#include "ckmmc/sectormap.hh"
+
+namespace ckmmc
+{
+    /**
+     * Reads the contents of a file.
+     * @param [in] path The file path.
+     * @param [out] data The file contents.
+     * @return If successful true is returned, if not false is returned.
+     */
+    static bool read_file(const ckcore::tchar *path,std::string &data)
+    {
+        data.clear();
+
+        char buffer[4096];
+#ifdef _WINDOWS
+        HANDLE handle = CreateFile(path,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,
+                                   FILE_ATTRIBUTE_NORMAL,NULL);
+        if (handle == INVALID_HANDLE_VALUE)
+            return false;
+
+        bool res = true;
+        for (;;)
+        {
+            DWORD read = 0;
+            if (!ReadFile(handle,buffer,sizeof(buffer),&read,NULL))
+            {
+                res = false;
+                break;
+            }
+
+            if (read == 0)
+                break;
+
+            data.append(buffer,read);
+        }
+
+        CloseHandle(handle);
+        return res;
+#else
+        int fd = ::open(path,O_RDONLY);
+        if (fd == -1)
+            return false;
+
+        ssize_t read = 0;
+        while ((read = ::read(fd,buffer,sizeof(buffer))) > 0)
+            data.append(buffer,read);
+
+        ::close(fd);
+        return read == 0;
+#endif
+    }
+
+    /**
+     * Replaces the contents of a file. The data is written to a temporary
+     * file which is flushed to disk and renamed over the target, the target
+     * is either left intact or completely replaced.
+     * @param [in] path The file path.
+     * @param [in] data The new file contents.
+     * @return If successful true is returned, if not false is returned.
+     */
+    static bool replace_file(const ckcore::tchar *path,const std::string &data)
+    {
+        ckcore::tstring tmp_path = path;
+        tmp_path += ckT(".tmp");
+
+#ifdef _WINDOWS
+        HANDLE handle = CreateFile(tmp_path.c_str(),GENERIC_WRITE,0,NULL,CREATE_ALWAYS,
+                                   FILE_ATTRIBUTE_NORMAL,NULL);
+        if (handle == INVALID_HANDLE_VALUE)
+            return false;
+
+        DWORD written = 0;
+        bool res = WriteFile(handle,data.c_str(),static_cast<DWORD>(data.size()),&written,NULL) &&
+                   written == data.size() && FlushFileBuffers(handle);
+        CloseHandle(handle);
+
+        if (!res || !MoveFileEx(tmp_path.c_str(),path,MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+        {
+            DeleteFile(tmp_path.c_str());
+            return false;
+        }
+#else
+        int fd = ::open(tmp_path.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0644);
+        if (fd == -1)
+            return false;
+
+        bool res = ::write(fd,data.c_str(),data.size()) == static_cast<ssize_t>(data.size()) &&
+                   fsync(fd) == 0;
+        ::close(fd);
+
+        if (!res || rename(tmp_path.c_str(),path) != 0)
+        {
+            unlink(tmp_path.c_str());
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    /**
+     * Constructs an empty SectorMap object.
+     */
+    SectorMap::SectorMap() : pass_(0)
+    {
+    }
+
+    /**
+     * Destructs the SectorMap object.
+     */
+    SectorMap::~SectorMap()
+    {
+    }
+
+    /**
+     * Compares a sector address to the start of a run.
+     * @param [in] lba The sector address.
+     * @param [in] run The run.
+     * @return If lba is before the start of the run true is returned, if not
+     *         false is returned.
+     */
+    bool SectorMap::run_less(ckcore::tuint32 lba,const Run &run)
+    {
+        return lba < run.lba_;
+    }
+
+    /**
+     * Finds the run containing a sector. The sector must be inside the map.
+     * @param [in] lba The sector address.
+     * @return The index of the run.
+     */
+    size_t SectorMap::locate(ckcore::tuint32 lba) const
+    {
+        std::vector<Run>::const_iterator it = std::upper_bound(runs_.begin(),runs_.end(),
+                                                               lba,run_less);
+        return (it - runs_.begin()) - 1;
+    }
+
+    /**
+     * Resets the map to cover a range of untried sectors.
+     * @param [in] lba The first sector.
+     * @param [in] count The number of sectors.
+     */
+    void SectorMap::reset(ckcore::tuint32 lba,ckcore::tuint32 count)
+    {
+        runs_.clear();
+        pass_ = 0;
+
+        if (count > 0)
+            runs_.push_back(Run(lba,count,ckSTATE_UNTRIED));
+    }
+
+    /**
+     * Changes the state of a range of sectors. The range is clipped to the
+     * map.
+     * @param [in] lba The first sector.
+     * @param [in] count The number of sectors.
+     * @param [in] state The new state.
+     */
+    void SectorMap::set(ckcore::tuint32 lba,ckcore::tuint32 count,State state)
+    {
+        if (runs_.empty())
+            return;
+
+        ckcore::tuint32 last = lba + count;
+        if (lba < first())
+            lba = first();
+        if (last > end())
+            last = end();
+        if (lba >= last)
+            return;
+
+        size_t i = locate(lba);
+        size_t j = locate(last - 1);
+
+        // Build the runs replacing run i to j, including their neighbours so
+        // that they can be merged.
+        std::vector<Run> repl;
+        size_t from = i > 0 ? i - 1 : i;
+        size_t to = j + 1 < runs_.size() ? j + 2 : j + 1;
+        if (from < i)
+            repl.push_back(runs_[from]);
+
+        if (runs_[i].lba_ < lba)
+            repl.push_back(Run(runs_[i].lba_,lba - runs_[i].lba_,runs_[i].state_));
+
+        repl.push_back(Run(lba,last - lba,state));
+
+        ckcore::tuint32 tail_end = runs_[j].lba_ + runs_[j].count_;
+        if (tail_end > last)
+            repl.push_back(Run(last,tail_end - last,runs_[j].state_));
+
+        if (to > j + 1)
+            repl.push_back(runs_[j + 1]);
+
+        // Merge runs sharing state.
+        size_t num_merged = 0;
+        for (size_t k = 0; k < repl.size(); k++)
+        {
+            if (num_merged > 0 && repl[num_merged - 1].state_ == repl[k].state_)
+                repl[num_merged - 1].count_ += repl[k].count_;
+            else
+                repl[num_merged++] = repl[k];
+        }
+
+        repl.erase(repl.begin() + num_merged,repl.end());
+
+        runs_.erase(runs_.begin() + from,runs_.begin() + to);
+        runs_.insert(runs_.begin() + from,repl.begin(),repl.end());
+    }
+
+    /**
+     * Returns the state of a sector.
+     * @param [in] lba The sector address.
+     * @return The sector state, sectors outside the map are reported as
+     *         untried.
+     */
+    SectorMap::State SectorMap::state(ckcore::tuint32 lba) const
+    {
+        if (runs_.empty() || lba < first() || lba >= end())
+            return ckSTATE_UNTRIED;
+
+        return runs_[locate(lba)].state_;
+    }
+
+    /**
+     * Finds the first range of sectors in a specific state starting at or
+     * after a sector.
+     * @param [in] state The state to look for.
+     * @param [in] from The sector to start searching from.
+     * @param [out] lba The first sector of the range.
+     * @param [out] count The number of sectors in the range.
+     * @return If a range was found true is returned, if not false is
+     *         returned.
+     */
+    bool SectorMap::find(State state,ckcore::tuint32 from,ckcore::tuint32 &lba,
+                         ckcore::tuint32 &count) const
+    {
+        if (runs_.empty() || from >= end())
+            return false;
+
+        size_t i = from < first() ? 0 : locate(from);
+        for (; i < runs_.size(); i++)
+        {
+            if (runs_[i].state_ != state)
+                continue;
+
+            lba = runs_[i].lba_ > from ? runs_[i].lba_ : from;
+            count = runs_[i].lba_ + runs_[i].count_ - lba;
+            return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * Counts the sectors in a specific state.
+     * @param [in] state The state.
+     * @return The number of sectors.
+     */
+    ckcore::tuint64 SectorMap::count(State state) const
+    {
+        ckcore::tuint64 total = 0;
+
+        std::vector<Run>::const_iterator it;
+        for (it = runs_.begin(); it != runs_.end(); it++)
+        {
+            if (it->state_ == state)
+                total += it->count_;
+        }
+
+        return total;
+    }
+
+    /**
+     * Returns the first sector covered by the map.
+     * @return The first sector.
+     */
+    ckcore::tuint32 SectorMap::first() const
+    {
+        return runs_.empty() ? 0 : runs_.front().lba_;
+    }
+
+    /**
+     * Returns the sector following the last sector covered by the map.
+     * @return The end of the map.
+     */
+    ckcore::tuint32 SectorMap::end() const
+    {
+        return runs_.empty() ? 0 : runs_.back().lba_ + runs_.back().count_;
+    }
+
+    /**
+     * Returns the runs of the map.
+     * @return The sorted list of runs.
+     */
+    const std::vector<SectorMap::Run> &SectorMap::runs() const
+    {
+        return runs_;
+    }
+
+    /**
+     * Sets the number of the pass in progress, it is stored with the map.
+     * @param [in] pass The pass number.
+     */
+    void SectorMap::pass(ckcore::tuint32 pass)
+    {
+        pass_ = pass;
+    }
+
+    /**
+     * Returns the number of the pass in progress.
+     * @return The pass number.
+     */
+    ckcore::tuint32 SectorMap::pass() const
+    {
+        return pass_;
+    }
+
+    /**
+     * Saves the map to a file, an existing file is replaced atomically.
+     * @param [in] path The file path.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool SectorMap::save(const ckcore::tchar *path) const
+    {
+        std::string data = "# ckmmc sector map\n";
+
+        char line[64];
+        sprintf(line,"%u\n",pass_);
+        data += line;
+
+        std::vector<Run>::const_iterator it;
+        for (it = runs_.begin(); it != runs_.end(); it++)
+        {
+            sprintf(line,"0x%08x 0x%08x %c\n",it->lba_,it->count_,static_cast<char>(it->state_));
+            data += line;
+        }
+
+        if (!replace_file(path,data))
+        {
+            ckcore::log::print_line(ckT("[sectormap]: unable to save sector map."));
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Loads the map from a file.
+     * @param [in] path The file path.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool SectorMap::load(const ckcore::tchar *path)
+    {
+        std::string data;
+        if (!read_file(path,data))
+            return false;
+
+        std::vector<Run> runs;
+        ckcore::tuint32 pass = 0;
+        bool has_pass = false;
+
+        size_t pos = 0;
+        while (pos < data.size())
+        {
+            size_t delim = data.find('\n',pos);
+            if (delim == std::string::npos)
+                delim = data.size();
+
+            std::string line = data.substr(pos,delim - pos);
+            pos = delim + 1;
+
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            if (!has_pass)
+            {
+                if (sscanf(line.c_str(),"%u",&pass) != 1)
+                    return false;
+
+                has_pass = true;
+                continue;
+            }
+
+            unsigned int lba = 0,count = 0;
+            char state = 0;
+            if (sscanf(line.c_str(),"%x %x %c",&lba,&count,&state) != 3 || count == 0)
+                return false;
+
+            if (state != ckSTATE_UNTRIED && state != ckSTATE_SKIPPED &&
+                state != ckSTATE_FAILED && state != ckSTATE_GOOD)
+            {
+                return false;
+            }
+
+            // Runs must be contiguous.
+            if (!runs.empty() && runs.back().lba_ + runs.back().count_ != lba)
+                return false;
+
+            runs.push_back(Run(lba,count,static_cast<State>(state)));
+        }
+
+        if (runs.empty())
+            return false;
+
+        runs_.clear();
+        runs_.push_back(runs.front());
+
+        // Merge runs sharing state, the file might have been edited.
+        for (size_t i = 1; i < runs.size(); i++)
+        {
+            if (runs_.back().state_ == runs[i].state_)
+                runs_.back().count_ += runs[i].count_;
+            else
+                runs_.push_back(runs[i]);
+        }
+
+        pass_ = pass;
+        return true;
+    }
+
+    /**
+     * Checks if a map file exists.
+     * @param [in] path The file path.
+     * @return If the file exists true is returned, if not false is returned.
+     */
+    bool SectorMap::exists(const ckcore::tchar *path)
+    {
+#ifdef _WINDOWS
+        return GetFileAttributes(path) != INVALID_FILE_ATTRIBUTES;
+#else
+        return access(path,F_OK) == 0;
+#endif
+    }
+};
@@ -0,0 +1,585 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <ckcore/log.hh>
+#include "ckmmc/simd.hh"
+#include "ckmmc/secureripper.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs a SecureRipper object.
+     * @param [in] device The device to read from.
+     */
+    SecureRipper::SecureRipper(MmcDevice &device) : device_(device),reader_(device),
+        search_(!device.support(MmcDevice::ckDEVICE_CDDA_ACCURATE)),
+        max_rereads_(ckDEFAULT_MAX_REREADS),leadout_(0),sink_(NULL),lba_(0),count_(0),
+        end_lba_(0),read_end_(0),out_(NULL),jitter_(0),
+        cache_frames_(0),chunk_frames_(0),frames_read_(0),reread_frames_(0),max_jitter_(0)
+    {
+        // The ripper does its own verification.
+        reader_.c2(false);
+        reader_.c2_retries(0);
+    }
+
+    /**
+     * Destructs the SecureRipper object.
+     */
+    SecureRipper::~SecureRipper()
+    {
+    }
+
+    /**
+     * Compares two buffers.
+     * @param [in] data1 The first buffer.
+     * @param [in] data2 The second buffer.
+     * @param [in] len The number of bytes to compare.
+     * @return If the buffers are equal true is returned, if not false is
+     *         returned.
+     */
+    bool SecureRipper::match(const unsigned char *data1,const unsigned char *data2,
+                             ckcore::tuint32 len)
+    {
+        ckcore::tuint32 i = 0;
+#ifdef CK_MMC_SSE2
+        for (; i + 64 <= len; i += 64)
+        {
+            __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data1 + i)),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i *>(data2 + i)));
+            __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data1 + i + 16)),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i *>(data2 + i + 16)));
+            __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data1 + i + 32)),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i *>(data2 + i + 32)));
+            __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data1 + i + 48)),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i *>(data2 + i + 48)));
+
+            __m128i eq = _mm_and_si128(_mm_and_si128(eq0,eq1),_mm_and_si128(eq2,eq3));
+            if (_mm_movemask_epi8(eq) != 0xffff)
+                return false;
+        }
+
+        for (; i + 16 <= len; i += 16)
+        {
+            __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data1 + i)),
+                                        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data2 + i)));
+            if (_mm_movemask_epi8(eq) != 0xffff)
+                return false;
+        }
+#endif
+        return memcmp(data1 + i,data2 + i,len - i) == 0;
+    }
+
+    /**
+     * Reads a range of frames into the chunk buffer.
+     * @param [in] first The first frame, relative to the start of the rip.
+     * @param [in] count The number of frames.
+     * @return The number of samples read.
+     */
+    ckcore::tuint32 SecureRipper::read_chunk(ckcore::tuint32 first,ckcore::tuint32 count)
+    {
+        chunk_.resize(static_cast<size_t>(count) * AudioReader::ckFRAME_SIZE);
+
+        // Unreadable frames are zero filled, they will fail verification.
+        std::vector<ckcore::tuint32> bad_frames;
+        reader_.read(lba_ + first,count,&chunk_[0],NULL,NULL,bad_frames);
+
+        frames_read_ += count;
+        return count * ckFRAME_SAMPLES;
+    }
+
+    /**
+     * Finds the shift of the chunk buffer relative to the extracted audio by
+     * searching for a run of extracted samples. The search starts at the
+     * specified shift and moves outwards, so runs of identical samples such
+     * as digital silence keep the previous shift. If the run is not found,
+     * possibly because one of the reads contains an error, the preceding
+     * runs are tried.
+     * @param [in] chunk_samples The number of samples in the chunk buffer.
+     * @param [in] chunk_start The nominal position of the first sample in the
+     *                         chunk buffer.
+     * @param [in] probe The position of the first extracted sample of the
+     *                   first run to match.
+     * @param [in,out] jitter The shift in samples to start searching from,
+     *                        receives the shift found.
+     * @return If the shift was found true is returned, if not false is
+     *         returned.
+     */
+    bool SecureRipper::align(ckcore::tuint32 chunk_samples,ckcore::tint64 chunk_start,
+                             ckcore::tuint64 probe,int &jitter)
+    {
+        for (unsigned int i = 0; i < ckPROBE_COUNT && probe >= i * ckPROBE_SAMPLES; i++)
+        {
+            ckcore::tuint64 ref_pos = probe - i * ckPROBE_SAMPLES;
+            const unsigned char *ref = out_ + ref_pos * 4;
+            ckcore::tint64 base = static_cast<ckcore::tint64>(ref_pos) - chunk_start;
+
+            for (int dist = 0; dist <= 2 * ckMAX_JITTER; dist++)
+            {
+                // Alternate between shifts above and below the start value.
+                int cur = (dist & 1) ? jitter + (dist + 1) / 2 : jitter - dist / 2;
+                if (cur > ckMAX_JITTER || cur < -ckMAX_JITTER)
+                    continue;
+
+                ckcore::tint64 index = base - cur;
+                if (index < 0 || index + ckPROBE_SAMPLES > chunk_samples)
+                    continue;
+
+                if (match(&chunk_[static_cast<size_t>(index) * 4],ref,ckPROBE_SAMPLES * 4))
+                {
+                    jitter = cur;
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * Returns the position of the extracted samples used to align a read
+     * of an already extracted frame. The samples preceding the frame are
+     * used, except at the start of the rip where the frame itself is used.
+     * @param [in] frame The frame, relative to the start of the rip.
+     * @return The position of the first sample to match.
+     */
+    ckcore::tuint64 SecureRipper::probe_pos(ckcore::tuint32 frame) const
+    {
+        ckcore::tuint64 pos = static_cast<ckcore::tuint64>(frame) * ckFRAME_SAMPLES;
+        return pos >= ckPROBE_SAMPLES ? pos - ckPROBE_SAMPLES : pos;
+    }
+
+    /**
+     * Remembers the shift of the last aligned read.
+     * @param [in] jitter The shift in samples.
+     */
+    void SecureRipper::note_jitter(int jitter)
+    {
+        jitter_ = jitter;
+
+        ckcore::tuint32 abs_jitter = jitter < 0 ? -jitter : jitter;
+        if (abs_jitter > max_jitter_)
+            max_jitter_ = abs_jitter;
+    }
+
+    /**
+     * Reads an area far away from a frame, large enough to replace the
+     * contents of the drive cache. The area is kept before the lead-out, on
+     * discs too short for that as much as possible following the frame is
+     * read.
+     * @param [in] frame The frame that is about to be read again, relative
+     *                   to the start of the rip.
+     */
+    void SecureRipper::defeat_cache(ckcore::tuint32 frame)
+    {
+        ckcore::tuint32 pos = lba_ + frame;
+        ckcore::tuint32 dist = cache_frames_ * 2;
+        ckcore::tuint32 target = pos >= dist ? pos - dist : pos + dist;
+        ckcore::tuint32 count = cache_frames_;
+
+        if (end_lba_ != 0 && target > pos && target + count > end_lba_)
+        {
+            target = end_lba_ - pos > count ? end_lba_ - count : pos + 1;
+            count = end_lba_ - target;
+            if (count == 0)
+                return;
+        }
+
+        std::vector<ckcore::tuint32> bad_frames;
+        chunk_.resize(static_cast<size_t>(count) * AudioReader::ckFRAME_SIZE);
+        reader_.read(target,count,&chunk_[0],NULL,NULL,bad_frames);
+    }
+
+    /**
+     * Compares a read of a frame to the extracted frame and to earlier reads
+     * of the frame. The frame is verified when two reads match, the
+     * extracted frame is then replaced by the matching data.
+     * @param [in] frame The frame, relative to the start of the rip.
+     * @param [in] data The frame data.
+     * @return If the frame is verified true is returned, if not false is
+     *         returned.
+     */
+    bool SecureRipper::compare(ckcore::tuint32 frame,const unsigned char *data)
+    {
+        if (verified_[frame])
+            return true;
+
+        unsigned char *extracted = out_ + static_cast<size_t>(frame) * AudioReader::ckFRAME_SIZE;
+        if (match(extracted,data,AudioReader::ckFRAME_SIZE))
+        {
+            verified_[frame] = true;
+            candidates_.erase(frame);
+            return true;
+        }
+
+        std::vector<unsigned char> &candidates = candidates_[frame];
+        for (size_t i = 0; i < candidates.size(); i += AudioReader::ckFRAME_SIZE)
+        {
+            if (match(&candidates[i],data,AudioReader::ckFRAME_SIZE))
+            {
+                memcpy(extracted,data,AudioReader::ckFRAME_SIZE);
+                verified_[frame] = true;
+                candidates_.erase(frame);
+                return true;
+            }
+        }
+
+        candidates.insert(candidates.end(),data,data + AudioReader::ckFRAME_SIZE);
+        return false;
+    }
+
+    /**
+     * Extracts a range of frames to the output buffer using overlapping
+     * reads, each aligned to the samples extracted before it.
+     * @param [in] first The first frame, relative to the start of the rip.
+     * @param [in] end The frame following the last frame.
+     */
+    void SecureRipper::extract_pass(ckcore::tuint32 first,ckcore::tuint32 end)
+    {
+        ckcore::tuint64 pos = static_cast<ckcore::tuint64>(first) * ckFRAME_SAMPLES;
+        ckcore::tuint64 end_pos = static_cast<ckcore::tuint64>(end) * ckFRAME_SAMPLES;
+
+        while (pos < end_pos)
+        {
+            ckcore::tuint32 frame = static_cast<ckcore::tuint32>(pos / ckFRAME_SAMPLES);
+
+            // The reads extend past the end of the range when possible, the
+            // last frames can not be aligned otherwise.
+            ckcore::tuint32 start = frame >= ckOVERLAP_FRAMES ? frame - ckOVERLAP_FRAMES : 0;
+            ckcore::tuint32 num_frames = chunk_frames_ + 2 * ckOVERLAP_FRAMES;
+            if (num_frames > read_end_ - start)
+                num_frames = read_end_ - start;
+
+            ckcore::tuint32 chunk_samples = read_chunk(start,num_frames);
+            ckcore::tint64 chunk_start = static_cast<ckcore::tint64>(start) * ckFRAME_SAMPLES;
+
+            // Read the chunk again if it can not be aligned, copying it using
+            // the previous shift would leave a gap or a repetition in the
+            // output that the verification pass can not detect.
+            if (search_ && pos >= ckPROBE_SAMPLES)
+            {
+                for (unsigned int retry = 0; ; retry++)
+                {
+                    int jitter = jitter_;
+                    if (align(chunk_samples,chunk_start,pos - ckPROBE_SAMPLES,jitter))
+                    {
+                        note_jitter(jitter);
+                        break;
+                    }
+
+                    if (retry == ckALIGN_RETRIES)
+                    {
+                        ckcore::log::print_line(ckT("[secureripper]: unable to align frame %u."),
+                                                lba_ + frame);
+                        break;
+                    }
+
+                    chunk_samples = read_chunk(start,num_frames);
+                }
+            }
+
+            // Fall back to the nominal position if the shifted data does not
+            // cover the position.
+            ckcore::tint64 src = static_cast<ckcore::tint64>(pos) - chunk_start - jitter_;
+            if (src < 0 || src >= chunk_samples)
+                src = static_cast<ckcore::tint64>(pos) - chunk_start;
+
+            ckcore::tuint64 num_samples = chunk_samples - src;
+            if (num_samples > end_pos - pos)
+                num_samples = end_pos - pos;
+
+            memcpy(out_ + pos * 4,&chunk_[static_cast<size_t>(src) * 4],
+                   static_cast<size_t>(num_samples) * 4);
+            pos += num_samples;
+        }
+    }
+
+    /**
+     * Reads a range of frames a second time and compares them to the
+     * extracted frames.
+     * @param [in] first The first frame, relative to the start of the rip.
+     * @param [in] end The frame following the last frame.
+     */
+    void SecureRipper::verify_pass(ckcore::tuint32 first,ckcore::tuint32 end)
+    {
+        ckcore::tuint32 frame = first;
+        while (frame < end)
+        {
+            ckcore::tuint32 start = frame >= ckOVERLAP_FRAMES ? frame - ckOVERLAP_FRAMES : 0;
+            ckcore::tuint32 num_frames = chunk_frames_ + 2 * ckOVERLAP_FRAMES;
+            if (num_frames > read_end_ - start)
+                num_frames = read_end_ - start;
+
+            ckcore::tuint32 chunk_samples = read_chunk(start,num_frames);
+            ckcore::tint64 chunk_start = static_cast<ckcore::tint64>(start) * ckFRAME_SAMPLES;
+
+            // Frames of a read that can not be aligned are left unverified.
+            int jitter = 0;
+            bool aligned = true;
+            if (search_)
+            {
+                jitter = jitter_;
+                aligned = align(chunk_samples,chunk_start,probe_pos(frame),jitter);
+                if (aligned)
+                    note_jitter(jitter);
+            }
+
+            ckcore::tuint32 last = end - frame < chunk_frames_ ? end : frame + chunk_frames_;
+            for (; frame < last; frame++)
+            {
+                ckcore::tint64 src = static_cast<ckcore::tint64>(frame) * ckFRAME_SAMPLES -
+                                     chunk_start - jitter;
+                if (aligned && src >= 0 && src + ckFRAME_SAMPLES <= chunk_samples)
+                    compare(frame,&chunk_[static_cast<size_t>(src) * 4]);
+            }
+        }
+    }
+
+    /**
+     * Reads unverified frames again until they are verified or the maximum
+     * number of re-reads is reached. The drive cache is flushed before each
+     * read.
+     * @param [in] first The first frame, relative to the start of the rip.
+     * @param [in] end The frame following the last frame.
+     */
+    void SecureRipper::reread(ckcore::tuint32 first,ckcore::tuint32 end)
+    {
+        for (unsigned int attempt = 0; attempt < max_rereads_; attempt++)
+        {
+            bool done = true;
+
+            ckcore::tuint32 frame = first;
+            while (frame < end)
+            {
+                if (verified_[frame])
+                {
+                    frame++;
+                    continue;
+                }
+
+                done = false;
+
+                ckcore::tuint32 run_end = frame + 1;
+                while (run_end < end && !verified_[run_end] && run_end - frame < chunk_frames_)
+                    run_end++;
+
+                defeat_cache(frame);
+
+                ckcore::tuint32 start = frame >= ckOVERLAP_FRAMES ? frame - ckOVERLAP_FRAMES : 0;
+                ckcore::tuint32 num_frames = run_end + ckOVERLAP_FRAMES - start;
+                if (num_frames > read_end_ - start)
+                    num_frames = read_end_ - start;
+
+                ckcore::tuint32 chunk_samples = read_chunk(start,num_frames);
+                ckcore::tint64 chunk_start = static_cast<ckcore::tint64>(start) * ckFRAME_SAMPLES;
+                reread_frames_ += num_frames;
+
+                // Frames of a read that can not be aligned are left unverified.
+                int jitter = 0;
+                bool aligned = true;
+                if (search_)
+                {
+                    jitter = jitter_;
+                    aligned = align(chunk_samples,chunk_start,probe_pos(frame),jitter);
+                    if (aligned)
+                        note_jitter(jitter);
+                }
+
+                for (; frame < run_end; frame++)
+                {
+                    ckcore::tint64 src = static_cast<ckcore::tint64>(frame) * ckFRAME_SAMPLES -
+                                         chunk_start - jitter;
+                    if (aligned && src >= 0 && src + ckFRAME_SAMPLES <= chunk_samples)
+                        compare(frame,&chunk_[static_cast<size_t>(src) * 4]);
+                }
+            }
+
+            if (done)
+                break;
+        }
+    }
+
+    /**
+     * Sets the maximum number of times unverified frames are read again.
+     * @param [in] rereads The maximum number of re-reads.
+     */
+    void SecureRipper::max_rereads(unsigned int rereads)
+    {
+        max_rereads_ = rereads;
+    }
+
+    /**
+     * Returns the maximum number of times unverified frames are read again.
+     * @return The maximum number of re-reads.
+     */
+    unsigned int SecureRipper::max_rereads() const
+    {
+        return max_rereads_;
+    }
+
+    /**
+     * Sets the address of the lead-out. Reads are never made at or past the
+     * lead-out, the overlap needed for aligning the last frames of the disc
+     * is then omitted. On multi-session discs this should be the lead-out
+     * of the session containing the audio. If not set the disc capacity is
+     * used.
+     * @param [in] lba The lead-out address, or 0 to use the disc capacity.
+     */
+    void SecureRipper::leadout(ckcore::tuint32 lba)
+    {
+        leadout_ = lba;
+    }
+
+    /**
+     * Returns the address of the lead-out set using leadout(ckcore::tuint32).
+     * @return The lead-out address, 0 if the disc capacity is used.
+     */
+    ckcore::tuint32 SecureRipper::leadout() const
+    {
+        return leadout_;
+    }
+
+    /**
+     * Sets the sink receiving the audio of each segment once it has been
+     * verified.
+     * @param [in] sink The sink, or NULL to disable.
+     */
+    void SecureRipper::sink(Sink *sink)
+    {
+        sink_ = sink;
+    }
+
+    /**
+     * Extracts and verifies a range of audio frames.
+     * @param [in] lba The address of the first frame.
+     * @param [in] count The number of frames.
+     * @param [out] audio Buffer receiving count * 2352 bytes of audio.
+     * @param [out] unverified Frames for which no two reads matched, relative
+     *                         to lba.
+     * @return If all frames were verified true is returned, if not false is
+     *         returned.
+     */
+    bool SecureRipper::rip(ckcore::tuint32 lba,ckcore::tuint32 count,unsigned char *audio,
+                           std::vector<ckcore::tuint32> &unverified)
+    {
+        unverified.clear();
+
+        lba_ = lba;
+        count_ = count;
+        out_ = audio;
+        verified_.assign(count,false);
+        candidates_.clear();
+        jitter_ = 0;
+        frames_read_ = 0;
+        reread_frames_ = 0;
+        max_jitter_ = 0;
+
+        ckcore::tuint32 cache_size = device_.property(MmcDevice::ckPROP_BUFFER_SIZE);
+        if (cache_size == 0)
+            cache_size = ckDEFAULT_CACHE_SIZE;
+
+        cache_frames_ = cache_size * 1024 / AudioReader::ckFRAME_SIZE + 1;
+
+        // Reads extend past the range for alignment, but never into the
+        // lead-out. If the lead-out is unknown the range is not exceeded.
+        end_lba_ = leadout_;
+        if (end_lba_ == 0)
+        {
+            ckcore::tuint32 last_lba = 0,block_len = 0;
+            if (device_.read_capacity(last_lba,block_len))
+                end_lba_ = last_lba + 1;
+        }
+
+        read_end_ = count;
+        if (end_lba_ > lba + count)
+        {
+            read_end_ = end_lba_ - lba - count < ckOVERLAP_FRAMES ?
+                end_lba_ - lba : count + ckOVERLAP_FRAMES;
+        }
+
+        // Each read, including the overlap, must be made using a single
+        // command since the shift may change between commands.
+        chunk_frames_ = device_.transfer_len() / AudioReader::ckFRAME_SIZE;
+        chunk_frames_ = chunk_frames_ > 2 * ckOVERLAP_FRAMES ? chunk_frames_ - 2 * ckOVERLAP_FRAMES : 1;
+        if (chunk_frames_ > ckMAX_CHUNK_FRAMES)
+            chunk_frames_ = ckMAX_CHUNK_FRAMES;
+
+        ckcore::tuint32 segment = cache_frames_ * 2;
+        if (segment < ckMIN_SEGMENT_FRAMES)
+            segment = ckMIN_SEGMENT_FRAMES;
+
+        for (ckcore::tuint32 first = 0; first < count; first += segment)
+        {
+            ckcore::tuint32 end = count - first < segment ? count : first + segment;
+
+            extract_pass(first,end);
+            verify_pass(first,end);
+            reread(first,end);
+
+            candidates_.clear();
+
+            if (sink_ != NULL)
+            {
+                sink_->audio(lba_ + first,out_ + static_cast<size_t>(first) * AudioReader::ckFRAME_SIZE,
+                             end - first);
+            }
+        }
+
+        for (ckcore::tuint32 i = 0; i < count; i++)
+        {
+            if (!verified_[i])
+                unverified.push_back(i);
+        }
+
+        ckcore::log::print_line(ckT("[secureripper]: %u frames read for %u frames, %u unverified, max jitter %u samples."),
+                                static_cast<ckcore::tuint32>(frames_read_),count,
+                                static_cast<ckcore::tuint32>(unverified.size()),max_jitter_);
+
+        out_ = NULL;
+        return unverified.empty();
+    }
+
+    /**
+     * Returns the number of frames read during the last rip, excluding
+     * reads made to flush the drive cache.
+     * @return The number of frames read.
+     */
+    ckcore::tuint64 SecureRipper::frames_read() const
+    {
+        return frames_read_;
+    }
+
+    /**
+     * Returns the number of frames read again during the last rip because
+     * two reads did not match.
+     * @return The number of re-read frames.
+     */
+    ckcore::tuint64 SecureRipper::reread_frames() const
+    {
+        return reread_frames_;
+    }
+
+    /**
+     * Returns the largest shift between reads during the last rip.
+     * @return The largest shift in samples.
+     */
+    ckcore::tuint32 SecureRipper::max_jitter() const
+    {
+        return max_jitter_;
+    }
+};
@@ -0,0 +1,274 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ckcore/log.hh>
+#include "ckmmc/streamreader.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs a StreamReader object.
+     * @param [in] device The device to read from.
+     */
+    StreamReader::StreamReader(MmcDevice &device) : device_(device),num_slots_(0),
+        lba_(0),count_(0),chunk_blocks_(0),head_(0),tail_(0),depth_(ckMIN_DEPTH),
+        leased_(0),stop_(0),finished_(1),empty_waits_(0),full_waits_(0),adapt_count_(0)
+    {
+    }
+
+    /**
+     * Destructs the StreamReader object.
+     */
+    StreamReader::~StreamReader()
+    {
+        stop();
+    }
+
+    /**
+     * Adjusts the number of chunks the producer may read ahead. If both the
+     * producer and the consumer had to wait since the last adjustment the
+     * consumer speed varies and more read ahead would have kept the device
+     * busy. If the producer never had to wait the read ahead is not needed.
+     */
+    void StreamReader::adapt()
+    {
+        if (++adapt_count_ < ckADAPT_INTERVAL)
+            return;
+
+        long empty_waits = atomic::exchange(&empty_waits_,0);
+        long depth = atomic::load(&depth_);
+
+        if (full_waits_ > 0 && empty_waits > 0)
+        {
+            depth <<= 1;
+            if (depth > static_cast<long>(num_slots_))
+                depth = static_cast<long>(num_slots_);
+        }
+        else if (full_waits_ == 0 && depth > ckMIN_DEPTH)
+        {
+            depth--;
+        }
+
+        atomic::store(&depth_,depth);
+
+        full_waits_ = 0;
+        adapt_count_ = 0;
+    }
+
+    /**
+     * Producer thread, reads all chunks in order.
+     */
+    void StreamReader::run()
+    {
+        ckcore::tuint32 pos = 0;
+        while (pos < count_ && atomic::load(&stop_) == 0)
+        {
+            // Wait for a free slot. The chunk following the leased chunks
+            // must always be read, otherwise a consumer holding as many leases
+            // as the current depth would wait for it forever.
+            bool stopped = false;
+            for (;;)
+            {
+                long limit = atomic::load(&leased_) + 1;
+                if (limit < atomic::load(&depth_))
+                    limit = atomic::load(&depth_);
+
+                if (head_ - atomic::load(&tail_) < limit)
+                    break;
+
+                full_waits_++;
+                space_event_.wait();
+
+                if (atomic::load(&stop_) != 0)
+                {
+                    stopped = true;
+                    break;
+                }
+            }
+
+            if (stopped)
+                break;
+
+            Slot &slot = slots_[head_ % num_slots_];
+            if (slot.buffer_.data() == NULL && !slot.buffer_.allocate(chunk_blocks_ * 2048))
+            {
+                ckcore::log::print_line(ckT("[streamreader]: unable to allocate read buffer."));
+                break;
+            }
+
+            slot.lba_ = lba_ + pos;
+            slot.count_ = count_ - pos < chunk_blocks_ ? count_ - pos : chunk_blocks_;
+            device_.read_sectors(slot.lba_,slot.count_,slot.buffer_.data(),
+                                 slot.buffer_.size(),slot.errors_);
+
+            // Publish the slot to the consumer.
+            atomic::add(&head_,1);
+            data_event_.set();
+
+            pos += slot.count_;
+            adapt();
+        }
+
+        atomic::store(&finished_,1);
+        data_event_.set();
+    }
+
+    /**
+     * Starts reading a range of sectors.
+     * @param [in] lba The first sector to read.
+     * @param [in] count The number of sectors to read.
+     * @param [in] max_depth The maximum number of chunks to read ahead of the
+     *                       consumer.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool StreamReader::start(ckcore::tuint32 lba,ckcore::tuint32 count,
+                             unsigned int max_depth)
+    {
+        stop();
+
+        num_slots_ = max_depth;
+        if (num_slots_ > ckMAX_DEPTH)
+            num_slots_ = ckMAX_DEPTH;
+        if (num_slots_ < ckMIN_DEPTH)
+            num_slots_ = ckMIN_DEPTH;
+
+        // Buffers are allocated on first use, release buffers of a different
+        // chunk size.
+        // Keep chunks a multiple of the buffer alignment so that they can be
+        // written using unbuffered I/O.
+        ckcore::tuint32 align_blocks = AlignedBuffer::ckBUFFER_ALIGNMENT / 2048;
+        ckcore::tuint32 chunk_blocks = device_.transfer_len() / 2048;
+        if (chunk_blocks > align_blocks)
+            chunk_blocks -= chunk_blocks % align_blocks;
+        if (chunk_blocks == 0)
+            chunk_blocks = 1;
+
+        if (chunk_blocks != chunk_blocks_)
+        {
+            for (unsigned int i = 0; i < ckMAX_DEPTH; i++)
+                slots_[i].buffer_.free();
+        }
+
+        lba_ = lba;
+        count_ = count;
+        chunk_blocks_ = chunk_blocks;
+
+        head_ = 0;
+        tail_ = 0;
+        depth_ = ckMIN_DEPTH;
+        leased_ = 0;
+        stop_ = 0;
+        finished_ = 0;
+        empty_waits_ = 0;
+        full_waits_ = 0;
+        adapt_count_ = 0;
+
+        if (!Thread::start())
+        {
+            finished_ = 1;
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Stops reading and waits for the producer thread to finish. All
+     * outstanding leases become invalid.
+     */
+    void StreamReader::stop()
+    {
+        atomic::store(&stop_,1);
+        space_event_.set();
+        join();
+    }
+
+    /**
+     * Leases the next chunk of read sectors. The function blocks until the
+     * chunk has been read. Multiple leases may be held at the same time, they
+     * must be released in the order they were leased. Each lease occupies a
+     * ring slot, so at most max_depth leases (as passed to start()) may be
+     * held. The producer always reads the chunk following the leased
+     * chunks, regardless of the current read ahead depth.
+     * @param [out] lease The leased chunk.
+     * @return If a chunk was leased true is returned, if the end of the range
+     *         has been reached or all ring slots are leased false is returned.
+     */
+    bool StreamReader::lease(Lease &lease)
+    {
+        if (leased_ >= static_cast<long>(num_slots_))
+        {
+            ckcore::log::print_line(ckT("[streamreader]: error: all %u buffers are leased."),num_slots_);
+            return false;
+        }
+
+        // Let the producer read past the chunks already leased.
+        long pos = tail_ + atomic::add(&leased_,1) - 1;
+        space_event_.set();
+
+        for (;;)
+        {
+            // The finished flag must be read before the head, if the producer
+            // has finished the head is final.
+            bool finished = atomic::load(&finished_) != 0;
+            if (pos < atomic::load(&head_))
+                break;
+
+            if (finished)
+            {
+                atomic::add(&leased_,-1);
+                return false;
+            }
+
+            atomic::add(&empty_waits_,1);
+            data_event_.wait();
+        }
+
+        Slot &slot = slots_[pos % num_slots_];
+        lease.data_ = slot.buffer_.data();
+        lease.lba_ = slot.lba_;
+        lease.count_ = slot.count_;
+        lease.errors_ = &slot.errors_;
+
+        return true;
+    }
+
+    /**
+     * Releases the oldest outstanding lease, allowing the producer to reuse
+     * its buffer.
+     */
+    void StreamReader::release()
+    {
+        if (leased_ == 0)
+            return;
+
+        atomic::add(&leased_,-1);
+        atomic::add(&tail_,1);
+        space_event_.set();
+    }
+
+    /**
+     * Returns the current number of chunks the producer may read ahead of
+     * the consumer.
+     * @return The current read ahead depth.
+     */
+    unsigned int StreamReader::depth() const
+    {
+        return static_cast<unsigned int>(depth_);
+    }
+};
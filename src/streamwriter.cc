@@ -0,0 +1,462 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ckcore/log.hh>
+#include "ckmmc/mmc.hh"
+#include "ckmmc/timer.hh"
+#include "ckmmc/streamwriter.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs a StreamWriter object.
+     * @param [in] device The device to write to.
+     */
+    StreamWriter::StreamWriter(MmcDevice &device) : device_(device),num_slots_(0),
+        lba_(0),block_len_(0),chunk_blocks_(0),alignment_mask_(0),burn_proof_(false),
+        head_(0),tail_(0),
+        stop_(0),done_(0),finished_(1),failed_(0),host_fill_(0),drive_size_(0),
+        drive_fill_(0),written_(0),host_waits_(0),underruns_(0),underrun_lba_(0),
+        leased_(false),pacing_(true),underrun_(false),drive_free_(0)
+    {
+    }
+
+    /**
+     * Destructs the StreamWriter object.
+     */
+    StreamWriter::~StreamWriter()
+    {
+        stop();
+    }
+
+    /**
+     * Waits until the device buffer has room for the next submission. The
+     * device is only polled when the estimated free space is exhausted, an
+     * empty buffer while writing is counted as an underrun.
+     * @param [in] lba The address of the next submission.
+     * @param [in] bytes The size of the next submission.
+     * @return If the submission may proceed true is returned, if the writer
+     *         was stopped false is returned.
+     */
+    bool StreamWriter::pace(ckcore::tuint32 lba,ckcore::tuint32 bytes)
+    {
+        while (pacing_ && drive_free_ < bytes)
+        {
+            ckcore::tuint32 buffer_len = 0,buffer_free = 0;
+            if (!device_.read_buffer_capacity(buffer_len,buffer_free) || buffer_len == 0)
+            {
+                ckcore::log::print_line(ckT("[streamwriter]: unable to read buffer capacity, pacing disabled."));
+                pacing_ = false;
+                break;
+            }
+
+            atomic::store(&drive_size_,static_cast<long>(buffer_len));
+            atomic::store(&drive_fill_,static_cast<long>(buffer_len - buffer_free));
+
+            if (buffer_free == buffer_len && atomic::load(&written_) > 0)
+            {
+                if (!underrun_)
+                {
+                    ckcore::log::print_line(ckT("[streamwriter]: device buffer ran empty at %u."),lba);
+                    atomic::add(&underruns_,1);
+                    atomic::store(&underrun_lba_,static_cast<long>(lba));
+                    underrun_ = true;
+                }
+            }
+            else
+            {
+                underrun_ = false;
+            }
+
+            drive_free_ = buffer_free;
+            if (drive_free_ >= bytes)
+                break;
+
+            // Wait for the device to drain its buffer.
+            stop_event_.wait(ckPOLL_INTERVAL);
+            if (atomic::load(&stop_) != 0)
+                return false;
+        }
+
+        drive_free_ = drive_free_ > bytes ? drive_free_ - bytes : 0;
+        return true;
+    }
+
+    /**
+     * Writes a chunk of blocks. Writes rejected while the device is busy
+     * with a previous write are retried.
+     * @param [in] lba The first block to write.
+     * @param [in] data The data to write.
+     * @param [in] blocks The number of blocks to write.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool StreamWriter::write(ckcore::tuint32 lba,const unsigned char *data,
+                             ckcore::tuint32 blocks)
+    {
+        Timer timer;
+        for (;;)
+        {
+            ScsiSenseData sense_data;
+            if (device_.write10(lba,static_cast<ckcore::tuint16>(blocks),data,
+                                blocks * block_len_,sense_data))
+            {
+                return true;
+            }
+
+            if (sense_data.sense_key_ != ScsiSenseData::ckSENSE_NOT_READY ||
+                sense_data.asc_ != ScsiSenseData::ckASC_NOT_READY ||
+                sense_data.ascq_ != ScsiSenseData::ckASCQ_LONG_WRITE_IN_PROGRESS)
+            {
+                ckcore::log::print_line(ckT("[streamwriter]: write of %u blocks at %u failed (%.2X/%.2X/%.2X)."),
+                                        blocks,lba,sense_data.sense_key_,sense_data.asc_,
+                                        sense_data.ascq_);
+                return false;
+            }
+
+            if (timer.elapsed() > static_cast<ckcore::tuint64>(ckLONG_WRITE_TIMEOUT) * 1000)
+            {
+                ckcore::log::print_line(ckT("[streamwriter]: device busy for too long at %u."),lba);
+                return false;
+            }
+
+            // The device buffer is full, it must have drained faster than
+            // estimated.
+            drive_free_ = 0;
+            stop_event_.wait(ckPOLL_INTERVAL);
+            if (atomic::load(&stop_) != 0)
+                return false;
+        }
+    }
+
+    /**
+     * Writer thread, writes all committed slots in order.
+     */
+    void StreamWriter::run()
+    {
+        ckcore::tuint32 lba = lba_;
+        while (atomic::load(&stop_) == 0)
+        {
+            // Wait for data. The done flag must be read before the head, if
+            // the producer is done the head is final.
+            bool done = atomic::load(&done_) != 0;
+            if (tail_ == atomic::load(&head_))
+            {
+                if (done)
+                    break;
+
+                // The device keeps writing from its buffer while waiting,
+                // poll it before the next submission.
+                atomic::add(&host_waits_,1);
+                drive_free_ = 0;
+                data_event_.wait();
+                continue;
+            }
+
+            Slot &slot = slots_[tail_ % num_slots_];
+            ckcore::tuint32 bytes = slot.blocks_ * block_len_;
+
+            if (!pace(lba,bytes))
+                break;
+
+            if (!write(lba,slot.data_,slot.blocks_))
+            {
+                atomic::store(&failed_,1);
+                break;
+            }
+
+            lba += slot.blocks_;
+            atomic::add(&written_,static_cast<long>(slot.blocks_));
+            atomic::add(&host_fill_,-static_cast<long>(bytes));
+
+            // Return the slot to the producer.
+            atomic::add(&tail_,1);
+            space_event_.set();
+        }
+
+        atomic::store(&finished_,1);
+        space_event_.set();
+    }
+
+    /**
+     * Starts writing blocks.
+     * @param [in] lba The address of the first block to write.
+     * @param [in] block_len The size of each block in bytes.
+     * @param [in] fifo_size The size of the host FIFO in bytes.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool StreamWriter::start(ckcore::tuint32 lba,ckcore::tuint32 block_len,
+                             ckcore::tuint32 fifo_size)
+    {
+        stop();
+
+        if (block_len == 0)
+            return false;
+
+        ckcore::tuint32 chunk_blocks = device_.transfer_len() / block_len;
+        if (chunk_blocks > 0xffff)
+            chunk_blocks = 0xffff;
+        if (chunk_blocks == 0)
+            chunk_blocks = 1;
+
+        // Buffers are allocated on first use, release buffers of a different
+        // chunk size.
+        if (chunk_blocks * block_len != chunk_blocks_ * block_len_)
+        {
+            for (unsigned int i = 0; i < ckMAX_SLOTS; i++)
+                slots_[i].buffer_.free();
+        }
+
+        num_slots_ = fifo_size / (chunk_blocks * block_len);
+        if (num_slots_ > ckMAX_SLOTS)
+            num_slots_ = ckMAX_SLOTS;
+        if (num_slots_ < ckMIN_SLOTS)
+            num_slots_ = ckMIN_SLOTS;
+
+        // Submitted data must satisfy the host adapter alignment, fall back to
+        // page alignment if the requirement is not known.
+        ckcore::tuint32 max_transfer = 0,alignment_mask = 0;
+        if (!device_.transfer_limits(max_transfer,alignment_mask))
+            alignment_mask = AlignedBuffer::ckBUFFER_ALIGNMENT - 1;
+
+        lba_ = lba;
+        block_len_ = block_len;
+        chunk_blocks_ = chunk_blocks;
+        alignment_mask_ = alignment_mask;
+        burn_proof_ = device_.support(MmcDevice::ckDEVICE_BUP);
+
+        head_ = 0;
+        tail_ = 0;
+        stop_ = 0;
+        done_ = 0;
+        finished_ = 0;
+        failed_ = 0;
+        host_fill_ = 0;
+        drive_size_ = 0;
+        drive_fill_ = 0;
+        written_ = 0;
+        host_waits_ = 0;
+        underruns_ = 0;
+        underrun_lba_ = 0;
+        leased_ = false;
+        queued_ = 0;
+        pacing_ = true;
+        underrun_ = false;
+        drive_free_ = 0;
+
+        if (!Thread::start())
+        {
+            finished_ = 1;
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Signals that the producer has committed all data and waits for the
+     * writer thread to write it.
+     * @return If all data was written true is returned, if not false is
+     *         returned.
+     */
+    bool StreamWriter::finish()
+    {
+        atomic::store(&done_,1);
+        data_event_.set();
+        join();
+
+        return atomic::load(&failed_) == 0 && atomic::load(&stop_) == 0 &&
+               tail_ == head_;
+    }
+
+    /**
+     * Stops writing and waits for the writer thread to finish. Data
+     * remaining in the host FIFO is discarded.
+     */
+    void StreamWriter::stop()
+    {
+        atomic::store(&stop_,1);
+        data_event_.set();
+        stop_event_.set();
+        join();
+    }
+
+    /**
+     * Waits for a free FIFO slot.
+     * @return If a slot is free true is returned, if the writer has stopped
+     *         false is returned.
+     */
+    bool StreamWriter::wait_slot()
+    {
+        while (head_ - atomic::load(&tail_) >= static_cast<long>(num_slots_))
+        {
+            if (atomic::load(&finished_) != 0)
+                return false;
+
+            space_event_.wait();
+        }
+
+        return atomic::load(&finished_) == 0;
+    }
+
+    /**
+     * Leases the next empty FIFO buffer. The function blocks until a buffer
+     * is available. Only one lease may be held at a time.
+     * @param [out] lease The leased buffer.
+     * @return If a buffer was leased true is returned, if the writer has
+     *         stopped false is returned.
+     */
+    bool StreamWriter::lease(Lease &lease)
+    {
+        if (leased_ || !wait_slot())
+            return false;
+
+        Slot &slot = slots_[head_ % num_slots_];
+        if (slot.buffer_.data() == NULL && !slot.buffer_.allocate(chunk_blocks_ * block_len_))
+        {
+            ckcore::log::print_line(ckT("[streamwriter]: unable to allocate write buffer."));
+            return false;
+        }
+
+        lease.data_ = slot.buffer_.data();
+        lease.blocks_ = chunk_blocks_;
+
+        leased_ = true;
+        return true;
+    }
+
+    /**
+     * Commits the leased buffer to be written.
+     * @param [in] blocks The number of blocks stored in the buffer, may be
+     *                    less than its capacity.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool StreamWriter::commit(ckcore::tuint32 blocks)
+    {
+        if (!leased_ || blocks > chunk_blocks_)
+            return false;
+
+        leased_ = false;
+        if (blocks == 0)
+            return true;
+
+        Slot &slot = slots_[head_ % num_slots_];
+        slot.data_ = slot.buffer_.data();
+        slot.blocks_ = blocks;
+        queued_ += blocks;
+        atomic::add(&host_fill_,static_cast<long>(blocks * block_len_));
+
+        // Publish the slot to the writer.
+        atomic::add(&head_,1);
+        data_event_.set();
+
+        return atomic::load(&failed_) == 0;
+    }
+
+    /**
+     * Queues data to be written without copying it to the FIFO. The data
+     * must remain valid until it has been written, see wait(). The function
+     * blocks until a FIFO slot is available.
+     * @param [in] data The data to write, must satisfy the alignment
+     *                  requirement of the host adapter.
+     * @param [in] blocks The number of blocks to write, at most
+     *                    chunk_blocks().
+     * @return If the data was queued true is returned, if not false is
+     *         returned. Data that is not suitably aligned is rejected and
+     *         must be written through a leased buffer instead.
+     */
+    bool StreamWriter::submit(const unsigned char *data,ckcore::tuint32 blocks)
+    {
+        if (leased_ || blocks == 0 || blocks > chunk_blocks_ ||
+            (reinterpret_cast<size_t>(data) & alignment_mask_) != 0)
+        {
+            return false;
+        }
+
+        if (!wait_slot())
+            return false;
+
+        Slot &slot = slots_[head_ % num_slots_];
+        slot.data_ = data;
+        slot.blocks_ = blocks;
+        queued_ += blocks;
+        atomic::add(&host_fill_,static_cast<long>(blocks * block_len_));
+
+        // Publish the slot to the writer.
+        atomic::add(&head_,1);
+        data_event_.set();
+
+        return atomic::load(&failed_) == 0;
+    }
+
+    /**
+     * Waits until a number of blocks have been written.
+     * @param [in] blocks The number of blocks, counted from the start of the
+     *                    stream.
+     * @return If the blocks have been written true is returned, if the
+     *         writer stopped before writing them false is returned.
+     */
+    bool StreamWriter::wait(ckcore::tuint32 blocks)
+    {
+        while (static_cast<ckcore::tuint32>(atomic::load(&written_)) < blocks)
+        {
+            if (atomic::load(&finished_) != 0)
+                return static_cast<ckcore::tuint32>(atomic::load(&written_)) >= blocks;
+
+            space_event_.wait();
+        }
+
+        return true;
+    }
+
+    /**
+     * Returns the number of blocks queued by the producer since the writer
+     * was started. Data queued after this call has been written once wait()
+     * returns for the returned value plus the number of blocks queued.
+     * @return The number of queued blocks.
+     */
+    ckcore::tuint32 StreamWriter::queued() const
+    {
+        return queued_;
+    }
+
+    /**
+     * Returns the maximum number of blocks in a FIFO chunk.
+     * @return The chunk size in blocks.
+     */
+    ckcore::tuint32 StreamWriter::chunk_blocks() const
+    {
+        return chunk_blocks_;
+    }
+
+    /**
+     * Takes a snapshot of the writer metrics.
+     * @param [out] metrics Receives the metrics.
+     */
+    void StreamWriter::metrics(Metrics &metrics)
+    {
+        metrics.host_size_ = num_slots_ * chunk_blocks_ * block_len_;
+        metrics.host_fill_ = static_cast<ckcore::tuint32>(atomic::load(&host_fill_));
+        metrics.drive_size_ = static_cast<ckcore::tuint32>(atomic::load(&drive_size_));
+        metrics.drive_fill_ = static_cast<ckcore::tuint32>(atomic::load(&drive_fill_));
+        metrics.written_ = static_cast<ckcore::tuint32>(atomic::load(&written_));
+        metrics.host_waits_ = static_cast<ckcore::tuint32>(atomic::load(&host_waits_));
+        metrics.underruns_ = static_cast<ckcore::tuint32>(atomic::load(&underruns_));
+        metrics.underrun_lba_ = static_cast<ckcore::tuint32>(atomic::load(&underrun_lba_));
+        metrics.burn_proof_ = burn_proof_;
+    }
+};
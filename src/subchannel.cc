@@ -0,0 +1,352 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "ckmmc/simd.hh"
+#include "ckmmc/subchannel.hh"
+
+namespace ckmmc
+{
+    /**
+     * @brief Sub-channel table class.
+     * Tables for the Q CRC and the raw sub-channel bit transpose, generated
+     * once when the library is loaded.
+     */
+    class SubchannelTables
+    {
+    public:
+        ckcore::tuint16 crc_[256];
+        ckcore::tuint16 syndrome_[96];  // CRC syndrome of each single bit error.
+        ckcore::tuint64 spread_[256];   // Byte bits spread to the top bit of eight bytes.
+
+        SubchannelTables()
+        {
+            // CRC-16 using x^16 + x^12 + x^5 + 1.
+            for (unsigned int i = 0; i < 256; i++)
+            {
+                ckcore::tuint16 crc = static_cast<ckcore::tuint16>(i << 8);
+                for (int j = 0; j < 8; j++)
+                    crc = static_cast<ckcore::tuint16>((crc << 1) ^ ((crc & 0x8000) ? 0x1021 : 0));
+
+                crc_[i] = crc;
+            }
+
+            for (unsigned int i = 0; i < 96; i++)
+            {
+                unsigned char q[12];
+                memset(q,0,sizeof(q));
+                q[i >> 3] = static_cast<unsigned char>(0x80 >> (i & 7));
+
+                ckcore::tuint16 crc = 0;
+                for (int j = 0; j < 10; j++)
+                    crc = static_cast<ckcore::tuint16>((crc << 8) ^ crc_[(crc >> 8) ^ q[j]]);
+
+                syndrome_[i] = crc ^ static_cast<ckcore::tuint16>((q[10] << 8) | q[11]);
+            }
+
+            // Byte b of the result has its top bit set if bit 7 - b of the
+            // index is set, bytes are numbered in memory order.
+            for (unsigned int i = 0; i < 256; i++)
+            {
+                unsigned char bytes[8];
+                for (int b = 0; b < 8; b++)
+                    bytes[b] = (i & (0x80 >> b)) ? 0x80 : 0;
+
+                memcpy(&spread_[i],bytes,sizeof(bytes));
+            }
+        }
+    };
+
+    static const SubchannelTables tables;
+
+    /*
+     * The R-W channels are interleaved over eight packs (IEC 60908). Within
+     * each pack symbols 1 and 18 and symbols 2 and 5 trade places, after
+     * which symbol i is delayed by i modulo 8 packs.
+     */
+    static const unsigned char rw_swap[Subchannel::ckPACK_SIZE] =
+    {
+        0,18,5,3,4,2,6,7,8,9,10,11,12,13,14,15,16,17,1,19,20,21,22,23
+    };
+
+    /**
+     * Converts raw sub-channel data to cooked sub-channel data. Every eight
+     * raw bytes hold one byte of each channel, the conversion is an 8x8 bit
+     * matrix transpose.
+     * @param [in] raw The raw sub-channel data of the first sector.
+     * @param [out] cooked Receives the cooked sub-channel data of all sectors
+     *                     stored back to back.
+     * @param [in] count The number of sectors.
+     * @param [in] stride The distance between the raw sub-channel data of two
+     *                    sectors.
+     */
+    void Subchannel::deinterleave(const unsigned char *raw,unsigned char *cooked,
+                                  ckcore::tuint32 count,ckcore::tuint32 stride)
+    {
+        for (ckcore::tuint32 i = 0; i < count; i++)
+        {
+            const unsigned char *src = raw + static_cast<size_t>(i) * stride;
+            unsigned char *dst = cooked + static_cast<size_t>(i) * ckSUBCH_SIZE;
+
+#ifdef CK_MMC_SSE2
+            for (unsigned int j = 0; j < ckSUBCH_SIZE; j += 16)
+            {
+                __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + j));
+
+                // Reverse the bytes of each half so that the first byte ends
+                // up in the most significant bit of the mask.
+                value = _mm_shufflelo_epi16(value,0x1b);
+                value = _mm_shufflehi_epi16(value,0x1b);
+                value = _mm_or_si128(_mm_slli_epi16(value,8),_mm_srli_epi16(value,8));
+
+                for (unsigned int c = 0; c < 8; c++)
+                {
+                    int mask = _mm_movemask_epi8(value);
+                    dst[c * ckCHANNEL_SIZE + (j >> 3)] = static_cast<unsigned char>(mask & 0xff);
+                    dst[c * ckCHANNEL_SIZE + (j >> 3) + 1] = static_cast<unsigned char>(mask >> 8);
+
+                    value = _mm_add_epi8(value,value);
+                }
+            }
+#else
+            for (unsigned int j = 0; j < ckCHANNEL_SIZE; j++)
+            {
+                for (unsigned int c = 0; c < 8; c++)
+                {
+                    unsigned char value = 0;
+                    for (unsigned int b = 0; b < 8; b++)
+                        value |= static_cast<unsigned char>(((src[(j << 3) + b] << c) & 0x80) >> b);
+
+                    dst[c * ckCHANNEL_SIZE + j] = value;
+                }
+            }
+#endif
+        }
+    }
+
+    /**
+     * Converts cooked sub-channel data to raw sub-channel data.
+     * @param [in] cooked The cooked sub-channel data of all sectors stored
+     *                    back to back.
+     * @param [out] raw Receives the raw sub-channel data of the first sector.
+     * @param [in] count The number of sectors.
+     * @param [in] stride The distance between the raw sub-channel data of two
+     *                    sectors.
+     */
+    void Subchannel::interleave(const unsigned char *cooked,unsigned char *raw,
+                                ckcore::tuint32 count,ckcore::tuint32 stride)
+    {
+        for (ckcore::tuint32 i = 0; i < count; i++)
+        {
+            const unsigned char *src = cooked + static_cast<size_t>(i) * ckSUBCH_SIZE;
+            unsigned char *dst = raw + static_cast<size_t>(i) * stride;
+
+            for (unsigned int j = 0; j < ckCHANNEL_SIZE; j++)
+            {
+                ckcore::tuint64 value = 0;
+                for (unsigned int c = 0; c < 8; c++)
+                    value |= tables.spread_[src[c * ckCHANNEL_SIZE + j]] >> c;
+
+                memcpy(dst + (j << 3),&value,sizeof(value));
+            }
+        }
+    }
+
+    /**
+     * Extracts the de-interleaved R-W symbols from raw sub-channel data.
+     * Symbols interleaved from packs outside the batch are set to zero.
+     * @param [in] raw The raw sub-channel data of the first sector.
+     * @param [out] packed Receives the packed R-W data of the first sector.
+     * @param [in] count The number of sectors.
+     * @param [in] stride The distance between the sub-channel data of two
+     *                    sectors, used for both the raw and packed data.
+     */
+    void Subchannel::unpack_rw(const unsigned char *raw,unsigned char *packed,
+                               ckcore::tuint32 count,ckcore::tuint32 stride)
+    {
+        ckcore::tuint32 packs = count * ckPACKS;
+        for (ckcore::tuint32 n = 0; n < packs; n++)
+        {
+            unsigned char *dst = packed + static_cast<size_t>(n / ckPACKS) * stride +
+                (n % ckPACKS) * ckPACK_SIZE;
+
+            for (unsigned int i = 0; i < ckPACK_SIZE; i++)
+            {
+                unsigned int sym = rw_swap[i];
+                ckcore::tuint32 src = n + (sym & 7);
+
+                dst[i] = src < packs ? raw[static_cast<size_t>(src / ckPACKS) * stride +
+                    (src % ckPACKS) * ckPACK_SIZE + sym] & 0x3f : 0;
+            }
+        }
+    }
+
+    /**
+     * Interleaves packed R-W symbols into raw sub-channel data. The P and Q
+     * bits of the raw data are left unchanged.
+     * @param [in] packed The packed R-W data of the first sector.
+     * @param [in,out] raw The raw sub-channel data of the first sector.
+     * @param [in] count The number of sectors.
+     * @param [in] stride The distance between the sub-channel data of two
+     *                    sectors, used for both the raw and packed data.
+     */
+    void Subchannel::pack_rw(const unsigned char *packed,unsigned char *raw,
+                             ckcore::tuint32 count,ckcore::tuint32 stride)
+    {
+        ckcore::tuint32 packs = count * ckPACKS;
+        for (ckcore::tuint32 n = 0; n < packs; n++)
+        {
+            unsigned char *dst = raw + static_cast<size_t>(n / ckPACKS) * stride +
+                (n % ckPACKS) * ckPACK_SIZE;
+
+            for (unsigned int i = 0; i < ckPACK_SIZE; i++)
+            {
+                unsigned int delay = i & 7;
+                unsigned char value = 0;
+                if (n >= delay)
+                {
+                    ckcore::tuint32 src = n - delay;
+                    value = packed[static_cast<size_t>(src / ckPACKS) * stride +
+                        (src % ckPACKS) * ckPACK_SIZE + rw_swap[i]] & 0x3f;
+                }
+
+                dst[i] = (dst[i] & 0xc0) | value;
+            }
+        }
+    }
+
+    /**
+     * Calculates the CRC of a Q sub-channel frame.
+     * @param [in] q The 12 byte Q frame.
+     * @return The CRC as stored in the last two bytes of the frame.
+     */
+    ckcore::tuint16 Subchannel::crc_q(const unsigned char *q)
+    {
+        ckcore::tuint16 crc = 0;
+        for (int i = 0; i < 10; i++)
+            crc = static_cast<ckcore::tuint16>((crc << 8) ^ tables.crc_[(crc >> 8) ^ q[i]]);
+
+        return static_cast<ckcore::tuint16>(~crc);
+    }
+
+    /**
+     * Verifies the CRC of a Q sub-channel frame.
+     * @param [in] q The 12 byte Q frame.
+     * @return If the CRC is valid true is returned, if not false is returned.
+     */
+    bool Subchannel::check_q(const unsigned char *q)
+    {
+        return crc_q(q) == static_cast<ckcore::tuint16>((q[10] << 8) | q[11]);
+    }
+
+    /**
+     * Converts a BCD encoded MSF address to a frame count.
+     * @param [in] msf The three address bytes.
+     * @return The number of frames.
+     */
+    static ckcore::tint32 msf_to_frames(const unsigned char *msf)
+    {
+        return (((msf[0] >> 4) * 10 + (msf[0] & 0x0f)) * 60 +
+                ((msf[1] >> 4) * 10 + (msf[1] & 0x0f))) * 75 +
+                ((msf[2] >> 4) * 10 + (msf[2] & 0x0f));
+    }
+
+    /**
+     * Converts a frame count to a BCD encoded MSF address.
+     * @param [in] frames The number of frames.
+     * @param [out] msf Receives the three address bytes.
+     */
+    static void frames_to_msf(ckcore::tint32 frames,unsigned char *msf)
+    {
+        unsigned char min = static_cast<unsigned char>(frames / (60 * 75));
+        unsigned char sec = static_cast<unsigned char>((frames / 75) % 60);
+        unsigned char frame = static_cast<unsigned char>(frames % 75);
+
+        msf[0] = static_cast<unsigned char>(((min / 10) << 4) | (min % 10));
+        msf[1] = static_cast<unsigned char>(((sec / 10) << 4) | (sec % 10));
+        msf[2] = static_cast<unsigned char>(((frame / 10) << 4) | (frame % 10));
+    }
+
+    /**
+     * Attempts to repair a Q sub-channel frame with an invalid CRC. Single
+     * bit errors are corrected using the CRC. Otherwise, if the preceding
+     * frame is known and holds a position, the frame is predicted from it
+     * and the prediction is used if it differs from the damaged frame in at
+     * most ckQ_MAX_REPAIR_BYTES bytes.
+     * @param [in,out] q The 12 byte Q frame.
+     * @param [in] prev_q The valid Q frame preceding q, may be NULL.
+     * @return If the frame is valid or was repaired true is returned, if not
+     *         false is returned.
+     */
+    bool Subchannel::repair_q(unsigned char *q,const unsigned char *prev_q)
+    {
+        ckcore::tuint16 syndrome = crc_q(q) ^ static_cast<ckcore::tuint16>((q[10] << 8) | q[11]);
+        if (syndrome == 0)
+            return true;
+
+        for (unsigned int i = 0; i < 96; i++)
+        {
+            if (tables.syndrome_[i] == syndrome)
+            {
+                q[i >> 3] ^= static_cast<unsigned char>(0x80 >> (i & 7));
+                return true;
+            }
+        }
+
+        // Only frames in ADR mode 1 hold a position that can be predicted.
+        if (prev_q == NULL || (prev_q[0] & 0x0f) != 1)
+            return false;
+
+        unsigned char predicted[12];
+        memcpy(predicted,prev_q,10);
+
+        // The relative time counts down in the pause preceding a track.
+        ckcore::tint32 rel = msf_to_frames(prev_q + 3);
+        if (prev_q[2] == 0)
+        {
+            if (rel == 0)
+                return false;
+
+            rel--;
+        }
+        else
+        {
+            rel++;
+        }
+
+        frames_to_msf(rel,predicted + 3);
+        frames_to_msf(msf_to_frames(prev_q + 7) + 1,predicted + 7);
+
+        ckcore::tuint16 crc = crc_q(predicted);
+        predicted[10] = static_cast<unsigned char>(crc >> 8);
+        predicted[11] = static_cast<unsigned char>(crc & 0xff);
+
+        unsigned int diff = 0;
+        for (unsigned int i = 0; i < 12; i++)
+        {
+            if (predicted[i] != q[i])
+                diff++;
+        }
+
+        if (diff > ckQ_MAX_REPAIR_BYTES)
+            return false;
+
+        memcpy(q,predicted,sizeof(predicted));
+        return true;
+    }
+};
@@ -0,0 +1,441 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <string.h>
+#include <ckcore/log.hh>
+#include "ckmmc/errorrecoveryscope.hh"
+#include "ckmmc/mmc.hh"
+#include "ckmmc/sync.hh"
+#include "ckmmc/timer.hh"
+#include "ckmmc/surfacescan.hh"
+
+namespace ckmmc
+{
+    /**
+     * Calculates the throughput of the chunk.
+     * @return The throughput in kB/s.
+     */
+    ckcore::tuint32 SurfaceScan::Chunk::throughput() const
+    {
+        if (latency_ == 0)
+            return 0;
+
+        return static_cast<ckcore::tuint32>(static_cast<ckcore::tuint64>(count_) * 2048 *
+                                             1000 / latency_);
+    }
+
+    /**
+     * Constructs a SurfaceScan object.
+     * @param [in] device The device to scan.
+     */
+    SurfaceScan::SurfaceScan(MmcDevice &device) : device_(device),
+        chunk_sectors_(ckDEFAULT_CHUNK_SECTORS),host_retries_(ckDEFAULT_HOST_RETRIES),
+        stop_(0),slow_latency_(0),score_(0)
+    {
+    }
+
+    /**
+     * Destructs the SurfaceScan object.
+     */
+    SurfaceScan::~SurfaceScan()
+    {
+    }
+
+    /**
+     * Reads a chunk, retrying failed reads up to the number of host retries.
+     * @param [in,out] chunk The chunk to read, the result is stored in it.
+     * @return If the scan can continue true is returned, if the device or
+     *         media is no longer usable false is returned.
+     */
+    bool SurfaceScan::read(Chunk &chunk)
+    {
+        // Prepare CDB.
+        unsigned char cdb[16];
+        memset(cdb,0,sizeof(cdb));
+
+        cdb[0] = MmcDevice::ckCMD_READ10;
+        write_uint32_msbf(chunk.lba_,cdb + 2);
+        write_uint16_msbf(static_cast<ckcore::tuint16>(chunk.count_),cdb + 7);
+
+        ckcore::tuint64 latency = 0;
+        while (chunk.attempts_ <= host_retries_)
+        {
+            unsigned char sense[24];
+            memset(sense,0,sizeof(sense));
+            unsigned char result = 0;
+
+            Timer timer;
+            bool res = device_.transport_with_sense(cdb,10,buffer_.data(),chunk.count_ * 2048,
+                                                    ScsiDevice::ckTM_READ,sense,result);
+            latency += timer.elapsed();
+            chunk.attempts_++;
+
+            if (!res || (result != ScsiDevice::ckSCSISTAT_GOOD &&
+                         result != ScsiDevice::ckSCSISTAT_CHECK_CONDITION))
+            {
+                ckcore::log::print_line(ckT("[surfacescan]: transport failed at sector %u."),chunk.lba_);
+                return false;
+            }
+
+            ScsiSenseData sense_data;
+            memset(&sense_data,0,sizeof(ScsiSenseData));
+            if (result == ScsiDevice::ckSCSISTAT_CHECK_CONDITION)
+                sense_data.parse(sense);
+
+            chunk.sense_key_ = sense_data.sense_key_;
+            chunk.asc_ = sense_data.asc_;
+            chunk.ascq_ = sense_data.ascq_;
+
+            switch (sense_data.sense_key_)
+            {
+                case ScsiSenseData::ckSENSE_NO_SENSE:
+                    chunk.error_class_ = chunk.attempts_ > 1 ? ckEC_RECOVERED : ckEC_NONE;
+                    break;
+
+                case ScsiSenseData::ckSENSE_RECOVERED_ERROR:
+                    chunk.error_class_ = ckEC_RECOVERED;
+                    break;
+
+                case ScsiSenseData::ckSENSE_MEDIUM_ERROR:
+                    chunk.error_class_ = ckEC_MEDIUM;
+                    continue;
+
+                case ScsiSenseData::ckSENSE_HARDWARE_ERROR:
+                    chunk.error_class_ = ckEC_HARDWARE;
+                    continue;
+
+                case ScsiSenseData::ckSENSE_NOT_READY:
+                case ScsiSenseData::ckSENSE_UNIT_ATTENTION:
+                    ckcore::log::print_line(ckT("[surfacescan]: device not ready at sector %u (%.2X/%.2X/%.2X)."),
+                                            chunk.lba_,sense_data.sense_key_,sense_data.asc_,sense_data.ascq_);
+                    return false;
+
+                default:
+                    chunk.error_class_ = ckEC_OTHER;
+                    continue;
+            }
+
+            break;
+        }
+
+        chunk.latency_ = latency > 0xffffffff ? 0xffffffff : static_cast<ckcore::tuint32>(latency);
+        return true;
+    }
+
+    /**
+     * Summarizes the scanned chunks into zones and calculates the score.
+     *
+     * A chunk is slow if its latency exceeds ckSLOW_FACTOR times the median
+     * latency of the chunks read without errors. The score starts at 100 and
+     * is reduced by 20 points per percent of sectors in unreadable chunks,
+     * 2 points per percent of sectors in recovered chunks and 0.2 points per
+     * percent of sectors in slow chunks. A disc with unreadable sectors never
+     * scores more than 49.
+     */
+    void SurfaceScan::summarize()
+    {
+        zones_.clear();
+        slow_latency_ = 0;
+        score_ = 0;
+
+        if (chunks_.empty())
+            return;
+
+        // Determine the slow chunk limit.
+        std::vector<ckcore::tuint32> latencies;
+        latencies.reserve(chunks_.size());
+
+        std::vector<Chunk>::const_iterator it;
+        for (it = chunks_.begin(); it != chunks_.end(); it++)
+        {
+            if (it->error_class_ == ckEC_NONE)
+                latencies.push_back(it->latency_);
+        }
+
+        if (!latencies.empty())
+        {
+            std::nth_element(latencies.begin(),latencies.begin() + latencies.size() / 2,
+                             latencies.end());
+            slow_latency_ = latencies[latencies.size() / 2] * ckSLOW_FACTOR;
+        }
+
+        // Build the zones.
+        ckcore::tuint32 first = chunks_.front().lba_;
+        ckcore::tuint64 total = static_cast<ckcore::tuint64>(chunks_.back().lba_) +
+                                chunks_.back().count_ - first;
+        ckcore::tuint64 zone_len = (total + ckNUM_ZONES - 1) / ckNUM_ZONES;
+
+        ckcore::tuint64 num_slow = 0,num_recovered = 0,num_errors = 0;
+        ckcore::tuint64 zone_latency = 0;
+        unsigned int zone_chunks = 0;
+
+        for (it = chunks_.begin(); it != chunks_.end(); it++)
+        {
+            ckcore::tuint64 zone_index = (it->lba_ - first) / zone_len;
+            if (zones_.empty() || zones_.size() <= zone_index)
+            {
+                zones_.push_back(Zone(it->lba_));
+                zone_latency = 0;
+                zone_chunks = 0;
+            }
+
+            Zone &zone = zones_.back();
+            if (zone_chunks == 0 || it->latency_ < zone.min_latency_)
+                zone.min_latency_ = it->latency_;
+            if (it->latency_ > zone.max_latency_)
+                zone.max_latency_ = it->latency_;
+
+            zone.count_ += it->count_;
+            zone_latency += it->latency_;
+            zone_chunks++;
+
+            zone.avg_latency_ = static_cast<ckcore::tuint32>(zone_latency / zone_chunks);
+            zone.throughput_ = zone_latency > 0 ?
+                static_cast<ckcore::tuint32>(static_cast<ckcore::tuint64>(zone.count_) * 2048 *
+                                             1000 / zone_latency) : 0;
+
+            if (it->error_class_ >= ckEC_MEDIUM)
+            {
+                zone.errors_ += it->count_;
+                num_errors += it->count_;
+            }
+            else if (it->error_class_ == ckEC_RECOVERED)
+            {
+                zone.recovered_ += it->count_;
+                num_recovered += it->count_;
+            }
+            else if (it->latency_ > slow_latency_)
+            {
+                zone.slow_ += it->count_;
+                num_slow += it->count_;
+            }
+        }
+
+        // Penalties in tenths of points.
+        ckcore::tuint64 penalty = (num_errors * 20000 + num_recovered * 2000 + num_slow * 200) / total;
+
+        ckcore::tuint64 score = penalty >= 1000 ? 0 : 100 - (penalty + 9) / 10;
+        if (num_errors > 0 && score > 49)
+            score = 49;
+
+        score_ = static_cast<unsigned int>(score);
+    }
+
+    /**
+     * Sets the number of sectors read by each command.
+     * @param [in] sectors The chunk size in sectors.
+     */
+    void SurfaceScan::chunk_sectors(ckcore::tuint32 sectors)
+    {
+        chunk_sectors_ = sectors > 0 ? sectors : 1;
+    }
+
+    /**
+     * Returns the number of sectors read by each command.
+     * @return The chunk size in sectors.
+     */
+    ckcore::tuint32 SurfaceScan::chunk_sectors() const
+    {
+        return chunk_sectors_;
+    }
+
+    /**
+     * Sets how many times a failed chunk is read again.
+     * @param [in] retries The number of retries.
+     */
+    void SurfaceScan::host_retries(unsigned int retries)
+    {
+        host_retries_ = retries < 0xff ? retries : 0xfe;
+    }
+
+    /**
+     * Returns how many times a failed chunk is read again.
+     * @return The number of retries.
+     */
+    unsigned int SurfaceScan::host_retries() const
+    {
+        return host_retries_;
+    }
+
+    /**
+     * Scans all sectors on the inserted disc.
+     * @return If the scan completed true is returned, if not false is
+     *         returned.
+     */
+    bool SurfaceScan::scan()
+    {
+        ckcore::tuint32 last_lba = 0,block_len = 0;
+        if (!device_.read_capacity(last_lba,block_len) || block_len != 2048)
+        {
+            ckcore::log::print_line(ckT("[surfacescan]: unable to determine disc capacity."));
+            return false;
+        }
+
+        return scan(0,last_lba + 1);
+    }
+
+    /**
+     * Scans a range of sectors. The results of scans that did not complete
+     * cover the sectors scanned before the scan stopped.
+     * @param [in] lba The first sector to scan.
+     * @param [in] count The number of sectors to scan.
+     * @return If the scan completed true is returned, if not false is
+     *         returned.
+     */
+    bool SurfaceScan::scan(ckcore::tuint32 lba,ckcore::tuint32 count)
+    {
+        atomic::store(&stop_,0);
+        chunks_.clear();
+
+        ckcore::tuint32 chunk_sectors = chunk_sectors_;
+        if (chunk_sectors > device_.transfer_len() / 2048)
+            chunk_sectors = device_.transfer_len() / 2048;
+        if (chunk_sectors > 0xffff)
+            chunk_sectors = 0xffff;
+        if (chunk_sectors == 0)
+            chunk_sectors = 1;
+
+        if (!buffer_.allocate(chunk_sectors * 2048))
+            return false;
+
+        chunks_.reserve(count / chunk_sectors + 1);
+
+        // Make the device report errors it recovered from.
+        ErrorRecoveryScope recovery(device_);
+        ScsiModePage01 page = recovery.saved();
+        page.per_ = true;
+        page.dte_ = false;
+        if (!recovery.apply(page))
+            ckcore::log::print_line(ckT("[surfacescan]: unable to enable reporting of recovered errors."));
+
+        bool res = true;
+        for (ckcore::tuint32 pos = 0; pos < count; pos += chunk_sectors)
+        {
+            if (atomic::load(&stop_) != 0)
+            {
+                res = false;
+                break;
+            }
+
+            Chunk chunk(lba + pos,count - pos < chunk_sectors ? count - pos : chunk_sectors);
+            if (!read(chunk))
+            {
+                res = false;
+                break;
+            }
+
+            chunks_.push_back(chunk);
+        }
+
+        recovery.restore();
+        summarize();
+
+        return res;
+    }
+
+    /**
+     * Requests a running scan to stop. This function may be called from any
+     * thread.
+     */
+    void SurfaceScan::stop()
+    {
+        atomic::store(&stop_,1);
+    }
+
+    /**
+     * Returns the chunks of the last scan.
+     * @return The chunk results in address order.
+     */
+    const std::vector<SurfaceScan::Chunk> &SurfaceScan::chunks() const
+    {
+        return chunks_;
+    }
+
+    /**
+     * Returns the zones of the last scan.
+     * @return The zone summaries in address order.
+     */
+    const std::vector<SurfaceScan::Zone> &SurfaceScan::zones() const
+    {
+        return zones_;
+    }
+
+    /**
+     * Returns the score of the last scan.
+     * @return The score, from 0 (worst) to 100 (best).
+     */
+    unsigned int SurfaceScan::score() const
+    {
+        return score_;
+    }
+
+    /**
+     * Returns a compact map of the last scan with one character per zone:
+     * 'X' for zones with unreadable sectors, 'r' for zones with recovered
+     * errors, 's' for zones with slow chunks and '.' for good zones.
+     * @return The zone map.
+     */
+    ckcore::tstring SurfaceScan::zone_map() const
+    {
+        ckcore::tstring map;
+
+        std::vector<Zone>::const_iterator it;
+        for (it = zones_.begin(); it != zones_.end(); it++)
+        {
+            if (it->errors_ > 0)
+                map += ckT("X");
+            else if (it->recovered_ > 0)
+                map += ckT("r");
+            else if (it->slow_ > 0)
+                map += ckT("s");
+            else
+                map += ckT(".");
+        }
+
+        return map;
+    }
+
+    /**
+     * Exports the chunks of the last scan as comma separated values suitable
+     * for plotting, with one header line followed by one line per chunk.
+     * @return The chunk table.
+     */
+    ckcore::tstring SurfaceScan::csv() const
+    {
+        ckcore::tstringstream stream;
+        stream << ckT("lba,count,latency_us,throughput_kbps,attempts,error_class,slow,sense_key,asc,ascq\n");
+
+        std::vector<Chunk>::const_iterator it;
+        for (it = chunks_.begin(); it != chunks_.end(); it++)
+        {
+            stream << it->lba_ << ckT(",")
+                   << it->count_ << ckT(",")
+                   << it->latency_ << ckT(",")
+                   << it->throughput() << ckT(",")
+                   << static_cast<unsigned int>(it->attempts_) << ckT(",")
+                   << static_cast<unsigned int>(it->error_class_) << ckT(",")
+                   << (it->error_class_ == ckEC_NONE && it->latency_ > slow_latency_ ? 1 : 0) << ckT(",")
+                   << static_cast<unsigned int>(it->sense_key_) << ckT(",")
+                   << static_cast<unsigned int>(it->asc_) << ckT(",")
+                   << static_cast<unsigned int>(it->ascq_) << ckT("\n");
+        }
+
+        return stream.str();
+    }
+};
@@ -0,0 +1,310 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ckmmc/sync.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs a Thread object. The thread is not started until start is
+     * called.
+     */
+#ifdef _WINDOWS
+    Thread::Thread() : handle_(NULL)
+#else
+    Thread::Thread() : started_(false)
+#endif
+    {
+    }
+
+    /**
+     * Destructs the Thread object. The thread must have been joined by the
+     * derived class before it's destructed.
+     */
+    Thread::~Thread()
+    {
+#ifdef _WINDOWS
+        if (handle_ != NULL)
+            CloseHandle(handle_);
+#endif
+    }
+
+    /**
+     * Thread entry point.
+     * @param [in] param Pointer to the Thread object.
+     * @return Always zero.
+     */
+#ifdef _WINDOWS
+    DWORD WINAPI Thread::entry(LPVOID param)
+    {
+        static_cast<Thread *>(param)->run();
+        return 0;
+    }
+#else
+    void *Thread::entry(void *param)
+    {
+        static_cast<Thread *>(param)->run();
+        return NULL;
+    }
+#endif
+
+    /**
+     * Starts the thread.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool Thread::start()
+    {
+#ifdef _WINDOWS
+        if (handle_ != NULL)
+            return false;
+
+        handle_ = CreateThread(NULL,0,entry,this,0,NULL);
+        return handle_ != NULL;
+#else
+        if (started_)
+            return false;
+
+        started_ = pthread_create(&handle_,NULL,entry,this) == 0;
+        return started_;
+#endif
+    }
+
+    /**
+     * Waits for the thread to finish.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool Thread::join()
+    {
+#ifdef _WINDOWS
+        if (handle_ == NULL)
+            return false;
+
+        bool res = WaitForSingleObject(handle_,INFINITE) == WAIT_OBJECT_0;
+        CloseHandle(handle_);
+        handle_ = NULL;
+
+        return res;
+#else
+        if (!started_)
+            return false;
+
+        started_ = false;
+        return pthread_join(handle_,NULL) == 0;
+#endif
+    }
+
+    /**
+     * Constructs a Mutex object.
+     */
+    Mutex::Mutex()
+    {
+#ifdef _WINDOWS
+        InitializeCriticalSection(&cs_);
+#else
+        pthread_mutex_init(&mutex_,NULL);
+#endif
+    }
+
+    /**
+     * Destructs the Mutex object.
+     */
+    Mutex::~Mutex()
+    {
+#ifdef _WINDOWS
+        DeleteCriticalSection(&cs_);
+#else
+        pthread_mutex_destroy(&mutex_);
+#endif
+    }
+
+    /**
+     * Locks the mutex.
+     */
+    void Mutex::lock()
+    {
+#ifdef _WINDOWS
+        EnterCriticalSection(&cs_);
+#else
+        pthread_mutex_lock(&mutex_);
+#endif
+    }
+
+    /**
+     * Unlocks the mutex.
+     */
+    void Mutex::unlock()
+    {
+#ifdef _WINDOWS
+        LeaveCriticalSection(&cs_);
+#else
+        pthread_mutex_unlock(&mutex_);
+#endif
+    }
+
+    /**
+     * Constructs a non-signaled Event object.
+     */
+    Event::Event()
+    {
+#ifdef _WINDOWS
+        handle_ = CreateEvent(NULL,FALSE,FALSE,NULL);
+#else
+        pthread_mutex_init(&mutex_,NULL);
+        pthread_cond_init(&cond_,NULL);
+        signaled_ = false;
+#endif
+    }
+
+    /**
+     * Destructs the Event object.
+     */
+    Event::~Event()
+    {
+#ifdef _WINDOWS
+        CloseHandle(handle_);
+#else
+        pthread_cond_destroy(&cond_);
+        pthread_mutex_destroy(&mutex_);
+#endif
+    }
+
+    /**
+     * Signals the event.
+     */
+    void Event::set()
+    {
+#ifdef _WINDOWS
+        SetEvent(handle_);
+#else
+        pthread_mutex_lock(&mutex_);
+        signaled_ = true;
+        pthread_cond_signal(&cond_);
+        pthread_mutex_unlock(&mutex_);
+#endif
+    }
+
+    /**
+     * Waits for the event to become signaled and resets it.
+     */
+    void Event::wait()
+    {
+#ifdef _WINDOWS
+        WaitForSingleObject(handle_,INFINITE);
+#else
+        pthread_mutex_lock(&mutex_);
+        while (!signaled_)
+            pthread_cond_wait(&cond_,&mutex_);
+        signaled_ = false;
+        pthread_mutex_unlock(&mutex_);
+#endif
+    }
+
+    /**
+     * Waits for the event to become signaled and resets it, giving up after
+     * the specified time.
+     * @param [in] timeout The maximum time to wait in milliseconds.
+     * @return If the event was signaled true is returned, if the wait timed
+     *         out false is returned.
+     */
+    bool Event::wait(ckcore::tuint32 timeout)
+    {
+#ifdef _WINDOWS
+        return WaitForSingleObject(handle_,timeout) == WAIT_OBJECT_0;
+#else
+        struct timeval now;
+        gettimeofday(&now,NULL);
+
+        ckcore::tuint64 usec = static_cast<ckcore::tuint64>(now.tv_usec) +
+            static_cast<ckcore::tuint64>(timeout) * 1000;
+
+        struct timespec deadline;
+        deadline.tv_sec = now.tv_sec + static_cast<time_t>(usec / 1000000);
+        deadline.tv_nsec = static_cast<long>((usec % 1000000) * 1000);
+
+        pthread_mutex_lock(&mutex_);
+        int res = 0;
+        while (!signaled_ && res == 0)
+            res = pthread_cond_timedwait(&cond_,&mutex_,&deadline);
+
+        bool signaled = signaled_;
+        signaled_ = false;
+        pthread_mutex_unlock(&mutex_);
+
+        return signaled;
+#endif
+    }
+
+    namespace atomic
+    {
+        /**
+         * Reads a value shared between threads. The read acts as a full
+         * memory barrier.
+         * @param [in] value Pointer to the value.
+         * @return The current value.
+         */
+        long load(volatile long *value)
+        {
+#ifdef _WINDOWS
+            return InterlockedExchangeAdd(value,0);
+#else
+            return __sync_fetch_and_add(value,0);
+#endif
+        }
+
+        /**
+         * Writes a value shared between threads. The write acts as a full
+         * memory barrier.
+         * @param [in] value Pointer to the value.
+         * @param [in] new_value The new value.
+         */
+        void store(volatile long *value,long new_value)
+        {
+            exchange(value,new_value);
+        }
+
+        /**
+         * Adds to a value shared between threads.
+         * @param [in] value Pointer to the value.
+         * @param [in] delta The value to add.
+         * @return The new value.
+         */
+        long add(volatile long *value,long delta)
+        {
+#ifdef _WINDOWS
+            return InterlockedExchangeAdd(value,delta) + delta;
+#else
+            return __sync_add_and_fetch(value,delta);
+#endif
+        }
+
+        /**
+         * Replaces a value shared between threads.
+         * @param [in] value Pointer to the value.
+         * @param [in] new_value The new value.
+         * @return The previous value.
+         */
+        long exchange(volatile long *value,long new_value)
+        {
+#ifdef _WINDOWS
+            return InterlockedExchange(value,new_value);
+#else
+            return __sync_lock_test_and_set(value,new_value);
+#endif
+        }
+    };
+};
@@ -0,0 +1,84 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef _WINDOWS
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+#include "ckmmc/timer.hh"
+
+namespace ckmmc
+{
+    /**
+     * Constructs a Timer object. The timer is started immediately.
+     */
+    Timer::Timer() : start_(now())
+    {
+    }
+
+    /**
+     * Destructs the Timer object.
+     */
+    Timer::~Timer()
+    {
+    }
+
+    /**
+     * Restarts the timer.
+     */
+    void Timer::reset()
+    {
+        start_ = now();
+    }
+
+    /**
+     * Returns the time elapsed since the timer was started.
+     * @return The elapsed time in microseconds.
+     */
+    ckcore::tuint64 Timer::elapsed() const
+    {
+        return now() - start_;
+    }
+
+    /**
+     * Returns the current value of the system's monotonic clock.
+     * @return The current time in microseconds since an unspecified point in
+     *         time.
+     */
+    ckcore::tuint64 Timer::now()
+    {
+#ifdef _WINDOWS
+        static LARGE_INTEGER freq = { 0 };
+        if (freq.QuadPart == 0)
+            QueryPerformanceFrequency(&freq);
+
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
+
+        // Split the calculation to avoid overflowing the counter.
+        ckcore::tuint64 sec = counter.QuadPart / freq.QuadPart;
+        ckcore::tuint64 rem = counter.QuadPart % freq.QuadPart;
+        return sec * 1000000 + (rem * 1000000) / freq.QuadPart;
+#else
+        struct timeval tv;
+        gettimeofday(&tv,NULL);
+        return static_cast<ckcore::tuint64>(tv.tv_sec) * 1000000 + tv.tv_usec;
+#endif
+    }
+};
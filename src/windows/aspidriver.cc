@@ -25,7 +25,8 @@ namespace ckmmc
     /**
      * Constructs an AspiDriver object.
      */
-    AspiDriver::AspiDriver() : dll_instance_(NULL),driver_loaded_(false)
+    AspiDriver::AspiDriver() :
+        dll_instance_(NULL),driver_loaded_(false),timeout_(ckASPI_DEFAULT_TIMEOUT)
     {
     }
 
@@ -94,9 +95,84 @@ namespace ckmmc
      */
     bool AspiDriver::timeout(long timeout)
     {
+        timeout_ = timeout < 0 ? ckASPI_DEFAULT_TIMEOUT : timeout;
         return true;
     }
 
+    /**
+     * Executes a SCSI command request block and waits for it to complete. If
+     * the command does not complete in time it will be aborted. Should the
+     * abort request not be honored the device will be reset which forces the
+     * request to complete.
+     * @param [in,out] srb_cmd The request block to execute.
+     * @param [in] timeout The command timeout in seconds. If negative the
+     *                     default timeout will be used.
+     */
+    void AspiDriver::execute(SRB_ExecSCSICmd &srb_cmd,long timeout)
+    {
+        // Setup wait event.
+        HANDLE wait_event = CreateEvent(NULL,TRUE,FALSE,NULL);
+        ResetEvent(wait_event);
+        srb_cmd.SRB_PostProc = (void (__cdecl *)(void))wait_event;
+
+        // Execute SCSI command and wait for it to finish.
+        if (SendASPI32Command((LPSRB)&srb_cmd) == SS_PENDING)
+        {
+            unsigned long wait_time = (timeout < 0 ? timeout_ : timeout) * 1000;
+            if (WaitForSingleObject(wait_event,wait_time) == WAIT_TIMEOUT)
+            {
+                ckcore::log::print_line(ckT("[aspidriver]: command 0x%.2x timed out, aborting."),
+                                        srb_cmd.CDBByte[0]);
+
+                SRB_Abort srb_abort;
+                memset(&srb_abort,0,sizeof(SRB_Abort));
+                srb_abort.SRB_Cmd = SC_ABORT_SRB;
+                srb_abort.SRB_HaId = srb_cmd.SRB_HaId;
+                srb_abort.SRB_ToAbort = &srb_cmd;
+                SendASPI32Command((LPSRB)&srb_abort);
+
+                // The request block lives on the stack of the caller, we can't
+                // return before ASPI has released it.
+                if (WaitForSingleObject(wait_event,ckASPI_ABORT_TIMEOUT * 1000) == WAIT_TIMEOUT)
+                {
+                    reset_device(srb_cmd.SRB_HaId,srb_cmd.SRB_Target,srb_cmd.SRB_Lun);
+                    WaitForSingleObject(wait_event,INFINITE);
+                }
+            }
+        }
+
+        CloseHandle(wait_event);
+    }
+
+    /**
+     * Sends a device reset request to the specified target.
+     * @param [in] ha_id The host adapter identifier.
+     * @param [in] target The target identifier.
+     * @param [in] lun The logical unit number.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool AspiDriver::reset_device(BYTE ha_id,BYTE target,BYTE lun)
+    {
+        SRB_BusDeviceReset srb_reset;
+        memset(&srb_reset,0,sizeof(SRB_BusDeviceReset));
+        srb_reset.SRB_Cmd = SC_RESET_DEV;
+        srb_reset.SRB_HaId = ha_id;
+        srb_reset.SRB_Flags = SRB_EVENT_NOTIFY;
+        srb_reset.SRB_Target = target;
+        srb_reset.SRB_Lun = lun;
+
+        HANDLE wait_event = CreateEvent(NULL,TRUE,FALSE,NULL);
+        ResetEvent(wait_event);
+        srb_reset.SRB_PostProc = (void (__cdecl *)(void))wait_event;
+
+        if (SendASPI32Command((LPSRB)&srb_reset) == SS_PENDING)
+            WaitForSingleObject(wait_event,INFINITE);
+
+        CloseHandle(wait_event);
+
+        return srb_reset.SRB_Status == SS_COMP;
+    }
+
     /**
      * Scans the system for devices.
      * @param [out] addresses Vector containing addresses of all detected
@@ -158,21 +234,18 @@ namespace ckmmc
     }
 
     /**
-     * Transports data from or to the device using SCSI commands.
-     * @param [in] device The device to transport the command to.
-     * @param [in] cdb Buffer to command descriptor block.
-     * @param [in] cdb_len Length of the command descriptor block.
-     * @param [in] data Pointer to data buffer for either receiving or
-     *                  writing data.
-     * @param [in] data_len Length of the data buffer.
-     * @param [in] mode Specifies the transport mode.
-     * @return If the transport was successfully carried through true is
-     *         returned, if not false is returned.
+     * Obtains the transfer limits of the host adapter a device is attached
+     * to from the host adapter unique parameters.
+     * @param [in] addr The device address.
+     * @param [out] max_transfer The maximum number of bytes that can be
+     *                           transferred in a single command.
+     * @param [out] alignment_mask The required data buffer alignment mask.
+     * @return If the limits are known true is returned, if not false is
+     *         returned.
      */
-    bool AspiDriver::transport(ScsiDevice &device,
-                               unsigned char *cdb,unsigned char cdb_len,
-                               unsigned char *data,unsigned long data_len,
-                               ScsiDevice::TransportMode mode)
+    bool AspiDriver::transfer_limits(const ScsiDevice::Address &addr,
+                                     ckcore::tuint32 &max_transfer,
+                                     ckcore::tuint32 &alignment_mask)
     {
         // Make sure that the driver DLL is loaded.
         if (!driver_loaded_)
@@ -182,105 +255,29 @@ namespace ckmmc
                 return false;
         }
 
-        if (device.address().bus_ == -1 ||
-            device.address().target_ == -1 ||
-            device.address().lun_ == -1)
-        {
-            return false;
-        }
-
-        if (cdb == NULL || cdb_len > 16)
-            return false;
-
-        // Prepare SCSI command.
-        SRB_ExecSCSICmd srb_cmd;
-        memset(&srb_cmd,0,sizeof(SRB_ExecSCSICmd));
-
-        srb_cmd.SRB_Cmd = SC_EXEC_SCSI_CMD;
-        srb_cmd.SRB_HaId = static_cast<BYTE>(device.address().bus_);
-        srb_cmd.SRB_Target = static_cast<BYTE>(device.address().target_);
-        srb_cmd.SRB_Lun = static_cast<BYTE>(device.address().lun_);
-        srb_cmd.SRB_SenseLen = 24;
-        srb_cmd.SRB_BufPointer = data;
-        srb_cmd.SRB_BufLen = data_len;
-        srb_cmd.SRB_CDBLen = cdb_len;
-        memcpy(srb_cmd.CDBByte,cdb,cdb_len);
-
-        switch (mode)
-        {
-            case ScsiDevice::ckTM_UNSPECIFIED:
-                srb_cmd.SRB_Flags = 0;
-                break;
-
-            case ScsiDevice::ckTM_READ:
-                srb_cmd.SRB_Flags = SRB_DIR_IN | SRB_EVENT_NOTIFY;
-                break;
-
-            case ScsiDevice::ckTM_WRITE:
-                srb_cmd.SRB_Flags = SRB_DIR_OUT | SRB_EVENT_NOTIFY;
-                break;
-
-            default:
-                return false;
-        }
-
-        // Setup wait event.
-        HANDLE wait_event = CreateEvent(NULL,TRUE,FALSE,NULL);
-        ResetEvent(wait_event);
-        srb_cmd.SRB_PostProc = (void (__cdecl *)(void))wait_event;
-
-        // Execute SCSI command and wait for it to finish.
-        if (SendASPI32Command((LPSRB)&srb_cmd) == SS_PENDING)
-            WaitForSingleObject(wait_event,INFINITE);
-
-        CloseHandle(wait_event);
-
-        // Verify the commnad result.
-        if (srb_cmd.SRB_Status != SS_COMP)
-        {
-            if (!silent_)
-            {
-                ckcore::log::print_line(ckT("[aspidriver]: SendASPI32Command failed (0x%.2x, %d)."),
-                                        srb_cmd.SRB_Status,GetLastError());
-            }
+        SRB_HaInquiry ha_inq;
+        memset(&ha_inq,0,sizeof(SRB_HaInquiry));
+        ha_inq.SRB_Cmd = SC_HA_INQUIRY;
+        ha_inq.SRB_HaId = static_cast<BYTE>(addr.bus_);
 
+        SendASPI32Command((LPSRB)&ha_inq);
+        if (ha_inq.SRB_Status != SS_COMP)
             return false;
-        }
 
-        if (srb_cmd.SRB_TargStat != ScsiDevice::ckSCSISTAT_GOOD)
-        {
-            if (!silent_)
-            {
-                ckcore::log::print_line(ckT("[aspidriver]: scsi command failed (0x%.2x)."),
-                                        srb_cmd.SRB_TargStat);
+        alignment_mask = ha_inq.HA_Unique[0] | (ha_inq.HA_Unique[1] << 8);
+        max_transfer = ha_inq.HA_Unique[4] | (ha_inq.HA_Unique[5] << 8) |
+                       (ha_inq.HA_Unique[6] << 16) | (ha_inq.HA_Unique[7] << 24);
 
-                // Dump CDB.
-                ckcore::log::print(ckT("[aspidriver]: > cdb: "));
-                for (unsigned int i = 0; i < cdb_len; i++)
-                {
-                    if (i == 0)
-                        ckcore::log::print(ckT("0x%.2x"),cdb[i]);
-                    else
-                        ckcore::log::print(ckT(",0x%.2x"),cdb[i]);
-                }
-
-                ckcore::log::print_line(ckT(""));
-
-                // Dump sense information.
-                ckcore::log::print_line(ckT("[aspidriver]: > sense key: 0x%x"),srb_cmd.SenseArea[2] & 0xf);
-                ckcore::log::print_line(ckT("[aspidriver]: > asc: 0x%.2x"),srb_cmd.SenseArea[12]);
-                ckcore::log::print_line(ckT("[aspidriver]: > ascq: 0x%.2x"),srb_cmd.SenseArea[13]);
-            }
-
-            return false;
-        }
+        // Old ASPI managers don't report the limit, they are however
+        // guaranteed to handle 64 KiB transfers.
+        if (max_transfer == 0)
+            max_transfer = 64 * 1024;
 
         return true;
     }
 
     /**
-     * Transports data from or to the device using SCSI commands. This is
-     * similar to the transport function with the exception that the sense
+     * Transports data from or to the device using SCSI commands. The sense
      * and result is written back to the caller.
      * @param [in] device The device to transport the command to.
      * @param [in] cdb Buffer to command descriptor block.
@@ -291,6 +288,9 @@ namespace ckmmc
      * @param [in] mode Specifies the transport mode.
      * @param [out] sense Pointer to sense buffer.
      * @param [out] result Contains the transport result.
+     * @param [out] transferred The number of bytes actually transferred.
+     * @param [in] timeout The command timeout in seconds. If negative the
+     *                     default timeout will be used.
      * @return If the transport was successfully carried through true is
      *         returned, if not false is returned.
      */
@@ -298,7 +298,8 @@ namespace ckmmc
                                           unsigned char *cdb,unsigned char cdb_len,
                                           unsigned char *data,unsigned long data_len,
                                           ScsiDevice::TransportMode mode,
-                                          unsigned char *sense,unsigned char &result)
+                                          unsigned char *sense,unsigned char &result,
+                                          unsigned long &transferred,long timeout)
     {
         // Make sure that the driver DLL is loaded.
         if (!driver_loaded_)
@@ -338,7 +339,7 @@ namespace ckmmc
         switch (mode)
         {
             case ScsiDevice::ckTM_UNSPECIFIED:
-                srb_cmd.SRB_Flags = 0;
+                srb_cmd.SRB_Flags = SRB_EVENT_NOTIFY;
                 break;
 
             case ScsiDevice::ckTM_READ:
@@ -353,20 +354,58 @@ namespace ckmmc
                 return false;
         }
 
-        // Setup wait event.
-        HANDLE wait_event = CreateEvent(NULL,TRUE,FALSE,NULL);
-        ResetEvent(wait_event);
-        srb_cmd.SRB_PostProc = (void (__cdecl *)(void))wait_event;
-
         // Execute SCSI command and wait for it to finish.
-        if (SendASPI32Command((LPSRB)&srb_cmd) == SS_PENDING)
-            WaitForSingleObject(wait_event,INFINITE);
+        execute(srb_cmd,timeout);
 
-        CloseHandle(wait_event);
+        // Requests that failed without the target reporting an error never
+        // reached the device, there is no sense information to return.
+        if (srb_cmd.SRB_Status != SS_COMP &&
+            srb_cmd.SRB_TargStat == ScsiDevice::ckSCSISTAT_GOOD)
+        {
+            if (!silent_)
+            {
+                ckcore::log::print_line(ckT("[aspidriver]: SendASPI32Command failed (0x%.2x, %d)."),
+                                        srb_cmd.SRB_Status,GetLastError());
+            }
+
+            return false;
+        }
 
         memcpy(sense,srb_cmd.SenseArea,24);
         result = srb_cmd.SRB_TargStat;
 
+        // ASPI does not report residuals, the transfer is all or nothing.
+        transferred = srb_cmd.SRB_Status == SS_COMP ? data_len : 0;
+
         return true;
     }
+
+    /**
+     * Resets a device or the bus it is attached to.
+     * @param [in] device The device to reset.
+     * @param [in] level The reset level.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool AspiDriver::reset(ScsiDevice &device,ScsiDevice::ResetLevel level)
+    {
+        if (!driver_loaded_)
+            return false;
+
+        switch (level)
+        {
+            case ScsiDevice::ckRESET_ABORT:
+                // Timed out commands are aborted by the transport functions,
+                // there is nothing outstanding to abort at this point.
+                return true;
+
+            case ScsiDevice::ckRESET_DEVICE:
+                return reset_device(static_cast<BYTE>(device.address().bus_),
+                                    static_cast<BYTE>(device.address().target_),
+                                    static_cast<BYTE>(device.address().lun_));
+
+            default:
+                // ASPI does not provide any means of resetting a bus.
+                return false;
+        }
+    }
 };
@@ -33,6 +33,9 @@ namespace ckmmc
         UCHAR ucSenseBuf[32];
     } SCSI_PASS_THROUGH_DIRECT_WITH_BUFFER, *PSCSI_PASS_THROUGH_DIRECT_WITH_BUFFER;
 
+    // CancelIoEx is not available prior to Windows Vista.
+    typedef BOOL (WINAPI *tCancelIoEx)(HANDLE file,LPOVERLAPPED overlapped);
+
     /**
      * Constructs an SptiDriver object.
      * @param [in] ctcm Set to true to enable cdrtools compatibility mode.
@@ -54,26 +57,58 @@ namespace ckmmc
             CloseHandle(it->second);
 
         handles_.clear();
+        handle_users_.clear();
+    }
+
+    /**
+     * Constructs a ScopedHandle object, acquiring the handle of the
+     * specified device.
+     * @param [in] driver The driver owning the handle.
+     * @param [in] addr The address of the device.
+     */
+    SptiDriver::ScopedHandle::ScopedHandle(SptiDriver &driver,
+                                           const ScsiDevice::Address &addr) :
+        driver_(driver),drive_letter_(0),handle_(INVALID_HANDLE_VALUE)
+    {
+        handle_ = driver_.acquire_handle(addr);
+        if (handle_ != INVALID_HANDLE_VALUE)
+            drive_letter_ = addr.device_[0];
     }
 
     /**
-     * Tries to find the handle of the specified device.
-     * @param [in] device The device to find the handle of.
+     * Destructs the ScopedHandle object, releasing the device handle.
+     */
+    SptiDriver::ScopedHandle::~ScopedHandle()
+    {
+        if (handle_ != INVALID_HANDLE_VALUE)
+            driver_.release_handle(drive_letter_,handle_);
+    }
+
+    /**
+     * Tries to find the handle of the specified device. The handle must be
+     * released using release_handle when no longer used.
+     * @param [in] addr The address of the device to find the handle of.
      * @return If successful the handle is returned, if not
      *         INVALID_HANDLE_VALUE is returned.
      */
-    HANDLE SptiDriver::get_handle(ScsiDevice &device)
+    HANDLE SptiDriver::acquire_handle(const ScsiDevice::Address &addr)
     {
-        if (device.address().device_.empty())
+        if (addr.device_.empty())
         {
             ckcore::log::print_line(ckT("[sptidriver]: invalid address."));
             return INVALID_HANDLE_VALUE;
         }
 
+        ScopedLock lock(handles_mutex_);
+
         // See if a handle already exist.
-        ckcore::tchar drv_letter = device.address().device_[0];
-        if (handles_.count(drv_letter) > 0)
-            return handles_[drv_letter];
+        ckcore::tchar drv_letter = addr.device_[0];
+        std::map<ckcore::tchar,HANDLE>::iterator it = handles_.find(drv_letter);
+        if (it != handles_.end())
+        {
+            handle_users_[it->second]++;
+            return it->second;
+        }
 
         // Create a new handle to the device.
         ckcore::tchar drive_str[7];
@@ -89,9 +124,32 @@ namespace ckmmc
             return INVALID_HANDLE_VALUE;
 
         handles_[drv_letter] = handle;
+        handle_users_[handle] = 1;
         return handle;
     }
 
+    /**
+     * Releases a device handle acquired using acquire_handle. If the handle
+     * has been retired and this was its last user the handle is closed.
+     * @param [in] drive_letter The drive letter of the device.
+     * @param [in] handle The handle to release.
+     */
+    void SptiDriver::release_handle(ckcore::tchar drive_letter,HANDLE handle)
+    {
+        ScopedLock lock(handles_mutex_);
+
+        std::map<HANDLE,unsigned int>::iterator it = handle_users_.find(handle);
+        if (it == handle_users_.end() || --it->second > 0)
+            return;
+
+        std::map<ckcore::tchar,HANDLE>::iterator it_handle = handles_.find(drive_letter);
+        if (it_handle == handles_.end() || it_handle->second != handle)
+        {
+            CloseHandle(handle);
+            handle_users_.erase(it);
+        }
+    }
+
     /**
      * Tries to find the device letter string for the specified address.
      * @param [in,out] addr The address to update with device drive letter
@@ -286,8 +344,18 @@ namespace ckmmc
             // Add to the address vector.
             addr.device_.push_back(drive_letter);
 
-            // Remember the handle.
-            handles_[drive_letter] = handle;
+            // Remember the handle unless one already is in use.
+            handles_mutex_.lock();
+            if (handles_.count(drive_letter) > 0)
+            {
+                CloseHandle(handle);
+            }
+            else
+            {
+                handles_[drive_letter] = handle;
+                handle_users_[handle] = 0;
+            }
+            handles_mutex_.unlock();
 
             // Add the address to the address vector.
             addresses.push_back(addr);
@@ -313,121 +381,137 @@ namespace ckmmc
     }
 
     /**
-     * Transports data from or to the device using SCSI commands.
-     * @param [in] device The device to transport the command to.
-     * @param [in] cdb Buffer to command descriptor block.
-     * @param [in] cdb_len Length of the command descriptor block.
-     * @param [in] data Pointer to data buffer for either receiving or
-     *                  writing data.
-     * @param [in] data_len Length of the data buffer.
-     * @param [in] mode Specifies the transport mode.
-     * @return If the transport was successfully carried through true is
-     *         returned, if not false is returned.
+     * Obtains the vendor and product identifiers of a device from the
+     * storage class driver. The class driver caches the device inquiry data
+     * so no command will be sent to the device.
+     * @param [in] addr The device address.
+     * @param [out] vendor The device vendor.
+     * @param [out] identifier The device product identifier.
+     * @return If the identity is known true is returned, if not false is
+     *         returned.
      */
-    bool SptiDriver::transport(ScsiDevice &device,
-                               unsigned char *cdb,unsigned char cdb_len,
-                               unsigned char *data,unsigned long data_len,
-                               ScsiDevice::TransportMode mode)
+    bool SptiDriver::identify(const ScsiDevice::Address &addr,
+                              ckcore::tstring &vendor,
+                              ckcore::tstring &identifier)
     {
-        // Try to obtain the device handle.
-        HANDLE handle = get_handle(device);
+        ScopedHandle scoped_handle(*this,addr);
+        HANDLE handle = scoped_handle.handle();
         if (handle == INVALID_HANDLE_VALUE)
-        {
-            if (!silent_)
-            {
-                ckcore::log::print_line(ckT("[sptidriver]: unable to obtain device handle (%d, %d, %d, %s)."),
-                                        device.address().bus_,device.address().target_,device.address().lun_,
-                                        device.address().device_.c_str());
-            }
-
             return false;
-        }
 
-        if (cdb == NULL || cdb_len > 16)
-            return false;
+        STORAGE_PROPERTY_QUERY query;
+        memset(&query,0,sizeof(STORAGE_PROPERTY_QUERY));
+        query.PropertyId = StorageDeviceProperty;
+        query.QueryType = PropertyStandardQuery;
 
-        // Prepare SCSI command.
-        SCSI_PASS_THROUGH_DIRECT_WITH_BUFFER sptwb;
-        memset(&sptwb,0,sizeof(SCSI_PASS_THROUGH_DIRECT_WITH_BUFFER));
+        unsigned char buffer[512];
+        memset(buffer,0,sizeof(buffer));
 
-        sptwb.spt.Length = sizeof(SCSI_PASS_THROUGH_DIRECT);
-        sptwb.spt.SenseInfoLength = 24;
-        sptwb.spt.SenseInfoOffset = offsetof(SCSI_PASS_THROUGH_DIRECT_WITH_BUFFER,ucSenseBuf);
-        sptwb.spt.DataTransferLength = data_len;
-        sptwb.spt.DataBuffer = data;
-        sptwb.spt.CdbLength = cdb_len;
-        sptwb.spt.TimeOutValue = timeout_;
-        memcpy(sptwb.spt.Cdb,cdb,cdb_len);
-    
-        switch (mode)
+        unsigned long returned = 0;
+        if (!DeviceIoControl(handle,IOCTL_STORAGE_QUERY_PROPERTY,
+                             &query,sizeof(STORAGE_PROPERTY_QUERY),
+                             buffer,sizeof(buffer),&returned,FALSE))
         {
-            case ScsiDevice::ckTM_UNSPECIFIED:
-                sptwb.spt.DataIn = SCSI_IOCTL_DATA_UNSPECIFIED;
-                break;
+            return false;
+        }
 
-            case ScsiDevice::ckTM_READ:
-                sptwb.spt.DataIn = SCSI_IOCTL_DATA_IN;
-                break;
+        STORAGE_DEVICE_DESCRIPTOR *desc =
+            reinterpret_cast<STORAGE_DEVICE_DESCRIPTOR *>(buffer);
+        if (desc->VendorIdOffset == 0 || desc->VendorIdOffset >= returned ||
+            desc->ProductIdOffset == 0 || desc->ProductIdOffset >= returned)
+        {
+            return false;
+        }
 
-            case ScsiDevice::ckTM_WRITE:
-                sptwb.spt.DataIn = SCSI_IOCTL_DATA_OUT;
-                break;
+        // Make sure that the strings are terminated.
+        buffer[sizeof(buffer) - 1] = '\0';
 
-            default:
-                return false;
-        }
+        ckcore::tchar str[64];
+        ckcore::string::ansi_to_auto(reinterpret_cast<const char *>(buffer + desc->VendorIdOffset),
+                                     str,sizeof(str) / sizeof(ckcore::tchar));
+        vendor = str;
+        ckcore::string::ansi_to_auto(reinterpret_cast<const char *>(buffer + desc->ProductIdOffset),
+                                     str,sizeof(str) / sizeof(ckcore::tchar));
+        identifier = str;
 
-        // Send SCSI command.
-        unsigned long returned = 0;
-        if (!DeviceIoControl(handle,IOCTL_SCSI_PASS_THROUGH_DIRECT,
-                             &sptwb,sizeof(SCSI_PASS_THROUGH_DIRECT_WITH_BUFFER),
-                             &sptwb,sizeof(SCSI_PASS_THROUGH_DIRECT_WITH_BUFFER),
-                             &returned,FALSE))
-        {
-            if (!silent_)
-            {
-                ckcore::log::print_line(ckT("[sptidriver]: DeviceIoControl failed (%d; 0x%p, %d, 0x%p, %d, %d)."),
-                                        GetLastError(),cdb,cdb_len,data,data_len,static_cast<int>(mode));
-            }
+        // Trim trailing spaces the same way as the inquiry data parser.
+        while (!vendor.empty() && vendor[vendor.size() - 1] == ' ')
+            vendor.erase(vendor.size() - 1);
+        while (!identifier.empty() && identifier[identifier.size() - 1] == ' ')
+            identifier.erase(identifier.size() - 1);
+
+        return true;
+    }
 
+    /**
+     * Obtains the transfer limits of the host adapter a device is attached
+     * to. The storage adapter descriptor is tried first since it's also
+     * available for devices not handled by a SCSI port driver, such as USB
+     * devices.
+     * @param [in] addr The device address.
+     * @param [out] max_transfer The maximum number of bytes that can be
+     *                           transferred in a single command.
+     * @param [out] alignment_mask The required data buffer alignment mask.
+     * @return If the limits are known true is returned, if not false is
+     *         returned.
+     */
+    bool SptiDriver::transfer_limits(const ScsiDevice::Address &addr,
+                                     ckcore::tuint32 &max_transfer,
+                                     ckcore::tuint32 &alignment_mask)
+    {
+        ScopedHandle scoped_handle(*this,addr);
+        HANDLE handle = scoped_handle.handle();
+        if (handle == INVALID_HANDLE_VALUE)
             return false;
-        }
 
-        // Verify command result.
-        if (sptwb.spt.ScsiStatus != ScsiDevice::ckSCSISTAT_GOOD)
-        {
-            if (!silent_)
-            {
-                ckcore::log::print_line(ckT("[sptidriver]: scsi command failed (0x%.2x)."),
-                                        sptwb.spt.ScsiStatus);
+        unsigned long max_len = 0,max_pages = 0,align = 0;
 
-                // Dump CDB.
-                ckcore::log::print(ckT("[sptidriver]: > cdb: "));
-                for (unsigned int i = 0; i < cdb_len; i++)
-                {
-                    if (i == 0)
-                        ckcore::log::print(ckT("0x%.2x"),cdb[i]);
-                    else
-                        ckcore::log::print(ckT(",0x%.2x"),cdb[i]);
-                }
+        STORAGE_PROPERTY_QUERY query;
+        memset(&query,0,sizeof(STORAGE_PROPERTY_QUERY));
+        query.PropertyId = StorageAdapterProperty;
+        query.QueryType = PropertyStandardQuery;
 
-                ckcore::log::print_line(ckT(""));
+        STORAGE_ADAPTER_DESCRIPTOR adapter_desc;
+        memset(&adapter_desc,0,sizeof(STORAGE_ADAPTER_DESCRIPTOR));
 
-                // Dump sense information.
-                ckcore::log::print_line(ckT("[sptidriver]: > sense key: 0x%x"),sptwb.ucSenseBuf[2] & 0xf);
-                ckcore::log::print_line(ckT("[sptidriver]: > asc: 0x%.2x"),sptwb.ucSenseBuf[12]);
-                ckcore::log::print_line(ckT("[sptidriver]: > ascq: 0x%.2x"),sptwb.ucSenseBuf[13]);
-            }
+        IO_SCSI_CAPABILITIES caps;
+        memset(&caps,0,sizeof(IO_SCSI_CAPABILITIES));
 
+        unsigned long returned = 0;
+        if (DeviceIoControl(handle,IOCTL_STORAGE_QUERY_PROPERTY,
+                            &query,sizeof(STORAGE_PROPERTY_QUERY),
+                            &adapter_desc,sizeof(STORAGE_ADAPTER_DESCRIPTOR),
+                            &returned,FALSE))
+        {
+            max_len = adapter_desc.MaximumTransferLength;
+            max_pages = adapter_desc.MaximumPhysicalPages;
+            align = adapter_desc.AlignmentMask;
+        }
+        else if (DeviceIoControl(handle,IOCTL_SCSI_GET_CAPABILITIES,NULL,0,
+                                 &caps,sizeof(IO_SCSI_CAPABILITIES),
+                                 &returned,FALSE))
+        {
+            max_len = caps.MaximumTransferLength;
+            max_pages = caps.MaximumPhysicalPages;
+            align = caps.AlignmentMask;
+        }
+        else
+        {
             return false;
         }
 
-        return true;
+        // A buffer which is not page aligned spans one more physical page
+        // than its size suggests.
+        if (max_pages > 1 && (max_pages - 1) * 4096 < max_len)
+            max_len = (max_pages - 1) * 4096;
+
+        max_transfer = max_len;
+        alignment_mask = align;
+        return max_len != 0;
     }
 
     /**
-     * Transports data from or to the device using SCSI commands. This is
-     * similar to the transport function with the exception that the sense
+     * Transports data from or to the device using SCSI commands. The sense
      * and result is written back to the caller.
      * @param [in] device The device to transport the command to.
      * @param [in] cdb Buffer to command descriptor block.
@@ -438,6 +522,9 @@ namespace ckmmc
      * @param [in] mode Specifies the transport mode.
      * @param [out] sense Pointer to sense buffer.
      * @param [out] result Contains the transport result.
+     * @param [out] transferred The number of bytes actually transferred.
+     * @param [in] timeout The command timeout in seconds. If negative the
+     *                     default timeout will be used.
      * @return If the transport was successfully carried through true is
      *         returned, if not false is returned.
      */
@@ -445,10 +532,12 @@ namespace ckmmc
                                           unsigned char *cdb,unsigned char cdb_len,
                                           unsigned char *data,unsigned long data_len,
                                           ScsiDevice::TransportMode mode,
-                                          unsigned char *sense,unsigned char &result)
+                                          unsigned char *sense,unsigned char &result,
+                                          unsigned long &transferred,long timeout)
     {
         // Try to obtain the device handle.
-        HANDLE handle = get_handle(device);
+        ScopedHandle scoped_handle(*this,device.address());
+        HANDLE handle = scoped_handle.handle();
         if (handle == INVALID_HANDLE_VALUE)
         {
             if (!silent_)
@@ -477,7 +566,7 @@ namespace ckmmc
         sptwb.spt.DataTransferLength = data_len;
         sptwb.spt.DataBuffer = data;
         sptwb.spt.CdbLength = cdb_len;
-        sptwb.spt.TimeOutValue = timeout_;
+        sptwb.spt.TimeOutValue = timeout < 0 ? timeout_ : timeout;
         memcpy(sptwb.spt.Cdb,cdb,cdb_len);
     
         switch (mode)
@@ -518,6 +607,83 @@ namespace ckmmc
         memcpy(sense,sptwb.ucSenseBuf,24);
         result = sptwb.spt.ScsiStatus;
 
+        // The port driver updates the transfer length with the number of bytes
+        // actually transferred.
+        transferred = sptwb.spt.DataTransferLength;
+
         return true;
     }
+
+    /**
+     * Resets a device or the bus it is attached to.
+     * @param [in] device The device to reset.
+     * @param [in] level The reset level.
+     * @return If successful true is returned, if not false is returned.
+     */
+    bool SptiDriver::reset(ScsiDevice &device,ScsiDevice::ResetLevel level)
+    {
+        if (device.address().device_.empty())
+            return false;
+
+        // The device handle is retired, a new handle will be opened for the
+        // next command. Requests still pending on the old handle from other
+        // threads are cancelled and the handle is closed when the last of
+        // them has returned.
+        if (level == ScsiDevice::ckRESET_ABORT)
+        {
+            ScopedLock lock(handles_mutex_);
+
+            std::map<ckcore::tchar,HANDLE>::iterator it =
+                handles_.find(device.address().device_[0]);
+            if (it == handles_.end())
+                return true;
+
+            HANDLE handle = it->second;
+            handles_.erase(it);
+
+            if (handle_users_[handle] == 0)
+            {
+                CloseHandle(handle);
+                handle_users_.erase(handle);
+            }
+            else
+            {
+                tCancelIoEx cancel_io_ex = reinterpret_cast<tCancelIoEx>(
+                    GetProcAddress(GetModuleHandle(ckT("kernel32.dll")),"CancelIoEx"));
+                if (cancel_io_ex != NULL)
+                    cancel_io_ex(handle,NULL);
+            }
+
+            return true;
+        }
+
+        ScopedHandle scoped_handle(*this,device.address());
+        HANDLE handle = scoped_handle.handle();
+        if (handle == INVALID_HANDLE_VALUE)
+            return false;
+
+        unsigned long returned = 0;
+        if (level == ScsiDevice::ckRESET_DEVICE)
+        {
+            return DeviceIoControl(handle,IOCTL_STORAGE_RESET_DEVICE,NULL,0,
+                                   NULL,0,&returned,FALSE) != 0;
+        }
+
+        // The bus reset request needs the path identifier of the device.
+        SCSI_ADDRESS scsi_addr;
+        memset(&scsi_addr,0,sizeof(SCSI_ADDRESS));
+        if (!DeviceIoControl(handle,IOCTL_SCSI_GET_ADDRESS,NULL,0,
+                             &scsi_addr,sizeof(SCSI_ADDRESS),&returned,FALSE))
+        {
+            return false;
+        }
+
+        STORAGE_BUS_RESET_REQUEST reset_req;
+        reset_req.PathId = scsi_addr.PathId;
+
+        return DeviceIoControl(handle,IOCTL_STORAGE_RESET_BUS,
+                               &reset_req,sizeof(STORAGE_BUS_RESET_REQUEST),
+                               &reset_req,sizeof(STORAGE_BUS_RESET_REQUEST),
+                               &returned,FALSE) != 0;
+    }
 };
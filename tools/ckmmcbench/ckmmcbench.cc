@@ -0,0 +1,563 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef _WINDOWS
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ckcore/string.hh>
+#include <ckcore/types.hh>
+#include "ckmmc/buffer.hh"
+#include "ckmmc/devicemanager.hh"
+#include "ckmmc/mmc.hh"
+#include "ckmmc/timer.hh"
+
+/**
+ * Defines benchmark constants.
+ */
+enum
+{
+    ckBENCH_DEFAULT_SIZE = 256,         // Megabytes read per data path.
+    ckBENCH_BUFFER_SIZE = 8 * 1024 * 1024,
+    ckBENCH_CURVE_POINTS = 10,          // Positions of the sequential curve.
+    ckBENCH_CURVE_SIZE = 16,            // Megabytes read at each position.
+    ckBENCH_RANDOM_READS = 200,         // Reads per random test.
+    ckBENCH_STROKE_READS = 20,          // Reads per end in the full stroke test.
+    ckBENCH_STROKE_STEP = 1024,         // Sectors between full stroke reads.
+    ckBENCH_OVERHEAD_COMMANDS = 200,    // Commands per overhead test.
+    ckBENCH_SPIN_DOWN_WAIT = 3000,      // Milliseconds to wait after stopping.
+    ckBENCH_SPIN_UP_TIMEOUT = 120       // Timeout in seconds of commands spinning up the disc.
+};
+
+/**
+ * Finds the device with the specified drive letter.
+ * @param [in] manager The device manager.
+ * @param [in] drive The drive letter.
+ * @return Pointer to the device if found, NULL if not found.
+ */
+static ckmmc::Device *find_device(ckmmc::DeviceManager &manager,char drive)
+{
+    const std::vector<ckmmc::Device *> &devices = manager.devices();
+
+    std::vector<ckmmc::Device *>::const_iterator it;
+    for (it = devices.begin(); it != devices.end(); it++)
+    {
+        const ckcore::tstring &device_str = (*it)->address().device_;
+        if (!device_str.empty() && toupper(device_str[0]) == toupper(drive))
+            return *it;
+    }
+
+    return NULL;
+}
+
+/**
+ * Returns the next number of a pseudo random sequence. A fixed sequence
+ * makes results comparable between runs.
+ * @param [in,out] state The generator state, must not be zero.
+ * @return The next number.
+ */
+static ckcore::tuint32 next_random(ckcore::tuint32 &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/**
+ * Sleeps for the specified number of milliseconds.
+ * @param [in] ms The number of milliseconds.
+ */
+static void sleep_ms(ckcore::tuint32 ms)
+{
+    ckcore::tuint64 end = ckmmc::Timer::now() + static_cast<ckcore::tuint64>(ms) * 1000;
+    while (ckmmc::Timer::now() < end)
+    {
+#ifdef _WINDOWS
+        Sleep(10);
+#else
+        usleep(10000);
+#endif
+    }
+}
+
+/**
+ * Writes a string value to a JSON file, adding quotes and escaping special
+ * characters.
+ * @param [in] file The output file.
+ * @param [in] str The string.
+ */
+static void json_string(FILE *file,const ckcore::tchar *str)
+{
+    char ansi_str[256];
+    ckcore::string::auto_to_ansi(str,ansi_str,sizeof(ansi_str));
+
+    fputc('"',file);
+    for (const char *c = ansi_str; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            fprintf(file,"\\%c",*c);
+        else if (static_cast<unsigned char>(*c) < 0x20)
+            fprintf(file,"\\u%04x",static_cast<unsigned char>(*c));
+        else
+            fputc(*c,file);
+    }
+    fputc('"',file);
+}
+
+/**
+ * Writes a measured value to a JSON file. Negative values mark skipped or
+ * failed measurements and are written as null.
+ * @param [in] file The output file.
+ * @param [in] format The printf format of the value.
+ * @param [in] value The value.
+ */
+static void json_number(FILE *file,const char *format,double value)
+{
+    if (value < 0.0)
+        fprintf(file,"null");
+    else
+        fprintf(file,format,value);
+}
+
+/**
+ * Reads a range of sectors using the current data path of the device.
+ * @param [in] device The device to read from.
+ * @param [in] lba The first sector.
+ * @param [in] count The number of sectors to read.
+ * @param [in] buffer The read buffer.
+ * @return The throughput in MiB/s, negative if reading failed.
+ */
+static double read_range(ckmmc::Device &device,ckcore::tuint32 lba,
+                         ckcore::tuint32 count,ckmmc::AlignedBuffer &buffer)
+{
+    std::vector<ckmmc::MmcDevice::ReadError> errors;
+    ckcore::tuint32 chunk = buffer.size() / 2048;
+
+    ckmmc::Timer timer;
+    for (ckcore::tuint32 pos = 0; pos < count; pos += chunk)
+    {
+        ckcore::tuint32 num = count - pos < chunk ? count - pos : chunk;
+        if (!device.read_sectors(lba + pos,num,buffer.data(),buffer.size(),errors))
+        {
+            fprintf(stderr,"read error at sector %u.\n",lba + pos);
+            return -1.0;
+        }
+    }
+
+    double seconds = static_cast<double>(timer.elapsed()) / 1000000.0;
+    double mib = static_cast<double>(count) * 2048.0 / (1024.0 * 1024.0);
+
+    return seconds > 0.0 ? mib / seconds : 0.0;
+}
+
+/**
+ * Starts the disc and reads the first sector. The commands may have to wait
+ * for the disc to spin up, they are therefore given a long timeout instead
+ * of the timeout learned from earlier commands.
+ * @param [in] device The device.
+ * @param [in] buffer The read buffer.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool start_disc(ckmmc::Device &device,ckmmc::AlignedBuffer &buffer)
+{
+    long timeout = device.timeout();
+    device.timeout(ckBENCH_SPIN_UP_TIMEOUT);
+
+    unsigned char cdb[16];
+    memset(cdb,0,sizeof(cdb));
+    cdb[0] = ckmmc::MmcDevice::ckCMD_START_STOP_UNIT;
+    cdb[4] = 0x01;                      // Start the disc.
+
+    std::vector<ckmmc::MmcDevice::ReadError> errors;
+    bool res = device.transport(cdb,6,NULL,0,ckmmc::ScsiDevice::ckTM_UNSPECIFIED) &&
+               device.read_sectors(0,1,buffer.data(),buffer.size(),errors);
+
+    device.timeout(timeout);
+    return res;
+}
+
+/**
+ * Measures the time needed to spin up the disc from a stopped state until
+ * the first sector has been read.
+ * @param [in] device The device.
+ * @param [in] buffer The read buffer.
+ * @return The spin-up time in milliseconds, negative if the test failed.
+ */
+static double bench_spin_up(ckmmc::Device &device,ckmmc::AlignedBuffer &buffer)
+{
+    unsigned char cdb[16];
+    memset(cdb,0,sizeof(cdb));
+    cdb[0] = ckmmc::MmcDevice::ckCMD_START_STOP_UNIT;
+    cdb[4] = 0x00;                      // Stop the disc.
+
+    if (!device.transport(cdb,6,NULL,0,ckmmc::ScsiDevice::ckTM_UNSPECIFIED))
+        return -1.0;
+
+    sleep_ms(ckBENCH_SPIN_DOWN_WAIT);
+
+    ckmmc::Timer timer;
+    if (!start_disc(device,buffer))
+        return -1.0;
+
+    return static_cast<double>(timer.elapsed()) / 1000.0;
+}
+
+/**
+ * Measures the sequential read throughput at evenly distributed positions
+ * across the disc. On CAV drives the throughput increases towards the
+ * outer edge of the disc.
+ * @param [in] file The output file.
+ * @param [in] device The device.
+ * @param [in] num_sectors The number of sectors on the disc.
+ * @param [in] buffer The read buffer.
+ */
+static void bench_sequential(FILE *file,ckmmc::Device &device,
+                             ckcore::tuint32 num_sectors,ckmmc::AlignedBuffer &buffer)
+{
+    ckcore::tuint32 sample = ckBENCH_CURVE_SIZE * (1024 * 1024 / 2048);
+    if (sample > num_sectors)
+        sample = num_sectors;
+
+    fprintf(file,"  \"sequential\": [\n");
+
+    for (unsigned int i = 0; i < ckBENCH_CURVE_POINTS; i++)
+    {
+        ckcore::tuint32 lba = static_cast<ckcore::tuint32>(
+            static_cast<ckcore::tuint64>(num_sectors - sample) * i / (ckBENCH_CURVE_POINTS - 1));
+
+        // Position the head before measuring.
+        std::vector<ckmmc::MmcDevice::ReadError> errors;
+        device.read_sectors(lba,1,buffer.data(),buffer.size(),errors);
+
+        double mib_s = read_range(device,lba + 1,sample - 1,buffer);
+        fprintf(stderr,"sequential at %3u%%: %7.2f MiB/s\n",i * 100 / (ckBENCH_CURVE_POINTS - 1),mib_s);
+
+        fprintf(file,"    { \"lba\": %u, \"position\": %.3f, \"mib_s\": ",lba,
+                static_cast<double>(lba) / num_sectors);
+        json_number(file,"%.2f",mib_s);
+        fprintf(file," }%s\n",i + 1 < ckBENCH_CURVE_POINTS ? "," : "");
+    }
+
+    fprintf(file,"  ],\n");
+}
+
+/**
+ * Measures random reads of a fixed size across the disc. The result is
+ * written as null if the disc is too small for the test or the test failed.
+ * @param [in] file The output file.
+ * @param [in] device The device.
+ * @param [in] name The name of the test.
+ * @param [in] sectors The number of sectors per read.
+ * @param [in] num_sectors The number of sectors on the disc.
+ * @param [in] buffer The read buffer.
+ * @param [out] avg_ms The average latency in milliseconds, negative if the
+ *                     test was skipped or failed.
+ * @return If the test succeeded or was skipped true is returned, if the
+ *         test failed false is returned.
+ */
+static bool bench_random(FILE *file,ckmmc::Device &device,const char *name,
+                         ckcore::tuint32 sectors,ckcore::tuint32 num_sectors,
+                         ckmmc::AlignedBuffer &buffer,double &avg_ms)
+{
+    avg_ms = -1.0;
+    if (num_sectors <= sectors)
+    {
+        fprintf(stderr,"%s: skipped, the disc is too small.\n",name);
+        fprintf(file,"  \"%s\": null,\n",name);
+        return true;
+    }
+
+    std::vector<ckmmc::MmcDevice::ReadError> errors;
+    ckcore::tuint32 state = 0x2545f491;
+    ckcore::tuint64 max_latency = 0;
+
+    ckmmc::Timer timer;
+    for (unsigned int i = 0; i < ckBENCH_RANDOM_READS; i++)
+    {
+        ckcore::tuint32 lba = next_random(state) % (num_sectors - sectors);
+
+        ckcore::tuint64 start = ckmmc::Timer::now();
+        if (!device.read_sectors(lba,sectors,buffer.data(),buffer.size(),errors))
+        {
+            fprintf(stderr,"%s: read error at sector %u.\n",name,lba);
+            fprintf(file,"  \"%s\": null,\n",name);
+            return false;
+        }
+
+        ckcore::tuint64 latency = ckmmc::Timer::now() - start;
+        if (latency > max_latency)
+            max_latency = latency;
+    }
+
+    double seconds = static_cast<double>(timer.elapsed()) / 1000000.0;
+    double iops = seconds > 0.0 ? ckBENCH_RANDOM_READS / seconds : 0.0;
+    avg_ms = seconds * 1000.0 / ckBENCH_RANDOM_READS;
+
+    fprintf(stderr,"%s: %7.1f IOPS, %7.2f ms average\n",name,iops,avg_ms);
+    fprintf(file,"  \"%s\": { \"iops\": %.1f, \"avg_ms\": %.2f, \"max_ms\": %.2f },\n",
+            name,iops,avg_ms,static_cast<double>(max_latency) / 1000.0);
+
+    return true;
+}
+
+/**
+ * Measures the time of seeks between the start and the end of the disc.
+ * The addresses move a little with every read to avoid hitting the drive
+ * cache.
+ * @param [in] device The device.
+ * @param [in] num_sectors The number of sectors on the disc.
+ * @param [in] buffer The read buffer.
+ * @return The average full stroke seek time in milliseconds, negative if
+ *         the disc is too small for the test or the test failed.
+ */
+static double bench_full_stroke(ckmmc::Device &device,ckcore::tuint32 num_sectors,
+                                ckmmc::AlignedBuffer &buffer)
+{
+    std::vector<ckmmc::MmcDevice::ReadError> errors;
+    if (num_sectors < 2 * ckBENCH_STROKE_READS * ckBENCH_STROKE_STEP)
+        return -1.0;
+
+    // Start at the end of the disc.
+    if (!device.read_sectors(num_sectors - 1,1,buffer.data(),buffer.size(),errors))
+        return -1.0;
+
+    ckmmc::Timer timer;
+    for (ckcore::tuint32 i = 0; i < ckBENCH_STROKE_READS; i++)
+    {
+        ckcore::tuint32 offset = i * ckBENCH_STROKE_STEP;
+        if (!device.read_sectors(offset,1,buffer.data(),buffer.size(),errors) ||
+            !device.read_sectors(num_sectors - 2 - offset,1,buffer.data(),buffer.size(),errors))
+        {
+            return -1.0;
+        }
+    }
+
+    return static_cast<double>(timer.elapsed()) / 1000.0 / (2 * ckBENCH_STROKE_READS);
+}
+
+/**
+ * Measures the average time of a command without data transfer.
+ * @param [in] device The device.
+ * @return The average command time in microseconds, negative if the test
+ *         failed.
+ */
+static double bench_command_overhead(ckmmc::Device &device)
+{
+    unsigned char cdb[16];
+    memset(cdb,0,sizeof(cdb));
+    cdb[0] = ckmmc::MmcDevice::ckCMD_TEST_UNIT_READY;
+
+    ckmmc::Timer timer;
+    for (unsigned int i = 0; i < ckBENCH_OVERHEAD_COMMANDS; i++)
+    {
+        if (!device.transport(cdb,6,NULL,0,ckmmc::ScsiDevice::ckTM_UNSPECIFIED))
+            return -1.0;
+    }
+
+    return static_cast<double>(timer.elapsed()) / ckBENCH_OVERHEAD_COMMANDS;
+}
+
+/**
+ * Measures the average time of reading a single cached sector using the
+ * current data path of the device.
+ * @param [in] device The device.
+ * @param [in] buffer The read buffer.
+ * @return The average read time in microseconds, negative if the test
+ *         failed.
+ */
+static double bench_read_overhead(ckmmc::Device &device,ckmmc::AlignedBuffer &buffer)
+{
+    std::vector<ckmmc::MmcDevice::ReadError> errors;
+
+    // The first read fills the drive cache.
+    if (!device.read_sectors(0,1,buffer.data(),buffer.size(),errors))
+        return -1.0;
+
+    ckmmc::Timer timer;
+    for (unsigned int i = 0; i < ckBENCH_OVERHEAD_COMMANDS; i++)
+    {
+        if (!device.read_sectors(0,1,buffer.data(),buffer.size(),errors))
+            return -1.0;
+    }
+
+    return static_cast<double>(timer.elapsed()) / ckBENCH_OVERHEAD_COMMANDS;
+}
+
+/**
+ * Measures the sequential throughput and single sector overhead of the
+ * available data paths.
+ * @param [in] file The output file.
+ * @param [in] device The device.
+ * @param [in] count The number of sectors to read sequentially.
+ * @param [in] buffer The read buffer.
+ */
+static void bench_data_paths(FILE *file,ckmmc::Device &device,ckcore::tuint32 count,
+                             ckmmc::AlignedBuffer &buffer)
+{
+    double tur_us = bench_command_overhead(device);
+    double scsi_us = bench_read_overhead(device,buffer);
+    double scsi_mib_s = read_range(device,0,count,buffer);
+
+    fprintf(stderr,"scsi:  %7.2f MiB/s, %7.1f us per read, %7.1f us per command\n",
+            scsi_mib_s,scsi_us,tur_us);
+
+    fprintf(file,"  \"data_paths\": {\n");
+    fprintf(file,"    \"scsi\": { \"mib_s\": ");
+    json_number(file,"%.2f",scsi_mib_s);
+    fprintf(file,", \"read_us\": ");
+    json_number(file,"%.1f",scsi_us);
+    fprintf(file,", \"command_us\": ");
+    json_number(file,"%.1f",tur_us);
+    fprintf(file," }");
+
+    if (device.data_path(ckmmc::MmcDevice::ckDP_BLOCK))
+    {
+        double block_us = bench_read_overhead(device,buffer);
+        double block_mib_s = read_range(device,0,count,buffer);
+
+        device.data_path(ckmmc::MmcDevice::ckDP_SCSI);
+
+        fprintf(stderr,"block: %7.2f MiB/s, %7.1f us per read\n",block_mib_s,block_us);
+        fprintf(file,",\n    \"block\": { \"mib_s\": ");
+        json_number(file,"%.2f",block_mib_s);
+        fprintf(file,", \"read_us\": ");
+        json_number(file,"%.1f",block_us);
+        fprintf(file," }");
+    }
+    else
+    {
+        fprintf(stderr,"block: not available.\n");
+    }
+
+    fprintf(file,"\n  },\n");
+}
+
+int main(int argc,char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("usage: ckmmcbench <drive letter> [-o <file>] [-s <megabytes>] [-nospin]\n");
+        return 1;
+    }
+
+    const char *out_path = NULL;
+    ckcore::tuint32 size = ckBENCH_DEFAULT_SIZE;
+    bool spin_up = true;
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (!strcmp(argv[i],"-o") && i + 1 < argc)
+            out_path = argv[++i];
+        else if (!strcmp(argv[i],"-s") && i + 1 < argc)
+            size = static_cast<ckcore::tuint32>(atoi(argv[++i]));
+        else if (!strcmp(argv[i],"-nospin"))
+            spin_up = false;
+    }
+
+    ckmmc::DeviceManager manager;
+    if (!manager.scan(NULL))
+    {
+        fprintf(stderr,"error: unable to scan for devices.\n");
+        return 1;
+    }
+
+    ckmmc::Device *device = find_device(manager,argv[1][0]);
+    if (device == NULL)
+    {
+        fprintf(stderr,"error: no device found at %c:.\n",argv[1][0]);
+        return 1;
+    }
+
+    ckcore::tuint32 last_lba = 0,block_len = 0;
+    if (!device->read_capacity(last_lba,block_len) || block_len != 2048)
+    {
+        fprintf(stderr,"error: a data disc must be inserted.\n");
+        return 1;
+    }
+
+    ckcore::tuint32 num_sectors = last_lba + 1;
+    ckcore::tuint32 count = size * (1024 * 1024 / 2048);
+    if (count > num_sectors)
+        count = num_sectors;
+
+    ckmmc::AlignedBuffer buffer(ckBENCH_BUFFER_SIZE);
+    if (buffer.data() == NULL)
+    {
+        fprintf(stderr,"error: unable to allocate read buffer.\n");
+        return 1;
+    }
+
+    FILE *file = stdout;
+    if (out_path != NULL && (file = fopen(out_path,"w")) == NULL)
+    {
+        fprintf(stderr,"error: unable to create %s.\n",out_path);
+        return 1;
+    }
+
+    fprintf(file,"{\n");
+    fprintf(file,"  \"drive\": { \"vendor\": ");
+    json_string(file,device->vendor());
+    fprintf(file,", \"identifier\": ");
+    json_string(file,device->identifier());
+    fprintf(file,", \"revision\": ");
+    json_string(file,device->revision());
+    fprintf(file,", \"transfer_len\": %u, \"sectors\": %u },\n",device->transfer_len(),num_sectors);
+
+    if (spin_up)
+    {
+        double spin_up_ms = bench_spin_up(*device,buffer);
+        fprintf(stderr,"spin-up: %.0f ms\n",spin_up_ms);
+        fprintf(file,"  \"spin_up_ms\": ");
+        json_number(file,"%.1f",spin_up_ms);
+        fprintf(file,",\n");
+    }
+    else
+    {
+        // Spin up the disc before measuring.
+        start_disc(*device,buffer);
+    }
+
+    bench_data_paths(file,*device,count,buffer);
+    bench_sequential(file,*device,num_sectors,buffer);
+
+    int res = 0;
+    double seek_ms = -1.0,avg_ms = -1.0;
+    if (!bench_random(file,*device,"random_2k",1,num_sectors,buffer,seek_ms))
+        res = 1;
+    if (!bench_random(file,*device,"random_64k",32,num_sectors,buffer,avg_ms))
+        res = 1;
+
+    double stroke_ms = bench_full_stroke(*device,num_sectors,buffer);
+    fprintf(stderr,"seek: %.2f ms average, %.2f ms full stroke\n",seek_ms,stroke_ms);
+    fprintf(file,"  \"seek\": { \"avg_ms\": ");
+    json_number(file,"%.2f",seek_ms);
+    fprintf(file,", \"full_stroke_ms\": ");
+    json_number(file,"%.2f",stroke_ms);
+    fprintf(file," }\n");
+    fprintf(file,"}\n");
+
+    if (file != stdout)
+        fclose(file);
+
+    return res;
+}
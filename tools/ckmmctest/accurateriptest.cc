@@ -0,0 +1,349 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <vector>
+#include "ckmmc/accuraterip.hh"
+#include "ckmmc/hash.hh"
+#include "ckmmctest.hh"
+
+using ckmmc::AccurateRip;
+
+/**
+ * Defines AccurateRip test constants.
+ */
+enum
+{
+    ckTEST_AR_LEADOUT = 150,
+    ckTEST_AR_FRAME_SIZE = 2352
+};
+
+/**
+ * Builds the test disc layout, one short track between three longer ones.
+ * @param [out] lbas The start addresses of the tracks.
+ */
+static void test_layout(std::vector<ckcore::tuint32> &lbas)
+{
+    lbas.clear();
+    lbas.push_back(0);
+    lbas.push_back(40);
+    lbas.push_back(43);
+    lbas.push_back(100);
+}
+
+/**
+ * Fills a buffer with pseudo-random audio, the same on all platforms.
+ * @param [out] audio The audio.
+ */
+static void test_audio(std::vector<unsigned char> &audio)
+{
+    audio.resize(ckTEST_AR_LEADOUT * ckTEST_AR_FRAME_SIZE);
+
+    ckcore::tuint32 seed = 1;
+    for (size_t i = 0; i < audio.size(); i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        audio[i] = static_cast<unsigned char>(seed >> 24);
+    }
+}
+
+/**
+ * Returns a sample of the test audio, samples outside the disc are silent.
+ * @param [in] audio The audio.
+ * @param [in] pos The disc position of the sample.
+ * @return The sample.
+ */
+static ckcore::tuint32 test_sample(const std::vector<unsigned char> &audio,ckcore::tint64 pos)
+{
+    if (pos < 0 || pos * 4 >= static_cast<ckcore::tint64>(audio.size()))
+        return 0;
+
+    const unsigned char *data = &audio[static_cast<size_t>(pos * 4)];
+    return static_cast<ckcore::tuint32>(data[0]) |
+           (static_cast<ckcore::tuint32>(data[1]) << 8) |
+           (static_cast<ckcore::tuint32>(data[2]) << 16) |
+           (static_cast<ckcore::tuint32>(data[3]) << 24);
+}
+
+/**
+ * Calculates the v1 and v2 checksums of a track one sample at a time, as
+ * described by the AccurateRip database.
+ * @param [in] audio The audio.
+ * @param [in] lbas The start addresses of the tracks.
+ * @param [in] track The index of the track.
+ * @param [in] offset The offset in samples.
+ * @param [out] v1 The v1 checksum.
+ * @param [out] v2 The v2 checksum.
+ */
+static void test_reference(const std::vector<unsigned char> &audio,
+                           const std::vector<ckcore::tuint32> &lbas,unsigned int track,
+                           int offset,ckcore::tuint32 &v1,ckcore::tuint32 &v2)
+{
+    ckcore::tint64 start = static_cast<ckcore::tint64>(lbas[track]) * 588;
+    ckcore::tint64 end = static_cast<ckcore::tint64>(track + 1 < lbas.size() ?
+                                                     lbas[track + 1] : ckTEST_AR_LEADOUT) * 588;
+
+    // Skip the first and last five frames of the disc.
+    ckcore::tint64 first = track == 0 ? start + 5 * 588 - 1 : start;
+    ckcore::tint64 last = track + 1 == lbas.size() ? end - 5 * 588 - 1 : end - 1;
+
+    v1 = 0;
+    v2 = 0;
+    for (ckcore::tint64 pos = first; pos <= last; pos++)
+    {
+        ckcore::tuint64 product = static_cast<ckcore::tuint64>(test_sample(audio,pos + offset)) *
+                                  static_cast<ckcore::tuint32>(pos - start + 1);
+        v1 += static_cast<ckcore::tuint32>(product);
+        v2 += static_cast<ckcore::tuint32>(product) + static_cast<ckcore::tuint32>(product >> 32);
+    }
+}
+
+/**
+ * Calculates the IEEE 802.3 CRC-32 checksum one bit at a time.
+ * @param [in] data The data.
+ * @param [in] len The size of the data in bytes.
+ * @return The checksum.
+ */
+static ckcore::tuint32 test_crc32(const unsigned char *data,size_t len)
+{
+    ckcore::tuint32 crc = 0xffffffff;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        for (int j = 0; j < 8; j++)
+            crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+    }
+
+    return crc ^ 0xffffffff;
+}
+
+/**
+ * Appends a little endian 32-bit integer to a buffer.
+ * @param [in,out] data The buffer.
+ * @param [in] val The integer value.
+ */
+static void append_le32(std::vector<unsigned char> &data,ckcore::tuint32 val)
+{
+    for (int i = 0; i < 4; i++)
+        data.push_back(static_cast<unsigned char>(val >> (i * 8)));
+}
+
+/**
+ * Tests the disc identifiers against hand-computed values.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool test_accuraterip_ids()
+{
+    bool res = true;
+
+    std::vector<ckcore::tuint32> lbas;
+    lbas.push_back(0);
+    lbas.push_back(15000);
+    lbas.push_back(30000);
+
+    AccurateRip ar(lbas,45000);
+    CK_TEST_CHECK(ar.disc_id1() == 90000);
+    CK_TEST_CHECK(ar.disc_id2() == 45000 * 4 + 1 + 15000 * 2 + 30000 * 3);
+    CK_TEST_CHECK(ar.cddb_id() == 0x0c025803);
+    CK_TEST_CHECK(ar.dbar_name() == ckT("dBAR-003-00015f90-000493e1-0c025803.bin"));
+
+    // The CRC-32 check value.
+    ckmmc::Crc32 crc;
+    crc.update(reinterpret_cast<const unsigned char *>("123456789"),9);
+    CK_TEST_CHECK(crc.checksum() == 0xcbf43926);
+
+    return res;
+}
+
+/**
+ * Tests the checksums of all tracks against the reference for a range of
+ * offsets, with the audio delivered in chunks of varying size.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool test_accuraterip_checksums()
+{
+    static const int offsets[] = { 0,1,-1,2,-30,667,1000,-1500,2939,-2939 };
+
+    bool res = true;
+
+    std::vector<ckcore::tuint32> lbas;
+    test_layout(lbas);
+
+    std::vector<unsigned char> audio;
+    test_audio(audio);
+
+    AccurateRip ar(lbas,ckTEST_AR_LEADOUT);
+    ar.add_offset(667);
+    ar.add_offset(-30);
+    ar.add_offset(5000);                    // Outside the offset range.
+
+    ckcore::tuint32 crc = 0;
+    CK_TEST_CHECK(!ar.complete());
+    CK_TEST_CHECK(!ar.v1(0,0,crc));
+
+    // Out of order audio is ignored.
+    ar.audio(1,&audio[0],1);
+
+    ckcore::tuint32 frame = 0,step = 1;
+    while (frame < ckTEST_AR_LEADOUT)
+    {
+        ckcore::tuint32 count = frame + step > ckTEST_AR_LEADOUT ? ckTEST_AR_LEADOUT - frame : step;
+        ar.audio(frame,&audio[frame * ckTEST_AR_FRAME_SIZE],count);
+
+        frame += count;
+        step = step % 17 + 3;
+    }
+
+    CK_TEST_CHECK(ar.complete());
+
+    for (unsigned int track = 0; track < lbas.size(); track++)
+    {
+        for (size_t i = 0; i < sizeof(offsets) / sizeof(int); i++)
+        {
+            int offset = offsets[i];
+
+            ckcore::tuint32 ref_v1 = 0,ref_v2 = 0;
+            test_reference(audio,lbas,track,offset,ref_v1,ref_v2);
+
+            CK_TEST_CHECK(ar.v1(track,offset,crc) && crc == ref_v1);
+            if (offset == 0 || offset == 667 || offset == -30)
+                CK_TEST_CHECK(ar.v2(track,offset,crc) && crc == ref_v2);
+            else
+                CK_TEST_CHECK(!ar.v2(track,offset,crc));
+        }
+    }
+
+    CK_TEST_CHECK(!ar.v1(0,2940,crc));
+    CK_TEST_CHECK(!ar.v1(4,0,crc));
+
+    // The CUETools database CRC skips the first and last ten frames.
+    CK_TEST_CHECK(ar.ctdb_crc(0,crc));
+    CK_TEST_CHECK(crc == test_crc32(&audio[10 * ckTEST_AR_FRAME_SIZE],
+                                    (ckTEST_AR_LEADOUT - 20) * ckTEST_AR_FRAME_SIZE));
+    CK_TEST_CHECK(ar.ctdb_crc(-30,crc));
+    CK_TEST_CHECK(crc == test_crc32(&audio[10 * ckTEST_AR_FRAME_SIZE - 30 * 4],
+                                    (ckTEST_AR_LEADOUT - 20) * ckTEST_AR_FRAME_SIZE));
+    CK_TEST_CHECK(!ar.ctdb_crc(1,crc));
+
+    // Known answers guarding the reference itself.
+    CK_TEST_CHECK(ar.v1(0,0,crc) && crc == 0x44d2d042);
+    CK_TEST_CHECK(ar.v2(0,0,crc) && crc == 0x4cf56098);
+    CK_TEST_CHECK(ar.v1(3,0,crc) && crc == 0x1eb6f31a);
+    CK_TEST_CHECK(ar.v2(3,0,crc) && crc == 0x2922da6b);
+
+    // Delivering everything at once gives the same checksums.
+    AccurateRip ar_once(lbas,ckTEST_AR_LEADOUT);
+    ar_once.update(&audio[0],ckTEST_AR_LEADOUT);
+    CK_TEST_CHECK(ar_once.complete());
+
+    for (unsigned int track = 0; track < lbas.size(); track++)
+    {
+        ckcore::tuint32 crc_once = 0;
+        CK_TEST_CHECK(ar.v1(track,-1,crc) && ar_once.v1(track,-1,crc_once) && crc == crc_once);
+        CK_TEST_CHECK(ar.v2(track,0,crc) && ar_once.v2(track,0,crc_once) && crc == crc_once);
+    }
+
+    return res;
+}
+
+/**
+ * Tests loading a database file and matching the checksums.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool test_accuraterip_verify()
+{
+    bool res = true;
+
+    std::vector<ckcore::tuint32> lbas;
+    test_layout(lbas);
+
+    std::vector<unsigned char> audio;
+    test_audio(audio);
+
+    AccurateRip ar(lbas,ckTEST_AR_LEADOUT);
+    ar.update(&audio[0],ckTEST_AR_LEADOUT);
+
+    ckcore::tuint32 crc = 0;
+    std::vector<unsigned char> db;
+
+    // A response for another disc.
+    db.push_back(4);
+    append_le32(db,ar.disc_id1() + 1);
+    append_le32(db,ar.disc_id2());
+    append_le32(db,ar.cddb_id());
+    for (unsigned int track = 0; track < lbas.size(); track++)
+    {
+        ar.v1(track,0,crc);
+        db.push_back(99);
+        append_le32(db,crc);
+        append_le32(db,0);
+    }
+
+    // Track 1 matches v1, track 2 matches v2, track 3 matches v1 of another
+    // pressing and track 4 does not match.
+    db.push_back(4);
+    append_le32(db,ar.disc_id1());
+    append_le32(db,ar.disc_id2());
+    append_le32(db,ar.cddb_id());
+    for (unsigned int track = 0; track < lbas.size(); track++)
+    {
+        if (track == 0)
+            ar.v1(track,0,crc);
+        else if (track == 1)
+            ar.v2(track,0,crc);
+        else if (track == 2)
+            ar.v1(track,-1234,crc);
+        else
+            crc = 0x12345678;
+
+        db.push_back(static_cast<unsigned char>(5 + track));
+        append_le32(db,crc);
+        append_le32(db,0);
+    }
+
+    CK_TEST_CHECK(ar.load(&db[0],db.size()));
+
+    AccurateRip::Match match;
+    CK_TEST_CHECK(ar.verify(0,match));
+    CK_TEST_CHECK(match.offset_ == 0 && !match.v2_ && match.confidence_ == 5);
+    CK_TEST_CHECK(ar.verify(1,match));
+    CK_TEST_CHECK(match.offset_ == 0 && match.v2_ && match.confidence_ == 6);
+    CK_TEST_CHECK(ar.verify(2,match));
+    CK_TEST_CHECK(match.offset_ == -1234 && !match.v2_ && match.confidence_ == 7);
+    CK_TEST_CHECK(!ar.verify(3,match));
+    CK_TEST_CHECK(!ar.verify(4,match));
+
+    // Truncated files are rejected.
+    CK_TEST_CHECK(!ar.load(&db[0],db.size() - 1));
+    CK_TEST_CHECK(!ar.load(&db[0],12));
+
+    return res;
+}
+
+/**
+ * Tests the AccurateRip class.
+ * @return If successful true is returned, if not false is returned.
+ */
+bool test_accuraterip()
+{
+    bool res = test_accuraterip_ids();
+    res = test_accuraterip_checksums() && res;
+    res = test_accuraterip_verify() && res;
+
+    return res;
+}
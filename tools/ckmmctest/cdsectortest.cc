@@ -0,0 +1,502 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <vector>
+#include "ckmmc/cdsector.hh"
+#include "ckmmctest.hh"
+
+using ckmmc::CdSector;
+using ckmmc::ScsiModePage05;
+
+/**
+ * Defines CD sector test constants.
+ */
+enum
+{
+    ckTEST_SECTOR_SUBCH_SIZE = 96,
+    ckTEST_SECTOR_ECC_OFFSET = 12,      // First byte covered by the P and Q codes.
+    ckTEST_SECTOR_P_OFFSET = 2076,
+    ckTEST_SECTOR_Q_OFFSET = 2248
+};
+
+/**
+ * Multiplies two elements of GF(2^8) one bit at a time.
+ * @param [in] a The first element.
+ * @param [in] b The second element.
+ * @return The product.
+ */
+static unsigned char test_gf_mul(unsigned int a,unsigned int b)
+{
+    unsigned int product = 0;
+    for (; b > 0; b >>= 1)
+    {
+        if (b & 1)
+            product ^= a;
+
+        a <<= 1;
+        if (a & 0x100)
+            a ^= 0x11d;
+    }
+
+    return static_cast<unsigned char>(product);
+}
+
+/**
+ * Checks that a codeword of the P or Q code has zero syndromes, that is
+ * that the sum of its bytes and the sum of its bytes weighted by
+ * alpha^(length - 1 - i) are both zero.
+ * @param [in] data The bytes covered by the code.
+ * @param [in] parity The two parity bytes.
+ * @param [in] index The position of the first byte.
+ * @param [in] count The number of data bytes.
+ * @param [in] inc The distance between bytes.
+ * @param [in] size The number of bytes covered by the code.
+ * @return If the syndromes are zero true is returned, if not false is
+ *         returned.
+ */
+static bool test_codeword(const unsigned char *data,const unsigned char *parity,
+                          unsigned int index,unsigned int count,unsigned int inc,
+                          unsigned int size)
+{
+    unsigned char s0 = 0,s1 = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        s0 ^= data[index];
+        s1 = test_gf_mul(s1,2) ^ data[index];
+        index = (index + inc) % size;
+    }
+
+    s0 ^= parity[0] ^ parity[1];
+    s1 = test_gf_mul(test_gf_mul(s1,2) ^ parity[0],2) ^ parity[1];
+    return s0 == 0 && s1 == 0;
+}
+
+/**
+ * Checks all P and Q codewords of a sector.
+ * @param [in] sector The sector.
+ * @return If all codewords are valid true is returned, if not false is
+ *         returned.
+ */
+static bool test_ecc(const unsigned char *sector)
+{
+    const unsigned char *data = sector + ckTEST_SECTOR_ECC_OFFSET;
+    const unsigned char *p = sector + ckTEST_SECTOR_P_OFFSET;
+    const unsigned char *q = sector + ckTEST_SECTOR_Q_OFFSET;
+
+    for (unsigned int col = 0; col < 86; col++)
+    {
+        unsigned char parity[2] = { p[col],p[col + 86] };
+        if (!test_codeword(data,parity,col,24,86,24 * 86))
+            return false;
+    }
+
+    for (unsigned int diag = 0; diag < 52; diag++)
+    {
+        unsigned char parity[2] = { q[diag],q[diag + 52] };
+        if (!test_codeword(data,parity,(diag >> 1) * 86 + (diag & 1),43,88,43 * 52))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Calculates the EDC one bit at a time.
+ * @param [in] data The data.
+ * @param [in] len The number of bytes.
+ * @return The EDC.
+ */
+static ckcore::tuint32 test_edc(const unsigned char *data,size_t len)
+{
+    ckcore::tuint32 edc = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        edc ^= data[i];
+        for (int j = 0; j < 8; j++)
+            edc = (edc >> 1) ^ ((edc & 1) ? 0xd8018001 : 0);
+    }
+
+    return edc;
+}
+
+/**
+ * Reads a little endian 32-bit integer.
+ * @param [in] buffer The buffer to read from.
+ * @return The value.
+ */
+static ckcore::tuint32 test_read_le32(const unsigned char *buffer)
+{
+    return static_cast<ckcore::tuint32>(buffer[0]) |
+           (static_cast<ckcore::tuint32>(buffer[1]) << 8) |
+           (static_cast<ckcore::tuint32>(buffer[2]) << 16) |
+           (static_cast<ckcore::tuint32>(buffer[3]) << 24);
+}
+
+/**
+ * Builds the Mode 1 test sector.
+ * @param [out] sector The sector.
+ * @param [in] lba The logical address of the sector.
+ */
+static void test_mode1(unsigned char *sector,ckcore::tuint32 lba)
+{
+    memset(sector,0xcc,CdSector::ckSECTOR_SIZE);
+    for (unsigned int i = 0; i < CdSector::ckMODE1_DATA_SIZE; i++)
+        sector[CdSector::ckDATA_OFFSET + i] = static_cast<unsigned char>(i * 7 + lba);
+
+    CdSector::encode_mode1(sector,lba);
+}
+
+/**
+ * Builds the Mode 2 Form 1 test sector.
+ * @param [out] sector The sector.
+ * @param [in] lba The logical address of the sector.
+ */
+static void test_mode2_form1(unsigned char *sector,ckcore::tuint32 lba)
+{
+    static const unsigned char subheader[8] = { 0x00,0x00,0x08,0x00,0x00,0x00,0x08,0x00 };
+
+    memset(sector,0xcc,CdSector::ckSECTOR_SIZE);
+    memcpy(sector + CdSector::ckSUBHEADER_OFFSET,subheader,sizeof(subheader));
+    for (unsigned int i = 0; i < CdSector::ckMODE2_FORM1_DATA_SIZE; i++)
+        sector[CdSector::ckMODE2_DATA_OFFSET + i] = static_cast<unsigned char>((i + 8) * 13 + 5);
+
+    CdSector::encode_mode2_form1(sector,lba);
+}
+
+/**
+ * Builds the Mode 2 Form 2 test sector.
+ * @param [out] sector The sector.
+ * @param [in] lba The logical address of the sector.
+ */
+static void test_mode2_form2(unsigned char *sector,ckcore::tuint32 lba)
+{
+    static const unsigned char subheader[8] = { 0x01,0x02,0x20,0x00,0x01,0x02,0x20,0x00 };
+
+    memset(sector,0xcc,CdSector::ckSECTOR_SIZE);
+    memcpy(sector + CdSector::ckSUBHEADER_OFFSET,subheader,sizeof(subheader));
+    for (unsigned int i = 0; i < CdSector::ckMODE2_FORM2_DATA_SIZE; i++)
+        sector[CdSector::ckMODE2_DATA_OFFSET + i] = static_cast<unsigned char>(i * 3);
+
+    CdSector::encode_mode2_form2(sector,lba);
+}
+
+/**
+ * Tests the EDC and the scrambler against bitwise references.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool test_cdsector_edc()
+{
+    static const unsigned char scramble_start[16] =
+    {
+        0x01,0x80,0x00,0x60,0x00,0x28,0x00,0x1e,0x80,0x08,0x60,0x06,0xa8,0x02,0xfe,0x81
+    };
+
+    bool res = true;
+
+    // The EDC check value.
+    CK_TEST_CHECK(CdSector::edc(reinterpret_cast<const unsigned char *>("123456789"),9) ==
+                  0x6ec2edc4);
+
+    // Lengths around the eight byte stride.
+    unsigned char data[CdSector::ckSECTOR_SIZE];
+    for (unsigned int i = 0; i < sizeof(data); i++)
+        data[i] = static_cast<unsigned char>(i * 31 + (i >> 8));
+
+    for (size_t len = 0; len < 40; len++)
+        CK_TEST_CHECK(CdSector::edc(data + 3,len) == test_edc(data + 3,len));
+
+    CK_TEST_CHECK(CdSector::edc(data,2064) == test_edc(data,2064));
+
+    // The scrambler sequence of ECMA-130 annex B, compared in full to the
+    // shift register.
+    unsigned char sector[CdSector::ckSECTOR_SIZE];
+    memset(sector,0,sizeof(sector));
+    CdSector::scramble(sector);
+
+    for (unsigned int i = 0; i < 12; i++)
+        CK_TEST_CHECK(sector[i] == 0);
+
+    CK_TEST_CHECK(memcmp(sector + 12,scramble_start,sizeof(scramble_start)) == 0);
+
+    ckcore::tuint32 reg = 1;
+    bool match = true;
+    for (unsigned int i = 12; i < CdSector::ckSECTOR_SIZE; i++)
+    {
+        unsigned char value = 0;
+        for (int j = 0; j < 8; j++)
+        {
+            value |= static_cast<unsigned char>((reg & 1) << j);
+            reg = (reg >> 1) | (((reg ^ (reg >> 1)) & 1) << 14);
+        }
+
+        if (sector[i] != value)
+            match = false;
+    }
+
+    CK_TEST_CHECK(match);
+
+    // Scrambling is its own inverse.
+    memcpy(sector,data,sizeof(sector));
+    CdSector::scramble(sector);
+    CK_TEST_CHECK(memcmp(sector,data,12) == 0);
+    CK_TEST_CHECK(memcmp(sector,data,sizeof(sector)) != 0);
+    CdSector::scramble(sector);
+    CK_TEST_CHECK(memcmp(sector,data,sizeof(sector)) == 0);
+
+    return res;
+}
+
+/**
+ * Tests encoding sectors against known answers and the parity check
+ * equations of the P and Q codes.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool test_cdsector_encode()
+{
+    static const unsigned char sync[12] =
+    {
+        0x00,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0x00
+    };
+    static const unsigned char mode1_header[4] = { 0x00,0x15,0x25,0x01 };
+    static const unsigned char mode1_edc[4] = { 0x73,0x74,0xd0,0x64 };
+    static const unsigned char mode1_p[4] = { 0x46,0xef,0xdf,0xd2 };
+    static const unsigned char mode1_q[4] = { 0x85,0x5d,0xe9,0xf5 };
+    static const unsigned char mode1_q_end[4] = { 0xbe,0x60,0x27,0x0b };
+    static const unsigned char form1_edc[4] = { 0xab,0x2c,0x44,0x93 };
+    static const unsigned char form1_p[4] = { 0xd6,0xf2,0x23,0xed };
+    static const unsigned char form1_q_end[4] = { 0xee,0xed,0xf3,0x74 };
+
+    bool res = true;
+    unsigned char sector[CdSector::ckSECTOR_SIZE];
+
+    // Mode 1, the address is 00:15:25 and the EDC covers the header.
+    test_mode1(sector,1000);
+    CK_TEST_CHECK(memcmp(sector,sync,sizeof(sync)) == 0);
+    CK_TEST_CHECK(memcmp(sector + 12,mode1_header,sizeof(mode1_header)) == 0);
+    CK_TEST_CHECK(memcmp(sector + 2064,mode1_edc,sizeof(mode1_edc)) == 0);
+    CK_TEST_CHECK(test_read_le32(sector + 2064) == test_edc(sector,2064));
+    for (unsigned int i = 2068; i < 2076; i++)
+        CK_TEST_CHECK(sector[i] == 0);
+
+    CK_TEST_CHECK(memcmp(sector + ckTEST_SECTOR_P_OFFSET,mode1_p,sizeof(mode1_p)) == 0);
+    CK_TEST_CHECK(memcmp(sector + ckTEST_SECTOR_Q_OFFSET,mode1_q,sizeof(mode1_q)) == 0);
+    CK_TEST_CHECK(memcmp(sector + 2348,mode1_q_end,sizeof(mode1_q_end)) == 0);
+    CK_TEST_CHECK(test_ecc(sector));
+    CK_TEST_CHECK(CdSector::type(sector) == CdSector::ckTYPE_MODE1);
+    CK_TEST_CHECK(CdSector::check(sector));
+
+    // Mode 2 Form 1, the header is left out of the EDC and the ECC.
+    test_mode2_form1(sector,2000);
+    CK_TEST_CHECK(sector[12] == 0x00 && sector[13] == 0x28 && sector[14] == 0x50 &&
+                  sector[15] == 0x02);
+    CK_TEST_CHECK(memcmp(sector + 2072,form1_edc,sizeof(form1_edc)) == 0);
+    CK_TEST_CHECK(test_read_le32(sector + 2072) == test_edc(sector + 16,2056));
+    CK_TEST_CHECK(memcmp(sector + ckTEST_SECTOR_P_OFFSET,form1_p,sizeof(form1_p)) == 0);
+    CK_TEST_CHECK(memcmp(sector + 2348,form1_q_end,sizeof(form1_q_end)) == 0);
+    CK_TEST_CHECK(!test_ecc(sector));
+
+    unsigned char addr[4];
+    memcpy(addr,sector + 12,4);
+    memset(sector + 12,0,4);
+    CK_TEST_CHECK(test_ecc(sector));
+    memcpy(sector + 12,addr,4);
+
+    CK_TEST_CHECK(CdSector::type(sector) == CdSector::ckTYPE_MODE2_FORM1);
+    CK_TEST_CHECK(CdSector::check(sector));
+
+    // Mode 2 Form 2, the EDC is optional.
+    test_mode2_form2(sector,3000);
+    CK_TEST_CHECK(test_read_le32(sector + 2348) == test_edc(sector + 16,2332));
+    CK_TEST_CHECK(CdSector::type(sector) == CdSector::ckTYPE_MODE2_FORM2);
+    CK_TEST_CHECK(CdSector::check(sector));
+
+    sector[100] ^= 1;
+    CK_TEST_CHECK(!CdSector::check(sector));
+    memset(sector + 2348,0,4);
+    CK_TEST_CHECK(CdSector::check(sector));
+
+    // Unknown sectors.
+    test_mode1(sector,0);
+    sector[15] = 0;
+    CK_TEST_CHECK(CdSector::type(sector) == CdSector::ckTYPE_UNKNOWN);
+    CK_TEST_CHECK(!CdSector::check(sector));
+
+    test_mode1(sector,0);
+    sector[5] = 0;
+    CK_TEST_CHECK(CdSector::type(sector) == CdSector::ckTYPE_UNKNOWN);
+    CK_TEST_CHECK(!CdSector::correct(sector));
+
+    return res;
+}
+
+/**
+ * Tests repairing sectors using the P and Q codes.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool test_cdsector_correct()
+{
+    bool res = true;
+    unsigned char good[CdSector::ckSECTOR_SIZE];
+    unsigned char sector[CdSector::ckSECTOR_SIZE];
+
+    // Intact sectors are left alone.
+    test_mode1(good,1000);
+    memcpy(sector,good,sizeof(sector));
+    CK_TEST_CHECK(CdSector::correct(sector));
+    CK_TEST_CHECK(memcmp(sector,good,sizeof(sector)) == 0);
+
+    // A single error anywhere after the sync pattern, including the header,
+    // the EDC and the parity bytes.
+    bool match = true;
+    for (unsigned int i = 12; i < CdSector::ckSECTOR_SIZE; i += 7)
+    {
+        memcpy(sector,good,sizeof(sector));
+        sector[i] ^= static_cast<unsigned char>(i | 1);
+
+        if (!CdSector::correct(sector) || memcmp(sector,good,sizeof(sector)) != 0)
+            match = false;
+    }
+
+    CK_TEST_CHECK(match);
+
+    // Two errors in a P column are corrected by the Q code.
+    memcpy(sector,good,sizeof(sector));
+    sector[ckTEST_SECTOR_ECC_OFFSET + 5] ^= 0x55;
+    sector[ckTEST_SECTOR_ECC_OFFSET + 5 + 10 * 86] ^= 0xaa;
+    CK_TEST_CHECK(CdSector::correct(sector));
+    CK_TEST_CHECK(memcmp(sector,good,sizeof(sector)) == 0);
+
+    // A burst of errors in a row.
+    memcpy(sector,good,sizeof(sector));
+    for (unsigned int i = 0; i < 40; i++)
+        sector[ckTEST_SECTOR_ECC_OFFSET + 4 * 86 + i] ^= 0xff;
+
+    CK_TEST_CHECK(CdSector::correct(sector));
+    CK_TEST_CHECK(memcmp(sector,good,sizeof(sector)) == 0);
+
+    // Too many errors.
+    memcpy(sector,good,sizeof(sector));
+    for (unsigned int i = 0; i < 200; i++)
+        sector[100 + i * 3] ^= 0xff;
+
+    CK_TEST_CHECK(!CdSector::correct(sector));
+
+    // Mode 2 Form 1, the header is not covered and stays untouched.
+    test_mode2_form1(good,2000);
+    memcpy(sector,good,sizeof(sector));
+    sector[CdSector::ckMODE2_DATA_OFFSET + 1000] ^= 0x10;
+    sector[ckTEST_SECTOR_Q_OFFSET + 3] ^= 0x01;
+    CK_TEST_CHECK(CdSector::correct(sector));
+    CK_TEST_CHECK(memcmp(sector,good,sizeof(sector)) == 0);
+
+    // Mode 2 Form 2, there is nothing to correct with.
+    test_mode2_form2(good,3000);
+    memcpy(sector,good,sizeof(sector));
+    CK_TEST_CHECK(CdSector::correct(sector));
+    sector[CdSector::ckMODE2_DATA_OFFSET] ^= 0x01;
+    CK_TEST_CHECK(!CdSector::correct(sector));
+
+    return res;
+}
+
+/**
+ * Tests converting batches of raw sectors to cooked sectors.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool test_cdsector_cook()
+{
+    const ckcore::tuint32 stride = CdSector::ckSECTOR_SIZE + ckTEST_SECTOR_SUBCH_SIZE;
+    const ckcore::tuint32 lba = 500;
+
+    bool res = true;
+
+    // Three scrambled Mode 1 sectors with sub-channel data, the address of
+    // the last one is wrong.
+    std::vector<unsigned char> raw(3 * stride,0xee);
+    std::vector<unsigned char> expected;
+    for (ckcore::tuint32 i = 0; i < 3; i++)
+    {
+        unsigned char *sector = &raw[i * stride];
+        test_mode1(sector,i < 2 ? lba + i : lba + 10);
+        expected.insert(expected.end(),sector + CdSector::ckDATA_OFFSET,
+                        sector + CdSector::ckDATA_OFFSET + CdSector::ckMODE1_DATA_SIZE);
+        CdSector::scramble(sector);
+    }
+
+    std::vector<unsigned char> buffer = raw;
+    std::vector<ckcore::tuint32> invalid;
+    CK_TEST_CHECK(CdSector::cook(&buffer[0],3,stride,lba,true,
+                                 ScsiModePage05::ckDB_MODE_1_2048,invalid));
+    CK_TEST_CHECK(invalid.size() == 1 && invalid[0] == 2);
+    CK_TEST_CHECK(memcmp(&buffer[0],&expected[0],expected.size()) == 0);
+
+    // Raw sectors are descrambled and packed.
+    buffer = raw;
+    invalid.clear();
+    CK_TEST_CHECK(CdSector::cook(&buffer[0],2,stride,lba,true,
+                                 ScsiModePage05::ckDB_RAW_2352,invalid));
+    CK_TEST_CHECK(invalid.empty());
+
+    unsigned char sector[CdSector::ckSECTOR_SIZE];
+    test_mode1(sector,lba + 1);
+    CK_TEST_CHECK(memcmp(&buffer[CdSector::ckSECTOR_SIZE],sector,sizeof(sector)) == 0);
+
+    // The wrong mode is reported.
+    buffer = raw;
+    invalid.clear();
+    CK_TEST_CHECK(CdSector::cook(&buffer[0],1,stride,lba,true,
+                                 ScsiModePage05::ckDB_MODE_2_XA_FORM_1_2048,invalid));
+    CK_TEST_CHECK(invalid.size() == 1 && invalid[0] == 0);
+
+    // Mode 2 Form 1 sectors without scrambling.
+    buffer.assign(2 * CdSector::ckSECTOR_SIZE,0);
+    test_mode2_form1(&buffer[0],lba);
+    test_mode2_form1(&buffer[CdSector::ckSECTOR_SIZE],lba + 1);
+    expected.assign(buffer.begin() + CdSector::ckSUBHEADER_OFFSET,
+                    buffer.begin() + CdSector::ckSUBHEADER_OFFSET + 2056);
+    expected.insert(expected.end(),
+                    buffer.begin() + CdSector::ckSECTOR_SIZE + CdSector::ckSUBHEADER_OFFSET,
+                    buffer.begin() + CdSector::ckSECTOR_SIZE + CdSector::ckSUBHEADER_OFFSET + 2056);
+
+    invalid.clear();
+    CK_TEST_CHECK(CdSector::cook(&buffer[0],2,CdSector::ckSECTOR_SIZE,lba,false,
+                                 ScsiModePage05::ckDB_MODE_2_XA_FORM_1_2056,invalid));
+    CK_TEST_CHECK(invalid.empty());
+    CK_TEST_CHECK(memcmp(&buffer[0],&expected[0],expected.size()) == 0);
+
+    // Invalid arguments.
+    CK_TEST_CHECK(!CdSector::cook(&buffer[0],1,CdSector::ckSECTOR_SIZE - 1,lba,false,
+                                  ScsiModePage05::ckDB_RAW_2352,invalid));
+
+    return res;
+}
+
+/**
+ * Tests the CdSector class.
+ * @return If successful true is returned, if not false is returned.
+ */
+bool test_cdsector()
+{
+    bool res = test_cdsector_edc();
+    res = test_cdsector_encode() && res;
+    res = test_cdsector_correct() && res;
+    res = test_cdsector_cook() && res;
+
+    return res;
+}
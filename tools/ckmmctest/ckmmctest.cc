@@ -0,0 +1,58 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include "ckmmctest.hh"
+
+/**
+ * @brief Unit test class.
+ */
+struct UnitTest
+{
+    const char *name_;
+    bool (*func_)();
+};
+
+static const UnitTest unit_tests[] =
+{
+    { "accuraterip",test_accuraterip },
+    { "cdsector",test_cdsector },
+    { "sectormap",test_sectormap },
+    { "subchannel",test_subchannel }
+};
+
+int main(int argc,char *argv[])
+{
+    int num_failed = 0;
+    for (size_t i = 0; i < sizeof(unit_tests) / sizeof(UnitTest); i++)
+    {
+        bool res = unit_tests[i].func_();
+        printf("%s: %s\n",unit_tests[i].name_,res ? "passed" : "failed");
+
+        if (!res)
+            num_failed++;
+    }
+
+    if (num_failed > 0)
+    {
+        fprintf(stderr,"error: %d test(s) failed.\n",num_failed);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,45 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tools/ckmmctest/ckmmctest.hh
+ * @brief Defines the unit test helpers.
+ */
+
+#pragma once
+#include <stdio.h>
+
+/**
+ * Checks a condition, if it does not hold the failure is printed and the
+ * result of the enclosing test is set to false. The test must declare a
+ * bool named res.
+ */
+#define CK_TEST_CHECK(expr)                                                 \
+    do                                                                      \
+    {                                                                       \
+        if (!(expr))                                                        \
+        {                                                                   \
+            fprintf(stderr,"%s(%d): check failed: %s\n",__FILE__,__LINE__,#expr); \
+            res = false;                                                    \
+        }                                                                   \
+    } while (0)
+
+bool test_accuraterip();
+bool test_cdsector();
+bool test_sectormap();
+bool test_subchannel();
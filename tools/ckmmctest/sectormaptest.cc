@@ -0,0 +1,392 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef _WINDOWS
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "ckmmc/sectormap.hh"
+#include "ckmmctest.hh"
+
+using ckmmc::SectorMap;
+
+/**
+ * Defines sector map test constants.
+ */
+enum
+{
+    ckTEST_MAP_FIRST = 1000,
+    ckTEST_MAP_COUNT = 3000,
+    ckTEST_MAP_ROUNDS = 2000            // Random changes compared to the reference.
+};
+
+static const ckcore::tchar *test_map_path = ckT("ckmmctest.map");
+static const ckcore::tchar *test_map_tmp_path = ckT("ckmmctest.map.tmp");
+
+/**
+ * Replaces the contents of a file.
+ * @param [in] path The file path.
+ * @param [in] data The new file contents.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool write_file(const ckcore::tchar *path,const char *data)
+{
+#ifdef _WINDOWS
+    HANDLE handle = CreateFile(path,GENERIC_WRITE,0,NULL,CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL,NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+        return false;
+
+    DWORD written = 0;
+    bool res = WriteFile(handle,data,static_cast<DWORD>(strlen(data)),&written,NULL) &&
+               written == strlen(data);
+    CloseHandle(handle);
+    return res;
+#else
+    FILE *file = fopen(path,"wb");
+    if (file == NULL)
+        return false;
+
+    bool res = fwrite(data,1,strlen(data),file) == strlen(data);
+    return fclose(file) == 0 && res;
+#endif
+}
+
+/**
+ * Removes a file.
+ * @param [in] path The file path.
+ */
+static void remove_file(const ckcore::tchar *path)
+{
+#ifdef _WINDOWS
+    DeleteFile(path);
+#else
+    unlink(path);
+#endif
+}
+
+/**
+ * Checks that the runs of a map are sorted, contiguous and never share
+ * state with their neighbours.
+ * @param [in] map The map.
+ * @return If the runs are valid true is returned, if not false is returned.
+ */
+static bool valid_runs(const SectorMap &map)
+{
+    const std::vector<SectorMap::Run> &runs = map.runs();
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        if (runs[i].count_ == 0)
+            return false;
+
+        if (i > 0 && (runs[i - 1].lba_ + runs[i - 1].count_ != runs[i].lba_ ||
+                      runs[i - 1].state_ == runs[i].state_))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Compares the runs of two maps.
+ * @param [in] map1 The first map.
+ * @param [in] map2 The second map.
+ * @return If the maps are equal true is returned, if not false is returned.
+ */
+static bool equal_runs(const SectorMap &map1,const SectorMap &map2)
+{
+    const std::vector<SectorMap::Run> &runs1 = map1.runs();
+    const std::vector<SectorMap::Run> &runs2 = map2.runs();
+    if (runs1.size() != runs2.size())
+        return false;
+
+    for (size_t i = 0; i < runs1.size(); i++)
+    {
+        if (runs1[i].lba_ != runs2[i].lba_ || runs1[i].count_ != runs2[i].count_ ||
+            runs1[i].state_ != runs2[i].state_)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Tests setting ranges against hand-computed runs.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool test_sectormap_set()
+{
+    bool res = true;
+    SectorMap map;
+
+    // An empty map ignores changes.
+    map.set(0,10,SectorMap::ckSTATE_GOOD);
+    CK_TEST_CHECK(map.runs().empty());
+    CK_TEST_CHECK(map.first() == 0 && map.end() == 0);
+
+    map.reset(100,1000);
+    CK_TEST_CHECK(map.runs().size() == 1);
+    CK_TEST_CHECK(map.first() == 100 && map.end() == 1100);
+    CK_TEST_CHECK(map.count(SectorMap::ckSTATE_UNTRIED) == 1000);
+    CK_TEST_CHECK(map.pass() == 0);
+
+    // Split a run.
+    map.set(200,50,SectorMap::ckSTATE_GOOD);
+    CK_TEST_CHECK(map.runs().size() == 3);
+    CK_TEST_CHECK(map.state(199) == SectorMap::ckSTATE_UNTRIED);
+    CK_TEST_CHECK(map.state(200) == SectorMap::ckSTATE_GOOD);
+    CK_TEST_CHECK(map.state(249) == SectorMap::ckSTATE_GOOD);
+    CK_TEST_CHECK(map.state(250) == SectorMap::ckSTATE_UNTRIED);
+
+    // Extend the run, it is merged with its predecessor.
+    map.set(250,10,SectorMap::ckSTATE_GOOD);
+    CK_TEST_CHECK(map.runs().size() == 3);
+    CK_TEST_CHECK(map.runs()[1].lba_ == 200 && map.runs()[1].count_ == 60);
+
+    // Overwrite a run and parts of both neighbours.
+    map.set(150,200,SectorMap::ckSTATE_SKIPPED);
+    CK_TEST_CHECK(map.runs().size() == 3);
+    CK_TEST_CHECK(map.runs()[0].lba_ == 100 && map.runs()[0].count_ == 50);
+    CK_TEST_CHECK(map.runs()[1].lba_ == 150 && map.runs()[1].count_ == 200);
+    CK_TEST_CHECK(map.runs()[1].state_ == SectorMap::ckSTATE_SKIPPED);
+    CK_TEST_CHECK(map.runs()[2].lba_ == 350 && map.runs()[2].count_ == 750);
+
+    // Restoring the state of the neighbours merges all three runs.
+    map.set(150,200,SectorMap::ckSTATE_UNTRIED);
+    CK_TEST_CHECK(map.runs().size() == 1);
+    CK_TEST_CHECK(map.count(SectorMap::ckSTATE_UNTRIED) == 1000);
+
+    // Ranges are clipped to the map.
+    map.set(0,150,SectorMap::ckSTATE_FAILED);
+    map.set(1050,5000,SectorMap::ckSTATE_GOOD);
+    map.set(2000,10,SectorMap::ckSTATE_SKIPPED);
+    map.set(500,0,SectorMap::ckSTATE_SKIPPED);
+    CK_TEST_CHECK(map.runs().size() == 3);
+    CK_TEST_CHECK(map.first() == 100 && map.end() == 1100);
+    CK_TEST_CHECK(map.count(SectorMap::ckSTATE_FAILED) == 50);
+    CK_TEST_CHECK(map.count(SectorMap::ckSTATE_GOOD) == 50);
+    CK_TEST_CHECK(map.count(SectorMap::ckSTATE_SKIPPED) == 0);
+    CK_TEST_CHECK(map.state(99) == SectorMap::ckSTATE_UNTRIED);
+    CK_TEST_CHECK(map.state(1100) == SectorMap::ckSTATE_UNTRIED);
+
+    map.set(0,5000,SectorMap::ckSTATE_GOOD);
+    CK_TEST_CHECK(map.runs().size() == 1);
+    CK_TEST_CHECK(map.count(SectorMap::ckSTATE_GOOD) == 1000);
+
+    return res;
+}
+
+/**
+ * Tests finding ranges.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool test_sectormap_find()
+{
+    bool res = true;
+    SectorMap map;
+    map.reset(100,1000);
+    map.set(200,50,SectorMap::ckSTATE_FAILED);
+    map.set(600,10,SectorMap::ckSTATE_FAILED);
+
+    ckcore::tuint32 lba = 0,count = 0;
+    CK_TEST_CHECK(map.find(SectorMap::ckSTATE_FAILED,0,lba,count));
+    CK_TEST_CHECK(lba == 200 && count == 50);
+    CK_TEST_CHECK(map.find(SectorMap::ckSTATE_FAILED,220,lba,count));
+    CK_TEST_CHECK(lba == 220 && count == 30);
+    CK_TEST_CHECK(map.find(SectorMap::ckSTATE_FAILED,250,lba,count));
+    CK_TEST_CHECK(lba == 600 && count == 10);
+    CK_TEST_CHECK(!map.find(SectorMap::ckSTATE_FAILED,610,lba,count));
+    CK_TEST_CHECK(map.find(SectorMap::ckSTATE_UNTRIED,1000,lba,count));
+    CK_TEST_CHECK(lba == 1000 && count == 100);
+    CK_TEST_CHECK(!map.find(SectorMap::ckSTATE_UNTRIED,1100,lba,count));
+    CK_TEST_CHECK(!map.find(SectorMap::ckSTATE_GOOD,0,lba,count));
+
+    return res;
+}
+
+/**
+ * Tests random changes against a map holding the state of each sector.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool test_sectormap_random()
+{
+    static const SectorMap::State states[] =
+    {
+        SectorMap::ckSTATE_UNTRIED,
+        SectorMap::ckSTATE_SKIPPED,
+        SectorMap::ckSTATE_FAILED,
+        SectorMap::ckSTATE_GOOD
+    };
+
+    bool res = true;
+    SectorMap map;
+    map.reset(ckTEST_MAP_FIRST,ckTEST_MAP_COUNT);
+
+    std::vector<SectorMap::State> ref(ckTEST_MAP_COUNT,SectorMap::ckSTATE_UNTRIED);
+
+    // A fixed generator keeps the sequence identical on all platforms.
+    ckcore::tuint32 seed = 1;
+    for (int i = 0; i < ckTEST_MAP_ROUNDS && res; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        ckcore::tuint32 lba = (seed >> 8) % (ckTEST_MAP_COUNT + 200) + ckTEST_MAP_FIRST - 100;
+        seed = seed * 1103515245 + 12345;
+        ckcore::tuint32 count = (seed >> 8) % (i % 10 == 0 ? 1000 : 20);
+        SectorMap::State state = states[(seed >> 28) & 3];
+
+        map.set(lba,count,state);
+        for (ckcore::tuint32 j = lba; j < lba + count; j++)
+        {
+            if (j >= ckTEST_MAP_FIRST && j < ckTEST_MAP_FIRST + ckTEST_MAP_COUNT)
+                ref[j - ckTEST_MAP_FIRST] = state;
+        }
+
+        CK_TEST_CHECK(valid_runs(map));
+        CK_TEST_CHECK(map.first() == ckTEST_MAP_FIRST);
+        CK_TEST_CHECK(map.end() == ckTEST_MAP_FIRST + ckTEST_MAP_COUNT);
+
+        ckcore::tuint64 counts[4] = { 0,0,0,0 };
+        for (ckcore::tuint32 j = 0; j < ckTEST_MAP_COUNT; j++)
+        {
+            if (map.state(ckTEST_MAP_FIRST + j) != ref[j])
+            {
+                CK_TEST_CHECK(map.state(ckTEST_MAP_FIRST + j) == ref[j]);
+                break;
+            }
+
+            for (int k = 0; k < 4; k++)
+            {
+                if (ref[j] == states[k])
+                    counts[k]++;
+            }
+        }
+
+        for (int k = 0; k < 4; k++)
+            CK_TEST_CHECK(map.count(states[k]) == counts[k]);
+    }
+
+    return res;
+}
+
+/**
+ * Tests saving and loading a map.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool test_sectormap_save()
+{
+    bool res = true;
+    SectorMap map;
+    map.reset(100,1000);
+    map.set(200,50,SectorMap::ckSTATE_GOOD);
+    map.set(300,1,SectorMap::ckSTATE_FAILED);
+    map.set(301,99,SectorMap::ckSTATE_SKIPPED);
+    map.pass(3);
+
+    remove_file(test_map_path);
+    CK_TEST_CHECK(!SectorMap::exists(test_map_path));
+
+    CK_TEST_CHECK(map.save(test_map_path));
+    CK_TEST_CHECK(SectorMap::exists(test_map_path));
+    CK_TEST_CHECK(!SectorMap::exists(test_map_tmp_path));
+
+    SectorMap loaded;
+    CK_TEST_CHECK(loaded.load(test_map_path));
+    CK_TEST_CHECK(equal_runs(map,loaded));
+    CK_TEST_CHECK(loaded.pass() == 3);
+
+    // Saving replaces the previous map.
+    map.set(0,5000,SectorMap::ckSTATE_GOOD);
+    map.pass(4);
+    CK_TEST_CHECK(map.save(test_map_path));
+    CK_TEST_CHECK(loaded.load(test_map_path));
+    CK_TEST_CHECK(equal_runs(map,loaded));
+    CK_TEST_CHECK(loaded.pass() == 4);
+
+    remove_file(test_map_path);
+    CK_TEST_CHECK(!SectorMap::exists(test_map_path));
+    CK_TEST_CHECK(!loaded.load(test_map_path));
+
+    return res;
+}
+
+/**
+ * Tests loading hand-written and corrupt map files.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool test_sectormap_parse()
+{
+    static const char *corrupt[] =
+    {
+        "",                                         // No pass.
+        "# ckmmc sector map\n2\n",                  // No runs.
+        "x\n0x10 0x5 +\n",                          // Invalid pass.
+        "2\n0x10 0x5\n",                            // No state.
+        "2\n0x10 0x5 x\n",                          // Invalid state.
+        "2\n0x10 0x0 +\n",                          // Empty run.
+        "2\n0x10 0x5 +\n0x16 0x5 -\n",              // Gap between runs.
+        "2\n0x10 0x5 +\n0x14 0x5 -\n"               // Overlapping runs.
+    };
+
+    bool res = true;
+
+    // Comments and empty lines are skipped, runs sharing state are merged.
+    CK_TEST_CHECK(write_file(test_map_path,"# edited\n\n2\n0x10 0x5 +\n0x15 0x3 +\n0x18 0x2 -\n"));
+
+    SectorMap map;
+    CK_TEST_CHECK(map.load(test_map_path));
+    CK_TEST_CHECK(map.pass() == 2);
+    CK_TEST_CHECK(map.runs().size() == 2);
+    CK_TEST_CHECK(valid_runs(map));
+    CK_TEST_CHECK(map.first() == 0x10 && map.end() == 0x1a);
+    CK_TEST_CHECK(map.count(SectorMap::ckSTATE_GOOD) == 8);
+    CK_TEST_CHECK(map.count(SectorMap::ckSTATE_FAILED) == 2);
+
+    // Corrupt files leave the map untouched.
+    for (size_t i = 0; i < sizeof(corrupt) / sizeof(const char *); i++)
+    {
+        CK_TEST_CHECK(write_file(test_map_path,corrupt[i]));
+        CK_TEST_CHECK(!map.load(test_map_path));
+        CK_TEST_CHECK(map.pass() == 2 && map.runs().size() == 2);
+    }
+
+    remove_file(test_map_path);
+    return res;
+}
+
+/**
+ * Tests the SectorMap class.
+ * @return If successful true is returned, if not false is returned.
+ */
+bool test_sectormap()
+{
+    bool res = test_sectormap_set();
+    res = test_sectormap_find() && res;
+    res = test_sectormap_random() && res;
+    res = test_sectormap_save() && res;
+    res = test_sectormap_parse() && res;
+
+    return res;
+}
@@ -0,0 +1,326 @@
+/*
+ * The ckMMC library provides SCSI MMC functionality.
+ * Copyright (C) 2006-2011 Christian Kindahl
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <vector>
+#include "ckmmc/subchannel.hh"
+#include "ckmmctest.hh"
+
+using ckmmc::Subchannel;
+
+/**
+ * Defines sub-channel test constants.
+ */
+enum
+{
+    ckTEST_SUBCH_SECTORS = 5,
+    ckTEST_SUBCH_STRIDE = 2352 + 96     // Sub-channel data stored after the sector.
+};
+
+/**
+ * Fills a buffer with pseudo-random bytes, the same on all platforms.
+ * @param [out] data The buffer.
+ * @param [in] seed The seed.
+ */
+static void test_fill(std::vector<unsigned char> &data,ckcore::tuint32 seed)
+{
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        data[i] = static_cast<unsigned char>(seed >> 24);
+    }
+}
+
+/**
+ * Stores a CRC in the last two bytes of a Q frame.
+ * @param [in,out] q The 12 byte Q frame.
+ */
+static void test_seal_q(unsigned char *q)
+{
+    ckcore::tuint16 crc = Subchannel::crc_q(q);
+    q[10] = static_cast<unsigned char>(crc >> 8);
+    q[11] = static_cast<unsigned char>(crc & 0xff);
+}
+
+/**
+ * Tests converting between raw and cooked sub-channel data.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool test_subchannel_cooked()
+{
+    bool res = true;
+
+    // The P channel is the top bit of each raw byte.
+    unsigned char raw[Subchannel::ckSUBCH_SIZE];
+    unsigned char cooked[Subchannel::ckSUBCH_SIZE];
+    memset(raw,0x80,sizeof(raw));
+    Subchannel::deinterleave(raw,cooked,1,Subchannel::ckSUBCH_SIZE);
+
+    bool match = true;
+    for (unsigned int i = 0; i < Subchannel::ckSUBCH_SIZE; i++)
+    {
+        if (cooked[i] != (i < Subchannel::ckCHANNEL_SIZE ? 0xff : 0x00))
+            match = false;
+    }
+
+    CK_TEST_CHECK(match);
+
+    // The first raw byte holds the first bit of each channel, the ninth raw
+    // byte the ninth bit.
+    memset(raw,0,sizeof(raw));
+    raw[0] = 0x40;
+    raw[9] = 0x01;
+    Subchannel::deinterleave(raw,cooked,1,Subchannel::ckSUBCH_SIZE);
+    CK_TEST_CHECK(cooked[Subchannel::ckQ_OFFSET] == 0x80);
+    CK_TEST_CHECK(cooked[7 * Subchannel::ckCHANNEL_SIZE + 1] == 0x40);
+    CK_TEST_CHECK(cooked[0] == 0 && cooked[Subchannel::ckQ_OFFSET + 1] == 0);
+
+    // A batch stored after the sector data, compared to the bit definition.
+    std::vector<unsigned char> sectors(ckTEST_SUBCH_SECTORS * ckTEST_SUBCH_STRIDE);
+    test_fill(sectors,1);
+
+    std::vector<unsigned char> batch(ckTEST_SUBCH_SECTORS * Subchannel::ckSUBCH_SIZE);
+    Subchannel::deinterleave(&sectors[2352],&batch[0],ckTEST_SUBCH_SECTORS,ckTEST_SUBCH_STRIDE);
+
+    match = true;
+    for (unsigned int i = 0; i < ckTEST_SUBCH_SECTORS; i++)
+    {
+        const unsigned char *src = &sectors[i * ckTEST_SUBCH_STRIDE + 2352];
+        const unsigned char *dst = &batch[i * Subchannel::ckSUBCH_SIZE];
+
+        for (unsigned int bit = 0; bit < Subchannel::ckSUBCH_SIZE; bit++)
+        {
+            for (unsigned int c = 0; c < 8; c++)
+            {
+                unsigned int raw_bit = (src[bit] >> (7 - c)) & 1;
+                unsigned int cooked_bit = (dst[c * Subchannel::ckCHANNEL_SIZE + (bit >> 3)] >>
+                                           (7 - (bit & 7))) & 1;
+                if (raw_bit != cooked_bit)
+                    match = false;
+            }
+        }
+    }
+
+    CK_TEST_CHECK(match);
+
+    // Interleaving restores the raw data and leaves the sector data alone.
+    std::vector<unsigned char> restored(sectors.size(),0x5a);
+    Subchannel::interleave(&batch[0],&restored[2352],ckTEST_SUBCH_SECTORS,ckTEST_SUBCH_STRIDE);
+
+    match = true;
+    for (unsigned int i = 0; i < ckTEST_SUBCH_SECTORS; i++)
+    {
+        const unsigned char *sector = &restored[i * ckTEST_SUBCH_STRIDE];
+        for (unsigned int j = 0; j < 2352; j++)
+        {
+            if (sector[j] != 0x5a)
+                match = false;
+        }
+
+        if (memcmp(sector + 2352,&sectors[i * ckTEST_SUBCH_STRIDE + 2352],
+                   Subchannel::ckSUBCH_SIZE) != 0)
+        {
+            match = false;
+        }
+    }
+
+    CK_TEST_CHECK(match);
+
+    return res;
+}
+
+/**
+ * Tests interleaving and de-interleaving the R-W channels.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool test_subchannel_rw()
+{
+    const ckcore::tuint32 packs = ckTEST_SUBCH_SECTORS * Subchannel::ckPACKS;
+
+    bool res = true;
+
+    // Symbol 1 of a pack trades places with symbol 18 and is delayed by two
+    // packs, symbol 2 trades places with symbol 5 and is delayed by five.
+    std::vector<unsigned char> packed(ckTEST_SUBCH_SECTORS * Subchannel::ckSUBCH_SIZE,0);
+    std::vector<unsigned char> raw(packed.size(),0xc0);
+    packed[1] = 0x2a;
+    packed[2] = 0x15;
+    Subchannel::pack_rw(&packed[0],&raw[0],ckTEST_SUBCH_SECTORS,Subchannel::ckSUBCH_SIZE);
+
+    bool match = true;
+    for (size_t i = 0; i < raw.size(); i++)
+    {
+        unsigned char expected = 0xc0;
+        if (i == 2 * Subchannel::ckPACK_SIZE + 18)
+            expected |= 0x2a;
+        else if (i == 5 * Subchannel::ckPACK_SIZE + 5)
+            expected |= 0x15;
+
+        if (raw[i] != expected)
+            match = false;
+    }
+
+    CK_TEST_CHECK(match);
+
+    // Round trip in a batch stored after the sector data, the P and Q bits
+    // are kept and symbols interleaved from packs after the batch are lost.
+    std::vector<unsigned char> sectors(ckTEST_SUBCH_SECTORS * ckTEST_SUBCH_STRIDE);
+    test_fill(sectors,2);
+
+    std::vector<unsigned char> original = sectors;
+    Subchannel::pack_rw(&original[2352],&sectors[2352],ckTEST_SUBCH_SECTORS,ckTEST_SUBCH_STRIDE);
+
+    std::vector<unsigned char> unpacked(sectors.size(),0);
+    Subchannel::unpack_rw(&sectors[2352],&unpacked[2352],ckTEST_SUBCH_SECTORS,ckTEST_SUBCH_STRIDE);
+
+    // The number of packs between each packed symbol and the raw pack
+    // holding it.
+    static const unsigned int delay[Subchannel::ckPACK_SIZE] =
+    {
+        0,2,5,3,4,2,6,7,0,1,2,3,4,5,6,7,0,1,1,3,4,5,6,7
+    };
+
+    bool keep = true;
+    match = true;
+    for (ckcore::tuint32 n = 0; n < packs; n++)
+    {
+        size_t pos = (n / Subchannel::ckPACKS) * ckTEST_SUBCH_STRIDE + 2352 +
+                     (n % Subchannel::ckPACKS) * Subchannel::ckPACK_SIZE;
+
+        for (unsigned int i = 0; i < Subchannel::ckPACK_SIZE; i++)
+        {
+            if ((sectors[pos + i] & 0xc0) != (original[pos + i] & 0xc0))
+                keep = false;
+
+            unsigned char expected = n + delay[i] < packs ? original[pos + i] & 0x3f : 0;
+            if (unpacked[pos + i] != expected)
+                match = false;
+        }
+    }
+
+    CK_TEST_CHECK(keep);
+    CK_TEST_CHECK(match);
+
+    return res;
+}
+
+/**
+ * Tests the Q CRC and repairing Q frames.
+ * @return If successful true is returned, if not false is returned.
+ */
+static bool test_subchannel_q()
+{
+    // Track 1, index 1, relative time 00:00:00 and absolute time 00:02:00.
+    static const unsigned char track_start[12] =
+    {
+        0x01,0x01,0x01,0x00,0x00,0x00,0x00,0x00,0x02,0x00,0x5a,0x28
+    };
+
+    bool res = true;
+
+    CK_TEST_CHECK(Subchannel::crc_q(track_start) == 0x5a28);
+    CK_TEST_CHECK(Subchannel::check_q(track_start));
+
+    unsigned char q[12];
+    memcpy(q,track_start,sizeof(q));
+    CK_TEST_CHECK(Subchannel::repair_q(q,NULL));
+    CK_TEST_CHECK(memcmp(q,track_start,sizeof(q)) == 0);
+
+    // Every single bit error is corrected using the CRC.
+    bool match = true;
+    for (unsigned int i = 0; i < 96; i++)
+    {
+        memcpy(q,track_start,sizeof(q));
+        q[i >> 3] ^= static_cast<unsigned char>(0x80 >> (i & 7));
+        if (Subchannel::check_q(q) || !Subchannel::repair_q(q,NULL) ||
+            memcmp(q,track_start,sizeof(q)) != 0)
+        {
+            match = false;
+        }
+    }
+
+    CK_TEST_CHECK(match);
+
+    // Larger errors are repaired by predicting the frame from its
+    // predecessor, the relative time counts up in a track.
+    unsigned char prev[12] = { 0x01,0x01,0x01,0x00,0x00,0x74,0x00,0x00,0x03,0x74 };
+    test_seal_q(prev);
+
+    unsigned char next[12] = { 0x01,0x01,0x01,0x00,0x01,0x00,0x00,0x00,0x04,0x00 };
+    test_seal_q(next);
+
+    memcpy(q,next,sizeof(q));
+    q[4] = 0xff;
+    q[8] = 0xff;
+    CK_TEST_CHECK(!Subchannel::repair_q(q,NULL));
+    CK_TEST_CHECK(Subchannel::repair_q(q,prev));
+    CK_TEST_CHECK(memcmp(q,next,sizeof(q)) == 0);
+
+    // The relative time counts down in the pause preceding a track.
+    unsigned char pause_prev[12] = { 0x01,0x02,0x00,0x00,0x01,0x00,0x00,0x05,0x10,0x20 };
+    test_seal_q(pause_prev);
+
+    unsigned char pause_next[12] = { 0x01,0x02,0x00,0x00,0x00,0x74,0x00,0x05,0x10,0x21 };
+    test_seal_q(pause_next);
+
+    memcpy(q,pause_next,sizeof(q));
+    q[5] = 0x00;
+    q[9] = 0x00;
+    CK_TEST_CHECK(Subchannel::repair_q(q,pause_prev));
+    CK_TEST_CHECK(memcmp(q,pause_next,sizeof(q)) == 0);
+
+    // Frames differing in too many bytes are not replaced.
+    memcpy(q,next,sizeof(q));
+    q[1] ^= 0x11;
+    q[4] ^= 0x22;
+    q[8] ^= 0x44;
+    q[9] ^= 0x88;
+    q[10] ^= 0x01;
+    CK_TEST_CHECK(!Subchannel::repair_q(q,prev));
+
+    // Only ADR mode 1 frames are predicted and the pause can not count
+    // below zero.
+    memcpy(q,next,sizeof(q));
+    q[4] = 0xff;
+    q[8] = 0xff;
+
+    unsigned char isrc[12];
+    memcpy(isrc,prev,sizeof(isrc));
+    isrc[0] = 0x03;
+    test_seal_q(isrc);
+    CK_TEST_CHECK(!Subchannel::repair_q(q,isrc));
+
+    unsigned char pause_end[12] = { 0x01,0x02,0x00,0x00,0x00,0x00,0x00,0x00,0x03,0x74 };
+    test_seal_q(pause_end);
+    CK_TEST_CHECK(!Subchannel::repair_q(q,pause_end));
+
+    return res;
+}
+
+/**
+ * Tests the Subchannel class.
+ * @return If successful true is returned, if not false is returned.
+ */
+bool test_subchannel()
+{
+    bool res = test_subchannel_cooked();
+    res = test_subchannel_rw() && res;
+    res = test_subchannel_q() && res;
+
+    return res;
+}